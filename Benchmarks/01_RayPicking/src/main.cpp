@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "shared/scene/RayPicking.h"
+
+/*
+	Ray casting throughput of SceneBVH on the Bistro exterior scene.
+	Run the scene converter (data/sceneconverter.json) first to produce data/meshes/test.meshes and data/meshes/test.scene
+*/
+
+constexpr size_t kNumRays = 1000000;
+
+template <typename Func>
+static double measureSeconds(Func func)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+	func();
+	const auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+static void printRaysPerSecond(const char* name, size_t numRays, double seconds, size_t numHits)
+{
+	printf("%-24s %8.3f s  %7.2f Mrays/s  (%5.1f%% hit)\n", name, seconds, double(numRays) / seconds * 1e-6, 100.0 * double(numHits) / double(numRays));
+}
+
+int main(int argc, char* argv[])
+{
+	const char* meshFile  = (argc > 2) ? argv[1] : "data/meshes/test.meshes";
+	const char* sceneFile = (argc > 2) ? argv[2] : "data/meshes/test.scene";
+
+	MeshData meshData;
+	loadMeshData(meshFile, meshData);
+
+	Scene scene;
+	loadScene(sceneFile, scene);
+	markAsChanged(scene, 0);
+	recalculateGlobalTransforms(scene);
+
+	tf::Executor executor;
+
+	SceneBVH bvh;
+
+	const double buildTime = measureSeconds([&]() { bvh.build(meshData, scene, 0, &executor); });
+
+	size_t numTriangles = 0;
+	size_t numNodes = 0;
+	for (const auto& m: bvh.getMeshBVHs())
+	{
+		numTriangles += m.getTriangleCount();
+		numNodes += m.getNodeCount();
+	}
+
+	printf("Meshes: %u, instances: %u, triangles: %u, BVH nodes: %u\n", (uint32_t)meshData.meshes_.size(), (uint32_t)bvh.getInstanceCount(), (uint32_t)numTriangles, (uint32_t)numNodes);
+	printf("BVH build (%u threads): %.3f s\n\n", (uint32_t)executor.num_workers(), buildTime);
+
+	// scene bounds from the mesh boxes
+	std::vector<BoundingBox> boxes;
+	for (const auto& c: scene.meshes_)
+		boxes.push_back(meshData.boxes_[c.second].getTransformed(scene.globalTransform_[c.first]));
+	const BoundingBox bounds = combineBoxes(boxes);
+
+	// rays start inside the scene box and go in random directions
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+	std::normal_distribution<float> distNormal;
+
+	std::vector<Ray> rays(kNumRays);
+	for (auto& r: rays)
+	{
+		const vec3 t(dist01(rng), dist01(rng), dist01(rng));
+		r.origin_ = bounds.min_ + (bounds.max_ - bounds.min_) * t;
+		r.dir_ = glm::normalize(vec3(distNormal(rng), distNormal(rng), distNormal(rng)));
+	}
+
+	std::vector<RayHit> hits(kNumRays);
+	std::unique_ptr<bool[]> occluded(new bool[kNumRays]);
+
+	auto countHits = [&]() {
+		size_t n = 0;
+		for (const auto& h: hits)
+			n += h.hasHit() ? 1 : 0;
+		return n;
+	};
+
+	const size_t numSTRays = kNumRays / 10;
+	const double tNearestST = measureSeconds([&]() { bvh.intersectRays(rays.data(), hits.data(), numSTRays); });
+	size_t numHitsST = 0;
+	for (size_t i = 0; i != numSTRays; i++)
+		numHitsST += hits[i].hasHit() ? 1 : 0;
+	printRaysPerSecond("Nearest hit, 1 thread:", numSTRays, tNearestST, numHitsST);
+
+	const double tNearest = measureSeconds([&]() { bvh.intersectRays(rays.data(), hits.data(), kNumRays, &executor); });
+	printRaysPerSecond("Nearest hit, MT:", kNumRays, tNearest, countHits());
+
+	const double tAny = measureSeconds([&]() { bvh.intersectAnyRays(rays.data(), occluded.get(), kNumRays, &executor); });
+	size_t numOccluded = 0;
+	for (size_t i = 0; i != kNumRays; i++)
+		numOccluded += occluded[i] ? 1 : 0;
+	printRaysPerSecond("Any hit, MT:", kNumRays, tAny, numOccluded);
+
+	return EXIT_SUCCESS;
+}
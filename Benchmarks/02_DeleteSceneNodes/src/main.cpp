@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "shared/scene/Scene.h"
+
+/*
+	Deletion of ~50% of the nodes of a synthetic 1M-node scene graph with deleteSceneNodes()
+*/
+
+constexpr int kNumNodes = 1000000;
+
+static Scene generateScene(std::mt19937& rng)
+{
+	Scene scene;
+	scene.hierarchy_.reserve(kNumNodes);
+	scene.localTransform_.reserve(kNumNodes);
+	scene.globalTransform_.reserve(kNumNodes);
+
+	addNode(scene, -1, 0);
+
+	for (int i = 1; i != kNumNodes; i++)
+	{
+		// random recursive tree, the depth is limited by the size of Scene::changedAtThisFrame_[]
+		int parent = 0;
+		do {
+			parent = std::uniform_int_distribution<int>(0, i - 1)(rng);
+		} while (scene.hierarchy_[parent].level_ >= MAX_NODE_LEVEL - 1);
+
+		const int node = addNode(scene, parent, scene.hierarchy_[parent].level_ + 1);
+
+		scene.localTransform_[node] = glm::translate(glm::mat4(1.0f), glm::vec3((float)node, 0.0f, 0.0f));
+		scene.meshes_[node] = node % 1000;
+		scene.materialForNode_[node] = node % 100;
+	}
+
+	return scene;
+}
+
+/* Pick random subtrees until about a half of all nodes is covered */
+static std::vector<uint32_t> selectNodesToDelete(const Scene& scene, std::mt19937& rng)
+{
+	const int numNodes = (int)scene.hierarchy_.size();
+
+	// parents always precede their children in a generated scene
+	std::vector<int> subtreeSize(numNodes, 1);
+	for (int i = numNodes - 1; i > 0; i--)
+		subtreeSize[scene.hierarchy_[i].parent_] += subtreeSize[i];
+
+	std::vector<uint8_t> covered(numNodes, 0);
+	std::vector<uint32_t> nodes;
+	std::vector<int> stack;
+
+	int numCovered = 0;
+
+	while (numCovered < numNodes / 2)
+	{
+		const int n = std::uniform_int_distribution<int>(1, numNodes - 1)(rng);
+
+		if (covered[n] || subtreeSize[n] > 256)
+			continue;
+
+		nodes.push_back(n);
+
+		// count only the nodes which are not covered by the previously selected subtrees
+		stack.push_back(n);
+		while (!stack.empty())
+		{
+			const int node = stack.back();
+			stack.pop_back();
+
+			if (!covered[node])
+			{
+				covered[node] = 1;
+				numCovered++;
+			}
+
+			for (int c = scene.hierarchy_[node].firstChild_; c != -1; c = scene.hierarchy_[c].nextSibling_)
+				stack.push_back(c);
+		}
+	}
+
+	std::shuffle(nodes.begin(), nodes.end(), rng);
+
+	return nodes;
+}
+
+int main()
+{
+	std::mt19937 rng(1234);
+
+	printf("Generating a scene with %d nodes...\n", kNumNodes);
+	Scene scene = generateScene(rng);
+
+	const std::vector<uint32_t> nodesToDelete = selectNodesToDelete(scene, rng);
+
+	const size_t oldSize = scene.hierarchy_.size();
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	deleteSceneNodes(scene, nodesToDelete);
+	const auto end = std::chrono::high_resolution_clock::now();
+
+	const size_t newSize = scene.hierarchy_.size();
+
+	printf("Selected %u subtrees, deleted %u of %u nodes (%.1f%%)\n", (uint32_t)nodesToDelete.size(), (uint32_t)(oldSize - newSize), (uint32_t)oldSize, 100.0 * double(oldSize - newSize) / double(oldSize));
+	printf("deleteSceneNodes(): %.3f ms\n", std::chrono::duration<double, std::milli>(end - start).count());
+
+	// sanity check: every node must be reachable from its parent's list of children
+	size_t numLinked = 1;
+	for (size_t i = 0; i != newSize; i++)
+		for (int c = scene.hierarchy_[i].firstChild_; c != -1; c = scene.hierarchy_[c].nextSibling_, numLinked++)
+			if (scene.hierarchy_[c].parent_ != (int)i)
+			{
+				printf("Broken hierarchy at node %d\n", c);
+				return EXIT_FAILURE;
+			}
+
+	if (numLinked != newSize || scene.meshes_.size() != newSize - 1)
+	{
+		printf("Inconsistent scene after deletion\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "shared/Utils.h"
+#include "shared/scene/Scene.h"
+#include "shared/scene/TextureStreamer.h"
+
+/*
+	Progressive texture streaming of the Bistro exterior scene without a GPU: TextureStreamer is driven the way GLSceneDataLazy and
+	VKSceneData (asyncLoad) drive it, with a camera flying from the outside of the scene to its center. Prints when all the textures
+	become visible and when streaming settles down. Run it twice to compare a cold and a warm texture cache (data/.cache/textures/).
+	Run the scene converter (data/sceneconverter.json) first to produce data/meshes/test.meshes, test.scene and test.materials
+*/
+
+constexpr uint32_t kFlyFrames = 300;
+// frames with no uploads after the flight ends
+constexpr uint32_t kIdleFrames = 60;
+constexpr auto kFrameTime = std::chrono::milliseconds(8);
+constexpr float kViewportHeight = 1080.0f;
+
+int main(int argc, char* argv[])
+{
+	const char* meshFile     = (argc > 3) ? argv[1] : "data/meshes/test.meshes";
+	const char* sceneFile    = (argc > 3) ? argv[2] : "data/meshes/test.scene";
+	const char* materialFile = (argc > 3) ? argv[3] : "data/meshes/test.materials";
+
+	MeshData meshData;
+	loadMeshData(meshFile, meshData);
+
+	Scene scene;
+	loadScene(sceneFile, scene);
+	// the shapes index the node transforms
+	expandPrefabInstances(scene);
+
+	std::vector<MaterialDescription> materials;
+	std::vector<std::string> textureFiles;
+	loadMaterials(materialFile, materials, textureFiles);
+
+	std::vector<DrawData> shapes;
+	std::vector<BoundingBox> boxes;
+
+	for (const auto& c: scene.meshes_)
+	{
+		auto material = scene.materialForNode_.find(c.first);
+		if (material == scene.materialForNode_.end())
+			continue;
+
+		shapes.push_back(DrawData { .meshIndex = c.second, .materialIndex = material->second, .transformIndex = c.first });
+		boxes.push_back(meshData.boxes_[c.second].getTransformed(scene.globalTransform_[c.first]));
+	}
+
+	const BoundingBox bounds = combineBoxes(boxes);
+	const glm::vec3 center = bounds.getCenter();
+	const glm::vec3 farEye = center + glm::vec3(0.0f, 0.25f, 1.0f) * glm::length(bounds.getSize());
+	const glm::vec3 nearEye = center + glm::vec3(0.0f, 0.25f, 1.0f) * 2.0f;
+
+	const glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 10000.0f);
+
+	uint32_t numStreamed = 0;
+	for (const auto& f: textureFiles)
+		if (!endsWith(f.c_str(), ".ktx"))
+			numStreamed++;
+
+	printf("Shapes: %u, materials: %u, textures: %u (%u streamed)\n\n", (uint32_t)shapes.size(), (uint32_t)materials.size(), (uint32_t)textureFiles.size(), numStreamed);
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	auto getSeconds = [&start]() { return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count(); };
+
+	TextureStreamer streamer(textureFiles, getSRGBTextures(materials, textureFiles.size()));
+
+	std::vector<bool> isVisible(textureFiles.size(), false);
+	uint32_t numVisible = 0;
+	double allVisibleTime = 0.0;
+
+	size_t numUpdates = 0;
+	size_t uploadedBytes = 0;
+	size_t maxResidentBytes = 0;
+
+	uint32_t frame = 0;
+
+	for (uint32_t idleFrames = 0; frame < kFlyFrames || idleFrames < kIdleFrames; frame++)
+	{
+		const float t = std::min(1.0f, float(frame) / float(kFlyFrames));
+		const glm::mat4 view = glm::lookAt(glm::mix(farEye, nearEye, t), center, glm::vec3(0.0f, 1.0f, 0.0f));
+
+		requestShapeTextures(streamer, meshData, shapes, scene.globalTransform_, materials, view, proj, kViewportHeight);
+		streamer.update();
+
+		bool hasUpdates = false;
+		StreamedTextureUpdate u;
+
+		// a renderer would recreate its texture objects here
+		while (streamer.popUpdate(u))
+		{
+			hasUpdates = true;
+			numUpdates++;
+			for (uint32_t i = 0; i != u.numLevels_; i++)
+				uploadedBytes += size_t(std::max(1, u.w_ >> i)) * std::max(1, u.h_ >> i) * 4;
+
+			if (!isVisible[u.texture_])
+			{
+				isVisible[u.texture_] = true;
+				if (++numVisible == numStreamed)
+					allVisibleTime = getSeconds();
+			}
+		}
+
+		maxResidentBytes = std::max(maxResidentBytes, streamer.getResidentBytes());
+
+		idleFrames = (hasUpdates || streamer.getNumPendingLoads()) ? 0 : idleFrames + 1;
+
+		std::this_thread::sleep_for(kFrameTime);
+	}
+
+	const double totalTime = getSeconds();
+
+	if (numVisible == numStreamed)
+		printf("All textures visible:   %8.3f s\n", allVisibleTime);
+	else
+		printf("Visible textures:       %u of %u (the rest failed to load)\n", numVisible, numStreamed);
+	printf("Streaming settled:      %8.3f s (%u frames)\n", totalTime, frame);
+	printf("Texture updates:        %u, %.1f MB uploaded\n", (uint32_t)numUpdates, double(uploadedBytes) / (1024.0 * 1024.0));
+	printf("Resident:               %.1f MB at the end, %.1f MB max\n", double(streamer.getResidentBytes()) / (1024.0 * 1024.0), double(maxResidentBytes) / (1024.0 * 1024.0));
+
+	return EXIT_SUCCESS;
+}
@@ -6,6 +6,9 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include <memory>
+#include "shared/glFramework/GLStreamingBuffer.h"
+
 static const char* shaderCodeVertex = R"(
 #version 460 core
 layout(std140, binding = 0) uniform PerFrameData
@@ -123,10 +126,8 @@ int main(void) {
 	glBindVertexArray(vao);
 
 	const GLsizeiptr kBufferSize = sizeof(PerFrameData);
-	GLuint preFrameDataBuffer;
-	glCreateBuffers(1, &preFrameDataBuffer);
-	glNamedBufferStorage(preFrameDataBuffer, kBufferSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, preFrameDataBuffer, 0, kBufferSize);
+	// every draw call gets its own range of the uniform data, the CPU does not wait for the GPU to read the previous one
+	auto preFrameDataBuffer = std::make_unique<GLStreamingBuffer>(2 * kBufferSize);
 
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_POLYGON_OFFSET_LINE);
@@ -144,20 +145,22 @@ int main(void) {
 		glm::mat4 p = glm::perspective(45.0f, ratio, 0.1f, 1000.0f);
 
 		PerFrameData perFrameData = { p* m, false };
-		glNamedBufferSubData(preFrameDataBuffer, 0, kBufferSize, &perFrameData);
+		preFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, preFrameDataBuffer->upload(&perFrameData, kBufferSize));
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 		glDrawArrays(GL_TRIANGLES, 0, 36);
 
 		perFrameData.isWireframe = true;
-        glNamedBufferSubData(preFrameDataBuffer, 0, kBufferSize, &perFrameData);
+        preFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, preFrameDataBuffer->upload(&perFrameData, kBufferSize));
         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
         glDrawArrays(GL_TRIANGLES, 0, 36);
 
+		preFrameDataBuffer->endFrame();
+
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
-	glDeleteBuffers(1, &preFrameDataBuffer);
+	preFrameDataBuffer.reset();
 	glDeleteVertexArrays(1, &vao);
 	glDeleteProgram(program);
 	glDeleteShader(fragmentShader);
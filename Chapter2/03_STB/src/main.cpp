@@ -3,6 +3,9 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include <filesystem>
+#include <memory>
+
+#include "shared/glFramework/GLStreamingBuffer.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
@@ -99,10 +102,8 @@ int main() {
 
 	const GLsizeiptr bufferSize = sizeof(glm::mat4);
 	
-	GLuint perFrameDataBuffer;
-	glCreateBuffers(1, &perFrameDataBuffer);
-	glNamedBufferStorage(perFrameDataBuffer, bufferSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer, 0, bufferSize);
+	// the data of every frame goes to a new range, the CPU does not wait for the GPU to read the previous one
+	auto perFrameDataBuffer = std::make_unique<GLStreamingBuffer>(bufferSize);
 
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 
@@ -136,16 +137,18 @@ int main() {
 
 		glUseProgram(program);
 		glActiveTexture(texture);
-		glNamedBufferSubData(perFrameDataBuffer, 0, bufferSize, glm::value_ptr(p * m));
+		perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(glm::value_ptr(p * m), bufferSize));
 
 		glDrawArrays(GL_TRIANGLES, 0, 3);
 
+		perFrameDataBuffer->endFrame();
+
 		glfwSwapBuffers(widnow);
 		glfwPollEvents();
 	}
 
 	glDeleteTextures(1, &texture);
-	glDeleteBuffers(1, &perFrameDataBuffer);
+	perFrameDataBuffer.reset();
 	glDeleteVertexArrays(1, &vao);
 	glDeleteProgram(program);
 	glDeleteShader(fragmentShader);
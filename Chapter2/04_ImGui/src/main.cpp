@@ -7,6 +7,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <memory>
+
+#include "shared/glFramework/GLStreamingBuffer.h"
 
 int main() {
 	glfwSetErrorCallback([](int error, const char* reason) {
@@ -72,16 +75,8 @@ int main() {
 	GLuint vao;
 	glCreateVertexArrays(1, &vao);
 	
-	GLuint handleVBO;
-	glCreateBuffers(1, &handleVBO);
-	glNamedBufferStorage(handleVBO, 128 * 1024, nullptr, GL_DYNAMIC_STORAGE_BIT);
-
-	GLuint handleElements;
-	glCreateBuffers(1, &handleElements);
-	glNamedBufferStorage(handleElements, 256 * 1024, nullptr, GL_DYNAMIC_STORAGE_BIT);
-
-	glVertexArrayElementBuffer(vao, handleElements);
-	glVertexArrayVertexBuffer(vao, 0, handleVBO, 0, sizeof(ImDrawVert));
+	// the projection, vertices and indices of a frame; every draw list gets its own ranges bound below
+	auto streamingBuffer = std::make_unique<GLStreamingBuffer>(256 * 1024);
 
 	glEnableVertexArrayAttrib(vao, 0);
 	glEnableVertexArrayAttrib(vao, 1);
@@ -111,11 +106,6 @@ int main() {
 	glLinkProgram(progrom);
 	glUseProgram(progrom);
 
-	GLuint preFrameDataBuffer;
-	glCreateBuffers(1, &preFrameDataBuffer);
-	glNamedBufferStorage(preFrameDataBuffer, sizeof(glm::mat4), nullptr, GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferBase(GL_UNIFORM_BUFFER, 0, preFrameDataBuffer);
-
 	ImGui::CreateContext();
 
 	ImGuiIO& io = ImGui::GetIO();
@@ -179,12 +169,14 @@ int main() {
         const float B = draw_data->DisplayPos.y + draw_data->DisplaySize.y;
         const glm::mat4 orthoProjection = glm::ortho(L, R, B, T);
 
-		glNamedBufferSubData(preFrameDataBuffer, 0, sizeof(glm::mat4), glm::value_ptr(orthoProjection));
+		streamingBuffer->bindRange(GL_UNIFORM_BUFFER, 0, streamingBuffer->upload(glm::value_ptr(orthoProjection), sizeof(glm::mat4)));
 
 		for (int n = 0; n < draw_data->CmdListsCount; ++n) {
 			const ImDrawList* drawList = draw_data->CmdLists[n];
-			glNamedBufferSubData(handleVBO, 0, (GLsizei)drawList->VtxBuffer.Size * sizeof(ImDrawVert), drawList->VtxBuffer.Data);
-			glNamedBufferSubData(handleElements, 0, (GLsizei)drawList->IdxBuffer.Size * sizeof(ImDrawIdx), drawList->IdxBuffer.Data);
+			const GLStreamingBuffer::Range vertices = streamingBuffer->upload(drawList->VtxBuffer.Data, (GLsizeiptr)drawList->VtxBuffer.Size * sizeof(ImDrawVert));
+			const GLStreamingBuffer::Range elements = streamingBuffer->upload(drawList->IdxBuffer.Data, (GLsizeiptr)drawList->IdxBuffer.Size * sizeof(ImDrawIdx));
+			glVertexArrayVertexBuffer(vao, 0, vertices.buffer_, vertices.offset_, sizeof(ImDrawVert));
+			glVertexArrayElementBuffer(vao, elements.buffer_);
 
             for (int cmd_i = 0; cmd_i < drawList->CmdBuffer.Size; cmd_i++) {
                 const ImDrawCmd* pcmd = &drawList->CmdBuffer[cmd_i];
@@ -192,18 +184,22 @@ int main() {
                 glScissor((int)cr.x, (int)(height - cr.w), (int)(cr.z - cr.x), (int)(cr.w - cr.y));
                 glBindTextureUnit(0, (GLuint)(intptr_t)pcmd->TextureId);
                 glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, GL_UNSIGNED_SHORT,
-                    (void*)(intptr_t)(pcmd->IdxOffset * sizeof(ImDrawIdx)), (GLint)pcmd->VtxOffset);
+                    (void*)(intptr_t)(elements.offset_ + pcmd->IdxOffset * sizeof(ImDrawIdx)), (GLint)pcmd->VtxOffset);
             }
 		}
 
         glScissor(0, 0, width, height);
 
+		streamingBuffer->endFrame();
+
         glfwSwapBuffers(window);
         glfwPollEvents();
 	}
 
     ImGui::DestroyContext();
 
+	streamingBuffer.reset();
+
     glfwDestroyWindow(window);
 
     glfwTerminate();
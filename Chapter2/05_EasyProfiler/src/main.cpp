@@ -9,6 +9,9 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include <memory>
+#include "shared/glFramework/GLStreamingBuffer.h"
+
 #include <easy/profiler.h>
 
 static const char* shaderCodeVertex = R"(
@@ -135,10 +138,8 @@ int main() {
 
 	const GLsizeiptr kBufferSize = sizeof(PerFrameData);
 
-	GLuint perFrameDataBuffer;
-	glCreateBuffers(1, &perFrameDataBuffer);
-	glNamedBufferStorage(perFrameDataBuffer, kBufferSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer, 0, kBufferSize);
+	// every draw call gets its own range of the uniform data, the CPU does not wait for the GPU to read the previous one
+	auto perFrameDataBuffer = std::make_unique<GLStreamingBuffer>(2 * kBufferSize);
 
 	EASY_END_BLOCK;
 
@@ -174,7 +175,7 @@ int main() {
             EASY_BLOCK("Pass1");
             std::this_thread::sleep_for(std::chrono::milliseconds(2));
 			perFrameData.isWireframe = false;
-			glNamedBufferSubData(perFrameDataBuffer, 0, kBufferSize, &perFrameData);
+			perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, kBufferSize));
 
 			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
@@ -185,12 +186,14 @@ int main() {
             std::this_thread::sleep_for(std::chrono::milliseconds(2));
 
 			perFrameData.isWireframe = true;
-			glNamedBufferSubData(perFrameDataBuffer, 0, kBufferSize, &perFrameData);
+			perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, kBufferSize));
 
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
             glDrawArrays(GL_TRIANGLES, 0, 36);
 		}
 
+        perFrameDataBuffer->endFrame();
+
         {
             EASY_BLOCK("glfwSwapBuffers()");
             glfwSwapBuffers(window);
@@ -202,7 +205,7 @@ int main() {
         }
 	}
 
-    glDeleteBuffers(1, &perFrameDataBuffer);
+    perFrameDataBuffer.reset();
     glDeleteProgram(program);
     glDeleteShader(fragment);
     glDeleteShader(vertext);
@@ -7,6 +7,9 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include <memory>
+#include "shared/glFramework/GLStreamingBuffer.h"
+
 #include <optick.h>
 
 static const char* shaderCodeVertex = R"(
@@ -128,10 +131,8 @@ int main() {
 
 	GLsizei perFrameDataSize = sizeof(PerFrameData);
 
-	GLuint perFrameDataBuffer;
-	glCreateBuffers(1, &perFrameDataBuffer);
-	glNamedBufferStorage(perFrameDataBuffer, perFrameDataSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer, 0, perFrameDataSize);
+	// every draw call gets its own range of the uniform data, the CPU does not wait for the GPU to read the previous one
+	auto perFrameDataBuffer = std::make_unique<GLStreamingBuffer>(2 * perFrameDataSize);
 
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 	glEnable(GL_DEPTH_TEST);
@@ -153,25 +154,27 @@ int main() {
 
 		glUseProgram(program);
 		{
-			glNamedBufferSubData(perFrameDataBuffer, 0, perFrameDataSize, &perFrameData);
+			perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, perFrameDataSize));
 
 			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
 		}
 
         {
-            glNamedBufferSubData(perFrameDataBuffer, 0, perFrameDataSize, &perFrameData);
+            perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, perFrameDataSize));
 
 			perFrameData.isWireframe = true;
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
             glDrawArrays(GL_TRIANGLES, 0, 36);
         }
 
+		perFrameDataBuffer->endFrame();
+
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
-	glDeleteBuffers(1, &perFrameDataBuffer);
+	perFrameDataBuffer.reset();
 	glDeleteVertexArrays(1, &vao);
 	glDeleteProgram(program);
 	glDeleteShader(fragmentShader);
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <memory>
 #include <vector>
 
 #include <glad/gl.h>
@@ -9,6 +10,8 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include "shared/glFramework/GLStreamingBuffer.h"
+
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <assimp/cimport.h>
@@ -130,10 +133,8 @@ int main() {
 	const int numVertices = static_cast<int>(position.size());
 
 	const int perFrameDataBufferSize = sizeof(PerFrameData);
-	GLuint perFrameDataBuffer;
-	glCreateBuffers(1, &perFrameDataBuffer);
-	glNamedBufferStorage(perFrameDataBuffer, perFrameDataBufferSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer, 0, perFrameDataBufferSize);
+	// every draw call gets its own range of the uniform data, the CPU does not wait for the GPU to read the previous one
+	auto perFrameDataBuffer = std::make_unique<GLStreamingBuffer>(2 * perFrameDataBufferSize);
 
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 	glEnable(GL_DEPTH_TEST);
@@ -157,23 +158,25 @@ int main() {
 		PerFrameData perFrameData = { p * m, false };
 		glUseProgram(program);
 		
-		glNamedBufferSubData(perFrameDataBuffer, 0, perFrameDataBufferSize, &perFrameData);
+		perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, perFrameDataBufferSize));
 
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 		glDrawArrays(GL_TRIANGLES, 0, numVertices);
 
 		perFrameData.isWireframe = true;
-		glNamedBufferSubData(perFrameDataBuffer, 0, perFrameDataBufferSize, &perFrameData);
+		perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, perFrameDataBufferSize));
 
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		glDrawArrays(GL_TRIANGLES, 0, numVertices);
 
+		perFrameDataBuffer->endFrame();
+
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
     glDeleteBuffers(1, &meshData);
-    glDeleteBuffers(1, &perFrameDataBuffer);
+    perFrameDataBuffer.reset();
     glDeleteProgram(program);
     glDeleteShader(fragmentShader);
     glDeleteShader(vertexShader);
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <memory>
 #include <vector>
 
 #include <glad/gl.h>
@@ -10,6 +11,8 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include "shared/glFramework/GLStreamingBuffer.h"
+
 #include <assimp/scene.h>
 #include <assimp/cimport.h>
 #include <assimp/postprocess.h>
@@ -207,10 +210,8 @@ int main() {
 
 	const size_t kBufferSize = sizeof(PerFrameData);
 
-	GLuint perFrameDataBuffer;
-	glCreateBuffers(1, &perFrameDataBuffer);
-	glNamedBufferStorage(perFrameDataBuffer, kBufferSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer, 0, kBufferSize);
+	// every draw call gets its own range of the uniform data, the CPU does not wait for the GPU to read the previous one
+	auto perFrameDataBuffer = std::make_unique<GLStreamingBuffer>(2 * kBufferSize);
 
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 	glEnable(GL_DEPTH_TEST);
@@ -231,19 +232,21 @@ int main() {
 		const glm::mat4 p = glm::perspective(45.0f, ratio, 0.1f, 1000.0f);
 
 		PerFrameData perFrameData{ p * m1 };
-		glNamedBufferSubData(perFrameDataBuffer, 0, kBufferSize, &perFrameData);
+		perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, kBufferSize));
 		glDrawElements(GL_TRIANGLES, static_cast<unsigned>(indices.size()), GL_UNSIGNED_INT, nullptr);
 
 		PerFrameData perFrameData2{ p * m2 };
-		glNamedBufferSubData(perFrameDataBuffer, 0, kBufferSize, &perFrameData2);
+		perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData2, kBufferSize));
 		glDrawElements(GL_TRIANGLES, static_cast<unsigned>(indicesLod.size()), GL_UNSIGNED_INT, (void*)sizeIndices);
 
+		perFrameDataBuffer->endFrame();
+
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
 	glDeleteBuffers(1, &meshData);
-	glDeleteBuffers(1, &perFrameDataBuffer);
+	perFrameDataBuffer.reset();
 	glDeleteProgram(program);
 	glDeleteShader(fragmentShader);
 	glDeleteShader(vertexShader);
@@ -14,8 +14,10 @@
 #include <stb/stb_image.h>
 
 #include "shared/glFramework/GLShader.h"
+#include "shared/glFramework/GLStreamingBuffer.h"
 #include "shared/debug.h"
 
+#include <memory>
 #include <vector>
 
 struct PerFrameData {
@@ -126,10 +128,8 @@ int main() {
 
     const GLsizei kPerFrameDataSize = sizeof(PerFrameData);
 
-    GLuint perFrameDataBuffer;
-    glCreateBuffers(1, &perFrameDataBuffer);
-    glNamedBufferStorage(perFrameDataBuffer, kPerFrameDataSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-    glBindBufferRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer, 0, kPerFrameDataSize);
+    // the matrix of every frame goes to a new range, the CPU does not wait for the GPU to read the previous one
+    auto perFrameDataBuffer = std::make_unique<GLStreamingBuffer>(kPerFrameDataSize);
 
     GLProgram program(vertexShader, geomShader, fragShader);
     program.useProgram();
@@ -151,14 +151,17 @@ int main() {
         glm::mat4 p = glm::perspective(45.0f, ratio, 0.1f, 1000.0f);
 
         PerFrameData perFrameData{ .mvp = p * m };
-        glNamedBufferSubData(perFrameDataBuffer, 0, kPerFrameDataSize, (const void*)&perFrameData);
+        perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, kPerFrameDataSize));
 
         glDrawElements(GL_TRIANGLES, static_cast<unsigned>(indices.size()), GL_UNSIGNED_INT, nullptr);
 
+        perFrameDataBuffer->endFrame();
+
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    perFrameDataBuffer.reset();
     glDeleteVertexArrays(1, &dataVertices);
     glDeleteVertexArrays(1, &vao);
     glDeleteBuffers(1, &indicesBuffer);
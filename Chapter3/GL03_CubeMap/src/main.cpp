@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <memory>
 #include <vector>
 
 #include "shared/glFramework/GLShader.h"
+#include "shared/glFramework/GLStreamingBuffer.h"
 #include "shared/UtilsMath.h"
 #include "shared/Bitmap.h"
 #include "shared/debug.h"
@@ -203,10 +205,8 @@ int main() {
 
     const GLsizeiptr kUniformBufferSize = sizeof(PerFrameData);
 
-    GLuint perFrameDataBuffer;
-    glCreateBuffers(1, &perFrameDataBuffer);
-    glNamedBufferStorage(perFrameDataBuffer, kUniformBufferSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-    glBindBufferRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer, 0, kUniformBufferSize);
+    // the model and the cube get their own uniform ranges in every frame, none of them is overwritten while the GPU reads it
+    auto perFrameDataBuffer = std::make_unique<GLStreamingBuffer>(4 * kUniformBufferSize);
 
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     glEnable(GL_DEPTH_TEST);
@@ -227,7 +227,7 @@ int main() {
                 (float)glfwGetTime(), glm::vec3(0.0f, 1.0f, 0.0f));
             const PerFrameData perFrameData = { .model = m, .mvp = p * m, .cameraPos = glm::vec4(0.0f)};
             progModel.useProgram();
-            glNamedBufferSubData(perFrameDataBuffer, 0, kUniformBufferSize, &perFrameData);
+            perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, kUniformBufferSize));
             glDrawElements(GL_TRIANGLES, static_cast<unsigned>(indices.size()), GL_UNSIGNED_INT, nullptr);
         }
 
@@ -235,17 +235,19 @@ int main() {
             const glm::mat4 m = glm::scale(glm::mat4(1.0f), vec3(2.0f));
             const PerFrameData perFrameData = { .model = m, .mvp = p * m, .cameraPos = vec4(0.0f) };
             progCube.useProgram();
-            glNamedBufferSubData(perFrameDataBuffer, 0, kUniformBufferSize, &perFrameData);
+            perFrameDataBuffer->bindRange(GL_UNIFORM_BUFFER, 0, perFrameDataBuffer->upload(&perFrameData, kUniformBufferSize));
             glDrawArrays(GL_TRIANGLES, 0, 36);
         }
 
+        perFrameDataBuffer->endFrame();
+
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
     glDeleteBuffers(1, &dataIndices);
     glDeleteBuffers(1, &dataVertices);
-    glDeleteBuffers(1, &perFrameDataBuffer);
+    perFrameDataBuffer.reset();
     glDeleteVertexArrays(1, &vao);
 
     return 0;
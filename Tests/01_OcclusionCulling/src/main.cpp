@@ -0,0 +1,141 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "shared/scene/OcclusionCulling.h"
+
+/*
+	CPU-only checks of OcclusionBuffer: the depth buffer contents and the box visibility queries
+*/
+
+using glm::mat4;
+using glm::vec3;
+
+static int numFailed = 0;
+
+static void check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", what);
+		numFailed++;
+	}
+}
+
+/* An axis-aligned quad in the XY plane (3 floats per vertex) */
+static void addQuad(OcclusionBuffer& buffer, float x0, float y0, float x1, float y1, float z, const mat4& model = mat4(1.0f))
+{
+	const float vertices[] = {
+		x0, y0, z,
+		x1, y0, z,
+		x1, y1, z,
+		x0, y1, z,
+	};
+	const uint32_t indices[] = { 0, 1, 2, 0, 2, 3 };
+
+	buffer.addOccluder(vertices, 3, indices, 6, 0, model);
+}
+
+static bool isDepthFinite(const OcclusionBuffer& buffer)
+{
+	for (float d: buffer.getDepth())
+		if (!isfinite(d))
+			return false;
+	return true;
+}
+
+/* With the identity view-projection NDC is the world space: the depth is z * 0.5 + 0.5 */
+static void testDepthBuffer(tf::Executor* executor)
+{
+	OcclusionBuffer buffer(256, 128);
+
+	buffer.clear(mat4(1.0f));
+	// the left half of the screen at depth 0.5
+	addQuad(buffer, -1.0f, -1.0f, 0.0f, 1.0f, 0.0f);
+	buffer.rasterize(executor);
+
+	const std::vector<float>& depth = buffer.getDepth();
+	const int w = buffer.getWidth();
+	const int h = buffer.getHeight();
+
+	check(fabsf(depth[(h / 2) * w + w / 4] - 0.5f) < 1e-3f, "the depth inside of the occluder");
+	check(depth[(h / 2) * w + 3 * w / 4] == 1.0f, "the depth outside of the occluder");
+	check(isDepthFinite(buffer), "finite depth values");
+}
+
+static void testQueries(tf::Executor* executor)
+{
+	OcclusionBuffer buffer(256, 128);
+
+	buffer.clear(mat4(1.0f));
+	addQuad(buffer, -1.0f, -1.0f, 0.0f, 1.0f, 0.0f);
+	buffer.rasterize(executor);
+
+	check(!buffer.isBoxVisible(BoundingBox(vec3(-0.8f, -0.5f, 0.5f), vec3(-0.2f, 0.5f, 0.8f))), "a box behind the occluder is hidden");
+	check(buffer.isBoxVisible(BoundingBox(vec3(-0.8f, -0.5f, -0.5f), vec3(-0.2f, 0.5f, -0.2f))), "a box in front of the occluder is visible");
+	check(buffer.isBoxVisible(BoundingBox(vec3(0.2f, -0.5f, 0.5f), vec3(0.5f, 0.5f, 0.8f))), "a box next to the occluder is visible");
+	check(buffer.isBoxVisible(BoundingBox(vec3(-0.5f, -0.5f, 0.5f), vec3(0.5f, 0.5f, 0.8f))), "a box partially behind the occluder is visible");
+	check(!buffer.isBoxVisible(BoundingBox(vec3(2.0f, 2.0f, 0.5f), vec3(3.0f, 3.0f, 0.8f))), "a box outside of the screen is hidden");
+}
+
+/* The vertices just in front of the eye project millions of pixels away from the screen */
+static void testNearPlane(tf::Executor* executor)
+{
+	OcclusionBuffer buffer(256, 128);
+
+	const mat4 proj = glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 100.0f);
+
+	buffer.clear(proj);
+	addQuad(buffer, -1e5f, -1e5f, 1e5f, 1e5f, -2e-4f);
+	addQuad(buffer, -1.0f, -1.0f, 1e6f, 1.0f, -5.0f);
+	buffer.rasterize(executor);
+
+	check(isDepthFinite(buffer), "finite depth values near the near plane");
+
+	buffer.isBoxVisible(BoundingBox(vec3(-1e6f, -1.0f, -3e-4f), vec3(1e6f, 1.0f, -1e-4f)));
+	check(!buffer.isBoxVisible(BoundingBox(vec3(-0.5f, -0.5f, -20.0f), vec3(0.5f, 0.5f, -10.0f))), "a box behind a large occluder is hidden");
+}
+
+/* The renderer clips the geometry between the eye and the near plane away: it cannot occlude anything */
+static void testBeforeNearPlane(tf::Executor* executor)
+{
+	OcclusionBuffer buffer(256, 128);
+
+	const mat4 proj = glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 100.0f);
+
+	buffer.clear(proj);
+	// covers the whole screen at 0.05, the near plane is at 0.1
+	addQuad(buffer, -10.0f, -10.0f, 10.0f, 10.0f, -0.05f);
+	buffer.rasterize(executor);
+
+	check(isDepthFinite(buffer), "finite depth values in front of the near plane");
+	check(buffer.isBoxVisible(BoundingBox(vec3(-0.5f, -0.5f, -20.0f), vec3(0.5f, 0.5f, -10.0f))), "a box behind a quad in front of the near plane is visible");
+}
+
+int main()
+{
+	tf::Executor executor;
+
+	for (tf::Executor* e: { (tf::Executor*)nullptr, &executor })
+	{
+		testDepthBuffer(e);
+		testQueries(e);
+		testNearPlane(e);
+		testBeforeNearPlane(e);
+	}
+
+	if (numFailed)
+	{
+		printf("%d checks failed\n", numFailed);
+		return EXIT_FAILURE;
+	}
+
+	printf("All checks passed\n");
+
+	return EXIT_SUCCESS;
+}
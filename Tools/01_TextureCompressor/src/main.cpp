@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "etc2comp/EtcLib/Etc/Etc.h"
+#include "etc2comp/EtcLib/Etc/EtcImage.h"
+#include "etc2comp/EtcTool/EtcFile.h"
+
+#include <stb/stb_image.h>
+
+#include "shared/Bitmap.h"
+#include "shared/UtilsMips.h"
+#include "shared/scene/Material.h"
+
+#include <taskflow/taskflow.hpp>
+
+/*
+	Batch ETC2/EAC compression of all the textures referenced by a material file.
+
+	Every texture gets a full MIP chain (see generateMipChain()) and is saved as "<original file name>.ktx" next to the original one.
+	Opaque textures are encoded as ETC2 RGB, textures with translucent texels as ETC2 RGBA (EAC alpha).
+	Files are processed in parallel, the MIP levels of every file are encoded in parallel too. Up-to-date KTX files are not encoded again.
+	The material file referencing the KTX files is saved as "<input>_ktx.materials" unless another output file is given, the input one is kept.
+	GLSceneData, GLSceneDataLazy and VKSceneData load KTX files with all their stored levels through GLTexture and VulkanResources::loadKTX()
+	(TextureStreamer does not stream them).
+
+	Usage: Tool01_TextureCompressor [input.materials [output.materials]]
+*/
+
+constexpr const char* kKTXExtension = ".ktx";
+
+struct CompressionJob
+{
+	std::string srcFile_;
+	std::string dstFile_;
+	bool isNormalMap_ = false;
+	// color textures are filtered in linear space (see getSRGBTextures())
+	bool isSRGB_ = true;
+	bool succeeded_ = false;
+};
+
+static bool hasKTXExtension(const std::string& fileName)
+{
+	const size_t len = strlen(kKTXExtension);
+	return fileName.size() > len && fileName.compare(fileName.size() - len, len, kKTXExtension) == 0;
+}
+
+static bool isUpToDate(const std::string& srcFile, const std::string& dstFile)
+{
+	std::error_code ec;
+	const auto srcTime = std::filesystem::last_write_time(srcFile, ec);
+	if (ec)
+		return false;
+	const auto dstTime = std::filesystem::last_write_time(dstFile, ec);
+	return !ec && dstTime >= srcTime;
+}
+
+static bool hasTranslucentTexels(const uint8_t* rgba, size_t numTexels)
+{
+	for (size_t i = 0; i != numTexels; i++)
+		if (rgba[i * 4 + 3] != 255)
+			return true;
+	return false;
+}
+
+static bool compressTexture(const CompressionJob& job, tf::Subflow& subflow)
+{
+	int w, h;
+	uint8_t* img = stbi_load(job.srcFile_.c_str(), &w, &h, nullptr, STBI_rgb_alpha);
+
+	if (!img)
+	{
+		printf("Failed to load [%s] texture\n", job.srcFile_.c_str());
+		return false;
+	}
+
+	const Bitmap bmp(w, h, 4, eBitmapFormat_UnsignedByte, img);
+	const bool hasAlpha = hasTranslucentTexels(img, size_t(w) * h);
+	stbi_image_free(img);
+
+	const Etc::Image::Format format = hasAlpha ? Etc::Image::Format::RGBA8 : Etc::Image::Format::RGB8;
+	const Etc::ErrorMetric errorMetric = hasAlpha ? Etc::ErrorMetric::RGBA : (job.isNormalMap_ ? Etc::ErrorMetric::NORMALXYZ : Etc::ErrorMetric::BT709);
+
+	const uint32_t numLevels = getMipChainLevelCount(w, h);
+	const std::vector<uint8_t> mips = generateMipChain(bmp, numLevels, MipChainParams { .sRGB_ = job.isSRGB_ });
+
+	std::vector<Etc::RawImage> levels(numLevels);
+
+	size_t offset = 0;
+	for (uint32_t i = 0; i != numLevels; i++)
+	{
+		const int levelW = std::max(1, w >> i);
+		const int levelH = std::max(1, h >> i);
+		const uint8_t* levelData = mips.data() + offset;
+		offset += size_t(levelW) * levelH * 4;
+
+		// every level is encoded by a single job, the levels and the files provide enough parallelism
+		subflow.emplace([&levels, i, levelW, levelH, levelData, format, errorMetric]()
+		{
+			std::vector<float> rgbaf(size_t(levelW) * levelH * 4);
+			for (size_t j = 0; j != rgbaf.size(); j++)
+				rgbaf[j] = float(levelData[j]) / 255.0f;
+
+			Etc::Image image(rgbaf.data(), levelW, levelH, errorMetric);
+			image.Encode(format, errorMetric, ETCCOMP_DEFAULT_EFFORT_LEVEL, 1, 1);
+
+			// the encoding bits are not owned by Etc::Image
+			Etc::RawImage& level = levels[i];
+			level.uiExtendedWidth = image.GetExtendedWidth();
+			level.uiExtendedHeight = image.GetExtendedHeight();
+			level.uiEncodingBitsBytes = image.GetEncodingBitsBytes();
+			level.paucEncodingBits = std::shared_ptr<unsigned char>(image.GetEncodingBits(), [](unsigned char* p) { delete[] p; });
+		});
+	}
+
+	subflow.join();
+
+	Etc::File etcFile(job.dstFile_.c_str(), Etc::File::Format::KTX, format, numLevels, levels.data(), w, h);
+	etcFile.Write();
+
+	printf("%s -> %s (%ux%u, %u levels, %s)\n", job.srcFile_.c_str(), job.dstFile_.c_str(), w, h, numLevels, hasAlpha ? "RGBA8" : "RGB8");
+
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* inFile  = (argc > 1) ? argv[1] : "data/meshes/test.materials";
+
+	// the original material file stays usable by the loaders which only read the source images
+	std::filesystem::path defaultOutFile(inFile);
+	defaultOutFile.replace_filename(defaultOutFile.stem().string() + "_ktx" + defaultOutFile.extension().string());
+	const std::string outFile = (argc > 2) ? argv[2] : defaultOutFile.string();
+
+	std::vector<MaterialDescription> materials;
+	std::vector<std::string> files;
+	loadMaterials(inFile, materials, files);
+
+	std::vector<CompressionJob> jobs(files.size());
+
+	for (size_t i = 0; i != files.size(); i++)
+	{
+		jobs[i].srcFile_ = files[i];
+		jobs[i].dstFile_ = hasKTXExtension(files[i]) ? files[i] : files[i] + kKTXExtension;
+	}
+
+	for (const auto& m: materials)
+		if (m.normalMap_ != INVALID_TEXTURE)
+			jobs[m.normalMap_].isNormalMap_ = true;
+
+	const std::vector<bool> isSRGB = getSRGBTextures(materials, files.size());
+	for (size_t i = 0; i != files.size(); i++)
+		jobs[i].isSRGB_ = isSRGB[i];
+
+	tf::Executor executor;
+	tf::Taskflow taskflow;
+
+	size_t numEncoded = 0;
+
+	for (auto& job: jobs)
+	{
+		// already compressed by a previous run
+		if (job.srcFile_ == job.dstFile_ || isUpToDate(job.srcFile_, job.dstFile_))
+		{
+			job.succeeded_ = true;
+			continue;
+		}
+
+		taskflow.emplace([&job](tf::Subflow& subflow) { job.succeeded_ = compressTexture(job, subflow); });
+		numEncoded++;
+	}
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	executor.run(taskflow).wait();
+	const auto end = std::chrono::high_resolution_clock::now();
+
+	size_t numFailed = 0;
+
+	for (size_t i = 0; i != jobs.size(); i++)
+	{
+		if (jobs[i].succeeded_)
+			files[i] = jobs[i].dstFile_;
+		else
+			numFailed++;
+	}
+
+	saveMaterials(outFile.c_str(), materials, files);
+
+	printf("\nEncoded %u of %u textures in %.3f s (%u threads), %u failed and keep their original files\n",
+		(uint32_t)numEncoded, (uint32_t)files.size(), std::chrono::duration<double>(end - start).count(), (uint32_t)executor.num_workers(), (uint32_t)numFailed);
+	printf("Material file saved to %s\n", outFile.c_str());
+
+	return EXIT_SUCCESS;
+}
@@ -21,8 +21,8 @@ layout(binding = 6) uniform samplerCube texEnvMap;
 layout(binding = 7) uniform samplerCube texEnvMapIrradiance;
 layout(binding = 8) uniform sampler2D   texBRDF_LUT;
 
-// All 2D textures for all of the materials
-layout(binding = 9) uniform sampler2D textures[];
+// All 2D textures for all of the materials (the bindless table of VulkanResources)
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
 #include <data/shaders/chapter06/PBR.sp>
 
@@ -34,7 +34,7 @@ void main()
 	vec4 albedo = md.albedoColor_;
 	vec3 normalSample = vec3(0.0, 0.0, 0.0);
 
-	const int INVALID_HANDLE = 2000;
+	const uint64_t INVALID_HANDLE = 0xFFFFFFFFul;
 
 	// fetch albedo
 	if (md.albedoMap_ < INVALID_HANDLE)
@@ -26,8 +26,8 @@ layout(binding = 9) uniform sampler2D   texBRDF_LUT;
 
 layout(binding = 10) uniform sampler2D shadowMap;
 
-// All 2D textures for all of the materials
-layout(binding = 11) uniform sampler2D textures[];
+// All 2D textures for all of the materials (the bindless table of VulkanResources)
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
 #include <data/shaders/chapter06/PBR.sp>
 
@@ -67,7 +67,7 @@ void main()
 	vec4 albedo = md.albedoColor_;
 	vec3 normalSample = vec3(0.0, 0.0, 0.0);
 
-	const int INVALID_HANDLE = 2000;
+	const uint64_t INVALID_HANDLE = 0xFFFFFFFFul;
 
 	// fetch albedo
 	if (md.albedoMap_ < INVALID_HANDLE)
@@ -1,10 +1,15 @@
 ﻿#pragma once
 
+#include <assert.h>
+#include <stdint.h>
 #include <string.h>
+#include <span>
 #include <vector>
 
 #include <glm/glm.hpp>
 
+#include "shared/UtilsHalf.h"
+
 enum eBitmapType
 {
 	eBitmapType_2D,
@@ -15,8 +20,42 @@ enum eBitmapFormat
 {
 	eBitmapFormat_UnsignedByte,
 	eBitmapFormat_Float,
+	eBitmapFormat_Half,
+};
+
+/// Typed view of a (sub)image: 'Channels' interleaved components of type T per pixel.
+/// Rows are contiguous, so kernels can be written as loops over row spans
+template <typename T, int Channels>
+struct BitmapView
+{
+	T* data_ = nullptr;
+	int w_ = 0;
+	int h_ = 0;
+	int d_ = 1;
+	// distance between the starts of two rows, in components
+	size_t stride_ = 0;
+
+	inline T* row(int y, int z = 0) const { return data_ + (size_t(z) * h_ + y) * stride_; }
+	inline std::span<T> rowSpan(int y, int z = 0) const { return std::span<T>(row(y, z), size_t(w_) * Channels); }
+	inline T* pixel(int x, int y, int z = 0) const { return row(y, z) + size_t(x) * Channels; }
+
+	/// A rectangle inside a single layer, e.g. one face of a vertical cross
+	BitmapView subView(int x, int y, int w, int h) const
+	{
+		return BitmapView { .data_ = pixel(x, y), .w_ = w, .h_ = h, .d_ = 1, .stride_ = stride_ };
+	}
 };
 
+/// Conversion of the component values to/from normalized floats (used by Bitmap::getPixel()/setPixel())
+inline float bitmapComponentToFloat(uint8_t v) { return float(v) / 255.0f; }
+inline float bitmapComponentToFloat(float v) { return v; }
+inline float bitmapComponentToFloat(Half v) { return float(v); }
+
+template <typename T> T floatToBitmapComponent(float v);
+template <> inline uint8_t floatToBitmapComponent<uint8_t>(float v) { return uint8_t(v * 255.0f); }
+template <> inline float floatToBitmapComponent<float>(float v) { return v; }
+template <> inline Half floatToBitmapComponent<Half>(float v) { return Half(v); }
+
 /// R/RG/RGB/RGBA bitmaps
 struct Bitmap
 {
@@ -24,17 +63,14 @@ struct Bitmap
 	Bitmap(int w, int h, int comp, eBitmapFormat fmt)
 	:w_(w), h_(h), comp_(comp), fmt_(fmt), data_(w * h * comp * getBytesPerComponent(fmt))
 	{
-		initGetSetFuncs();
 	}
 	Bitmap(int w, int h, int d, int comp, eBitmapFormat fmt)
 	:w_(w), h_(h), d_(d), comp_(comp), fmt_(fmt), data_(w * h * d * comp * getBytesPerComponent(fmt))
 	{
-		initGetSetFuncs();
 	}
 	Bitmap(int w, int h, int comp, eBitmapFormat fmt, const void* ptr)
 	:w_(w), h_(h), comp_(comp), fmt_(fmt), data_(w * h * comp * getBytesPerComponent(fmt))
 	{
-		initGetSetFuncs();
 		memcpy(data_.data(), ptr, data_.size());
 	}
 	int w_ = 0;
@@ -49,73 +85,94 @@ struct Bitmap
 	{
 		if (fmt == eBitmapFormat_UnsignedByte) return 1;
 		if (fmt == eBitmapFormat_Float) return 4;
+		if (fmt == eBitmapFormat_Half) return 2;
 		return 0;
 	}
 
+	/// T and Channels must match fmt_ and comp_
+	template <typename T, int Channels>
+	BitmapView<T, Channels> getView()
+	{
+		assert(comp_ == Channels && getBytesPerComponent(fmt_) == sizeof(T));
+		return BitmapView<T, Channels> { .data_ = reinterpret_cast<T*>(data_.data()), .w_ = w_, .h_ = h_, .d_ = d_, .stride_ = size_t(w_) * Channels };
+	}
+	template <typename T, int Channels>
+	BitmapView<const T, Channels> getView() const
+	{
+		assert(comp_ == Channels && getBytesPerComponent(fmt_) == sizeof(T));
+		return BitmapView<const T, Channels> { .data_ = reinterpret_cast<const T*>(data_.data()), .w_ = w_, .h_ = h_, .d_ = d_, .stride_ = size_t(w_) * Channels };
+	}
+
+	/// Per-pixel convenience API. Prefer getView() and visitFormat() for the loops over the whole image
 	void setPixel(int x, int y, const glm::vec4& c)
 	{
-		(*this.*setPixelFunc)(x, y, c);
+		visitFormat([&]<typename T, int Channels>() {
+			T* p = getView<T, Channels>().pixel(x, y);
+			for (int i = 0; i != Channels; i++)
+				p[i] = floatToBitmapComponent<T>(c[i]);
+		});
 	}
 	glm::vec4 getPixel(int x, int y) const
 	{
-		return ((*this.*getPixelFunc)(x, y));
+		glm::vec4 c(0.0f);
+		visitFormat([&]<typename T, int Channels>() {
+			const T* p = getView<T, Channels>().pixel(x, y);
+			for (int i = 0; i != Channels; i++)
+				c[i] = bitmapComponentToFloat(p[i]);
+		});
+		return c;
 	}
-private:
-	using setPixel_t = void(Bitmap::*)(int, int, const glm::vec4&);
-	using getPixel_t = glm::vec4(Bitmap::*)(int, int) const;
-	setPixel_t setPixelFunc = &Bitmap::setPixelUnsignedByte;
-	getPixel_t getPixelFunc = &Bitmap::getPixelUnsignedByte;
 
-	void initGetSetFuncs()
+	/// Call func.template operator()<T, Channels>() for the component type and the number of components of this bitmap,
+	/// so the per-pixel work is dispatched once per image instead of once per pixel
+	template <typename Func>
+	void visitFormat(Func&& func) const
 	{
 		switch (fmt_)
 		{
 		case eBitmapFormat_UnsignedByte:
-			setPixelFunc = &Bitmap::setPixelUnsignedByte;
-			getPixelFunc = &Bitmap::getPixelUnsignedByte;
+			visitChannels<uint8_t>(func);
 			break;
 		case eBitmapFormat_Float:
-			setPixelFunc = &Bitmap::setPixelFloat;
-			getPixelFunc = &Bitmap::getPixelFloat;
+			visitChannels<float>(func);
+			break;
+		case eBitmapFormat_Half:
+			visitChannels<Half>(func);
 			break;
 		}
 	}
 
-	void setPixelFloat(int x, int y, const glm::vec4& c)
-	{
-		const int ofs = comp_ * (y * w_ + x);
-		float* data = reinterpret_cast<float*>(data_.data());
-		if (comp_ > 0) data[ofs + 0] = c.x;
-		if (comp_ > 1) data[ofs + 1] = c.y;
-		if (comp_ > 2) data[ofs + 2] = c.z;
-		if (comp_ > 3) data[ofs + 3] = c.w;
-	}
-	glm::vec4 getPixelFloat(int x, int y) const
-	{
-		const int ofs = comp_ * (y * w_ + x);
-		const float* data = reinterpret_cast<const float*>(data_.data());
-		return glm::vec4(
-			comp_ > 0 ? data[ofs + 0] : 0.0f,
-			comp_ > 1 ? data[ofs + 1] : 0.0f,
-			comp_ > 2 ? data[ofs + 2] : 0.0f,
-			comp_ > 3 ? data[ofs + 3] : 0.0f);
-	}
-
-	void setPixelUnsignedByte(int x, int y, const glm::vec4& c)
-	{
-		const int ofs = comp_ * (y * w_ + x);
-		if (comp_ > 0) data_[ofs + 0] = uint8_t(c.x * 255.0f);
-		if (comp_ > 1) data_[ofs + 1] = uint8_t(c.y * 255.0f);
-		if (comp_ > 2) data_[ofs + 2] = uint8_t(c.z * 255.0f);
-		if (comp_ > 3) data_[ofs + 3] = uint8_t(c.w * 255.0f);
-	}
-	glm::vec4 getPixelUnsignedByte(int x, int y) const
+private:
+	template <typename T, typename Func>
+	void visitChannels(Func& func) const
 	{
-		const int ofs = comp_ * (y * w_ + x);
-		return glm::vec4(
-			comp_ > 0 ? float(data_[ofs + 0]) / 255.0f : 0.0f,
-			comp_ > 1 ? float(data_[ofs + 1]) / 255.0f : 0.0f,
-			comp_ > 2 ? float(data_[ofs + 2]) / 255.0f : 0.0f,
-			comp_ > 3 ? float(data_[ofs + 3]) / 255.0f : 0.0f);
+		switch (comp_)
+		{
+		case 1: func.template operator()<T, 1>(); break;
+		case 2: func.template operator()<T, 2>(); break;
+		case 3: func.template operator()<T, 3>(); break;
+		case 4: func.template operator()<T, 4>(); break;
+		}
 	}
 };
+
+/// Float <-> half conversion of the whole bitmap (F16C when available). Other format pairs are not supported and return an empty bitmap
+inline Bitmap convertBitmapFormat(const Bitmap& b, eBitmapFormat fmt)
+{
+	if (b.fmt_ == fmt)
+		return b;
+
+	Bitmap result(b.w_, b.h_, b.d_, b.comp_, fmt);
+	result.type_ = b.type_;
+
+	const size_t count = size_t(b.w_) * b.h_ * b.d_ * b.comp_;
+
+	if (b.fmt_ == eBitmapFormat_Float && fmt == eBitmapFormat_Half)
+		floatToHalf(reinterpret_cast<const float*>(b.data_.data()), reinterpret_cast<uint16_t*>(result.data_.data()), count);
+	else if (b.fmt_ == eBitmapFormat_Half && fmt == eBitmapFormat_Float)
+		halfToFloat(reinterpret_cast<const uint16_t*>(b.data_.data()), reinterpret_cast<float*>(result.data_.data()), count);
+	else
+		return Bitmap();
+
+	return result;
+}
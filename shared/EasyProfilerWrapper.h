@@ -13,12 +13,39 @@
 #	define EASY_MAIN_THREAD
 #	define PROFILER_FRAME(...)
 #	define PROFILER_DUMP(fileName)
+#	define PROFILER_GPU_BLOCK(name, beginNs, endNs)
 #endif // !BUILD_WITH_EASY_PROFILER && !BUILD_WITH_OPTICK
 
+#if BUILD_WITH_EASY_PROFILER || BUILD_WITH_OPTICK
+#	include <chrono>
+#	include <stdint.h>
+
+inline uint64_t profilerSteadyClockNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif // BUILD_WITH_EASY_PROFILER || BUILD_WITH_OPTICK
+
 #if BUILD_WITH_EASY_PROFILER
 #	include "easy/profiler.h"
 #	define PROFILER_FRAME(...)
 #	define PROFILER_DUMP(fileName) profiler::dumpBlocksToFile(fileName);
+#	define PROFILER_GPU_BLOCK(name, beginNs, endNs) profilerStoreGPUBlock(name, beginNs, endNs);
+
+/// A block measured on the GPU (see VulkanGPUProfiler), the times are std::chrono::steady_clock nanoseconds
+inline void profilerStoreGPUBlock(const char* name, uint64_t beginNs, uint64_t endNs)
+{
+	static const profiler::BaseBlockDescriptor* desc = profiler::registerDescription(profiler::ON, "GPUBlock", "GPU", __FILE__, __LINE__, profiler::BlockType::Block, profiler::colors::Orange, true);
+
+	// the profiler has its own clock
+	const uint64_t nowNs = profilerSteadyClockNs();
+	const profiler::timestamp_t now = profiler::now();
+	const double ticksPerNs = 1e9 / (double)profiler::toNanoseconds(1000000000ull);
+
+	auto toTicks = [=](uint64_t ns) { return now - (profiler::timestamp_t)((double)(nowNs - ns) * ticksPerNs); };
+
+	profiler::storeBlock(desc, name, toTicks(beginNs), toTicks(endNs));
+}
 #endif // BUILD_WITH_EASY_PROFILER
 
 #if BUILD_WITH_OPTICK
@@ -31,6 +58,7 @@
 #	define EASY_MAIN_THREAD OPTICK_THREAD( "MainThread" )
 #	define PROFILER_FRAME(name) OPTICK_FRAME(name)
 #	define PROFILER_DUMP(fileName) OPTICK_STOP_CAPTURE(); OPTICK_SAVE_CAPTURE(fileName);
+#	define PROFILER_GPU_BLOCK(name, beginNs, endNs) profilerStoreGPUBlock(name, beginNs, endNs);
 
 namespace profiler
 {
@@ -42,6 +70,30 @@ namespace profiler
 	} // namespace colors
 } // namespace profiler
 
+#	include <unordered_map>
+
+/// A block measured on the GPU (see VulkanGPUProfiler) in a separate "GPU" track, the times are std::chrono::steady_clock nanoseconds
+inline void profilerStoreGPUBlock(const char* name, uint64_t beginNs, uint64_t endNs)
+{
+	static Optick::EventStorage* storage = OPTICK_STORAGE_REGISTER("GPU");
+
+	// the names are persistent strings, one description per name
+	static std::unordered_map<const char*, Optick::EventDescription*> descs;
+
+	Optick::EventDescription*& desc = descs[name];
+	if (!desc)
+		desc = Optick::EventDescription::Create(name, __FILE__, __LINE__);
+
+	// Optick has its own clock
+	const uint64_t nowNs = profilerSteadyClockNs();
+	const int64_t now = Optick::GetHighPrecisionTime();
+	const double ticksPerNs = (double)Optick::GetHighPrecisionFrequency() / 1e9;
+
+	auto toTicks = [=](uint64_t ns) { return now - (int64_t)((double)(nowNs - ns) * ticksPerNs); };
+
+	OPTICK_STORAGE_EVENT(storage, desc, toTicks(beginNs), toTicks(endNs));
+}
+
 class OptickScopeWrapper
 {
 public:
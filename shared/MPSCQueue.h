@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+/**
+	Unbounded lock-free multiple-producer single-consumer queue (D. Vyukov's intrusive MPSC node queue).
+
+	push() can be called from any number of threads and never blocks, pop() is called by a single consumer thread.
+	A value pushed by a producer which has been preempted in the middle of push() becomes visible to pop() once the producer resumes,
+	so pop() returning false means "nothing to consume now" rather than "the queue is empty".
+*/
+template <typename T>
+class MPSCQueue
+{
+public:
+	MPSCQueue()
+	: head_(new Node())
+	, tail_(head_.load(std::memory_order_relaxed))
+	{}
+
+	~MPSCQueue()
+	{
+		T value;
+		while (pop(value)) {}
+		delete tail_;
+	}
+
+	MPSCQueue(const MPSCQueue&) = delete;
+	MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+	void push(T&& value)
+	{
+		Node* node = new Node { std::move(value) };
+		Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+		prev->next_.store(node, std::memory_order_release);
+	}
+
+	bool pop(T& value)
+	{
+		Node* next = tail_->next_.load(std::memory_order_acquire);
+
+		if (!next)
+			return false;
+
+		// 'next' becomes the new stub node, its value is moved out
+		value = std::move(next->value_);
+		delete tail_;
+		tail_ = next;
+
+		return true;
+	}
+
+private:
+	struct Node
+	{
+		T value_;
+		std::atomic<Node*> next_ = nullptr;
+	};
+
+	// producers append to the head
+	alignas(64) std::atomic<Node*> head_;
+	// the consumer owns the tail
+	alignas(64) Node* tail_;
+};
@@ -0,0 +1,215 @@
+#include "shared/ShaderPreprocessor.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+ShaderPreprocessor& getShaderPreprocessor()
+{
+	static ShaderPreprocessor preprocessor;
+	return preprocessor;
+}
+
+static std::filesystem::file_time_type getFileTime(const std::string& fileName)
+{
+	std::error_code ec;
+	const auto time = std::filesystem::last_write_time(fileName, ec);
+	return ec ? std::filesystem::file_time_type::min() : time;
+}
+
+const ShaderPreprocessor::CachedFile* ShaderPreprocessor::getFile(const std::string& fileName)
+{
+	const auto time = getFileTime(fileName);
+
+	auto i = files_.find(fileName);
+
+	if (i != files_.end() && i->second.time_ == time)
+		return &i->second;
+
+	FILE* file = fopen(fileName.c_str(), "rb");
+
+	if (!file)
+	{
+		printf("I/O error. Cannot open shader file '%s'\n", fileName.c_str());
+		return nullptr;
+	}
+
+	fseek(file, 0L, SEEK_END);
+	const long bytesInFile = ftell(file);
+	fseek(file, 0L, SEEK_SET);
+
+	CachedFile f;
+	f.text_.resize(bytesInFile > 0 ? bytesInFile : 0);
+	f.text_.resize(fread(f.text_.data(), 1, f.text_.size(), file));
+	f.time_ = time;
+	fclose(file);
+
+	static constexpr char BOM[] = { '\xEF', '\xBB', '\xBF' };
+
+	if (f.text_.size() >= 3 && !memcmp(f.text_.data(), BOM, 3))
+		f.text_.erase(0, 3);
+
+	// the files were read in the text mode before
+	f.text_.erase(std::remove(f.text_.begin(), f.text_.end(), '\r'), f.text_.end());
+
+	CachedFile& cached = files_[fileName];
+	cached = std::move(f);
+
+	return &cached;
+}
+
+/// The name of '#include <name>' or '#include "name"', an empty string if the line is not an include
+static std::string getIncludeName(const char* line, const char* end, bool* isError)
+{
+	const char* p = line;
+
+	while (p != end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	static constexpr char kInclude[] = "#include";
+	constexpr size_t kIncludeLen = sizeof(kInclude) - 1;
+
+	if (size_t(end - p) < kIncludeLen || memcmp(p, kInclude, kIncludeLen))
+		return std::string();
+
+	p += kIncludeLen;
+
+	while (p != end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	const char close = (p != end && *p == '<') ? '>' : '"';
+	const char* nameEnd = (p != end && (*p == '<' || *p == '"')) ? std::find(p + 1, end, close) : end;
+
+	if (nameEnd == end || nameEnd == p + 1)
+	{
+		*isError = true;
+		return std::string();
+	}
+
+	return std::string(p + 1, nameEnd);
+}
+
+static bool isPragmaOnce(const char* line, const char* end)
+{
+	const char* p = line;
+
+	while (p != end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	if (p == end || *p != '#')
+		return false;
+
+	p++;
+
+	while (p != end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	static constexpr char kPragma[] = "pragma";
+	static constexpr char kOnce[] = "once";
+
+	if (size_t(end - p) < sizeof(kPragma) - 1 || memcmp(p, kPragma, sizeof(kPragma) - 1))
+		return false;
+
+	p += sizeof(kPragma) - 1;
+
+	while (p != end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	if (size_t(end - p) < sizeof(kOnce) - 1 || memcmp(p, kOnce, sizeof(kOnce) - 1))
+		return false;
+
+	p += sizeof(kOnce) - 1;
+
+	while (p != end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	return p == end;
+}
+
+bool ShaderPreprocessor::expand(const std::string& fileName, std::vector<std::string>& includeStack, std::vector<std::string>& onceFiles, PreprocessedShader& out)
+{
+	if (std::find(onceFiles.begin(), onceFiles.end(), fileName) != onceFiles.end())
+		return true;
+
+	if (std::find(includeStack.begin(), includeStack.end(), fileName) != includeStack.end())
+	{
+		printf("Error while loading shader program: '%s' includes itself\n", fileName.c_str());
+		return false;
+	}
+
+	const CachedFile* file = getFile(fileName);
+
+	if (!file)
+		return false;
+
+	if (std::none_of(out.dependencies_.begin(), out.dependencies_.end(), [&fileName](const ShaderDependency& d) { return d.fileName_ == fileName; }))
+		out.dependencies_.push_back(ShaderDependency { .fileName_ = fileName, .time_ = file->time_ });
+
+	includeStack.push_back(fileName);
+
+	// 'file' stays valid: a file is never read again while it is being expanded (it is on the include stack)
+	const char* text = file->text_.data();
+	const char* textEnd = text + file->text_.size();
+
+	for (const char* line = text; line != textEnd; )
+	{
+		const char* lineEnd = std::find(line, textEnd, '\n');
+		const char* next = (lineEnd == textEnd) ? textEnd : lineEnd + 1;
+
+		bool isError = false;
+		const std::string include = getIncludeName(line, lineEnd, &isError);
+
+		if (isError)
+		{
+			printf("Error while loading shader program '%s': %s\n", fileName.c_str(), std::string(line, lineEnd).c_str());
+			return false;
+		}
+
+		if (!include.empty())
+		{
+			if (!expand(include, includeStack, onceFiles, out))
+				return false;
+
+			out.code_ += '\n';
+		}
+		else if (isPragmaOnce(line, lineEnd))
+		{
+			// GLSL has no '#pragma once', the line is kept empty
+			onceFiles.push_back(fileName);
+			out.code_ += '\n';
+		}
+		else
+		{
+			out.code_.append(line, next);
+		}
+
+		line = next;
+	}
+
+	includeStack.pop_back();
+
+	return true;
+}
+
+bool ShaderPreprocessor::preprocess(const char* fileName, PreprocessedShader& out)
+{
+	out = PreprocessedShader();
+
+	std::lock_guard lock(mutex_);
+
+	std::vector<std::string> includeStack;
+	std::vector<std::string> onceFiles;
+
+	if (expand(fileName, includeStack, onceFiles, out))
+		return true;
+
+	out = PreprocessedShader();
+
+	return false;
+}
+
+bool ShaderPreprocessor::isOutdated(const PreprocessedShader& shader) const
+{
+	return std::any_of(shader.dependencies_.begin(), shader.dependencies_.end(),
+		[](const ShaderDependency& d) { return getFileTime(d.fileName_) != d.time_; });
+}
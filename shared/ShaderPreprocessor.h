@@ -0,0 +1,59 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ShaderDependency
+{
+	std::string fileName_;
+	std::filesystem::file_time_type time_;
+};
+
+struct PreprocessedShader
+{
+	/// the source with all the includes expanded
+	std::string code_;
+	/// the shader file and every file included into it (directly or not) with their modification times when they were read
+	std::vector<ShaderDependency> dependencies_;
+};
+
+/**
+	GLSL include expansion shared by the GL and Vulkan shader loaders.
+
+	'#include <file>' and '#include "file"' at the beginning of a line are replaced by the contents of the file (the paths are relative
+	to the working directory). A file with '#pragma once' is expanded only once into every output. The expansion is a single pass
+	over the lines of every file.
+
+	The files are cached in memory: shared headers are read from disk once for all the shaders. A cached file is read again
+	when its modification time changes; isOutdated() checks the dependencies of an output the same way (e.g. for hot reloading).
+	The persistent caches (SPIR-V, GL program binaries) are keyed by the expanded code, so a changed dependency never hits a stale entry.
+	Thread-safe.
+*/
+class ShaderPreprocessor final
+{
+public:
+	/// Returns false (and prints the error) if the file or any of its includes cannot be read or the includes are recursive
+	bool preprocess(const char* fileName, PreprocessedShader& out);
+
+	/// Any of the dependencies has changed on disk since 'shader' was preprocessed
+	bool isOutdated(const PreprocessedShader& shader) const;
+
+private:
+	struct CachedFile
+	{
+		std::string text_;
+		std::filesystem::file_time_type time_;
+	};
+
+	std::mutex mutex_;
+	std::unordered_map<std::string, CachedFile> files_;
+
+	const CachedFile* getFile(const std::string& fileName);
+	bool expand(const std::string& fileName, std::vector<std::string>& includeStack, std::vector<std::string>& onceFiles, PreprocessedShader& out);
+};
+
+/// Process-wide preprocessor used by readShaderFile()
+ShaderPreprocessor& getShaderPreprocessor();
@@ -0,0 +1,221 @@
+#include "shared/TextureCache.h"
+#include "shared/Bitmap.h"
+#include "shared/Utils.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+
+#include <stb/stb_image.h>
+#include <stb/stb_image_resize.h>
+
+constexpr uint32_t kTextureCacheMagic = 0x43584554; // "TEXC"
+// bump to invalidate all the entries written by older versions
+constexpr uint32_t kTextureCacheVersion = 3;
+
+struct TextureCacheHeader
+{
+	uint32_t magicValue_;
+	uint32_t version_;
+	uint64_t key_;
+	int32_t w_;
+	int32_t h_;
+	uint32_t numLevels_;
+	uint32_t padding_;
+	uint64_t dataSize_;
+};
+
+static_assert(sizeof(TextureCacheHeader) == 40);
+
+// the conversion parameters are hashed together with the path into the source key
+struct TextureCacheKeyParams
+{
+	uint32_t version_;
+	uint32_t numLevels_;
+	uint32_t filter_;
+	uint32_t sRGB_;
+};
+
+static_assert(sizeof(TextureCacheKeyParams) == 16);
+
+// the source file stamp is hashed together with the source key into the entry key
+struct TextureCacheFileStamp
+{
+	uint64_t fileSize_;
+	int64_t fileTime_;
+};
+
+static_assert(sizeof(TextureCacheFileStamp) == 16);
+
+static std::string getCacheEntryPrefix(uint64_t sourceKey)
+{
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "%016llx_", (unsigned long long)sourceKey);
+	return prefix;
+}
+
+// "<source key>_<entry key>.rgba": all the entries of a source file with the same parameters share the prefix
+static std::string getCacheEntryFileName(uint64_t sourceKey, uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.rgba", (unsigned long long)key);
+	return std::string(kTextureCacheDir) + getCacheEntryPrefix(sourceKey) + name;
+}
+
+/// Remove the entries of older versions of the source file and the entries named by older versions of the cache (no '_' in the name)
+static void removeStaleCacheEntries(uint64_t sourceKey, const std::string& entryFile)
+{
+	const std::string prefix = getCacheEntryPrefix(sourceKey);
+	const std::string entryName = std::filesystem::path(entryFile).filename().string();
+
+	std::error_code ec;
+
+	for (auto it = std::filesystem::directory_iterator(kTextureCacheDir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec))
+	{
+		const std::string name = it->path().filename().string();
+
+		// the temporary files of writeFileAtomically() do not end with ".rgba"
+		if (!name.ends_with(".rgba") || name == entryName)
+			continue;
+
+		// fails on Windows while another thread still maps the entry, it is removed on the next miss then
+		std::error_code removeError;
+		if (name.starts_with(prefix) || name.find('_') == std::string::npos)
+			std::filesystem::remove(it->path(), removeError);
+	}
+}
+
+static bool loadCacheEntry(const std::string& entryFile, uint64_t key, CachedTexture& texture)
+{
+	auto file = std::make_shared<MappedFile>(entryFile.c_str());
+
+	if (!file->isValid() || file->getSize() < sizeof(TextureCacheHeader))
+		return false;
+
+	TextureCacheHeader header;
+	memcpy(&header, file->getData(), sizeof(header));
+
+	if (header.magicValue_ != kTextureCacheMagic || header.version_ != kTextureCacheVersion || header.key_ != key)
+		return false;
+
+	// truncated entries (e.g. a crash while writing) are rejected
+	const Bitmap desc(header.w_, header.h_, 4, eBitmapFormat_UnsignedByte);
+	if (header.dataSize_ != getMipChainSize(desc, header.numLevels_) || file->getSize() != sizeof(header) + header.dataSize_)
+		return false;
+
+	texture.w_ = header.w_;
+	texture.h_ = header.h_;
+	texture.numLevels_ = header.numLevels_;
+	texture.file_ = std::move(file);
+	texture.offset_ = sizeof(TextureCacheHeader);
+	texture.data_.clear();
+
+	return true;
+}
+
+static void saveCacheEntry(const std::string& entryFile, uint64_t key, const CachedTexture& texture)
+{
+	const TextureCacheHeader header = {
+		.magicValue_ = kTextureCacheMagic,
+		.version_ = kTextureCacheVersion,
+		.key_ = key,
+		.w_ = texture.w_,
+		.h_ = texture.h_,
+		.numLevels_ = texture.numLevels_,
+		.padding_ = 0,
+		.dataSize_ = texture.data_.size()
+	};
+
+	writeFileAtomically(entryFile, &header, sizeof(header), texture.data_.data(), texture.data_.size());
+}
+
+CachedTexture makeUncachedTexture(int w, int h, const uint8_t* rgba, uint32_t numLevels, const MipChainParams& params)
+{
+	CachedTexture texture;
+	texture.w_ = w;
+	texture.h_ = h;
+	texture.numLevels_ = numLevels ? numLevels : getMipChainLevelCount(w, h);
+	texture.data_ = generateMipChain(Bitmap(w, h, 4, eBitmapFormat_UnsignedByte, rgba), texture.numLevels_, params);
+	return texture;
+}
+
+/// Levels of 'tailSize' texels and smaller resampled directly from the full image, nothing if the whole chain is that small
+static void makeTail(int w, int h, const uint8_t* rgba, uint32_t numLevels, const MipChainParams& params, uint32_t tailSize, const CachedTextureTailCallback& onTail)
+{
+	uint32_t firstLevel = 0;
+	while (firstLevel + 1 < numLevels && std::max(w >> firstLevel, h >> firstLevel) > (int)tailSize)
+		firstLevel++;
+
+	if (!firstLevel)
+		return;
+
+	const int tailW = std::max(1, w >> firstLevel);
+	const int tailH = std::max(1, h >> firstLevel);
+
+	std::vector<uint8_t> tail(size_t(tailW) * tailH * 4);
+
+	if (params.sRGB_)
+		stbir_resize_uint8_srgb(rgba, w, h, 0, tail.data(), tailW, tailH, 0, 4, 3, 0);
+	else
+		stbir_resize_uint8(rgba, w, h, 0, tail.data(), tailW, tailH, 0, 4);
+
+	onTail(makeUncachedTexture(tailW, tailH, tail.data(), numLevels - firstLevel, params), firstLevel);
+}
+
+bool loadCachedTexture(const char* fileName, CachedTexture& texture, uint32_t numLevels, const MipChainParams& params, uint32_t tailSize, const CachedTextureTailCallback& onTail)
+{
+	std::error_code ec;
+
+	const std::filesystem::path path = std::filesystem::absolute(fileName, ec).lexically_normal();
+	const uint64_t fileSize = ec ? 0 : std::filesystem::file_size(path, ec);
+	const auto fileTime = ec ? std::filesystem::file_time_type() : std::filesystem::last_write_time(path, ec);
+
+	if (ec)
+		return false;
+
+	const TextureCacheKeyParams keyParams = {
+		.version_ = kTextureCacheVersion,
+		.numLevels_ = numLevels,
+		.filter_ = (uint32_t)params.filter_,
+		.sRGB_ = params.sRGB_ ? 1u : 0u
+	};
+
+	const TextureCacheFileStamp stamp = {
+		.fileSize_ = fileSize,
+		.fileTime_ = (int64_t)fileTime.time_since_epoch().count()
+	};
+
+	const std::string pathString = path.string();
+
+	const uint64_t sourceKey = hashBytes(&keyParams, sizeof(keyParams), hashBytes(pathString.data(), pathString.size()));
+	const uint64_t key = hashBytes(&stamp, sizeof(stamp), sourceKey);
+	const std::string entryFile = getCacheEntryFileName(sourceKey, key);
+
+	if (loadCacheEntry(entryFile, key, texture))
+		return true;
+
+	const MappedFile source(fileName);
+
+	if (!source.isValid())
+		return false;
+
+	int w, h;
+	uint8_t* img = stbi_load_from_memory(source.getData(), (int)source.getSize(), &w, &h, nullptr, STBI_rgb_alpha);
+
+	if (!img)
+		return false;
+
+	if (onTail)
+		makeTail(w, h, img, numLevels ? numLevels : getMipChainLevelCount(w, h), params, tailSize, onTail);
+
+	texture = makeUncachedTexture(w, h, img, numLevels, params);
+	stbi_image_free(img);
+
+	saveCacheEntry(entryFile, key, texture);
+
+	// the source file has changed (or is new): the entries of its previous versions will never be hit again
+	removeStaleCacheEntries(sourceKey, entryFile);
+
+	return true;
+}
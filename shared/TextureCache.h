@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "shared/UtilsFile.h"
+#include "shared/UtilsMips.h"
+
+/**
+	Persistent cache of decoded textures.
+
+	An entry is an RGBA8 MIP chain (see generateMipChain()) ready to be uploaded. Entries are keyed by a hash of the path, size and modification time
+	of the source file and of the conversion parameters, so a changed source file or different parameters never hit a stale entry
+	and the source file is not read on a hit. Entries are read through memory-mapped files.
+	A miss removes the entries of the previous versions of the source file (same path and parameters), the cache does not grow
+	when the source files are edited.
+*/
+
+constexpr const char* kTextureCacheDir = "data/.cache/textures/";
+
+struct CachedTexture
+{
+	int w_ = 0;
+	int h_ = 0;
+	uint32_t numLevels_ = 0;
+
+	/// RGBA8 levels one after another, the level i has max(1, w_ >> i) x max(1, h_ >> i) texels
+	inline const uint8_t* getMips() const { return file_ ? file_->getData() + offset_ : data_.data(); }
+
+	// either the memory-mapped cache entry or the data decoded by this process (if the entry could not be written)
+	std::shared_ptr<MappedFile> file_;
+	size_t offset_ = 0;
+	std::vector<uint8_t> data_;
+};
+
+/// Levels starting from 'firstLevel' of the full chain, 'tail' is not valid after the call
+using CachedTextureTailCallback = std::function<void(const CachedTexture& tail, uint32_t firstLevel)>;
+
+/**
+	Load a texture from the cache. On a miss the file is decoded with stb_image, 'numLevels' MIP levels are generated (0 - the full chain)
+	and a new cache entry is written. Returns false if the source file cannot be read or decoded. Can be called from multiple threads.
+	On a miss 'onTail' gets the levels of 'tailSize' texels and smaller right after decoding, resampled from the full image:
+	these are available long before the full chain is generated and saved (the cached levels can differ slightly)
+*/
+bool loadCachedTexture(const char* fileName, CachedTexture& texture, uint32_t numLevels = 0, const MipChainParams& params = MipChainParams(),
+	uint32_t tailSize = 0, const CachedTextureTailCallback& onTail = nullptr);
+
+/// MIP chain of an RGBA8 image which does not come from a file (e.g. a generated fallback image)
+CachedTexture makeUncachedTexture(int w, int h, const uint8_t* rgba, uint32_t numLevels = 0, const MipChainParams& params = MipChainParams());
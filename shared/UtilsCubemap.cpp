@@ -1,9 +1,19 @@
 ﻿#include "UtilsMath.h"
 #include "UtilsCubemap.h"
+#include "Utils.h"
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include <algorithm>
+#include <float.h>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#	define CUBEMAP_USE_SSE 1
+#	include <emmintrin.h>
+#endif
+
 using glm::vec3;
 using glm::vec4;
 using glm::ivec2;
@@ -23,7 +33,175 @@ vec3 faceCoordsToXYZ(int i, int j, int faceID, int faceSize)
 	return vec3();
 }
 
-Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b)
+// square tiles of a face processed by one task
+constexpr int kCubemapTileSize = 64;
+
+#if CUBEMAP_USE_SSE
+static inline __m128 selectSSE(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/// fastAtan2() for 4 values, the same polynomial and the same results for the signed zeros
+static inline __m128 fastAtan2SSE(__m128 y, __m128 x)
+{
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	const __m128 ax = _mm_andnot_ps(signMask, x);
+	const __m128 ay = _mm_andnot_ps(signMask, y);
+	const __m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(FLT_MIN)));
+	const __m128 s = _mm_mul_ps(a, a);
+
+	__m128 r = _mm_set1_ps(-0.01172120f);
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.05265332f));
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.11643287f));
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.19354346f));
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.33262347f));
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.99997726f));
+	r = _mm_mul_ps(r, a);
+
+	r = selectSSE(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(0.5f * Math::PI), r), r);
+	r = selectSSE(_mm_cmplt_ps(x, zero), _mm_sub_ps(_mm_set1_ps(Math::PI), r), r);
+
+	return _mm_xor_ps(r, _mm_and_ps(_mm_cmplt_ps(y, zero), signMask));
+}
+#endif // CUBEMAP_USE_SSE
+
+/**
+	Bilinear resampling of the equirectangular image into a tile of a cube face, row by row.
+	faceCoordsToXYZ() is affine in (i, j), so a row is a linear sweep of P. The source coordinates for the whole row
+	are computed with fastAtan2() (the error is below 0.01 texel even for 16K-wide equirectangular maps), 4 columns at a time
+	with SSE2: compilers do not vectorize the scalar loop (the selects of fastAtan2() and the errno semantics of std::sqrt()).
+*/
+template <typename T, int Channels>
+static void equirectangularToFaceTile(BitmapView<const T, Channels> src, BitmapView<T, Channels> dst, int face, bool flip, int x0, int y0)
+{
+	const int faceSize = dst.w_;
+	const int clampW = src.w_ - 1;
+	const int clampH = src.h_ - 1;
+
+	const int tileW = std::min(kCubemapTileSize, faceSize - x0);
+	const int tileH = std::min(kCubemapTileSize, faceSize - y0);
+
+	const vec3 P0 = faceCoordsToXYZ(0, 0, face, faceSize);
+	const vec3 dPdi = faceCoordsToXYZ(1, 0, face, faceSize) - P0;
+	const vec3 dPdj = faceCoordsToXYZ(0, 1, face, faceSize) - P0;
+
+	// a flipped face is rotated by 180 degrees: (i, j) is sampled at (faceSize - 1 - i, faceSize - 1 - j)
+	const int last = flip ? faceSize - 1 : 0;
+	const int dir = flip ? -1 : 1;
+
+	const float kScale = 2.0f * faceSize / Math::PI;
+
+	float Uf[kCubemapTileSize];
+	float Vf[kCubemapTileSize];
+	// half-float rows are converted at once (see floatToHalf() for arrays)
+	float outRow[kCubemapTileSize * Channels];
+
+	for (int j = y0; j != y0 + tileH; j++)
+	{
+		const vec3 rowStart = P0 + dPdj * float(last + dir * j);
+		const float firstColumn = float(last + dir * x0);
+
+		int i = 0;
+
+#if CUBEMAP_USE_SSE
+		const __m128 laneColumns = _mm_setr_ps(0.0f, float(dir), float(2 * dir), float(3 * dir));
+
+		for (; i + 4 <= tileW; i += 4)
+		{
+			const __m128 fi = _mm_add_ps(_mm_set1_ps(firstColumn + float(dir * i)), laneColumns);
+			const __m128 x = _mm_add_ps(_mm_set1_ps(rowStart.x), _mm_mul_ps(_mm_set1_ps(dPdi.x), fi));
+			const __m128 y = _mm_add_ps(_mm_set1_ps(rowStart.y), _mm_mul_ps(_mm_set1_ps(dPdi.y), fi));
+			const __m128 z = _mm_add_ps(_mm_set1_ps(rowStart.z), _mm_mul_ps(_mm_set1_ps(dPdi.z), fi));
+			const __m128 R = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+			const __m128 theta = fastAtan2SSE(y, x);
+			const __m128 phi = fastAtan2SSE(z, R);
+			_mm_storeu_ps(Uf + i, _mm_mul_ps(_mm_set1_ps(kScale), _mm_add_ps(theta, _mm_set1_ps(Math::PI))));
+			_mm_storeu_ps(Vf + i, _mm_mul_ps(_mm_set1_ps(kScale), _mm_sub_ps(_mm_set1_ps(0.5f * Math::PI), phi)));
+		}
+#endif // CUBEMAP_USE_SSE
+
+		for (; i != tileW; i++)
+		{
+			const float fi = firstColumn + float(dir * i);
+			const float x = rowStart.x + dPdi.x * fi;
+			const float y = rowStart.y + dPdi.y * fi;
+			const float z = rowStart.z + dPdi.z * fi;
+			const float R = std::sqrt(x * x + y * y);
+			const float theta = fastAtan2(y, x);
+			const float phi = fastAtan2(z, R);
+			//	float point source coordinates
+			Uf[i] = kScale * (theta + Math::PI);
+			Vf[i] = kScale * (0.5f * Math::PI - phi);
+		}
+
+		T* out = dst.pixel(x0, j);
+
+		for (int i = 0; i != tileW; i++)
+		{
+			// 4-samples for bilinear interpolation
+			const int U1 = clamp(int(floor(Uf[i])), 0, clampW);
+			const int V1 = clamp(int(floor(Vf[i])), 0, clampH);
+			const int U2 = clamp(U1 + 1, 0, clampW);
+			const int V2 = clamp(V1 + 1, 0, clampH);
+			// fractional part
+			const float s = Uf[i] - U1;
+			const float t = Vf[i] - V1;
+			// fetch 4-samples
+			const T* A = src.pixel(U1, V1);
+			const T* B = src.pixel(U2, V1);
+			const T* C = src.pixel(U1, V2);
+			const T* D = src.pixel(U2, V2);
+			// bilinear interpolation (normalization of 8-bit components cancels out)
+			const float wA = (1 - s) * (1 - t);
+			const float wB = (s) * (1 - t);
+			const float wC = (1 - s) * t;
+			const float wD = (s) * (t);
+			for (int c = 0; c != Channels; c++)
+				outRow[i * Channels + c] = float(A[c]) * wA + float(B[c]) * wB + float(C[c]) * wC + float(D[c]) * wD;
+		}
+
+		if constexpr (std::is_same_v<T, Half>)
+			floatToHalf(outRow, reinterpret_cast<uint16_t*>(out), size_t(tileW) * Channels);
+		else
+			for (int k = 0; k != tileW * Channels; k++)
+				out[k] = T(outRow[k]);
+	}
+}
+
+struct FaceSource
+{
+	// face index for faceCoordsToXYZ()
+	int face;
+	// the face is rotated by 180 degrees
+	bool flip;
+};
+
+/// Convert 'srcFaces' into the 'dst' views, every face is split into tiles processed by the executor
+template <typename T, int Channels>
+static void equirectangularToFaces(BitmapView<const T, Channels> src, const BitmapView<T, Channels>* dst, const FaceSource* srcFaces, tf::Executor* executor)
+{
+	const int faceSize = dst[0].w_;
+	const int tilesPerRow = (faceSize + kCubemapTileSize - 1) / kCubemapTileSize;
+	const int tilesPerFace = tilesPerRow * tilesPerRow;
+
+	auto convertTile = [&](int tile)
+	{
+		const int face = tile / tilesPerFace;
+		const int faceTile = tile % tilesPerFace;
+		equirectangularToFaceTile<T, Channels>(
+			src, dst[face], srcFaces[face].face, srcFaces[face].flip,
+			(faceTile % tilesPerRow) * kCubemapTileSize, (faceTile / tilesPerRow) * kCubemapTileSize);
+	};
+
+	tf::Taskflow taskflow;
+	taskflow.for_each_index(0, 6 * tilesPerFace, 1, convertTile);
+	(executor ? *executor : getImageProcessingExecutor()).run(taskflow).wait();
+}
+
+Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b, tf::Executor* executor)
 {
 	if (b.type_ != eBitmapType_2D) return Bitmap();
 
@@ -34,6 +212,9 @@ Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b)
 
 	Bitmap result(w, h, b.comp_, b.fmt_);
 
+	if (!faceSize)
+		return result;
+
 	const ivec2 kFaceOffsets[] =
 	{
 		ivec2(faceSize, faceSize * 3),
@@ -44,45 +225,67 @@ Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b)
 		ivec2(faceSize, faceSize * 2)
 	};
 
-	const int clampW = b.w_ - 1;
-	const int clampH = b.h_ - 1;
+	const FaceSource kFaces[6] = { { 0, false }, { 1, false }, { 2, false }, { 3, false }, { 4, false }, { 5, false } };
 
-	for (int face = 0; face != 6; face++)
+	// dispatch on the pixel format once, the kernels work on typed row spans
+	b.visitFormat([&]<typename T, int Channels>()
 	{
-		for (int i = 0; i != faceSize; i++)
-		{
-			for (int j = 0; j != faceSize; j++)
-			{
-				const vec3 P = faceCoordsToXYZ(i, j, face, faceSize);
-				const float R = hypot(P.x, P.y);
-				const float theta = atan2(P.y, P.x);
-				const float phi = atan2(P.z, R);
-				//	float point source coordinates
-				const float Uf = float(2.0f * faceSize * (theta + M_PI) / M_PI);
-				const float Vf = float(2.0f * faceSize * (M_PI / 2.0f - phi) / M_PI);
-				// 4-samples for bilinear interpolation
-				const int U1 = clamp(int(floor(Uf)), 0, clampW);
-				const int V1 = clamp(int(floor(Vf)), 0, clampH);
-				const int U2 = clamp(U1 + 1, 0, clampW);
-				const int V2 = clamp(V1 + 1, 0, clampH);
-				// fractional part
-				const float s = Uf - U1;
-				const float t = Vf - V1;
-				// fetch 4-samples
-				const vec4 A = b.getPixel(U1, V1);
-				const vec4 B = b.getPixel(U2, V1);
-				const vec4 C = b.getPixel(U1, V2);
-				const vec4 D = b.getPixel(U2, V2);
-				// bilinear interpolation
-				const vec4 color = A * (1 - s) * (1 - t) + B * (s) * (1 - t) + C * (1 - s) * t + D * (s) * (t);
-				result.setPixel(i + kFaceOffsets[face].x, j + kFaceOffsets[face].y, color);
-			}
-		};
-	}
+		const BitmapView<T, Channels> dst = result.getView<T, Channels>();
+
+		BitmapView<T, Channels> faces[6];
+		for (int face = 0; face != 6; face++)
+			faces[face] = dst.subView(kFaceOffsets[face].x, kFaceOffsets[face].y, faceSize, faceSize);
+
+		equirectangularToFaces<T, Channels>(b.getView<T, Channels>(), faces, kFaces, executor);
+	});
 
 	return result;
 }
 
+size_t getCubeMapFacesSize(const Bitmap& b)
+{
+	const size_t faceSize = b.w_ / 4;
+	return 6 * faceSize * faceSize * b.comp_ * Bitmap::getBytesPerComponent(b.fmt_);
+}
+
+void convertEquirectangularMapToCubeMapFaces(const Bitmap& b, void* dstData, tf::Executor* executor)
+{
+	const int faceSize = b.w_ / 4;
+
+	if (b.type_ != eBitmapType_2D || !faceSize) return;
+
+	/*
+		Faces of the vertical cross (see convertVerticalCrossToCubeMapFaces()) in the GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order:
+		+X, -X, -Z are copied as is, +Y, -Y, +Z are rotated by 180 degrees
+	*/
+	const FaceSource kFaces[6] = { { 1, false }, { 3, false }, { 4, true }, { 5, true }, { 0, true }, { 2, false } };
+
+	b.visitFormat([&]<typename T, int Channels>()
+	{
+		const size_t layerSize = size_t(faceSize) * faceSize * Channels;
+
+		BitmapView<T, Channels> faces[6];
+		for (int face = 0; face != 6; face++)
+			faces[face] = BitmapView<T, Channels> { .data_ = static_cast<T*>(dstData) + face * layerSize, .w_ = faceSize, .h_ = faceSize, .d_ = 1, .stride_ = size_t(faceSize) * Channels };
+
+		equirectangularToFaces<T, Channels>(b.getView<T, Channels>(), faces, kFaces, executor);
+	});
+}
+
+Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap& b, tf::Executor* executor)
+{
+	if (b.type_ != eBitmapType_2D) return Bitmap();
+
+	const int faceSize = b.w_ / 4;
+
+	Bitmap cubemap(faceSize, faceSize, 6, b.comp_, b.fmt_);
+	cubemap.type_ = eBitmapType_Cube;
+
+	convertEquirectangularMapToCubeMapFaces(b, cubemap.data_.data(), executor);
+
+	return cubemap;
+}
+
 Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b)
 {
 	const int faceWidth = b.w_ / 3;
@@ -91,9 +294,6 @@ Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b)
 	Bitmap cubemap(faceWidth, faceHeight, 6, b.comp_, b.fmt_);
 	cubemap.type_ = eBitmapType_Cube;
 
-	const uint8_t* src = b.data_.data();
-	uint8_t* dst = cubemap.data_.data();
-
 	/*
 			------
 			| +Y |
@@ -106,62 +306,51 @@ Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b)
 			------
 	*/
 
-	const int pixelSize = cubemap.comp_ * Bitmap::getBytesPerComponent(cubemap.fmt_);
+	struct CrossFace
+	{
+		// position of the face in the cross
+		int x, y;
+		// the face is rotated by 180 degrees (rows and columns go backwards)
+		bool flip;
+	};
+
+	const CrossFace kFaces[6] =
+	{
+		{ 0,             faceHeight,     false }, // GL_TEXTURE_CUBE_MAP_POSITIVE_X
+		{ 2 * faceWidth, faceHeight,     false }, // GL_TEXTURE_CUBE_MAP_NEGATIVE_X
+		{ faceWidth,     0,              true  }, // GL_TEXTURE_CUBE_MAP_POSITIVE_Y
+		{ faceWidth,     2 * faceHeight, true  }, // GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
+		{ faceWidth,     3 * faceHeight, true  }, // GL_TEXTURE_CUBE_MAP_POSITIVE_Z
+		{ faceWidth,     faceHeight,     false }, // GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
+	};
 
-	for (int face = 0; face != 6; ++face)
+	b.visitFormat([&]<typename T, int Channels>()
 	{
-		for (int j = 0; j != faceHeight; ++j)
+		const BitmapView<const T, Channels> src = b.getView<T, Channels>();
+		const BitmapView<T, Channels> dst = cubemap.getView<T, Channels>();
+
+		for (int face = 0; face != 6; ++face)
 		{
-			for (int i = 0; i != faceWidth; ++i)
+			const BitmapView<const T, Channels> srcFace = src.subView(kFaces[face].x, kFaces[face].y, faceWidth, faceHeight);
+
+			for (int j = 0; j != faceHeight; ++j)
 			{
-				int x = 0;
-				int y = 0;
+				const std::span<T> out = dst.rowSpan(j, face);
 
-				switch (face)
+				if (!kFaces[face].flip)
 				{
-					// GL_TEXTURE_CUBE_MAP_POSITIVE_X
-				case 0:
-					x = i;
-					y = faceHeight + j;
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_NEGATIVE_X
-				case 1:
-					x = 2 * faceWidth + i;
-					y = 1 * faceHeight + j;
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_POSITIVE_Y
-				case 2:
-					x = 2 * faceWidth - (i + 1);
-					y = 1 * faceHeight - (j + 1);
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
-				case 3:
-					x = 2 * faceWidth - (i + 1);
-					y = 3 * faceHeight - (j + 1);
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_POSITIVE_Z
-				case 4:
-					x = 2 * faceWidth - (i + 1);
-					y = b.h_ - (j + 1);
-					break;
-
-					// GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
-				case 5:
-					x = faceWidth + i;
-					y = faceHeight + j;
-					break;
+					const std::span<const T> in = srcFace.rowSpan(j);
+					std::copy(in.begin(), in.end(), out.begin());
+					continue;
 				}
 
-				memcpy(dst, src + (y * b.w_ + x) * pixelSize, pixelSize);
-
-				dst += pixelSize;
+				const T* in = srcFace.row(faceHeight - 1 - j);
+				for (int i = 0; i != faceWidth; ++i)
+					for (int c = 0; c != Channels; c++)
+						out[i * Channels + c] = in[(faceWidth - 1 - i) * Channels + c];
 			}
 		}
-	}
+	});
 
 	return cubemap;
 }
@@ -2,5 +2,16 @@
 
 #include "shared/Bitmap.h"
 
-Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b);
+#include <taskflow/taskflow.hpp>
+
+/// The faces are converted in tiles by the executor threads. If no executor is given, getImageProcessingExecutor() is used
+Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b, tf::Executor* executor = nullptr);
 Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b);
+
+/// Direct conversion into 6 layers of (w/4)x(w/4) pixels, same layout as convertVerticalCrossToCubeMapFaces() produces.
+/// No vertical cross is created in between
+Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap& b, tf::Executor* executor = nullptr);
+
+/// The same, written to 'dst' (e.g. a mapped staging buffer) which must have getCubeMapFacesSize(b) bytes
+void convertEquirectangularMapToCubeMapFaces(const Bitmap& b, void* dst, tf::Executor* executor = nullptr);
+size_t getCubeMapFacesSize(const Bitmap& b);
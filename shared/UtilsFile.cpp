@@ -0,0 +1,181 @@
+#include "shared/UtilsFile.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+
+#if defined(_WIN32)
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif // _WIN32
+
+#if defined(_WIN32)
+MappedFile::MappedFile(const char* fileName)
+{
+	HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = (GetFileSizeEx(file, &size) && size.QuadPart > 0) ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+	if (!data)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return;
+	}
+
+	file_ = file;
+	mapping_ = mapping;
+	data_ = static_cast<const uint8_t*>(data);
+	size_ = (size_t)size.QuadPart;
+}
+
+MappedFile::~MappedFile()
+{
+	if (!data_)
+		return;
+
+	UnmapViewOfFile(data_);
+	CloseHandle(mapping_);
+	CloseHandle(file_);
+}
+#else
+MappedFile::MappedFile(const char* fileName)
+{
+	const int fd = open(fileName, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED)
+		{
+			data_ = static_cast<const uint8_t*>(data);
+			size_ = (size_t)st.st_size;
+		}
+	}
+
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data_)
+		munmap(const_cast<uint8_t*>(data_), size_);
+}
+#endif // _WIN32
+
+static inline uint64_t mixHash(uint64_t h, uint64_t v)
+{
+	h ^= v * 0xFF51AFD7ED558CCDull;
+	h = (h << 27) | (h >> 37);
+	return h * 0x9E3779B97F4A7C15ull;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+
+	uint64_t h = mixHash(seed, size);
+
+	// 8 bytes per step, the tail is zero-padded
+	for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), p += sizeof(uint64_t))
+	{
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		h = mixHash(h, v);
+	}
+
+	uint64_t tail = 0;
+	memcpy(&tail, p, size);
+	h = mixHash(h, tail);
+
+	// MurmurHash3 finalizer
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/// A new file with a unique name in the directory of 'fileName': concurrent writers in any thread or process never share a temporary file
+static FILE* createTempFile(const std::string& fileName, std::string& tmpFile)
+{
+#if defined(_WIN32)
+	const std::filesystem::path dir = std::filesystem::path(fileName).parent_path();
+
+	char name[MAX_PATH];
+	if (!GetTempFileNameA(dir.empty() ? "." : dir.string().c_str(), "tmp", 0, name))
+		return nullptr;
+
+	tmpFile = name;
+
+	FILE* f = fopen(name, "wb");
+	if (!f)
+		DeleteFileA(name);
+
+	return f;
+#else
+	tmpFile = fileName + ".XXXXXX";
+
+	const int fd = mkstemp(tmpFile.data());
+	if (fd == -1)
+		return nullptr;
+
+	// mkstemp() creates the file readable by the owner only
+	fchmod(fd, 0644);
+
+	FILE* f = fdopen(fd, "wb");
+	if (!f)
+	{
+		close(fd);
+		unlink(tmpFile.c_str());
+	}
+
+	return f;
+#endif // _WIN32
+}
+
+bool writeFileAtomically(const std::string& fileName, const void* header, size_t headerSize, const void* data, size_t dataSize)
+{
+	std::error_code ec;
+
+	const std::filesystem::path dir = std::filesystem::path(fileName).parent_path();
+	if (!dir.empty())
+		std::filesystem::create_directories(dir, ec);
+
+	std::string tmpFile;
+
+	FILE* f = createTempFile(fileName, tmpFile);
+	if (!f)
+		return false;
+
+	const bool written = (!headerSize || fwrite(header, headerSize, 1, f) == 1) && (!dataSize || fwrite(data, dataSize, 1, f) == 1);
+	fclose(f);
+
+	if (written)
+		std::filesystem::rename(tmpFile, fileName, ec);
+
+	if (!written || ec)
+	{
+		std::filesystem::remove(tmpFile, ec);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/// Read-only memory-mapped view of a whole file
+class MappedFile
+{
+public:
+	explicit MappedFile(const char* fileName);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	inline bool isValid() const { return data_ != nullptr; }
+	inline const uint8_t* getData() const { return data_; }
+	inline size_t getSize() const { return size_; }
+
+private:
+	const uint8_t* data_ = nullptr;
+	size_t size_ = 0;
+#if defined(_WIN32)
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#endif // _WIN32
+};
+
+/// 64-bit non-cryptographic hash of a memory block, 'seed' chains several blocks into one hash
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+/**
+	Write a header followed by the data to a file under a temporary name and rename it, so other threads and processes never see a partial file
+	(cache entries). The directory of the file is created if needed. Returns false if the file cannot be written
+*/
+bool writeFileAtomically(const std::string& fileName, const void* header, size_t headerSize, const void* data, size_t dataSize);
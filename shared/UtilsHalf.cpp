@@ -0,0 +1,111 @@
+#include "shared/UtilsHalf.h"
+
+/*
+	The array conversions use F16C when the CPU supports it even if the compiler does not target it:
+	the F16C loops are compiled for AVX + F16C separately and selected at runtime with CPUID
+*/
+#if !defined(UTILSHALF_USE_F16C) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#	define UTILSHALF_DISPATCH_F16C 1
+#	include <immintrin.h>
+#	if defined(_MSC_VER)
+#		include <intrin.h>
+#		define UTILSHALF_TARGET_F16C
+#	else
+#		include <cpuid.h>
+#		define UTILSHALF_TARGET_F16C __attribute__((target("avx,f16c")))
+#	endif
+#elif defined(UTILSHALF_USE_F16C)
+#	define UTILSHALF_TARGET_F16C
+#endif
+
+#if defined(UTILSHALF_USE_F16C) || defined(UTILSHALF_DISPATCH_F16C)
+
+UTILSHALF_TARGET_F16C static size_t floatToHalfF16C(const float* src, uint16_t* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+	}
+	return i;
+}
+
+UTILSHALF_TARGET_F16C static size_t halfToFloatF16C(const uint16_t* src, float* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+	}
+	return i;
+}
+
+#endif
+
+#if defined(UTILSHALF_DISPATCH_F16C)
+
+// F16C, AVX and the AVX state enabled by the OS (CPUID.1:ECX bits 29, 28, 27 and XCR0 bits 1, 2)
+static bool detectF16C()
+{
+	uint32_t ecx = 0;
+
+#if defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 1);
+	ecx = (uint32_t)regs[2];
+#else
+	uint32_t eax, ebx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+#endif
+
+	const uint32_t kRequired = (1u << 27) | (1u << 28) | (1u << 29);
+	if ((ecx & kRequired) != kRequired)
+		return false;
+
+#if defined(_MSC_VER)
+	const uint64_t xcr0 = _xgetbv(0);
+#else
+	uint32_t xcr0lo, xcr0hi;
+	__asm__ volatile("xgetbv" : "=a"(xcr0lo), "=d"(xcr0hi) : "c"(0));
+	const uint64_t xcr0 = xcr0lo;
+#endif
+
+	return (xcr0 & 6) == 6;
+}
+
+static const bool hasF16C = detectF16C();
+
+#elif defined(UTILSHALF_USE_F16C)
+
+static constexpr bool hasF16C = true;
+
+#endif
+
+void floatToHalf(const float* src, uint16_t* dst, size_t count)
+{
+	size_t i = 0;
+
+#if defined(UTILSHALF_USE_F16C) || defined(UTILSHALF_DISPATCH_F16C)
+	if (hasF16C)
+		i = floatToHalfF16C(src, dst, count);
+#endif
+
+	for (; i != count; i++)
+		dst[i] = floatToHalf(src[i]);
+}
+
+void halfToFloat(const uint16_t* src, float* dst, size_t count)
+{
+	size_t i = 0;
+
+#if defined(UTILSHALF_USE_F16C) || defined(UTILSHALF_DISPATCH_F16C)
+	if (hasF16C)
+		i = halfToFloatF16C(src, dst, count);
+#endif
+
+	for (; i != count; i++)
+		dst[i] = halfToFloat(src[i]);
+}
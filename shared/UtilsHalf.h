@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+	IEEE 754 half-precision floats.
+	The single value conversions use F16C instructions when the compiler targets them (-mf16c / -mavx2 or /arch:AVX2), otherwise they are done in software.
+	The array conversions check the CPU at runtime and use F16C whenever it is available.
+	float -> half rounds to nearest even, overflows become infinities, NaNs stay NaNs.
+*/
+
+#if defined(__F16C__) || defined(__AVX2__)
+#	define UTILSHALF_USE_F16C 1
+#	include <immintrin.h>
+#endif
+
+inline uint16_t floatToHalf(float f)
+{
+#if defined(UTILSHALF_USE_F16C)
+	return (uint16_t)_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+
+	const uint32_t sign = (x >> 16) & 0x8000u;
+	x &= 0x7FFFFFFFu;
+
+	// NaN and Inf (and everything that overflows to Inf)
+	if (x >= 0x47800000u)
+		return uint16_t(sign | ((x > 0x7F800000u) ? 0x7E00u : 0x7C00u));
+
+	// normalized half
+	if (x >= 0x38800000u)
+	{
+		const uint32_t mantOdd = (x >> 13) & 1u;
+		x += 0xC8000FFFu + mantOdd; // rebias the exponent (-112 << 23) and round to nearest even
+		return uint16_t(sign | (x >> 13));
+	}
+
+	// denormalized half or zero: let the FPU do the rounding by adding 0.5f
+	float fx;
+	memcpy(&fx, &x, sizeof(fx));
+	fx += 0.5f;
+	memcpy(&x, &fx, sizeof(x));
+	return uint16_t(sign | (x - 0x3F000000u));
+#endif
+}
+
+inline float halfToFloat(uint16_t h)
+{
+#if defined(UTILSHALF_USE_F16C)
+	return _cvtsh_ss(h);
+#else
+	const uint32_t sign = uint32_t(h & 0x8000u) << 16;
+	const uint32_t exp = (h >> 10) & 0x1Fu;
+	const uint32_t mant = h & 0x3FFu;
+
+	uint32_t x;
+
+	if (exp == 0x1Fu)
+	{
+		// Inf/NaN
+		x = sign | 0x7F800000u | (mant << 13);
+	}
+	else if (exp != 0)
+	{
+		x = sign | ((exp + 112u) << 23) | (mant << 13);
+	}
+	else
+	{
+		// zero or denormal: mant * 2^-24
+		float f = float(mant) * (1.0f / 16777216.0f);
+		memcpy(&x, &f, sizeof(x));
+		x |= sign;
+	}
+
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+#endif
+}
+
+/// Array conversions, 8 values per instruction with F16C (detected at runtime)
+void floatToHalf(const float* src, uint16_t* dst, size_t count);
+void halfToFloat(const uint16_t* src, float* dst, size_t count);
+
+/// Storage type for half-float bitmap components
+struct Half
+{
+	uint16_t bits_ = 0;
+
+	Half() = default;
+	explicit Half(float f): bits_(floatToHalf(f)) {}
+	explicit operator float() const { return halfToFloat(bits_); }
+};
+
+static_assert(sizeof(Half) == sizeof(uint16_t));
@@ -5,6 +5,8 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include <algorithm>
+#include <limits>
 #include <vector>
 
 using glm::vec3;
@@ -74,6 +76,23 @@ T clamp(T v, T a, T b)
 	return v;
 }
 
+/**
+	atan2() approximation (odd minimax polynomial for atan() on [0..1] and octant reduction).
+	The absolute error is below 1e-5 radians (about 2e-6 measured over the full circle), fastAtan2(0, 0) returns 0.
+	Compilers do not vectorize loops calling it, UtilsCubemap.cpp has an SSE2 version of it.
+*/
+inline float fastAtan2(float y, float x)
+{
+	const float ax = std::fabs(x);
+	const float ay = std::fabs(y);
+	const float a = std::min(ax, ay) / std::max(std::max(ax, ay), std::numeric_limits<float>::min());
+	const float s = a * a;
+	float r = (((((-0.01172120f * s + 0.05265332f) * s - 0.11643287f) * s + 0.19354346f) * s - 0.33262347f) * s + 0.99997726f) * a;
+	r = (ay > ax) ? 0.5f * Math::PI - r : r;
+	r = (x < 0.0f) ? Math::PI - r : r;
+	return (y < 0.0f) ? -r : r;
+}
+
 inline float random01()
 {
 	return (float)rand() / (float)RAND_MAX;
@@ -0,0 +1,302 @@
+#include "shared/UtilsMips.h"
+#include "shared/Utils.h"
+#include "shared/UtilsMath.h"
+
+#include <algorithm>
+#include <cmath>
+
+// destination rows processed by one task
+constexpr int kMipRowsPerTask = 8;
+
+// maximal number of taps of the 1D downsampling filters
+constexpr int kMipMaxTaps = 8;
+
+/// Separable 1D filter for 2x downsampling: dst[x] = sum(weights_[k] * src[2 * x + first_ + k])
+struct MipFilterKernel
+{
+	int first_ = 0;
+	int numTaps_ = 0;
+	float weights_[kMipMaxTaps] = {};
+};
+
+static float besselI0(float x)
+{
+	// power series, converges quickly for the window parameters used here
+	float sum = 1.0f;
+	float term = 1.0f;
+	for (int k = 1; k != 16; k++)
+	{
+		term *= (0.5f * x / k) * (0.5f * x / k);
+		sum += term;
+	}
+	return sum;
+}
+
+static MipFilterKernel makeMipFilterKernel(eMipFilter filter)
+{
+	MipFilterKernel kernel;
+
+	if (filter == eMipFilter_Box)
+	{
+		kernel.first_ = 0;
+		kernel.numTaps_ = 2;
+		kernel.weights_[0] = kernel.weights_[1] = 0.5f;
+		return kernel;
+	}
+
+	// Kaiser window (alpha = 4) of a sinc with a radius of 2 destination texels: taps at 2x-3 .. 2x+4
+	const float alpha = 4.0f;
+	const float radius = 2.0f;
+
+	kernel.first_ = -3;
+	kernel.numTaps_ = 8;
+
+	float sum = 0.0f;
+	for (int k = 0; k != kernel.numTaps_; k++)
+	{
+		// distance from the destination texel center, in destination texels
+		const float t = (float(kernel.first_ + k) + 0.5f - 1.0f) * 0.5f;
+		const float sinc = (t == 0.0f) ? 1.0f : std::sin(Math::PI * t) / (Math::PI * t);
+		const float r = t / radius;
+		const float window = (std::fabs(r) < 1.0f) ? besselI0(alpha * std::sqrt(1.0f - r * r)) / besselI0(alpha) : 0.0f;
+		kernel.weights_[k] = sinc * window;
+		sum += kernel.weights_[k];
+	}
+
+	for (int k = 0; k != kernel.numTaps_; k++)
+		kernel.weights_[k] /= sum;
+
+	return kernel;
+}
+
+static float srgbToLinear(float c)
+{
+	return (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb(float c)
+{
+	return (c <= 0.0031308f) ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+/// sRGB <-> linear tables: 8-bit decoding and 16-bit linear -> 8-bit sRGB encoding
+struct SRGBTables
+{
+	float toLinear_[256];
+	uint8_t toSRGB_[65536];
+
+	SRGBTables()
+	{
+		for (int i = 0; i != 256; i++)
+			toLinear_[i] = srgbToLinear(float(i) / 255.0f);
+		for (int i = 0; i != 65536; i++)
+			toSRGB_[i] = uint8_t(linearToSrgb(float(i) / 65535.0f) * 255.0f + 0.5f);
+	}
+};
+
+static const SRGBTables& getSRGBTables()
+{
+	static const SRGBTables tables;
+	return tables;
+}
+
+static size_t getMipLevelSize(int w, int h, uint32_t level)
+{
+	return size_t(std::max(1, w >> level)) * std::max(1, h >> level);
+}
+
+uint32_t getMipChainLevelCount(int w, int h)
+{
+	uint32_t levels = 1;
+	while ((w | h) >> levels)
+		levels++;
+	return levels;
+}
+
+size_t getMipChainSize(const Bitmap& b, uint32_t numLevels)
+{
+	size_t texels = 0;
+	for (uint32_t i = 0; i != numLevels; i++)
+		texels += getMipLevelSize(b.w_, b.h_, i);
+
+	return texels * b.d_ * b.comp_ * Bitmap::getBytesPerComponent(b.fmt_);
+}
+
+/// Per-row conversions between the bitmap components and the linear floats the filter works on
+template <typename T>
+struct MipRowCodec;
+
+template <>
+struct MipRowCodec<uint8_t>
+{
+	static void decode(const uint8_t* src, float* dst, size_t count, int comp, bool sRGB)
+	{
+		const float* toLinear = getSRGBTables().toLinear_;
+		for (size_t i = 0; i != count; i++)
+		{
+			const bool isAlpha = (comp == 4) && ((i & 3) == 3);
+			dst[i] = (sRGB && !isAlpha) ? toLinear[src[i]] : float(src[i]) * (1.0f / 255.0f);
+		}
+	}
+	static void encode(const float* src, uint8_t* dst, size_t count, int comp, bool sRGB)
+	{
+		const uint8_t* toSRGB = getSRGBTables().toSRGB_;
+		for (size_t i = 0; i != count; i++)
+		{
+			const float v = std::clamp(src[i], 0.0f, 1.0f);
+			const bool isAlpha = (comp == 4) && ((i & 3) == 3);
+			dst[i] = (sRGB && !isAlpha) ? toSRGB[int(v * 65535.0f + 0.5f)] : uint8_t(v * 255.0f + 0.5f);
+		}
+	}
+};
+
+template <>
+struct MipRowCodec<float>
+{
+	static void decode(const float* src, float* dst, size_t count, int, bool) { std::copy(src, src + count, dst); }
+	static void encode(const float* src, float* dst, size_t count, int, bool) { std::copy(src, src + count, dst); }
+};
+
+template <>
+struct MipRowCodec<Half>
+{
+	static void decode(const Half* src, float* dst, size_t count, int, bool) { halfToFloat(reinterpret_cast<const uint16_t*>(src), dst, count); }
+	static void encode(const float* src, Half* dst, size_t count, int, bool) { floatToHalf(src, reinterpret_cast<uint16_t*>(dst), count); }
+};
+
+/**
+	Downsample 'numRows' destination rows starting at 'y0' of a single layer.
+	The vertical pass runs over whole source rows (contiguous floats, auto-vectorized), the horizontal pass works on the single filtered row
+*/
+static void downsampleRows(const float* src, int srcW, int srcH, float* dst, int dstW, int y0, int numRows, int comp, const MipFilterKernel& kernel, std::vector<float>& tmp)
+{
+	const size_t srcRowSize = size_t(srcW) * comp;
+	tmp.resize(srcRowSize);
+
+	for (int y = y0; y != y0 + numRows; y++)
+	{
+		// vertical pass
+		std::fill(tmp.begin(), tmp.end(), 0.0f);
+		for (int k = 0; k != kernel.numTaps_; k++)
+		{
+			const float w = kernel.weights_[k];
+			const float* row = src + size_t(std::clamp(2 * y + kernel.first_ + k, 0, srcH - 1)) * srcRowSize;
+			float* out = tmp.data();
+			for (size_t i = 0; i != srcRowSize; i++)
+				out[i] += w * row[i];
+		}
+
+		// horizontal pass
+		float* out = dst + size_t(y) * dstW * comp;
+		for (int x = 0; x != dstW; x++)
+		{
+			for (int c = 0; c != comp; c++)
+				out[x * comp + c] = 0.0f;
+
+			for (int k = 0; k != kernel.numTaps_; k++)
+			{
+				const float w = kernel.weights_[k];
+				const float* in = tmp.data() + size_t(std::clamp(2 * x + kernel.first_ + k, 0, srcW - 1)) * comp;
+				for (int c = 0; c != comp; c++)
+					out[x * comp + c] += w * in[c];
+			}
+		}
+	}
+}
+
+template <typename T>
+static void generateMipChainT(const Bitmap& b, uint32_t numLevels, uint8_t* dst, const MipChainParams& params, tf::Executor& executor)
+{
+	const int comp = b.comp_;
+	const int layers = b.d_;
+	const MipFilterKernel kernel = makeMipFilterKernel(params.filter_);
+
+	// level 0 is copied as is
+	const size_t level0Size = size_t(b.w_) * b.h_ * layers * comp;
+	memcpy(dst, b.data_.data(), level0Size * sizeof(T));
+	T* out = reinterpret_cast<T*>(dst) + level0Size;
+
+	if (numLevels < 2)
+		return;
+
+	std::vector<float> cur(level0Size);
+	std::vector<float> next;
+
+	// decode level 0 to linear floats
+	{
+		const T* src = reinterpret_cast<const T*>(b.data_.data());
+		const size_t rowSize = size_t(b.w_) * comp;
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, b.h_ * layers, 1, [&](int row)
+		{
+			MipRowCodec<T>::decode(src + row * rowSize, cur.data() + row * rowSize, rowSize, comp, params.sRGB_);
+		});
+		executor.run(taskflow).wait();
+	}
+
+	int srcW = b.w_;
+	int srcH = b.h_;
+
+	for (uint32_t level = 1; level != numLevels; level++)
+	{
+		const int dstW = std::max(1, srcW >> 1);
+		const int dstH = std::max(1, srcH >> 1);
+		const size_t srcLayerSize = size_t(srcW) * srcH * comp;
+		const size_t dstLayerSize = size_t(dstW) * dstH * comp;
+		const int tasksPerLayer = (dstH + kMipRowsPerTask - 1) / kMipRowsPerTask;
+
+		next.resize(dstLayerSize * layers);
+
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, tasksPerLayer * layers, 1, [&](int task)
+		{
+			thread_local std::vector<float> tmp;
+
+			const int layer = task / tasksPerLayer;
+			const int y0 = (task % tasksPerLayer) * kMipRowsPerTask;
+			const int numRows = std::min(kMipRowsPerTask, dstH - y0);
+
+			float* dstLayer = next.data() + layer * dstLayerSize;
+			downsampleRows(cur.data() + layer * srcLayerSize, srcW, srcH, dstLayer, dstW, y0, numRows, comp, kernel, tmp);
+
+			const size_t offset = size_t(y0) * dstW * comp;
+			MipRowCodec<T>::encode(dstLayer + offset, out + layer * dstLayerSize + offset, size_t(numRows) * dstW * comp, comp, params.sRGB_);
+		});
+		executor.run(taskflow).wait();
+
+		out += dstLayerSize * layers;
+
+		std::swap(cur, next);
+		srcW = dstW;
+		srcH = dstH;
+	}
+}
+
+void generateMipChain(const Bitmap& b, uint32_t numLevels, void* dst, const MipChainParams& params, tf::Executor* executor)
+{
+	if (!numLevels || b.data_.empty())
+		return;
+
+	tf::Executor& e = executor ? *executor : getImageProcessingExecutor();
+	uint8_t* out = static_cast<uint8_t*>(dst);
+
+	switch (b.fmt_)
+	{
+	case eBitmapFormat_UnsignedByte:
+		generateMipChainT<uint8_t>(b, numLevels, out, params, e);
+		break;
+	case eBitmapFormat_Float:
+		generateMipChainT<float>(b, numLevels, out, params, e);
+		break;
+	case eBitmapFormat_Half:
+		generateMipChainT<Half>(b, numLevels, out, params, e);
+		break;
+	}
+}
+
+std::vector<uint8_t> generateMipChain(const Bitmap& b, uint32_t numLevels, const MipChainParams& params, tf::Executor* executor)
+{
+	std::vector<uint8_t> mips(getMipChainSize(b, numLevels));
+	generateMipChain(b, numLevels, mips.data(), params, executor);
+	return mips;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "shared/Bitmap.h"
+
+#include <taskflow/taskflow.hpp>
+
+enum eMipFilter
+{
+	// 2x2 average
+	eMipFilter_Box,
+	// Kaiser-windowed sinc (8 taps per dimension): sharper, but it rings around very bright HDR texels, prefer eMipFilter_Box for those
+	eMipFilter_Kaiser,
+};
+
+struct MipChainParams
+{
+	eMipFilter filter_ = eMipFilter_Kaiser;
+	// 8-bit color channels are sRGB-encoded and are filtered in linear space (the alpha channel of RGBA images is always linear).
+	// Turn it off for the textures holding data: normal, metallic-roughness, occlusion and opacity maps (see getSRGBTextures())
+	bool sRGB_ = true;
+};
+
+/// Number of levels down to 1x1
+uint32_t getMipChainLevelCount(int w, int h);
+
+/// Size of the level i is max(1, w >> i) x max(1, h >> i)
+size_t getMipChainSize(const Bitmap& b, uint32_t numLevels);
+
+/**
+	MIP chain of all the layers of 'b' (d_ layers, e.g. 6 cube map faces) in the format of 'b'.
+	The levels are tightly packed one after another, every level stores all the layers: the layout copyMIPBufferToImage() expects.
+	Every level is filtered from the floating-point (linear) version of the previous one, the work is split between the executor
+	threads by layers and rows (getImageProcessingExecutor() is used if no executor is given).
+	'dst' must have getMipChainSize(b, numLevels) bytes
+*/
+void generateMipChain(const Bitmap& b, uint32_t numLevels, void* dst, const MipChainParams& params = MipChainParams(), tf::Executor* executor = nullptr);
+
+std::vector<uint8_t> generateMipChain(const Bitmap& b, uint32_t numLevels, const MipChainParams& params = MipChainParams(), tf::Executor* executor = nullptr);
@@ -2,6 +2,9 @@
 #include "shared/UtilsVulkan.h"
 #include "shared/Bitmap.h"
 #include "shared/UtilsCubemap.h"
+#include "shared/UtilsMips.h"
+#include "shared/UtilsFile.h"
+#include "shared/VulkanUploadBatcher.h"
 #include "shared/EasyProfilerWrapper.h"
 
 #include "StandAlone/ResourceLimits.h"
@@ -30,6 +33,7 @@ using glm::vec2;
 
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
 
 void CHECK(bool check, const char* fileName, int lineNumber)
 {
@@ -225,12 +229,77 @@ static size_t compileShader(glslang_stage_t stage, const char* shaderSource, Sha
 	return shaderModule.SPIRV.size();
 }
 
+constexpr uint32_t kSPIRVCacheMagic = 0x56525053; // "SPRV"
+// bump to invalidate all the entries written by older versions (e.g. after changing the glslang target versions in compileShader())
+constexpr uint32_t kSPIRVCacheVersion = 1;
+
+struct SPIRVCacheHeader
+{
+	uint32_t magicValue_;
+	uint32_t version_;
+	uint64_t key_;
+	uint64_t dataSize_;
+};
+
+static_assert(sizeof(SPIRVCacheHeader) == 24);
+
+static std::string getSPIRVCacheEntryFileName(uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.spv", (unsigned long long)key);
+	return std::string(kSPIRVCacheDir) + name;
+}
+
+static bool loadSPIRVCacheEntry(const std::string& entryFile, uint64_t key, ShaderModule& shaderModule)
+{
+	const MappedFile file(entryFile.c_str());
+
+	if (!file.isValid() || file.getSize() < sizeof(SPIRVCacheHeader))
+		return false;
+
+	SPIRVCacheHeader header;
+	memcpy(&header, file.getData(), sizeof(header));
+
+	// truncated entries are rejected
+	if (header.magicValue_ != kSPIRVCacheMagic || header.version_ != kSPIRVCacheVersion || header.key_ != key ||
+		!header.dataSize_ || header.dataSize_ % sizeof(unsigned int) || file.getSize() != sizeof(header) + header.dataSize_)
+		return false;
+
+	shaderModule.SPIRV.resize(header.dataSize_ / sizeof(unsigned int));
+	memcpy(shaderModule.SPIRV.data(), file.getData() + sizeof(header), header.dataSize_);
+
+	return true;
+}
+
 size_t compileShaderFile(const char* file, ShaderModule& shaderModule)
 {
-	if (auto shaderSource = readShaderFile(file); !shaderSource.empty())
-		return compileShader(glslangShaderStageFromFileName(file), shaderSource.c_str(), shaderModule);
+	const std::string shaderSource = readShaderFile(file);
 
-	return 0;
+	if (shaderSource.empty())
+		return 0;
+
+	const glslang_stage_t stage = glslangShaderStageFromFileName(file);
+
+	// the expanded source covers all the included files: any changed dependency gives a new key
+	const uint64_t key = hashBytes(shaderSource.data(), shaderSource.size(), hashBytes(&stage, sizeof(stage), kSPIRVCacheVersion));
+	const std::string entryFile = getSPIRVCacheEntryFileName(key);
+
+	if (loadSPIRVCacheEntry(entryFile, key, shaderModule))
+		return shaderModule.SPIRV.size();
+
+	if (!compileShader(stage, shaderSource.c_str(), shaderModule))
+		return 0;
+
+	const SPIRVCacheHeader header = {
+		.magicValue_ = kSPIRVCacheMagic,
+		.version_ = kSPIRVCacheVersion,
+		.key_ = key,
+		.dataSize_ = shaderModule.SPIRV.size() * sizeof(unsigned int)
+	};
+
+	writeFileAtomically(entryFile, &header, sizeof(header), shaderModule.SPIRV.data(), header.dataSize_);
+
+	return shaderModule.SPIRV.size();
 }
 
 VkResult createShaderModule(VkDevice device, ShaderModule* shader, const char* fileName)
@@ -429,9 +498,10 @@ VkResult createDevice2(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures
 	return vkCreateDevice(physicalDevice, &ci, nullptr, device);
 }
 
-VkResult createDevice2WithCompute(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures2 deviceFeatures2, uint32_t graphicsFamily, uint32_t computeFamily, VkDevice* device)
+VkResult createDevice2WithCompute(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures2 deviceFeatures2, uint32_t graphicsFamily, uint32_t computeFamily, VkDevice* device,
+	uint32_t transferFamily = VK_QUEUE_FAMILY_IGNORED, bool useCalibratedTimestamps = false)
 {
-	const std::vector<const char*> extensions =
+	std::vector<const char*> extensions =
 	{
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 		VK_KHR_MAINTENANCE3_EXTENSION_NAME,
@@ -440,39 +510,52 @@ VkResult createDevice2WithCompute(VkPhysicalDevice physicalDevice, VkPhysicalDev
 		VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME
 	};
 
-	if (graphicsFamily == computeFamily)
+	if (graphicsFamily == computeFamily && transferFamily == VK_QUEUE_FAMILY_IGNORED && !useCalibratedTimestamps)
 		return createDevice2(physicalDevice, deviceFeatures2, graphicsFamily, device);
 
-	const float queuePriorities[2] = { 0.f, 0.f };
-	const VkDeviceQueueCreateInfo qciGfx =
+	if (useCalibratedTimestamps)
+		extensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
+	// uploads on the transfer queue are handed over to the graphics queue with a timeline semaphore
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures =
 	{
-		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-		.pNext = nullptr,
-		.flags = 0,
-		.queueFamilyIndex = graphicsFamily,
-		.queueCount = 1,
-		.pQueuePriorities = &queuePriorities[0]
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+		.pNext = deviceFeatures2.pNext,
+		.timelineSemaphore = VK_TRUE
 	};
 
-	const VkDeviceQueueCreateInfo qciComp =
+	if (transferFamily != VK_QUEUE_FAMILY_IGNORED)
 	{
-		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-		.pNext = nullptr,
-		.flags = 0,
-		.queueFamilyIndex = computeFamily,
-		.queueCount = 1,
-		.pQueuePriorities = &queuePriorities[1]
-	};
+		extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		deviceFeatures2.pNext = &timelineFeatures;
+	}
 
-	const VkDeviceQueueCreateInfo qci[2] = { qciGfx, qciComp };
+	const float queuePriority = 0.f;
+
+	std::vector<VkDeviceQueueCreateInfo> qci;
+
+	for (uint32_t family: { graphicsFamily, computeFamily, transferFamily })
+	{
+		if (family == VK_QUEUE_FAMILY_IGNORED || std::any_of(qci.begin(), qci.end(), [family](const VkDeviceQueueCreateInfo& q) { return q.queueFamilyIndex == family; }))
+			continue;
+
+		qci.push_back(VkDeviceQueueCreateInfo {
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.pNext = nullptr,
+			.flags = 0,
+			.queueFamilyIndex = family,
+			.queueCount = 1,
+			.pQueuePriorities = &queuePriority
+		});
+	}
 
 	const VkDeviceCreateInfo ci =
 	{
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
 		.pNext = &deviceFeatures2,
 		.flags = 0,
-		.queueCreateInfoCount = 2,
-		.pQueueCreateInfos = qci,
+		.queueCreateInfoCount = static_cast<uint32_t>(qci.size()),
+		.pQueueCreateInfos = qci.data(),
 		.enabledLayerCount = 0,
 		.ppEnabledLayerNames = nullptr,
 		.enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
@@ -625,6 +708,59 @@ VkResult vkGetBestComputeQueue(VkPhysicalDevice physicalDevice, uint32_t* queueF
 	return VK_ERROR_INITIALIZATION_FAILED;
 }
 */
+VkResult vkGetBestTransferQueue(VkPhysicalDevice physicalDevice, uint32_t* queueFamilyIndex)
+{
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+	for (uint32_t i = 0; i != familyCount; i++)
+	{
+		// mask out the sparse binding bit that we aren't caring about
+		const VkQueueFlags maskedFlags = (~VK_QUEUE_SPARSE_BINDING_BIT & families[i].queueFlags);
+
+		if (families[i].queueCount > 0 && maskedFlags & VK_QUEUE_TRANSFER_BIT && !(maskedFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			*queueFamilyIndex = i;
+			return VK_SUCCESS;
+		}
+	}
+
+	return VK_ERROR_FEATURE_NOT_PRESENT;
+}
+
+static bool isDeviceExtensionSupported(VkPhysicalDevice physicalDevice, const char* extensionName)
+{
+	uint32_t count = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, nullptr);
+
+	std::vector<VkExtensionProperties> extensions(count);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, extensions.data());
+
+	return std::any_of(extensions.begin(), extensions.end(), [extensionName](const VkExtensionProperties& e) { return strcmp(e.extensionName, extensionName) == 0; });
+}
+
+static bool isTimelineSemaphoreSupported(VkPhysicalDevice physicalDevice)
+{
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures =
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+		.pNext = nullptr
+	};
+
+	VkPhysicalDeviceFeatures2 features2 =
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &timelineFeatures
+	};
+
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+	return timelineFeatures.timelineSemaphore == VK_TRUE;
+}
+
 bool initVulkanRenderDeviceWithCompute(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint32_t width, uint32_t height, VkPhysicalDeviceFeatures deviceFeatures)
 {
 	vkDev.framebufferWidth = width;
@@ -755,7 +891,7 @@ bool initVulkanRenderDevice2(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint
 	return true;
 }
 
-bool initVulkanRenderDevice2WithCompute(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint32_t width, uint32_t height, std::function<bool(VkPhysicalDevice)> selector, VkPhysicalDeviceFeatures2 deviceFeatures2, bool supportScreenshots)
+bool initVulkanRenderDevice2WithCompute(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint32_t width, uint32_t height, std::function<bool(VkPhysicalDevice)> selector, VkPhysicalDeviceFeatures2 deviceFeatures2, bool supportScreenshots, bool useTransferQueue)
 {
 	vkDev.framebufferWidth = width;
 	vkDev.framebufferHeight = height;
@@ -765,7 +901,24 @@ bool initVulkanRenderDevice2WithCompute(VulkanInstance& vk, VulkanRenderDevice&
 //	VK_CHECK(createDevice2(vkDev.physicalDevice, deviceFeatures2, vkDev.graphicsFamily, &vkDev.device));
 //	VK_CHECK(vkGetBestComputeQueue(vkDev.physicalDevice, &vkDev.computeFamily));
 	vkDev.computeFamily = findQueueFamilies(vkDev.physicalDevice, VK_QUEUE_COMPUTE_BIT);
-	VK_CHECK(createDevice2WithCompute(vkDev.physicalDevice, deviceFeatures2, vkDev.graphicsFamily, vkDev.computeFamily, &vkDev.device));
+
+	vkDev.useTransferQueue = useTransferQueue &&
+		isTimelineSemaphoreSupported(vkDev.physicalDevice) &&
+		vkGetBestTransferQueue(vkDev.physicalDevice, &vkDev.transferFamily) == VK_SUCCESS;
+
+	if (!vkDev.useTransferQueue)
+		vkDev.transferFamily = vkDev.graphicsFamily;
+
+	vkDev.useCalibratedTimestamps = isDeviceExtensionSupported(vkDev.physicalDevice, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
+	// ETC2 is optional: requesting it from a device which does not support it would fail the device creation
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(vkDev.physicalDevice, &supportedFeatures);
+	deviceFeatures2.features.textureCompressionETC2 &= supportedFeatures.textureCompressionETC2;
+	vkDev.useTextureCompressionETC2 = deviceFeatures2.features.textureCompressionETC2 == VK_TRUE;
+
+	VK_CHECK(createDevice2WithCompute(vkDev.physicalDevice, deviceFeatures2, vkDev.graphicsFamily, vkDev.computeFamily, &vkDev.device,
+		vkDev.useTransferQueue ? vkDev.transferFamily : VK_QUEUE_FAMILY_IGNORED, vkDev.useCalibratedTimestamps));
 
 	vkGetDeviceQueue(vkDev.device, vkDev.graphicsFamily, 0, &vkDev.graphicsQueue);
 	if (vkDev.graphicsQueue == nullptr)
@@ -775,6 +928,10 @@ bool initVulkanRenderDevice2WithCompute(VulkanInstance& vk, VulkanRenderDevice&
 	if (vkDev.computeQueue == nullptr)
 		exit(EXIT_FAILURE);
 
+	vkGetDeviceQueue(vkDev.device, vkDev.transferFamily, 0, &vkDev.transferQueue);
+	if (vkDev.transferQueue == nullptr)
+		exit(EXIT_FAILURE);
+
 	VkBool32 presentSupported = 0;
 	vkGetPhysicalDeviceSurfaceSupportKHR(vkDev.physicalDevice, vkDev.graphicsFamily, vk.surface, &presentSupported);
 	if (!presentSupported)
@@ -841,6 +998,10 @@ bool initVulkanRenderDevice3(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint
 	VkPhysicalDeviceDescriptorIndexingFeaturesEXT physicalDeviceDescriptorIndexingFeatures = {
 		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
 		.shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+		/* for the bindless texture table of VulkanResources */
+		.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+		.descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+		.descriptorBindingPartiallyBound = VK_TRUE,
 		.descriptorBindingVariableDescriptorCount = VK_TRUE,
 		.runtimeDescriptorArray = VK_TRUE,
 	};
@@ -853,6 +1014,8 @@ bool initVulkanRenderDevice3(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint
 		/* for indirect instanced rendering */
 		.multiDrawIndirect = VK_TRUE,
 		.drawIndirectFirstInstance = VK_TRUE,
+		/* for the KTX files of Tool01_TextureCompressor, enabled only if the device supports it */
+		.textureCompressionETC2 = VK_TRUE,
 		/* for OIT and general atomic operations */
 		.vertexPipelineStoresAndAtomics = (VkBool32)(ctxFeatures.vertexPipelineStoresAndAtomics_ ? VK_TRUE : VK_FALSE),
 		.fragmentStoresAndAtomics = (VkBool32)(ctxFeatures.fragmentStoresAndAtomics_ ? VK_TRUE : VK_FALSE),
@@ -868,11 +1031,19 @@ bool initVulkanRenderDevice3(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint
 		.features = deviceFeatures  /*  */
 	};
 
-	return initVulkanRenderDevice2WithCompute(vk, vkDev, width, height, isDeviceSuitable, deviceFeatures2, ctxFeatures.supportScreenshots_);
+	if (!initVulkanRenderDevice2WithCompute(vk, vkDev, width, height, isDeviceSuitable, deviceFeatures2, ctxFeatures.supportScreenshots_, true))
+		return false;
+
+	vkDev.uploadBatcher = new VulkanUploadBatcher(vkDev);
+
+	return true;
 }
 
 void destroyVulkanRenderDevice(VulkanRenderDevice& vkDev)
 {
+	delete vkDev.uploadBatcher;
+	vkDev.uploadBatcher = nullptr;
+
 	for (size_t i = 0; i < vkDev.swapchainImages.size(); i++)
 		vkDestroyImageView(vkDev.device, vkDev.swapchainImageViews[i], nullptr);
 
@@ -901,7 +1072,7 @@ void destroyVulkanInstance(VulkanInstance& vk)
 	vkDestroyInstance(vk.instance, nullptr);
 }
 
-bool createTextureSampler(VkDevice device, VkSampler* sampler, VkFilter minFilter, VkFilter maxFilter, VkSamplerAddressMode addressMode)
+bool createTextureSampler(VkDevice device, VkSampler* sampler, VkFilter minFilter, VkFilter maxFilter, VkSamplerAddressMode addressMode, float maxLod)
 {
 	const VkSamplerCreateInfo samplerInfo = {
 		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
@@ -919,7 +1090,7 @@ bool createTextureSampler(VkDevice device, VkSampler* sampler, VkFilter minFilte
 		.compareEnable = VK_FALSE,
 		.compareOp = VK_COMPARE_OP_ALWAYS,
 		.minLod = 0.0f,
-		.maxLod = 0.0f,
+		.maxLod = maxLod,
 		.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
 		.unnormalizedCoordinates = VK_FALSE
 	};
@@ -1073,6 +1244,20 @@ VkFormat findSupportedFormat(VkPhysicalDevice device, const std::vector<VkFormat
 	exit(0);
 }
 
+bool isTextureFormatSupported(const VulkanRenderDevice& vkDev, VkFormat format)
+{
+	// drivers may list the ETC2 formats, they cannot be used without the feature
+	if (format >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK && format <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK && !vkDev.useTextureCompressionETC2)
+		return false;
+
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(vkDev.physicalDevice, format, &props);
+
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+	return (props.optimalTilingFeatures & required) == required;
+}
+
 uint32_t findMemoryType(VkPhysicalDevice device, uint32_t typeFilter, VkMemoryPropertyFlags properties)
 {
 	VkPhysicalDeviceMemoryProperties memProperties;
@@ -1677,6 +1862,11 @@ void endSingleTimeCommands(VulkanRenderDevice& vkDev, VkCommandBuffer commandBuf
 {
 	vkEndCommandBuffer(commandBuffer);
 
+	// the batched uploads go first, vkQueueWaitIdle() below waits for them too
+	// [the copies on a dedicated transfer queue are handed over by a graphics queue submit waiting for them]
+	if (vkDev.uploadBatcher)
+		vkDev.uploadBatcher->flush();
+
 	const VkSubmitInfo submitInfo = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
 		.pNext = nullptr,
@@ -1712,6 +1902,12 @@ void copyBuffer(VulkanRenderDevice& vkDev, VkBuffer srcBuffer, VkBuffer dstBuffe
 
 void transitionImageLayout(VulkanRenderDevice& vkDev, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount, uint32_t mipLevels)
 {
+	if (vkDev.uploadBatcher)
+	{
+		vkDev.uploadBatcher->transitionImageLayout(image, format, oldLayout, newLayout, layerCount, mipLevels);
+		return;
+	}
+
 	VkCommandBuffer commandBuffer = beginSingleTimeCommands(vkDev);
 
 	transitionImageLayoutCmd(commandBuffer, image, format, oldLayout, newLayout, layerCount, mipLevels);
@@ -1959,12 +2155,10 @@ void copyBufferToImage(VulkanRenderDevice& vkDev, VkBuffer buffer, VkImage image
 	endSingleTimeCommands(vkDev, commandBuffer);
 }
 
-void copyMIPBufferToImage(VulkanRenderDevice& vkDev, VkBuffer buffer, VkImage image, uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t bytesPP, uint32_t layerCount)
+static std::vector<VkBufferImageCopy> getMIPBufferCopyRegions(uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t bytesPP, uint32_t layerCount)
 {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands(vkDev);
-
 	uint32_t w = width, h = height;
-	uint32_t offset = 0;
+	VkDeviceSize offset = 0;
 	std::vector<VkBufferImageCopy> regions(mipLevels);
 
 	for (uint32_t i = 0 ; i < mipLevels ; i++)
@@ -1983,14 +2177,23 @@ void copyMIPBufferToImage(VulkanRenderDevice& vkDev, VkBuffer buffer, VkImage im
 			.imageExtent = VkExtent3D {.width = w, .height = h, .depth = 1 }
 		};
 
-		offset += w * h * layerCount * bytesPP;
+		offset += VkDeviceSize(w) * h * layerCount * bytesPP;
 
 		regions[i] = region;
 
-		w >>= 1;
-		h >>= 1;
+		w = std::max(1u, w >> 1);
+		h = std::max(1u, h >> 1);
 	}
 
+	return regions;
+}
+
+void copyMIPBufferToImage(VulkanRenderDevice& vkDev, VkBuffer buffer, VkImage image, uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t bytesPP, uint32_t layerCount)
+{
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(vkDev);
+
+	const std::vector<VkBufferImageCopy> regions = getMIPBufferCopyRegions(mipLevels, width, height, bytesPP, layerCount);
+
 	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
 
 	endSingleTimeCommands(vkDev, commandBuffer);
@@ -2105,17 +2308,34 @@ bool updateTextureVolume(VulkanRenderDevice& vkDev, VkImage& textureVolume, VkDe
 }
 
 bool updateTextureImage(VulkanRenderDevice& vkDev, VkImage& textureImage, VkDeviceMemory& textureImageMemory, uint32_t texWidth, uint32_t texHeight, VkFormat texFormat, uint32_t layerCount, const void* imageData, VkImageLayout sourceImageLayout)
+{
+	const size_t imageSize = size_t(texWidth) * texHeight * bytesPerTexFormat(texFormat) * layerCount;
+
+	return updateTextureImage(vkDev, textureImage, texWidth, texHeight, texFormat, layerCount,
+		[imageData, imageSize](void* stagingData) { memcpy(stagingData, imageData, imageSize); },
+		sourceImageLayout);
+}
+
+bool updateTextureImage(VulkanRenderDevice& vkDev, VkImage& textureImage, uint32_t texWidth, uint32_t texHeight, VkFormat texFormat, uint32_t layerCount, const std::function<void(void* stagingData)>& fillStagingData, VkImageLayout sourceImageLayout)
 {
 	uint32_t bytesPerPixel = bytesPerTexFormat(texFormat);
 
 	VkDeviceSize layerSize = texWidth * texHeight * bytesPerPixel;
 	VkDeviceSize imageSize = layerSize * layerCount;
 
+	// an image owned by the graphics queue is updated synchronously if the uploads go through the transfer queue
+	if (vkDev.uploadBatcher && vkDev.uploadBatcher->uploadImage(textureImage, texFormat, sourceImageLayout, layerCount, 1, imageSize, fillStagingData,
+		getMIPBufferCopyRegions(1, texWidth, texHeight, bytesPerPixel, layerCount)))
+		return true;
+
 	VkBuffer stagingBuffer;
 	VkDeviceMemory stagingBufferMemory;
 	createBuffer(vkDev.device, vkDev.physicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
-	uploadBufferData(vkDev, stagingBufferMemory, 0, imageData, imageSize);
+	void* mappedData = nullptr;
+	vkMapMemory(vkDev.device, stagingBufferMemory, 0, imageSize, 0, &mappedData);
+		fillStagingData(mappedData);
+	vkUnmapMemory(vkDev.device, stagingBufferMemory);
 
 	transitionImageLayout(vkDev, textureImage, texFormat, sourceImageLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layerCount);
 		copyBufferToImage(vkDev, stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), layerCount);
@@ -2181,6 +2401,11 @@ bool createPipelineLayout(VkDevice device, VkDescriptorSetLayout dsLayout, VkPip
 }
 
 bool createPipelineLayoutWithConstants(VkDevice device, VkDescriptorSetLayout dsLayout, VkPipelineLayout* pipelineLayout, uint32_t vtxConstSize, uint32_t fragConstSize)
+{
+	return createPipelineLayoutWithConstants(device, 1, &dsLayout, pipelineLayout, vtxConstSize, fragConstSize);
+}
+
+bool createPipelineLayoutWithConstants(VkDevice device, uint32_t numLayouts, const VkDescriptorSetLayout* dsLayouts, VkPipelineLayout* pipelineLayout, uint32_t vtxConstSize, uint32_t fragConstSize)
 {
 	const VkPushConstantRange ranges[] =
 	{
@@ -2203,8 +2428,8 @@ bool createPipelineLayoutWithConstants(VkDevice device, VkDescriptorSetLayout ds
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
 		.pNext = nullptr,
 		.flags = 0,
-		.setLayoutCount = 1,
-		.pSetLayouts = &dsLayout,
+		.setLayoutCount = numLayouts,
+		.pSetLayouts = dsLayouts,
 		.pushConstantRangeCount = constSize,
 		.pPushConstantRanges = (constSize == 0) ? nullptr :
 			(vtxConstSize > 0 ? ranges : &ranges[1])
@@ -2244,11 +2469,15 @@ bool createMIPTextureImageFromData(VulkanRenderDevice& vkDev,
 	uint32_t w = texWidth, h = texHeight;
 	for (uint32_t i = 1 ; i < mipLevels ; i++)
 	{
-		w >>= 1;
-		h >>= 1;
+		w = std::max(1u, w >> 1);
+		h = std::max(1u, h >> 1);
 		imageSize += w * h * bytesPerPixel * layerCount;
 	}
 
+	if (vkDev.uploadBatcher && vkDev.uploadBatcher->uploadImage(textureImage, texFormat, VK_IMAGE_LAYOUT_UNDEFINED, layerCount, mipLevels, mipData, imageSize,
+		getMIPBufferCopyRegions(mipLevels, texWidth, texHeight, bytesPerPixel, layerCount)))
+		return true;
+
 	VkBuffer stagingBuffer;
 	VkDeviceMemory stagingBufferMemory;
 	createBuffer(vkDev.device, vkDev.physicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
@@ -2265,6 +2494,58 @@ bool createMIPTextureImageFromData(VulkanRenderDevice& vkDev,
 	return true;
 }
 
+bool createMIPTextureImageFromLevels(VulkanRenderDevice& vkDev,
+		VkImage& textureImage, VkDeviceMemory& textureImageMemory,
+		const void* mipData, size_t mipDataSize, const std::vector<size_t>& levelOffsets, uint32_t texWidth, uint32_t texHeight,
+		VkFormat texFormat)
+{
+	const uint32_t mipLevels = (uint32_t)levelOffsets.size();
+
+	createImage(vkDev.device, vkDev.physicalDevice, texWidth, texHeight, texFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory, 0, mipLevels);
+
+	// the extents of the smallest levels are not rounded up to the block size, as Vulkan expects for the whole subresource
+	std::vector<VkBufferImageCopy> regions(mipLevels);
+
+	for (uint32_t i = 0 ; i < mipLevels ; i++)
+	{
+		regions[i] = VkBufferImageCopy {
+			.bufferOffset = levelOffsets[i],
+			.bufferRowLength = 0,
+			.bufferImageHeight = 0,
+			.imageSubresource = VkImageSubresourceLayers {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = i,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			},
+			.imageOffset = VkOffset3D {.x = 0, .y = 0, .z = 0 },
+			.imageExtent = VkExtent3D {.width = std::max(1u, texWidth >> i), .height = std::max(1u, texHeight >> i), .depth = 1 }
+		};
+	}
+
+	if (vkDev.uploadBatcher && vkDev.uploadBatcher->uploadImage(textureImage, texFormat, VK_IMAGE_LAYOUT_UNDEFINED, 1, mipLevels, mipData, mipDataSize, regions))
+		return true;
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(vkDev.device, vkDev.physicalDevice, mipDataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+	uploadBufferData(vkDev, stagingBufferMemory, 0, mipData, mipDataSize);
+
+	transitionImageLayout(vkDev, textureImage, texFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, mipLevels);
+
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(vkDev);
+	vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+	endSingleTimeCommands(vkDev, commandBuffer);
+
+	transitionImageLayout(vkDev, textureImage, texFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, mipLevels);
+
+	vkDestroyBuffer(vkDev.device, stagingBuffer, nullptr);
+	vkFreeMemory(vkDev.device, stagingBufferMemory, nullptr);
+
+	return true;
+}
+
 bool createTextureImageFromData(VulkanRenderDevice& vkDev,
 		VkImage& textureImage, VkDeviceMemory& textureImageMemory,
 		void* imageData, uint32_t texWidth, uint32_t texHeight,
@@ -2288,6 +2569,18 @@ static void float24to32(int w, int h, const float* img24, float *img32)
 	}
 }
 
+// RGB floats to RGBA halves, row by row through a small temporary buffer
+static void float24to16(int w, int h, const float* img24, uint16_t* img16)
+{
+	std::vector<float> row(w * 4);
+
+	for (int y = 0; y != h; y++)
+	{
+		float24to32(w, 1, img24 + size_t(y) * w * 3, row.data());
+		floatToHalf(row.data(), img16 + size_t(y) * w * 4, row.size());
+	}
+}
+
 bool createMIPTextureImage(VulkanRenderDevice& vkDev, const char* filename, uint32_t mipLevels, VkImage& textureImage, VkDeviceMemory& textureImageMemory, uint32_t* width, uint32_t* height)
 {
 	int texWidth, texHeight, texChannels;
@@ -2298,40 +2591,22 @@ bool createMIPTextureImage(VulkanRenderDevice& vkDev, const char* filename, uint
 		return false;
 	}
 
-	uint32_t imgSize = texWidth * texHeight * texChannels;
-	uint32_t mipSize = (imgSize * 3) >> 1;
-	std::vector<uint8_t> mipData(mipSize);
-
-	uint8_t* dst = mipData.data();
-	uint8_t* src = dst;
-	memcpy(dst, pixels, imgSize);
+	// the pixels are always RGBA (STBI_rgb_alpha), whatever the number of channels in the file is
+	std::vector<uint8_t> mipData = generateMipChain(Bitmap(texWidth, texHeight, 4, eBitmapFormat_UnsignedByte, pixels), mipLevels);
 
-	uint32_t w = texWidth, h = texHeight;
-	for (uint32_t i = 1 ; i < mipLevels ; i++)
-	{
-		dst += (w * h * texChannels) >> 2;
-
-		stbir_resize_uint8(src, w, h, 0,
-				dst, w / 2, h / 2, 0, texChannels);
-
-		w >>= 1;
-		h >>= 1;
-		src = dst;
-	}
+	stbi_image_free(pixels);
 
-	bool result = createMIPTextureImageFromData(vkDev, textureImage, textureImageMemory,
+	const bool result = createMIPTextureImageFromData(vkDev, textureImage, textureImageMemory,
 		mipData.data(), mipLevels, texWidth, texHeight,
 		VK_FORMAT_R8G8B8A8_UNORM);
 
-	stbi_image_free(pixels);
-
 	if (width && height)
 	{
 		*width = texWidth;
 		*height = texHeight;
 	}
 
-	return true;
+	return result;
 }
 
 bool createTextureImage(VulkanRenderDevice& vkDev, const char* filename, VkImage& textureImage, VkDeviceMemory& textureImageMemory, uint32_t* outTexWidth, uint32_t* outTexHeight)
@@ -2481,66 +2756,39 @@ bool createMIPCubeTextureImage(VulkanRenderDevice& vkDev, const char* filename,
 		return false;
 	}
 
-	uint32_t imageSize = texWidth * texHeight * 4;
-	uint32_t mipSize = imageSize * 6;
-
-	uint32_t w = texWidth, h = texHeight;
-	for (uint32_t i = 1 ; i < mipLevels ; i++)
-	{
-		imageSize = w * h * 4;
-		w >>= 1;
-		h >>= 1;
-		mipSize += imageSize;
-	}
+	Bitmap in(texWidth, texHeight, 4, eBitmapFormat_Half);
+	float24to16(texWidth, texHeight, img, reinterpret_cast<uint16_t*>(in.data_.data()));
+	stbi_image_free((void*)img);
 
-	std::vector<float> mipData(mipSize);
-	float* src = mipData.data();
-	float* dst = mipData.data();
+	// MIP chain of the equirectangular image (the box filter does not ring around very bright HDR texels)
+	const std::vector<uint8_t> mipData = generateMipChain(in, mipLevels, MipChainParams { .filter_ = eMipFilter_Box });
+	const uint8_t* src = mipData.data();
 
-	w = texWidth;
-	h = texHeight;
-	float24to32(w, h, img, dst);
+	const uint32_t faceSize = texWidth / 4;
 
-	for (uint32_t i = 1 ; i < mipLevels ; i++)
+	size_t mipCubeSize = 0;
+	for (uint32_t i = 0 ; i < mipLevels ; i++)
 	{
-		imageSize = w * h * 4;
-		dst += w * h * 4;
-		stbir_resize_float_generic(
-			src, w, h, 0, dst, w / 2, h / 2, 0, 4,
-			STBIR_ALPHA_CHANNEL_NONE, 0, STBIR_EDGE_CLAMP, STBIR_FILTER_CUBICBSPLINE, STBIR_COLORSPACE_LINEAR, nullptr);
-
-		w >>= 1;
-		h >>= 1;
-		src = dst;
+		const uint32_t s = std::max(1u, faceSize >> i);
+		mipCubeSize += s * s * 4 * 6;
 	}
 
-	src = mipData.data();
-	dst = mipData.data();
-
-	std::vector<float> mipCube(mipSize * 6);
-	float* mip = mipCube.data();
+	std::vector<uint16_t> mipCube(mipCubeSize);
+	uint16_t* mip = mipCube.data();
 
-	w = texWidth;
-	h = texHeight;
-	uint32_t faceSize = w / 4;
 	for (uint32_t i = 0 ; i < mipLevels ; i++)
 	{
-		Bitmap in(w, h, 4, eBitmapFormat_Float, src);
-		Bitmap out = convertEquirectangularMapToVerticalCross(in);
-		Bitmap cube = convertVerticalCrossToCubeMapFaces(out);
+		const int w = std::max(1, texWidth >> i);
+		const int h = std::max(1, texHeight >> i);
+		const uint32_t s = std::max(1u, faceSize >> i);
 
-		imageSize = faceSize * faceSize * 4;
+		// the faces of this level are written straight into the MIP chain
+		convertEquirectangularMapToCubeMapFaces(Bitmap(w, h, 4, eBitmapFormat_Half, src), mip);
 
-		memcpy(mip, cube.data_.data(), 6 * imageSize * sizeof(float));
-		mip += imageSize * 6;
-
-		src += w * h * 4;
-		w >>= 1;
-		h >>= 1;
+		mip += s * s * 4 * 6;
+		src += size_t(w) * h * 4 * sizeof(uint16_t);
 	}
 
-	stbi_image_free((void*)img);
-
 	if (width && height)
 	{
 		*width = texWidth;
@@ -2550,7 +2798,7 @@ bool createMIPCubeTextureImage(VulkanRenderDevice& vkDev, const char* filename,
 	return createMIPTextureImageFromData(vkDev,
 		textureImage, textureImageMemory,
 		mipCube.data(), mipLevels, faceSize, faceSize,
-		VK_FORMAT_R32G32B32A32_SFLOAT,
+		VK_FORMAT_R16G16B16A16_SFLOAT,
 		6, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
 }
 
@@ -2558,21 +2806,16 @@ bool createCubeTextureImage(VulkanRenderDevice& vkDev, const char* filename, VkI
 {
 	int w, h, comp;
 	const float* img = stbi_loadf(filename, &w, &h, &comp, 3);
-	std::vector<float> img32(w * h * 4);
-
-	float24to32(w, h, img, img32.data());
 
 	if (!img) {
 		printf("Failed to load [%s] texture\n", filename); fflush(stdout);
 		return false;
 	}
 
-	stbi_image_free((void*)img);
+	Bitmap in(w, h, 4, eBitmapFormat_Half);
+	float24to16(w, h, img, reinterpret_cast<uint16_t*>(in.data_.data()));
 
-	Bitmap in(w, h, 4, eBitmapFormat_Float, img32.data());
-	Bitmap out = convertEquirectangularMapToVerticalCross(in);
-
-	Bitmap cube = convertVerticalCrossToCubeMapFaces(out);
+	stbi_image_free((void*)img);
 
 	if (width && height)
 	{
@@ -2580,10 +2823,13 @@ bool createCubeTextureImage(VulkanRenderDevice& vkDev, const char* filename, VkI
 		*height = h;
 	}
 
-	return createTextureImageFromData(vkDev, textureImage, textureImageMemory,
-		cube.data_.data(), cube.w_, cube.h_,
-		VK_FORMAT_R32G32B32A32_SFLOAT,
-		6, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+	const uint32_t faceSize = w / 4;
+
+	createImage(vkDev.device, vkDev.physicalDevice, faceSize, faceSize, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+
+	// the faces are converted directly into the staging buffer, no vertical cross and no intermediate cube bitmap
+	return updateTextureImage(vkDev, textureImage, faceSize, faceSize, VK_FORMAT_R16G16B16A16_SFLOAT, 6,
+		[&in](void* stagingData) { convertEquirectangularMapToCubeMapFaces(in, stagingData); });
 }
 
 bool executeComputeShader(VulkanRenderDevice& vkDev,
@@ -2621,6 +2867,10 @@ bool executeComputeShader(VulkanRenderDevice& vkDev,
 		0, 0, 0, 0, 1, &commandBuffer, 0, 0
 	};
 
+	// the compute queue is not ordered with the queues executing the batched uploads
+	if (vkDev.uploadBatcher)
+		vkDev.uploadBatcher->wait();
+
 	VK_CHECK(vkQueueSubmit(vkDev.computeQueue, 1, &submitInfo, 0));
 	VK_CHECK(vkQueueWaitIdle(vkDev.computeQueue));
 
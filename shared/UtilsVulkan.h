@@ -21,6 +21,8 @@ struct VulkanInstance final
 	VkDebugReportCallbackEXT reportCallback;
 };
 
+class VulkanUploadBatcher;
+
 struct VulkanRenderDevice final
 {
 	uint32_t framebufferWidth;
@@ -57,6 +59,21 @@ struct VulkanRenderDevice final
 
 	VkCommandBuffer computeCommandBuffer;
 	VkCommandPool computeCommandPool;
+
+	// Dedicated transfer queue for uploads, handed over to the graphics queue with a timeline semaphore
+	// [transferFamily and transferQueue coincide with the graphics ones if there is none]
+	bool useTransferQueue = false;
+	uint32_t transferFamily;
+	VkQueue transferQueue;
+
+	// Texture uploads and layout transitions are recorded here when present (created by initVulkanRenderDevice3())
+	VulkanUploadBatcher* uploadBatcher = nullptr;
+
+	// VK_EXT_calibrated_timestamps is enabled (GPU timestamps are converted to the CPU clock without a stall, see VulkanGPUProfiler)
+	bool useCalibratedTimestamps = false;
+
+	// The textureCompressionETC2 feature is enabled (it is requested by initVulkanRenderDevice3() and missing on most desktop GPUs)
+	bool useTextureCompressionETC2 = false;
 };
 
 // Features we need for our Vulkan context
@@ -134,6 +151,9 @@ bool setupDebugCallbacks(VkInstance instance, VkDebugUtilsMessengerEXT* messenge
 
 VkResult createShaderModule(VkDevice device, ShaderModule* shader, const char* fileName);
 
+/// SPIR-V compiled from the same expanded source is loaded from this directory instead of compiling it again
+constexpr const char* kSPIRVCacheDir = "data/.cache/spirv/";
+
 size_t compileShaderFile(const char* file, ShaderModule& shaderModule);
 
 inline VkPipelineShaderStageCreateInfo shaderStageInfo(VkShaderStageFlagBits shaderStage, ShaderModule& module, const char* entryPoint)
@@ -187,7 +207,7 @@ size_t createSwapchainImages(VkDevice device, VkSwapchainKHR swapchain, std::vec
 
 VkResult createSemaphore(VkDevice device, VkSemaphore* outSemaphore);
 
-bool createTextureSampler(VkDevice device, VkSampler* sampler, VkFilter minFilter = VK_FILTER_LINEAR, VkFilter maxFilter = VK_FILTER_LINEAR, VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT);
+bool createTextureSampler(VkDevice device, VkSampler* sampler, VkFilter minFilter = VK_FILTER_LINEAR, VkFilter maxFilter = VK_FILTER_LINEAR, VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT, float maxLod = 0.0f);
 
 bool createDescriptorPool(VulkanRenderDevice& vkDev, uint32_t uniformBufferCount, uint32_t storageBufferCount, uint32_t samplerCount, VkDescriptorPool* descriptorPool);
 
@@ -205,8 +225,14 @@ VkResult findSuitablePhysicalDevice(VkInstance instance, std::function<bool(VkPh
 
 uint32_t findQueueFamilies(VkPhysicalDevice device, VkQueueFlags desiredFlags);
 
+/* A queue family supporting transfers but neither graphics nor compute (usually backed by the DMA engines) */
+VkResult vkGetBestTransferQueue(VkPhysicalDevice physicalDevice, uint32_t* queueFamilyIndex);
+
 VkFormat findSupportedFormat(VkPhysicalDevice device, const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 
+/* An optimally tiled image of this format can be sampled with linear filtering (the ETC2 and EAC formats also need the feature enabled) */
+bool isTextureFormatSupported(const VulkanRenderDevice& vkDev, VkFormat format);
+
 uint32_t findMemoryType(VkPhysicalDevice device, uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
 VkFormat findDepthFormat(VkPhysicalDevice device);
@@ -303,7 +329,7 @@ void destroyVulkanInstance(VulkanInstance& vk);
 
 bool initVulkanRenderDeviceWithCompute(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint32_t width, uint32_t height, VkPhysicalDeviceFeatures deviceFeatures);
 
-bool initVulkanRenderDevice2WithCompute(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint32_t width, uint32_t height, std::function<bool(VkPhysicalDevice)> selector, VkPhysicalDeviceFeatures2 deviceFeatures2, bool supportScreenshots = false);
+bool initVulkanRenderDevice2WithCompute(VulkanInstance& vk, VulkanRenderDevice& vkDev, uint32_t width, uint32_t height, std::function<bool(VkPhysicalDevice)> selector, VkPhysicalDeviceFeatures2 deviceFeatures2, bool supportScreenshots = false, bool useTransferQueue = false);
 
 bool createColorAndDepthFramebuffers(VulkanRenderDevice& vkDev, VkRenderPass renderPass, VkImageView depthImageView, std::vector<VkFramebuffer>& swapchainFramebuffers);
 bool createColorAndDepthFramebuffer(VulkanRenderDevice& vkDev,
@@ -328,6 +354,9 @@ uint32_t bytesPerTexFormat(VkFormat fmt);
 /* VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL for real update of an existing texture */
 bool updateTextureImage(VulkanRenderDevice& vkDev, VkImage& textureImage, VkDeviceMemory& textureImageMemory, uint32_t texWidth, uint32_t texHeight, VkFormat texFormat, uint32_t layerCount, const void* imageData, VkImageLayout sourceImageLayout = VK_IMAGE_LAYOUT_UNDEFINED);
 
+/* Same as updateTextureImage(), but the texels are written by 'fillStagingData' directly into the mapped staging buffer (avoids an intermediate copy) */
+bool updateTextureImage(VulkanRenderDevice& vkDev, VkImage& textureImage, uint32_t texWidth, uint32_t texHeight, VkFormat texFormat, uint32_t layerCount, const std::function<void(void* stagingData)>& fillStagingData, VkImageLayout sourceImageLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+
 bool updateTextureVolume(VulkanRenderDevice& vkDev, VkImage& textureVolume, VkDeviceMemory& textureVolumeMemory, uint32_t texWidth, uint32_t texHeight, uint32_t texDepth, VkFormat texFormat, const void* volumeData, VkImageLayout sourceImageLayout = VK_IMAGE_LAYOUT_UNDEFINED);
 
 bool downloadImageData(VulkanRenderDevice& vkDev, VkImage& textureImage, uint32_t texWidth, uint32_t texHeight, VkFormat texFormat, uint32_t layerCount, void* imageData, VkImageLayout sourceImageLayout);
@@ -338,6 +367,9 @@ bool createPipelineLayout(VkDevice device, VkDescriptorSetLayout dsLayout, VkPip
 
 bool createPipelineLayoutWithConstants(VkDevice device, VkDescriptorSetLayout dsLayout, VkPipelineLayout* pipelineLayout, uint32_t vtxConstSize, uint32_t fragConstSize);
 
+/* Same as above with the descriptor sets 0..numLayouts-1 */
+bool createPipelineLayoutWithConstants(VkDevice device, uint32_t numLayouts, const VkDescriptorSetLayout* dsLayouts, VkPipelineLayout* pipelineLayout, uint32_t vtxConstSize, uint32_t fragConstSize);
+
 bool createTextureImageFromData(VulkanRenderDevice& vkDev,
 		VkImage& textureImage, VkDeviceMemory& textureImageMemory,
 		void* imageData, uint32_t texWidth, uint32_t texHeight,
@@ -350,6 +382,12 @@ bool createMIPTextureImageFromData(VulkanRenderDevice& vkDev,
 		VkFormat texFormat,
 		uint32_t layerCount = 1, VkImageCreateFlags flags = 0);
 
+/* MIP levels of any format (e.g. block-compressed ones loaded from KTX files): the level i starts at levelOffsets[i] bytes in 'mipData' */
+bool createMIPTextureImageFromLevels(VulkanRenderDevice& vkDev,
+		VkImage& textureImage, VkDeviceMemory& textureImageMemory,
+		const void* mipData, size_t mipDataSize, const std::vector<size_t>& levelOffsets, uint32_t texWidth, uint32_t texHeight,
+		VkFormat texFormat);
+
 bool createTextureVolumeFromData(VulkanRenderDevice& vkDev,
 		VkImage& textureVolume, VkDeviceMemory& textureVolumeMemory,
 		void* volumeData, uint32_t texWidth, uint32_t texHeight, uint32_t texDepth,
@@ -360,6 +398,7 @@ bool createTextureImage(VulkanRenderDevice& vkDev, const char* filename, VkImage
 
 bool createMIPTextureImage(VulkanRenderDevice& vkDev, const char* filename, uint32_t mipLevels, VkImage& textureImage, VkDeviceMemory& textureImageMemory, uint32_t* width = nullptr, uint32_t* height = nullptr);
 
+/* Equirectangular HDR images are converted to VK_FORMAT_R16G16B16A16_SFLOAT cube maps */
 bool createCubeTextureImage(VulkanRenderDevice& vkDev, const char* filename, VkImage& textureImage, VkDeviceMemory& textureImageMemory, uint32_t* width = nullptr, uint32_t* height = nullptr);
 
 bool createMIPCubeTextureImage(VulkanRenderDevice& vkDev, const char* filename, uint32_t mipLevels, VkImage& textureImage, VkDeviceMemory& textureImageMemory, uint32_t* width = nullptr, uint32_t* height = nullptr);
@@ -0,0 +1,432 @@
+#include "shared/VulkanUploadBatcher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <numeric>
+
+/// Release (on the transfer queue) or acquire (on the graphics queue) barrier of an uploaded image.
+/// Both sides have the same layouts and queue families, the uploaded textures are color images
+static void ownershipTransferBarrierCmd(VkCommandBuffer commandBuffer, VkImage image, uint32_t layerCount, uint32_t mipLevels,
+	uint32_t transferFamily, uint32_t graphicsFamily, bool isRelease)
+{
+	const VkImageMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = isRelease ? VK_ACCESS_TRANSFER_WRITE_BIT : VkAccessFlags(0),
+		.dstAccessMask = isRelease ? VkAccessFlags(0) : VK_ACCESS_SHADER_READ_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		.srcQueueFamilyIndex = transferFamily,
+		.dstQueueFamilyIndex = graphicsFamily,
+		.image = image,
+		.subresourceRange = VkImageSubresourceRange {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = 0,
+			.levelCount = mipLevels,
+			.baseArrayLayer = 0,
+			.layerCount = layerCount
+		}
+	};
+
+	vkCmdPipelineBarrier(commandBuffer,
+		isRelease ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		isRelease ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+VulkanUploadBatcher::VulkanUploadBatcher(VulkanRenderDevice& vkDev, VkDeviceSize stagingSize)
+: vkDev_(vkDev)
+, stagingSize_(stagingSize)
+{
+	const VkCommandPoolCreateInfo cpi = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		.queueFamilyIndex = vkDev.transferFamily
+	};
+
+	// a separate pool: the frame command pool is reset on every frame
+	VK_CHECK(vkCreateCommandPool(vkDev.device, &cpi, nullptr, &commandPool_));
+
+	if (vkDev.useTransferQueue)
+	{
+		const VkCommandPoolCreateInfo hpi = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+			.pNext = nullptr,
+			.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+			.queueFamilyIndex = vkDev.graphicsFamily
+		};
+
+		VK_CHECK(vkCreateCommandPool(vkDev.device, &hpi, nullptr, &handoffCommandPool_));
+
+		const VkSemaphoreTypeCreateInfoKHR sti = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+			.pNext = nullptr,
+			.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+			.initialValue = 0
+		};
+
+		const VkSemaphoreCreateInfo sci = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+			.pNext = &sti,
+			.flags = 0
+		};
+
+		VK_CHECK(vkCreateSemaphore(vkDev.device, &sci, nullptr, &timelineSemaphore_));
+	}
+
+	if (!createBuffer(vkDev.device, vkDev.physicalDevice, stagingSize_, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer_, stagingMemory_))
+	{
+		printf("VulkanUploadBatcher: cannot allocate the staging buffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	void* mappedData = nullptr;
+	VK_CHECK(vkMapMemory(vkDev.device, stagingMemory_, 0, stagingSize_, 0, &mappedData));
+	stagingData_ = static_cast<uint8_t*>(mappedData);
+}
+
+VulkanUploadBatcher::~VulkanUploadBatcher()
+{
+	wait();
+
+	for (const auto& b: free_)
+		vkDestroyFence(vkDev_.device, b.fence, nullptr);
+
+	for (const auto& b: freeHandoff_)
+		vkDestroyFence(vkDev_.device, b.fence, nullptr);
+
+	vkDestroyCommandPool(vkDev_.device, commandPool_, nullptr);
+
+	if (handoffCommandPool_ != VK_NULL_HANDLE)
+		vkDestroyCommandPool(vkDev_.device, handoffCommandPool_, nullptr);
+
+	if (timelineSemaphore_ != VK_NULL_HANDLE)
+		vkDestroySemaphore(vkDev_.device, timelineSemaphore_, nullptr);
+
+	vkUnmapMemory(vkDev_.device, stagingMemory_);
+	vkDestroyBuffer(vkDev_.device, stagingBuffer_, nullptr);
+	vkFreeMemory(vkDev_.device, stagingMemory_, nullptr);
+}
+
+VulkanUploadBatcher::Batch VulkanUploadBatcher::acquireBatch(bool isHandoff)
+{
+	std::vector<Batch>& freeBatches = isHandoff ? freeHandoff_ : free_;
+
+	Batch b { .isHandoff = isHandoff };
+
+	if (!freeBatches.empty())
+	{
+		b.commandBuffer = freeBatches.back().commandBuffer;
+		b.fence = freeBatches.back().fence;
+		freeBatches.pop_back();
+	}
+	else
+	{
+		const VkCommandBufferAllocateInfo ai = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.pNext = nullptr,
+			.commandPool = isHandoff ? handoffCommandPool_ : commandPool_,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1
+		};
+		VK_CHECK(vkAllocateCommandBuffers(vkDev_.device, &ai, &b.commandBuffer));
+
+		const VkFenceCreateInfo fci = {
+			.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+			.pNext = nullptr,
+			.flags = 0
+		};
+		VK_CHECK(vkCreateFence(vkDev_.device, &fci, nullptr, &b.fence));
+	}
+
+	const VkCommandBufferBeginInfo bi = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = nullptr
+	};
+
+	VK_CHECK(vkBeginCommandBuffer(b.commandBuffer, &bi));
+
+	return b;
+}
+
+VkCommandBuffer VulkanUploadBatcher::getCommandBuffer()
+{
+	if (current_.commandBuffer == VK_NULL_HANDLE)
+		current_ = acquireBatch(false);
+
+	return current_.commandBuffer;
+}
+
+uint8_t* VulkanUploadBatcher::allocateStaging(VkDeviceSize size, VkDeviceSize alignment, VkBuffer* buffer, VkDeviceSize* offset)
+{
+	// does not fit into the arena at all
+	if (size > stagingSize_)
+	{
+		VkBuffer dedicatedBuffer;
+		VkDeviceMemory dedicatedMemory;
+		if (!createBuffer(vkDev_.device, vkDev_.physicalDevice, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, dedicatedBuffer, dedicatedMemory))
+		{
+			printf("VulkanUploadBatcher: cannot allocate a staging buffer of %llu bytes\n", (unsigned long long)size);
+			exit(EXIT_FAILURE);
+		}
+
+		void* mappedData = nullptr;
+		VK_CHECK(vkMapMemory(vkDev_.device, dedicatedMemory, 0, size, 0, &mappedData));
+
+		getCommandBuffer();
+		current_.dedicatedStaging.push_back({ dedicatedBuffer, dedicatedMemory });
+
+		*buffer = dedicatedBuffer;
+		*offset = 0;
+
+		return static_cast<uint8_t*>(mappedData);
+	}
+
+	for (;;)
+	{
+		const VkDeviceSize alignedHead = (stagingHead_ + alignment - 1) / alignment * alignment;
+		const bool wraps = alignedHead + size > stagingSize_;
+		const VkDeviceSize start = wraps ? 0 : alignedHead;
+		// the tail of the arena is skipped when the allocation wraps around
+		const VkDeviceSize needed = (wraps ? stagingSize_ - stagingHead_ : alignedHead - stagingHead_) + size;
+
+		if (stagingUsed_ + needed <= stagingSize_)
+		{
+			stagingHead_ = start + size;
+			stagingUsed_ += needed;
+
+			getCommandBuffer();
+			current_.stagingBytes += needed;
+
+			*buffer = stagingBuffer_;
+			*offset = start;
+
+			return stagingData_ + start;
+		}
+
+		// the arena is full: submit the recorded copies and wait for the oldest batch to free its memory
+		// [the graphics queue barriers stay pending, they are recorded into the next frame]
+		if (submitted_.empty())
+			submitTransfers();
+
+		retireBatches(true);
+	}
+}
+
+void VulkanUploadBatcher::retireBatches(bool waitOldest)
+{
+	if (waitOldest && !submitted_.empty())
+		VK_CHECK(vkWaitForFences(vkDev_.device, 1, &submitted_.front().fence, VK_TRUE, UINT64_MAX));
+
+	while (!submitted_.empty() && vkGetFenceStatus(vkDev_.device, submitted_.front().fence) == VK_SUCCESS)
+	{
+		Batch& b = submitted_.front();
+
+		for (const auto& s: b.dedicatedStaging)
+		{
+			vkDestroyBuffer(vkDev_.device, s.first, nullptr);
+			vkFreeMemory(vkDev_.device, s.second, nullptr);
+		}
+
+		// the batches are retired in the order of their allocations, the ring tail moves forward
+		stagingUsed_ -= b.stagingBytes;
+		if (!stagingUsed_)
+			stagingHead_ = 0;
+
+		VK_CHECK(vkResetFences(vkDev_.device, 1, &b.fence));
+		(b.isHandoff ? freeHandoff_ : free_).push_back(Batch { .commandBuffer = b.commandBuffer, .fence = b.fence, .isHandoff = b.isHandoff });
+
+		submitted_.pop_front();
+	}
+}
+
+bool VulkanUploadBatcher::uploadImage(VkImage image, VkFormat format, VkImageLayout oldLayout, uint32_t layerCount, uint32_t mipLevels,
+	VkDeviceSize dataSize, const std::function<void(void* stagingData)>& fillStagingData, const std::vector<VkBufferImageCopy>& regions)
+{
+	// the contents of an image owned by the graphics queue cannot be handed over without a release on the graphics queue first
+	if (vkDev_.useTransferQueue && oldLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+		return false;
+
+	// buffer offsets should be multiples of the texel size and of 4
+	const VkDeviceSize texelSize = bytesPerTexFormat(format);
+	const VkDeviceSize alignment = texelSize ? std::lcm(VkDeviceSize(16), texelSize) : 16;
+
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	uint8_t* stagingData = allocateStaging(dataSize, alignment, &buffer, &offset);
+
+	fillStagingData(stagingData);
+
+	std::vector<VkBufferImageCopy> stagingRegions(regions);
+	for (auto& r: stagingRegions)
+		r.bufferOffset += offset;
+
+	VkCommandBuffer commandBuffer = getCommandBuffer();
+
+	transitionImageLayoutCmd(commandBuffer, image, format, oldLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layerCount, mipLevels);
+	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)stagingRegions.size(), stagingRegions.data());
+
+	if (vkDev_.useTransferQueue)
+	{
+		ownershipTransferBarrierCmd(commandBuffer, image, layerCount, mipLevels, vkDev_.transferFamily, vkDev_.graphicsFamily, true);
+		pendingBarriers_.push_back(GraphicsBarrier { image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount, mipLevels, true });
+	}
+	else
+	{
+		transitionImageLayoutCmd(commandBuffer, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount, mipLevels);
+	}
+
+	uploadedBytes_ += dataSize;
+
+	return true;
+}
+
+bool VulkanUploadBatcher::uploadImage(VkImage image, VkFormat format, VkImageLayout oldLayout, uint32_t layerCount, uint32_t mipLevels,
+	const void* data, VkDeviceSize dataSize, const std::vector<VkBufferImageCopy>& regions)
+{
+	return uploadImage(image, format, oldLayout, layerCount, mipLevels, dataSize,
+		[data, dataSize](void* stagingData) { memcpy(stagingData, data, dataSize); },
+		regions);
+}
+
+void VulkanUploadBatcher::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount, uint32_t mipLevels)
+{
+	if (vkDev_.useTransferQueue)
+		pendingBarriers_.push_back(GraphicsBarrier { image, format, oldLayout, newLayout, layerCount, mipLevels, false });
+	else
+		transitionImageLayoutCmd(getCommandBuffer(), image, format, oldLayout, newLayout, layerCount, mipLevels);
+}
+
+void VulkanUploadBatcher::submitTransfers()
+{
+	if (current_.commandBuffer != VK_NULL_HANDLE)
+	{
+		VK_CHECK(vkEndCommandBuffer(current_.commandBuffer));
+
+		const uint64_t signalValue = ++timelineValue_;
+
+		const VkTimelineSemaphoreSubmitInfoKHR tsi = {
+			.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+			.pNext = nullptr,
+			.waitSemaphoreValueCount = 0,
+			.pWaitSemaphoreValues = nullptr,
+			.signalSemaphoreValueCount = 1,
+			.pSignalSemaphoreValues = &signalValue
+		};
+
+		const VkSubmitInfo si = {
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.pNext = vkDev_.useTransferQueue ? &tsi : nullptr,
+			.waitSemaphoreCount = 0,
+			.pWaitSemaphores = nullptr,
+			.pWaitDstStageMask = nullptr,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &current_.commandBuffer,
+			.signalSemaphoreCount = vkDev_.useTransferQueue ? 1u : 0u,
+			.pSignalSemaphores = vkDev_.useTransferQueue ? &timelineSemaphore_ : nullptr
+		};
+
+		VK_CHECK(vkQueueSubmit(vkDev_.transferQueue, 1, &si, current_.fence));
+
+		submitted_.push_back(std::move(current_));
+		current_ = Batch();
+
+		numSubmits_++;
+	}
+
+	// the acquires recorded so far are covered by the last signaled value
+	if (std::any_of(pendingBarriers_.begin(), pendingBarriers_.end(), [](const GraphicsBarrier& b) { return b.isAcquire; }))
+		pendingWaitValue_ = timelineValue_;
+}
+
+uint64_t VulkanUploadBatcher::recordGraphicsBarriers(VkCommandBuffer commandBuffer)
+{
+	for (const auto& b: pendingBarriers_)
+	{
+		if (b.isAcquire)
+			ownershipTransferBarrierCmd(commandBuffer, b.image, b.layerCount, b.mipLevels, vkDev_.transferFamily, vkDev_.graphicsFamily, false);
+		else
+			transitionImageLayoutCmd(commandBuffer, b.image, b.format, b.oldLayout, b.newLayout, b.layerCount, b.mipLevels);
+	}
+
+	pendingBarriers_.clear();
+
+	const uint64_t waitValue = pendingWaitValue_;
+	pendingWaitValue_ = 0;
+
+	return waitValue;
+}
+
+uint64_t VulkanUploadBatcher::flushToCommandBuffer(VkCommandBuffer commandBuffer)
+{
+	submitTransfers();
+	retireBatches(false);
+
+	return recordGraphicsBarriers(commandBuffer);
+}
+
+uint64_t VulkanUploadBatcher::flush()
+{
+	submitTransfers();
+
+	uint64_t waitValue = 0;
+
+	if (!pendingBarriers_.empty())
+	{
+		// nothing is submitted to the graphics queue right now: the barriers get a command buffer of their own
+		Batch handoff = acquireBatch(true);
+
+		waitValue = recordGraphicsBarriers(handoff.commandBuffer);
+
+		VK_CHECK(vkEndCommandBuffer(handoff.commandBuffer));
+
+		const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+		const VkTimelineSemaphoreSubmitInfoKHR tsi = {
+			.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+			.pNext = nullptr,
+			.waitSemaphoreValueCount = 1,
+			.pWaitSemaphoreValues = &waitValue,
+			.signalSemaphoreValueCount = 0,
+			.pSignalSemaphoreValues = nullptr
+		};
+
+		const VkSubmitInfo si = {
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.pNext = waitValue ? &tsi : nullptr,
+			.waitSemaphoreCount = waitValue ? 1u : 0u,
+			.pWaitSemaphores = waitValue ? &timelineSemaphore_ : nullptr,
+			.pWaitDstStageMask = waitValue ? &waitStage : nullptr,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &handoff.commandBuffer,
+			.signalSemaphoreCount = 0,
+			.pSignalSemaphores = nullptr
+		};
+
+		VK_CHECK(vkQueueSubmit(vkDev_.graphicsQueue, 1, &si, handoff.fence));
+
+		submitted_.push_back(std::move(handoff));
+
+		numSubmits_++;
+	}
+
+	retireBatches(false);
+
+	// the semaphore wait of the handoff submit does not cover the later submits, they wait on this value themselves
+	return waitValue;
+}
+
+void VulkanUploadBatcher::wait()
+{
+	flush();
+
+	while (!submitted_.empty())
+		retireBatches(true);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "shared/UtilsVulkan.h"
+
+/**
+	Batched uploads of texture data through a persistent staging arena.
+
+	Copies and layout transitions are recorded into a single command buffer which is submitted with a fence when the frame is submitted
+	(see drawFrame()), when a synchronous single-time command buffer is submitted or when the staging arena is full.
+	The staging arena is a persistently mapped ring buffer: the memory of a batch is recycled as soon as its fence is signaled.
+	Uploads larger than the whole arena get a dedicated staging buffer released together with their batch.
+
+	If the device has a dedicated transfer queue (VulkanRenderDevice::useTransferQueue) the copies are submitted there and signal a timeline semaphore.
+	The uploaded images are released by the transfer queue family and acquired by the graphics one: the acquire barriers are recorded
+	at the beginning of the next frame (see flushToCommandBuffer()) whose submit waits on the semaphore, the frames without new uploads do not wait at all.
+	The barriers of the uploads recorded while the frame is being composed go to a separate graphics queue submit before the frame (see flush()),
+	the frame submit waits on the same semaphore value.
+	Layout transitions of the images owned by the graphics queue are recorded on the graphics queue too, in the same order.
+
+	The source data is copied into the staging memory right away, the caller can release it when the call returns.
+	The batcher is not thread-safe, it is used by the thread submitting the frames.
+*/
+class VulkanUploadBatcher final
+{
+public:
+	static constexpr VkDeviceSize kDefaultStagingSize = VkDeviceSize(64) << 20;
+
+	explicit VulkanUploadBatcher(VulkanRenderDevice& vkDev, VkDeviceSize stagingSize = kDefaultStagingSize);
+	~VulkanUploadBatcher();
+
+	VulkanUploadBatcher(const VulkanUploadBatcher&) = delete;
+	VulkanUploadBatcher& operator=(const VulkanUploadBatcher&) = delete;
+
+	/// Transition the image from 'oldLayout' to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy 'regions' and transition it to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+	/// The buffer offsets of 'regions' are relative to the data written by 'fillStagingData'.
+	/// Returns false if the image cannot be uploaded on the transfer queue (its contents are preserved and it is owned by the graphics queue),
+	/// nothing is recorded then and the caller should upload it synchronously
+	bool uploadImage(VkImage image, VkFormat format, VkImageLayout oldLayout, uint32_t layerCount, uint32_t mipLevels,
+		VkDeviceSize dataSize, const std::function<void(void* stagingData)>& fillStagingData, const std::vector<VkBufferImageCopy>& regions);
+
+	bool uploadImage(VkImage image, VkFormat format, VkImageLayout oldLayout, uint32_t layerCount, uint32_t mipLevels,
+		const void* data, VkDeviceSize dataSize, const std::vector<VkBufferImageCopy>& regions);
+
+	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount = 1, uint32_t mipLevels = 1);
+
+	/// Submit the recorded commands without waiting for them.
+	/// Returns the value of getTimelineSemaphore() the next graphics queue submit using the uploaded images should wait on, 0 if it does not have to wait
+	uint64_t flush();
+
+	/// Submit the recorded copies and record the pending graphics queue barriers into 'commandBuffer'.
+	/// Returns the value of getTimelineSemaphore() the submit of 'commandBuffer' should wait on (VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT), 0 if it does not have to wait
+	uint64_t flushToCommandBuffer(VkCommandBuffer commandBuffer);
+
+	/// Submit the recorded commands and wait until all the batches have been executed
+	void wait();
+
+	inline VkSemaphore getTimelineSemaphore() const { return timelineSemaphore_; }
+
+	inline uint32_t getNumSubmits() const { return numSubmits_; }
+	inline VkDeviceSize getUploadedBytes() const { return uploadedBytes_; }
+
+private:
+	struct Batch
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		// submitted to the graphics queue, the command buffer belongs to 'handoffCommandPool_'
+		bool isHandoff = false;
+		// bytes of the staging arena used by this batch (including the alignment padding)
+		VkDeviceSize stagingBytes = 0;
+		std::vector<std::pair<VkBuffer, VkDeviceMemory>> dedicatedStaging;
+	};
+
+	// a barrier to be recorded on the graphics queue
+	struct GraphicsBarrier
+	{
+		VkImage image;
+		VkFormat format;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+		uint32_t layerCount;
+		uint32_t mipLevels;
+		// the queue family ownership acquire of an image released by the transfer queue
+		bool isAcquire;
+	};
+
+	VulkanRenderDevice& vkDev_;
+
+	VkCommandPool commandPool_ = VK_NULL_HANDLE;
+	VkCommandPool handoffCommandPool_ = VK_NULL_HANDLE;
+
+	VkBuffer stagingBuffer_ = VK_NULL_HANDLE;
+	VkDeviceMemory stagingMemory_ = VK_NULL_HANDLE;
+	uint8_t* stagingData_ = nullptr;
+	VkDeviceSize stagingSize_ = 0;
+
+	// next free byte of the ring and the bytes used by the recorded and the submitted batches
+	VkDeviceSize stagingHead_ = 0;
+	VkDeviceSize stagingUsed_ = 0;
+
+	Batch current_;
+	std::deque<Batch> submitted_;
+	// completed batches with their command buffers and fences to be reused
+	std::vector<Batch> free_;
+	std::vector<Batch> freeHandoff_;
+
+	// signaled by the transfer queue with the number of submitted batches
+	VkSemaphore timelineSemaphore_ = VK_NULL_HANDLE;
+	uint64_t timelineValue_ = 0;
+
+	std::vector<GraphicsBarrier> pendingBarriers_;
+	// the value of the submitted copies the pending acquire barriers have to wait for
+	uint64_t pendingWaitValue_ = 0;
+
+	uint32_t numSubmits_ = 0;
+	VkDeviceSize uploadedBytes_ = 0;
+
+	Batch acquireBatch(bool isHandoff);
+	VkCommandBuffer getCommandBuffer();
+	uint8_t* allocateStaging(VkDeviceSize size, VkDeviceSize alignment, VkBuffer* buffer, VkDeviceSize* offset);
+	void submitTransfers();
+	uint64_t recordGraphicsBarriers(VkCommandBuffer commandBuffer);
+	void retireBatches(bool waitOldest);
+};
@@ -1,4 +1,6 @@
 ﻿#include "GLSceneData.h"
+#include "shared/TextureCache.h"
+#include "shared/Utils.h"
 
 static uint64_t getTextureHandleBindless(uint64_t idx, const std::vector<GLTexture>& textures)
 {
@@ -18,8 +20,16 @@ GLSceneData::GLSceneData(
 	std::vector<std::string> textureFiles;
 	loadMaterials(materialFile, materials_, textureFiles);
 
-	for (const auto& f: textureFiles) {
-		allMaterialTextures_.emplace_back(GL_TEXTURE_2D, f.c_str());
+	const std::vector<bool> isSRGB = getSRGBTextures(materials_, textureFiles.size());
+
+	for (size_t i = 0; i != textureFiles.size(); i++) {
+		const std::string& f = textureFiles[i];
+		// decoded textures come from the persistent cache, KTX files and missing files go through GLTexture
+		CachedTexture tex;
+		if (!endsWith(f.c_str(), ".ktx") && loadCachedTexture(f.c_str(), tex, 0, MipChainParams { .sRGB_ = isSRGB[i] }))
+			allMaterialTextures_.emplace_back(tex.w_, tex.h_, tex.numLevels_, tex.getMips());
+		else
+			allMaterialTextures_.emplace_back(GL_TEXTURE_2D, f.c_str(), GL_REPEAT, isSRGB[i]);
 	}
 
 	for (auto& mtl: materials_)
@@ -36,6 +46,9 @@ void GLSceneData::loadScene(const char* sceneFile)
 {
 	::loadScene(sceneFile, scene_);
 
+	// the shapes index the node transforms
+	expandPrefabInstances(scene_);
+
 	// prepare draw data buffer
 	for (const auto& c: scene_.meshes_)
 	{
@@ -1,7 +1,9 @@
-﻿#include <memory>
+﻿#include <algorithm>
+#include <chrono>
+#include <memory>
 
 #include "GLSceneDataLazy.h"
-#include <stb/stb_image.h>
+#include "shared/Utils.h"
 
 static uint64_t getTextureHandleBindless(uint64_t idx, const std::vector<std::shared_ptr<GLTexture>>& textures)
 {
@@ -19,52 +21,80 @@ GLSceneDataLazy::GLSceneDataLazy(
 	loadScene(sceneFile);
 	loadMaterials(materialFile, materialsLoaded_, textureFiles_);
 
-	// apply a dummy textures to everything
+	// apply a dummy textures to everything except KTX files: these keep their compressed levels and are not streamed
 	for (const auto& f: textureFiles_) {
-		allMaterialTextures_.emplace_back(dummyTexture_);
+		allMaterialTextures_.emplace_back(endsWith(f.c_str(), ".ktx") ? std::make_shared<GLTexture>(GL_TEXTURE_2D, f.c_str()) : dummyTexture_);
+	}
+
+	textureMaterials_.resize(textureFiles_.size());
+
+	for (uint32_t i = 0; i != (uint32_t)materialsLoaded_.size(); i++)
+	{
+		const auto& m = materialsLoaded_[i];
+		for (const uint64_t map: { m.ambientOcclusionMap_, m.emissiveMap_, m.albedoMap_, m.metallicRoughnessMap_, m.normalMap_ })
+			if (map != INVALID_TEXTURE && (textureMaterials_[map].empty() || textureMaterials_[map].back() != i))
+				textureMaterials_[map].push_back(i);
 	}
 
 	updateMaterials();
 
-	loadedFiles_.reserve(textureFiles_.size());
+	uploadRing_ = std::make_unique<GLUploadRing>();
 
-	taskflow_.for_each_index(0u, (uint32_t)textureFiles_.size(), 1u, [this](int idx)
-		{
-			int w, h;
-			const uint8_t* img = stbi_load(this->textureFiles_[idx].c_str(), &w, &h, nullptr, STBI_rgb_alpha);
-			if (img)
-			{
-				std::lock_guard lock(loadedFilesMutex_);
-				loadedFiles_.emplace_back(LoadedImageData { idx, w, h, img });
-			}
-		}
-	);
+	// the small tail levels come first, the rest is streamed in as requested
+	TextureStreamerParams params;
+	params.allocateStaging_ = [ring = uploadRing_.get()](size_t size, uint64_t* offset) { return ring->allocate(size, offset); };
 
-	executor_.run(taskflow_);
+	streamer_ = std::make_unique<TextureStreamer>(textureFiles_, getSRGBTextures(materialsLoaded_, textureFiles_.size()), params);
 }
 
-bool GLSceneDataLazy::uploadLoadedTextures()
+void GLSceneDataLazy::requestTextures(const glm::mat4& view, const glm::mat4& proj, float viewportHeight)
 {
-	LoadedImageData data;
+	requestShapeTextures(*streamer_, meshData_, shapes_, scene_.globalTransform_, materialsLoaded_, view, proj, viewportHeight);
+}
 
+bool GLSceneDataLazy::uploadLoadedTextures(double timeBudgetMs)
+{
+	streamer_->update();
+
+	changedMaterials_.clear();
+
+	const auto start = std::chrono::steady_clock::now();
+
+	bool hasUploads = false;
+	StreamedTextureUpdate u;
+
+	while (streamer_->popUpdate(u))
 	{
-		std::lock_guard lock(loadedFilesMutex_);
+		hasUploads = true;
 
-		if (loadedFiles_.empty())
-			return false;
+		// the previous texture is released together with its bindless handle
+		if (u.isStaged_)
+		{
+			allMaterialTextures_[u.texture_] = std::make_shared<GLTexture>(u.w_, u.h_, u.numLevels_, reinterpret_cast<const void*>(u.stagingOffset_), uploadRing_->getHandle());
+			uploadRing_->release(u.stagingOffset_);
+		}
+		else
+		{
+			allMaterialTextures_[u.texture_] = std::make_shared<GLTexture>(u.w_, u.h_, u.numLevels_, u.mips_.data());
+		}
 
-		data = loadedFiles_.back();
+		for (uint32_t m: textureMaterials_[u.texture_])
+		{
+			updateMaterial(m);
+			changedMaterials_.push_back(m);
+		}
 
-		loadedFiles_.pop_back();
+		if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() > timeBudgetMs)
+			break;
 	}
 
-	allMaterialTextures_[data.index_] = std::make_shared<GLTexture>(data.w_, data.h_, data.img_);
-
-	stbi_image_free((void*)data.img_);
+	// the staging memory of the textures uploaded above is recycled once the copies are done
+	uploadRing_->endFrame();
 
-	updateMaterials();
+	std::sort(changedMaterials_.begin(), changedMaterials_.end());
+	changedMaterials_.erase(std::unique(changedMaterials_.begin(), changedMaterials_.end()), changedMaterials_.end());
 
-	return true;
+	return hasUploads;
 }
 
 void GLSceneDataLazy::updateMaterials()
@@ -74,22 +104,28 @@ void GLSceneDataLazy::updateMaterials()
 	materials_.resize(numMaterials);
 
 	for (size_t i = 0; i != numMaterials; i++)
-	{
-		const auto& in = materialsLoaded_[i];
-		auto& out = materials_[i];
-		out = in;
-		out.ambientOcclusionMap_ = getTextureHandleBindless(in.ambientOcclusionMap_, allMaterialTextures_);
-		out.emissiveMap_ = getTextureHandleBindless(in.emissiveMap_, allMaterialTextures_);
-		out.albedoMap_ = getTextureHandleBindless(in.albedoMap_, allMaterialTextures_);
-		out.metallicRoughnessMap_ = getTextureHandleBindless(in.metallicRoughnessMap_, allMaterialTextures_);
-		out.normalMap_ = getTextureHandleBindless(in.normalMap_, allMaterialTextures_);
-	}
+		updateMaterial((uint32_t)i);
+}
+
+void GLSceneDataLazy::updateMaterial(uint32_t materialIndex)
+{
+	const auto& in = materialsLoaded_[materialIndex];
+	auto& out = materials_[materialIndex];
+	out = in;
+	out.ambientOcclusionMap_ = getTextureHandleBindless(in.ambientOcclusionMap_, allMaterialTextures_);
+	out.emissiveMap_ = getTextureHandleBindless(in.emissiveMap_, allMaterialTextures_);
+	out.albedoMap_ = getTextureHandleBindless(in.albedoMap_, allMaterialTextures_);
+	out.metallicRoughnessMap_ = getTextureHandleBindless(in.metallicRoughnessMap_, allMaterialTextures_);
+	out.normalMap_ = getTextureHandleBindless(in.normalMap_, allMaterialTextures_);
 }
 
 void GLSceneDataLazy::loadScene(const char* sceneFile)
 {
 	::loadScene(sceneFile, scene_);
 
+	// the shapes index the node transforms
+	expandPrefabInstances(scene_);
+
 	// prepare draw data buffer
 	for (const auto& c: scene_.meshes_)
 	{
@@ -1,13 +1,14 @@
 ﻿#pragma once
 
-#include <mutex>
+#include <memory>
 
 #include "shared/scene/Scene.h"
 #include "shared/scene/Material.h"
 #include "shared/scene/VtxData.h"
 #include "shared/glFramework/GLShader.h"
 #include "shared/glFramework/GLTexture.h"
-#include <taskflow/taskflow.hpp>
+#include "shared/glFramework/GLUploadRing.h"
+#include "shared/scene/TextureStreamer.h"
 
 class GLSceneDataLazy
 {
@@ -17,19 +18,12 @@ public:
 		const char* sceneFile,
 		const char* materialFile);
 
-	struct LoadedImageData
-	{
-		int index_ = 0;
-		int w_ = 0;
-		int h_ = 0;
-		const uint8_t* img_ = nullptr;
-	};
-
 	const std::shared_ptr<GLTexture> dummyTexture_ = std::make_shared<GLTexture>(GL_TEXTURE_2D, "data/const1.bmp");
 
 	std::vector<std::string> textureFiles_;
-	std::vector<LoadedImageData> loadedFiles_;
-	std::mutex loadedFilesMutex_;
+	// the streamer's workers write the loaded levels here, it outlives the streamer
+	std::unique_ptr<GLUploadRing> uploadRing_;
+	std::unique_ptr<TextureStreamer> streamer_;
 	std::vector<std::shared_ptr<GLTexture>> allMaterialTextures_;
 
 	MeshFileHeader header_;
@@ -38,14 +32,20 @@ public:
 	Scene scene_;
 	std::vector<MaterialDescription> materialsLoaded_; // materials loaded from scene
 	std::vector<MaterialDescription> materials_; // materials uploaded to GPU buffers
+	std::vector<uint32_t> changedMaterials_; // materials patched by the last uploadLoadedTextures() call, only these should be uploaded again
 	std::vector<DrawData> shapes_;
 
-	tf::Taskflow taskflow_;
-	tf::Executor executor_;
+	/// Textures of all the shapes are streamed at their on-screen resolution, call once per frame before uploadLoadedTextures()
+	void requestTextures(const glm::mat4& view, const glm::mat4& proj, float viewportHeight);
 
-	bool uploadLoadedTextures();
+	/// Replace the textures which have new MIP levels streamed in or out until the time budget runs out (at least one texture per call),
+	/// returns true if any texture has changed
+	bool uploadLoadedTextures(double timeBudgetMs = 2.0);
 
 private:
+	std::vector<std::vector<uint32_t>> textureMaterials_; // materials referencing each texture
+
 	void loadScene(const char* sceneFile);
 	void updateMaterials();
+	void updateMaterial(uint32_t materialIndex);
 };
@@ -1,10 +1,28 @@
 ﻿#include "GLShader.h"
 #include "shared/Utils.h"
+#include "shared/UtilsFile.h"
 
 #include <glad/gl.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
+#include <vector>
+
+constexpr uint32_t kProgramCacheMagic = 0x4D475250; // "PRGM"
+// bump to invalidate all the entries written by older versions
+constexpr uint32_t kProgramCacheVersion = 1;
+
+struct ProgramCacheHeader {
+    uint32_t magicValue_;
+    uint32_t version_;
+    uint64_t key_;
+    uint32_t binaryFormat_;
+    uint32_t padding_;
+    uint64_t binarySize_;
+};
+
+static_assert(sizeof(ProgramCacheHeader) == 32);
 
 GLShader::GLShader(const char* file) noexcept
     : GLShader(GLShaderTypeFromFileName(file), readShaderFile(file).c_str(), file) {
@@ -12,7 +30,18 @@ GLShader::GLShader(const char* file) noexcept
 
 GLShader::GLShader(GLenum type, const char* source,const char* debugFileName) noexcept
     : type_(type)
-    , handle_(glCreateShader(type)) {
+    , source_(source)
+    , debugFileName_(debugFileName ? debugFileName : "") {
+}
+
+GLuint GLShader::getHandle() const {
+    if (handle_) {
+        return handle_;
+    }
+
+    handle_ = glCreateShader(type_);
+
+    const char* source = source_.c_str();
     glShaderSource(handle_, 1, &source, nullptr);
     glCompileShader(handle_);
 
@@ -21,14 +50,18 @@ GLShader::GLShader(GLenum type, const char* source,const char* debugFileName) no
     glGetShaderInfoLog(handle_, sizeof(buffer), &length, buffer);
 
     if (length) {
-        printf("%s, (file=%s)\n", buffer, debugFileName);
+        printf("%s, (file=%s)\n", buffer, debugFileName_.c_str());
         printShaderSource(source);
         assert(false);
     }
+
+    return handle_;
 }
 
 GLShader::~GLShader() {
-    glDeleteShader(handle_);
+    if (handle_) {
+        glDeleteShader(handle_);
+    }
     type_ = 0;
 }
 
@@ -67,51 +100,138 @@ void printProgramInfoLog(GLuint handle) {
     }
 }
 
-GLProgram::GLProgram(const GLShader& shader)
-    : handle_(glCreateProgram()) {
-    glAttachShader(handle_, shader.getHandle());
+static std::string getProgramCacheEntryFileName(uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return std::string(kProgramCacheDir) + name;
+}
+
+/// The key covers the preprocessed sources of all the stages and the driver: a blob is never offered to another GPU or driver version
+static uint64_t getProgramCacheKey(const GLShader* const* shaders, size_t numShaders) {
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+    const char* version = (const char*)glGetString(GL_VERSION);
+
+    uint64_t key = hashBytes(&kProgramCacheVersion, sizeof(kProgramCacheVersion));
+    key = hashBytes(renderer, renderer ? strlen(renderer) : 0, key);
+    key = hashBytes(version, version ? strlen(version) : 0, key);
+
+    for (size_t i = 0; i != numShaders; i++) {
+        const GLenum type = shaders[i]->getType();
+        key = hashBytes(&type, sizeof(type), key);
+        key = hashBytes(shaders[i]->getSource().data(), shaders[i]->getSource().size(), key);
+    }
+
+    return key;
+}
+
+static bool loadProgramBinary(GLuint handle, const std::string& entryFile, uint64_t key) {
+    const MappedFile file(entryFile.c_str());
+
+    if (!file.isValid() || file.getSize() < sizeof(ProgramCacheHeader)) {
+        return false;
+    }
+
+    ProgramCacheHeader header;
+    memcpy(&header, file.getData(), sizeof(header));
+
+    if (header.magicValue_ != kProgramCacheMagic || header.version_ != kProgramCacheVersion || header.key_ != key ||
+        file.getSize() != sizeof(header) + header.binarySize_) {
+        return false;
+    }
+
+    glProgramBinary(handle, header.binaryFormat_, file.getData() + sizeof(header), (GLsizei)header.binarySize_);
+
+    // the driver can reject any blob (e.g. after an update which kept the version string), the program is linked from the sources then
+    GLint status = GL_FALSE;
+    glGetProgramiv(handle, GL_LINK_STATUS, &status);
+
+    return status == GL_TRUE;
+}
+
+static void saveProgramBinary(GLuint handle, const std::string& entryFile, uint64_t key) {
+    GLint length = 0;
+    glGetProgramiv(handle, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<uint8_t> binary(length);
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(handle, length, &length, &binaryFormat, binary.data());
+
+    const ProgramCacheHeader header = {
+        .magicValue_ = kProgramCacheMagic,
+        .version_ = kProgramCacheVersion,
+        .key_ = key,
+        .binaryFormat_ = binaryFormat,
+        .padding_ = 0,
+        .binarySize_ = (uint64_t)length
+    };
+
+    writeFileAtomically(entryFile, &header, sizeof(header), binary.data(), (size_t)length);
+}
+
+void GLProgram::link(const GLShader* const* shaders, size_t numShaders) {
+    GLint numBinaryFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+
+    const bool useCache = numBinaryFormats > 0;
+    const uint64_t key = useCache ? getProgramCacheKey(shaders, numShaders) : 0;
+    const std::string entryFile = useCache ? getProgramCacheEntryFileName(key) : std::string();
+
+    if (useCache && loadProgramBinary(handle_, entryFile, key)) {
+        return;
+    }
+
+    // a rejected blob leaves the program unlinked, it is linked from the sources as if there was no cache
+    for (size_t i = 0; i != numShaders; i++) {
+        glAttachShader(handle_, shaders[i]->getHandle());
+    }
+    if (useCache) {
+        glProgramParameteri(handle_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(handle_);
     printProgramInfoLog(handle_);
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(handle_, GL_LINK_STATUS, &status);
+
+    if (useCache && status == GL_TRUE) {
+        saveProgramBinary(handle_, entryFile, key);
+    }
+}
+
+GLProgram::GLProgram(const GLShader& shader)
+    : handle_(glCreateProgram()) {
+    const GLShader* shaders[] = { &shader };
+    link(shaders, 1);
 }
 
 GLProgram::GLProgram(const GLShader& shader, const GLShader& shader1) 
     : handle_(glCreateProgram()) {
-    glAttachShader(handle_, shader.getHandle());
-    glAttachShader(handle_, shader1.getHandle());
-    glLinkProgram(handle_);
-    printProgramInfoLog(handle_);
+    const GLShader* shaders[] = { &shader, &shader1 };
+    link(shaders, 2);
 }
 
 GLProgram::GLProgram(const GLShader& shader, const GLShader& shader1, const GLShader& shader2) 
     : handle_(glCreateProgram()) {
-    glAttachShader(handle_, shader.getHandle());
-    glAttachShader(handle_, shader1.getHandle());
-    glAttachShader(handle_, shader2.getHandle());
-    glLinkProgram(handle_);
-    printProgramInfoLog(handle_);
+    const GLShader* shaders[] = { &shader, &shader1, &shader2 };
+    link(shaders, 3);
 }
 
 GLProgram::GLProgram(const GLShader& shader, const GLShader& shader1, const GLShader& shader2,
     const GLShader& shader3) 
     : handle_(glCreateProgram()) {
-    glAttachShader(handle_, shader.getHandle());
-    glAttachShader(handle_, shader1.getHandle());
-    glAttachShader(handle_, shader2.getHandle());
-    glAttachShader(handle_, shader3.getHandle());
-    glLinkProgram(handle_);
-    printProgramInfoLog(handle_);
+    const GLShader* shaders[] = { &shader, &shader1, &shader2, &shader3 };
+    link(shaders, 4);
 }
 
 GLProgram::GLProgram(const GLShader& shader, const GLShader& shader1, const GLShader& shader2,
     const GLShader& shader3, const GLShader& shader4) 
     : handle_(glCreateProgram()) {
-    glAttachShader(handle_, shader.getHandle());
-    glAttachShader(handle_, shader1.getHandle());
-    glAttachShader(handle_, shader2.getHandle());
-    glAttachShader(handle_, shader3.getHandle());
-    glAttachShader(handle_, shader4.getHandle());
-    glLinkProgram(handle_);
-    printProgramInfoLog(handle_);
+    const GLShader* shaders[] = { &shader, &shader1, &shader2, &shader3, &shader4 };
+    link(shaders, 5);
 }
 
 GLProgram::~GLProgram() {
@@ -2,6 +2,12 @@
 
 #include <glad/gl.h>
 
+#include <string>
+
+/// Programs linked from the same sources on the same driver are loaded from glProgramBinary() blobs stored here
+constexpr const char* kProgramCacheDir = "data/.cache/programs/";
+
+/// The source is compiled when the handle is requested for the first time: a program found in the program cache does not compile its shaders at all
 class GLShader {
 public:
     explicit GLShader(const char* file) noexcept;
@@ -9,10 +15,14 @@ public:
     ~GLShader();
 
     GLenum getType() const { return type_; }
-    GLuint getHandle() const { return handle_; }
+    GLuint getHandle() const;
+    /// the source with all the includes resolved
+    const std::string& getSource() const { return source_; }
 private:
     GLenum type_;
-    GLuint handle_;
+    std::string source_;
+    std::string debugFileName_;
+    mutable GLuint handle_ = 0;
 };
 
 class GLProgram {
@@ -30,6 +40,8 @@ public:
     GLuint getHandle() const { return handle_; }
 private:
     GLuint handle_;
+
+    void link(const GLShader* const* shaders, size_t numShaders);
 };
 
 class GLBuffer {
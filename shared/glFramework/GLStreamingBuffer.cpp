@@ -0,0 +1,142 @@
+#include "shared/glFramework/GLStreamingBuffer.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+GLStreamingBuffer::GLStreamingBuffer(GLsizeiptr frameSize, uint32_t numFrames)
+: numFrames_(numFrames)
+{
+	assert(numFrames_ > 0 && numFrames_ <= sizeof(fences_) / sizeof(fences_[0]));
+
+	GLint uniformAlignment = 0;
+	GLint storageAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+	alignment_ = std::max<GLsizeiptr>({ 16, uniformAlignment, storageAlignment });
+
+	createBuffer(frameSize);
+}
+
+GLStreamingBuffer::~GLStreamingBuffer()
+{
+	for (uint32_t i = 0; i != numFrames_; i++)
+	{
+		if (!fences_[i])
+			continue;
+
+		glClientWaitSync(fences_[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(fences_[i]);
+	}
+
+	deleteRetiredBuffers();
+
+	glUnmapNamedBuffer(handle_);
+	glDeleteBuffers(1, &handle_);
+}
+
+void GLStreamingBuffer::createBuffer(GLsizeiptr frameSize)
+{
+	// every region starts aligned
+	frameSize_ = (frameSize + alignment_ - 1) / alignment_ * alignment_;
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glCreateBuffers(1, &handle_);
+	glNamedBufferStorage(handle_, frameSize_ * numFrames_, nullptr, flags);
+	data_ = static_cast<uint8_t*>(glMapNamedBufferRange(handle_, 0, frameSize_ * numFrames_, flags));
+
+	if (!data_)
+	{
+		printf("GLStreamingBuffer: cannot map a buffer of %lld bytes\n", (long long)(frameSize_ * numFrames_));
+		exit(EXIT_FAILURE);
+	}
+}
+
+void GLStreamingBuffer::grow(GLsizeiptr size)
+{
+	// the ranges handed out before stay in the old buffer, the fences of its regions are not needed anymore
+	retired_.push_back(handle_);
+
+	for (uint32_t i = 0; i != numFrames_; i++)
+	{
+		if (fences_[i])
+			glDeleteSync(fences_[i]);
+		fences_[i] = nullptr;
+	}
+
+	createBuffer(std::max(frameSize_ * 2, size));
+
+	frame_ = 0;
+	frameUsed_ = 0;
+
+	numGrows_++;
+}
+
+void GLStreamingBuffer::deleteRetiredBuffers()
+{
+	for (GLuint b: retired_)
+	{
+		glUnmapNamedBuffer(b);
+		glDeleteBuffers(1, &b);
+	}
+
+	retired_.clear();
+}
+
+GLStreamingBuffer::Range GLStreamingBuffer::allocate(GLsizeiptr size)
+{
+	GLsizeiptr offset = (frameUsed_ + alignment_ - 1) / alignment_ * alignment_;
+
+	if (offset + size > frameSize_)
+	{
+		grow(size);
+		offset = 0;
+	}
+
+	frameUsed_ = offset + size;
+
+	const GLintptr bufferOffset = frame_ * frameSize_ + offset;
+
+	return Range { .data_ = data_ + bufferOffset, .buffer_ = handle_, .offset_ = bufferOffset, .size_ = size };
+}
+
+GLStreamingBuffer::Range GLStreamingBuffer::upload(const void* data, GLsizeiptr size)
+{
+	const Range range = allocate(size);
+	memcpy(range.data_, data, size);
+	return range;
+}
+
+void GLStreamingBuffer::bindRange(GLenum target, GLuint index, const Range& range) const
+{
+	glBindBufferRange(target, index, range.buffer_, range.offset_, range.size_);
+}
+
+void GLStreamingBuffer::endFrame()
+{
+	fences_[frame_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	// all the commands using the replaced buffers have been issued
+	deleteRetiredBuffers();
+
+	frame_ = (frame_ + 1) % numFrames_;
+	frameUsed_ = 0;
+
+	GLsync& fence = fences_[frame_];
+
+	if (!fence)
+		return;
+
+	if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+	{
+		// the GPU is behind: the CPU cannot write into the region yet
+		numStalls_++;
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+	}
+
+	glDeleteSync(fence);
+	fence = nullptr;
+}
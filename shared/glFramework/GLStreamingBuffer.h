@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <stdint.h>
+#include <vector>
+
+/**
+	Persistently mapped buffer for the data rewritten every frame: uniforms, transforms, draw commands, debug lines.
+
+	The buffer is split into 'numFrames' regions used round-robin. allocate() hands out ranges of the current region which are written
+	through the mapped pointer and bound with bindRange() (or used as vertex, index and indirect buffer offsets). endFrame() fences the current region
+	and moves to the next one; if the GPU has not finished reading that region yet, the CPU waits for it and the stall is counted.
+	With 3 regions, the CPU never overwrites data the GPU may still read and does not wait unless the GPU falls 2 frames behind.
+
+	The size of a region should match the typical usage of a frame, not the worst case: a range which does not fit makes the buffer grow.
+	A new buffer with larger regions replaces the current one, the ranges allocated before stay valid in the old buffer until endFrame() deletes it
+	(GL keeps it alive until the commands reading it are completed). Every range knows its buffer, the handle of the streaming buffer changes when it grows.
+*/
+class GLStreamingBuffer final
+{
+public:
+	struct Range
+	{
+		void* data_ = nullptr;
+		GLuint buffer_ = 0;
+		GLintptr offset_ = 0;
+		GLsizeiptr size_ = 0;
+	};
+
+	explicit GLStreamingBuffer(GLsizeiptr frameSize, uint32_t numFrames = 3);
+	~GLStreamingBuffer();
+
+	GLStreamingBuffer(const GLStreamingBuffer&) = delete;
+	GLStreamingBuffer& operator=(const GLStreamingBuffer&) = delete;
+
+	/// The current buffer, the ranges allocated before the buffer has grown belong to the previous one (see Range::buffer_)
+	GLuint getHandle() const { return handle_; }
+
+	/// A range of the current frame's region aligned for uniform and shader storage bindings, valid until the next endFrame()
+	Range allocate(GLsizeiptr size);
+
+	/// Allocate a range and copy 'data' into it
+	Range upload(const void* data, GLsizeiptr size);
+
+	void bindRange(GLenum target, GLuint index, const Range& range) const;
+
+	/// Fence the current region once all the commands using it have been issued and switch to the next region
+	void endFrame();
+
+	/// Frames which had to wait for the GPU to release their region
+	uint32_t getNumStalls() const { return numStalls_; }
+
+	/// Allocations which did not fit into a region and made the buffer grow
+	uint32_t getNumGrows() const { return numGrows_; }
+
+private:
+	GLuint handle_ = 0;
+	uint8_t* data_ = nullptr;
+
+	GLsizeiptr frameSize_ = 0;
+	uint32_t numFrames_ = 0;
+	GLsizeiptr alignment_ = 0;
+
+	uint32_t frame_ = 0;
+	// bytes of the current region handed out so far
+	GLsizeiptr frameUsed_ = 0;
+	// fences of the regions, nullptr if the region is not used by the GPU
+	GLsync fences_[8] = {};
+
+	// replaced during the current frame, their ranges can still be written
+	std::vector<GLuint> retired_;
+
+	uint32_t numStalls_ = 0;
+	uint32_t numGrows_ = 0;
+
+	void createBuffer(GLsizeiptr frameSize);
+	void grow(GLsizeiptr size);
+	void deleteRetiredBuffers();
+};
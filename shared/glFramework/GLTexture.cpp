@@ -1,8 +1,10 @@
 ﻿#include "shared/glFramework/GLTexture.h"
 #include "shared/Bitmap.h"
 #include "shared/UtilsCubemap.h"
+#include "shared/UtilsMips.h"
 
 #include <glad/gl.h>
+#include <algorithm>
 #include <assert.h>
 #include <stdio.h>
 #include <string>
@@ -20,6 +22,30 @@ int getNumMipMapLevels2D(int w, int h)
 	return levels;
 }
 
+/// Upload MIP levels stored one after another, as generateMipChain() lays them out
+static void uploadMipLevels(GLuint handle, int width, int height, int depth, int bytesPerTexel, int numMipmaps, GLenum format, GLenum type, const uint8_t* data)
+{
+	for (int i = 0; i != numMipmaps; i++)
+	{
+		const int w = std::max(1, width >> i);
+		const int h = std::max(1, height >> i);
+
+		if (depth == 1)
+			glTextureSubImage2D(handle, i, 0, 0, w, h, format, type, data);
+		else
+			glTextureSubImage3D(handle, i, 0, 0, 0, w, h, depth, format, type, data);
+
+		data += size_t(w) * h * depth * bytesPerTexel;
+	}
+}
+
+/// Upload a MIP chain generated on the CPU (see generateMipChain()) instead of relying on glGenerateTextureMipmap()
+static void uploadMipChain(GLuint handle, const Bitmap& b, int numMipmaps, GLenum format, GLenum type, const MipChainParams& params = MipChainParams())
+{
+	const std::vector<uint8_t> mips = generateMipChain(b, numMipmaps, params);
+	uploadMipLevels(handle, b.w_, b.h_, b.d_, b.comp_ * Bitmap::getBytesPerComponent(b.fmt_), numMipmaps, format, type, mips.data());
+}
+
 GLTexture::GLTexture(GLenum type, int width, int height, GLenum internalFormat)
 	: type_(type)
 {
@@ -30,13 +56,13 @@ GLTexture::GLTexture(GLenum type, int width, int height, GLenum internalFormat)
 	glTextureStorage2D(handle_, getNumMipMapLevels2D(width, height), internalFormat, width, height);
 }
 
-/// Draw a checkerboard on a pre-allocated square RGB image.
+/// Draw a checkerboard on a pre-allocated square RGBA image.
 uint8_t* genDefaultCheckerboardImage(int* width, int* height)
 {
 	const int w = 128;
 	const int h = 128;
 
-	uint8_t* imgData = (uint8_t*)malloc(w * h * 3); // stbi_load() uses malloc(), so this is safe
+	uint8_t* imgData = (uint8_t*)malloc(w * h * 4); // stbi_load() uses malloc(), so this is safe
 
 	assert(imgData && w > 0 && h > 0);
 	assert(w == h);
@@ -48,7 +74,8 @@ uint8_t* genDefaultCheckerboardImage(int* width, int* height)
 	{
 		const int row = i / w;
 		const int col = i % w;
-		imgData[i * 3 + 0] = imgData[i * 3 + 1] = imgData[i * 3 + 2] = 0xFF * ((row + col) % 2);
+		imgData[i * 4 + 0] = imgData[i * 4 + 1] = imgData[i * 4 + 2] = 0xFF * ((row + col) % 2);
+		imgData[i * 4 + 3] = 0xFF;
 	}
 
 	if (width) *width = w;
@@ -61,7 +88,7 @@ GLTexture::GLTexture(GLenum type, const char* fileName)
 : GLTexture(type, fileName, GL_REPEAT)
 {}
 
-GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp)
+GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp, bool sRGB)
 	: type_(type)
 {
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
@@ -91,9 +118,21 @@ GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp)
 			glm::tvec3<GLsizei> extent(gliTex.extent(0));
 			w = extent.x;
 			h = extent.y;
-			numMipmaps = getNumMipMapLevels2D(w, h);
+			// all the stored levels are uploaded as they are (compressed ones cannot be generated by GL), the missing ones are generated
+			const int numStoredLevels = (int)gliTex.levels();
+			const bool isCompressed = gli::is_compressed(gliTex.format());
+			numMipmaps = (isCompressed || numStoredLevels > 1) ? numStoredLevels : getNumMipMapLevels2D(w, h);
 			glTextureStorage2D(handle_, numMipmaps, format.Internal, w, h);
-			glTextureSubImage2D(handle_, 0, 0, 0, w, h, format.External, format.Type, gliTex.data(0, 0, 0));
+			for (int i = 0; i != numStoredLevels; i++)
+			{
+				const glm::tvec3<GLsizei> levelExtent(gliTex.extent(i));
+				if (isCompressed)
+					glCompressedTextureSubImage2D(handle_, i, 0, 0, levelExtent.x, levelExtent.y, format.Internal, (GLsizei)gliTex.size(i), gliTex.data(0, 0, i));
+				else
+					glTextureSubImage2D(handle_, i, 0, 0, levelExtent.x, levelExtent.y, format.External, format.Type, gliTex.data(0, 0, i));
+			}
+			if (numMipmaps > numStoredLevels)
+				glGenerateTextureMipmap(handle_);
 		}
 		else
 		{
@@ -113,10 +152,9 @@ GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp)
 
 			numMipmaps = getNumMipMapLevels2D(w, h);
 			glTextureStorage2D(handle_, numMipmaps, GL_RGBA8, w, h);
-			glTextureSubImage2D(handle_, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, img);
+			uploadMipChain(handle_, Bitmap(w, h, 4, eBitmapFormat_UnsignedByte, img), numMipmaps, GL_RGBA, GL_UNSIGNED_BYTE, MipChainParams { .sRGB_ = sRGB });
 			stbi_image_free((void*)img);
 		}
-		glGenerateTextureMipmap(handle_);
 		glTextureParameteri(handle_, GL_TEXTURE_MAX_LEVEL, numMipmaps-1);
 		glTextureParameteri(handle_, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTextureParameteri(handle_, GL_TEXTURE_MAX_ANISOTROPY , 16);
@@ -125,13 +163,13 @@ GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp)
 	case GL_TEXTURE_CUBE_MAP:
 	{
 		int w, h, comp;
-		const float* img = stbi_loadf(fileName, &w, &h, &comp, 3);
+		const float* img = stbi_loadf(fileName, &w, &h, &comp, 4);
 		assert(img);
-		Bitmap in(w, h, comp, eBitmapFormat_Float, img);
+		// the faces are converted and uploaded as RGBA half floats (8 bytes per texel keep the rows aligned for any face size)
+		const Bitmap in = convertBitmapFormat(Bitmap(w, h, 4, eBitmapFormat_Float, img), eBitmapFormat_Half);
 		const bool isEquirectangular = w == 2 * h;
-		Bitmap out = isEquirectangular ? convertEquirectangularMapToVerticalCross(in) : in;
 		stbi_image_free((void*)img);
-		Bitmap cubemap = convertVerticalCrossToCubeMapFaces(out);
+		Bitmap cubemap = isEquirectangular ? convertEquirectangularMapToCubeMapFaces(in) : convertVerticalCrossToCubeMapFaces(in);
 
 		const int numMipmaps = getNumMipMapLevels2D(cubemap.w_, cubemap.h_);
 
@@ -143,16 +181,9 @@ GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp)
 		glTextureParameteri(handle_, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTextureParameteri(handle_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
-		glTextureStorage2D(handle_, numMipmaps, GL_RGB32F, cubemap.w_, cubemap.h_);
-		const uint8_t* data = cubemap.data_.data();
-
-		for (unsigned i = 0; i != 6; ++i)
-		{
-			glTextureSubImage3D(handle_, 0, 0, 0, i, cubemap.w_, cubemap.h_, 1, GL_RGB, GL_FLOAT, data);
-			data += cubemap.w_ * cubemap.h_ * cubemap.comp_ * Bitmap::getBytesPerComponent(cubemap.fmt_);
-		}
-
-		glGenerateTextureMipmap(handle_);
+		glTextureStorage2D(handle_, numMipmaps, GL_RGBA16F, cubemap.w_, cubemap.h_);
+		// all 6 faces are consecutive layers of every level; the box filter does not ring around very bright HDR texels
+		uploadMipChain(handle_, cubemap, numMipmaps, GL_RGBA, GL_HALF_FLOAT, MipChainParams { .filter_ = eMipFilter_Box });
 		break;
 	}
 	default:
@@ -163,15 +194,32 @@ GLTexture::GLTexture(GLenum type, const char* fileName, GLenum clamp)
 	glMakeTextureHandleResidentARB(handleBindless_);
 }
 
-GLTexture::GLTexture(int w, int h, const void* img)
+GLTexture::GLTexture(int w, int h, const void* img, bool sRGB)
 	: type_(GL_TEXTURE_2D)
 {
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glCreateTextures(type_, 1, &handle_);
 	int numMipmaps = getNumMipMapLevels2D(w, h);
 	glTextureStorage2D(handle_, numMipmaps, GL_RGBA8, w, h);
-	glTextureSubImage2D(handle_, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, img);
-	glGenerateTextureMipmap(handle_);
+	uploadMipChain(handle_, Bitmap(w, h, 4, eBitmapFormat_UnsignedByte, img), numMipmaps, GL_RGBA, GL_UNSIGNED_BYTE, MipChainParams { .sRGB_ = sRGB });
+	glTextureParameteri(handle_, GL_TEXTURE_MAX_LEVEL, numMipmaps - 1);
+	glTextureParameteri(handle_, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(handle_, GL_TEXTURE_MAX_ANISOTROPY, 16);
+	handleBindless_ = glGetTextureHandleARB(handle_);
+	glMakeTextureHandleResidentARB(handleBindless_);
+}
+
+GLTexture::GLTexture(int w, int h, uint32_t numMipmaps, const void* mips, GLuint pixelBuffer)
+	: type_(GL_TEXTURE_2D)
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glCreateTextures(type_, 1, &handle_);
+	glTextureStorage2D(handle_, numMipmaps, GL_RGBA8, w, h);
+	if (pixelBuffer)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+	uploadMipLevels(handle_, w, h, 1, 4, numMipmaps, GL_RGBA, GL_UNSIGNED_BYTE, static_cast<const uint8_t*>(mips));
+	if (pixelBuffer)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 	glTextureParameteri(handle_, GL_TEXTURE_MAX_LEVEL, numMipmaps - 1);
 	glTextureParameteri(handle_, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTextureParameteri(handle_, GL_TEXTURE_MAX_ANISOTROPY, 16);
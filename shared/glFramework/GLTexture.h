@@ -6,9 +6,13 @@ class GLTexture
 {
 public:
 	GLTexture(GLenum type, const char* fileName);
-	GLTexture(GLenum type, const char* fileName, GLenum clamp);
+	/// 'sRGB': the MIP chain of a 2D image is filtered in linear space (color maps), false for data maps (normals, metallic-roughness, AO)
+	GLTexture(GLenum type, const char* fileName, GLenum clamp, bool sRGB = true);
 	GLTexture(GLenum type, int width, int height, GLenum internalFormat);
-	GLTexture(int w, int h, const void* img);
+	GLTexture(int w, int h, const void* img, bool sRGB = true);
+	/// RGBA8 MIP chain with the levels stored one after another (see generateMipChain());
+	/// if 'pixelBuffer' is not 0, 'mips' is an offset in this pixel unpack buffer and the copies do not stall the render thread
+	GLTexture(int w, int h, uint32_t numMipmaps, const void* mips, GLuint pixelBuffer = 0);
 	~GLTexture();
 	GLTexture(const GLTexture&) = delete;
 	GLTexture(GLTexture&&);
@@ -0,0 +1,118 @@
+#include "shared/glFramework/GLUploadRing.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// offsets of the ranges are suitable for any texel format
+static constexpr uint64_t kAlignment = 64;
+
+GLUploadRing::GLUploadRing(size_t size)
+: size_(size)
+{
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glCreateBuffers(1, &handle_);
+	glNamedBufferStorage(handle_, size_, nullptr, flags);
+	data_ = static_cast<uint8_t*>(glMapNamedBufferRange(handle_, 0, size_, flags));
+
+	if (!data_)
+	{
+		printf("GLUploadRing: cannot map a buffer of %zu bytes\n", size_);
+		exit(EXIT_FAILURE);
+	}
+}
+
+GLUploadRing::~GLUploadRing()
+{
+	for (const auto& f: fences_)
+	{
+		glClientWaitSync(f.sync_, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(f.sync_);
+	}
+
+	glUnmapNamedBuffer(handle_);
+	glDeleteBuffers(1, &handle_);
+}
+
+uint8_t* GLUploadRing::allocate(size_t size, uint64_t* offset)
+{
+	if (!size || size > size_)
+		return nullptr;
+
+	std::lock_guard lock(mutex_);
+
+	uint64_t begin = (head_ + kAlignment - 1) / kAlignment * kAlignment;
+
+	// a range never wraps around, the end of the buffer is skipped
+	if (begin % size_ + size > size_)
+		begin += size_ - begin % size_;
+
+	if (begin + size - tail_ > size_)
+		return nullptr;
+
+	head_ = begin + size;
+	ranges_.push_back(Range { .begin_ = begin, .end_ = head_, .isReleased_ = false });
+
+	*offset = begin % size_;
+
+	return data_ + *offset;
+}
+
+void GLUploadRing::release(uint64_t offset)
+{
+	std::lock_guard lock(mutex_);
+
+	for (auto& r: ranges_)
+	{
+		if (!r.isReleased_ && r.begin_ % size_ == offset)
+		{
+			r.isReleased_ = true;
+			return;
+		}
+	}
+
+	assert(false);
+}
+
+void GLUploadRing::endFrame()
+{
+	uint64_t releasedEnd = fencedEnd_;
+
+	{
+		std::lock_guard lock(mutex_);
+
+		while (!ranges_.empty() && ranges_.front().isReleased_)
+		{
+			releasedEnd = ranges_.front().end_;
+			ranges_.pop_front();
+		}
+	}
+
+	// the copies issued so far read the released ranges
+	if (releasedEnd != fencedEnd_)
+	{
+		fences_.push_back(Fence { .sync_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), .end_ = releasedEnd });
+		fencedEnd_ = releasedEnd;
+	}
+
+	uint64_t completedEnd = 0;
+
+	while (!fences_.empty())
+	{
+		const GLenum status = glClientWaitSync(fences_.front().sync_, 0, 0);
+
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+
+		completedEnd = fences_.front().end_;
+		glDeleteSync(fences_.front().sync_);
+		fences_.pop_front();
+	}
+
+	if (completedEnd)
+	{
+		std::lock_guard lock(mutex_);
+		tail_ = completedEnd;
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+
+/**
+	Persistently mapped pixel unpack buffer used as a ring of staging memory for texture uploads.
+
+	Any thread can allocate() a range and write texels into it directly (the mapping is coherent, no flushes are needed).
+	The render thread issues the copies from the buffer (see GLTexture), then release()-s the ranges. endFrame() fences the released ranges:
+	they are recycled once the GPU has executed the copies. The ranges are recycled in the order of their allocations,
+	so a range which is never released holds back all the ranges allocated after it.
+*/
+class GLUploadRing final
+{
+public:
+	static constexpr size_t kDefaultSize = size_t(64) << 20;
+
+	explicit GLUploadRing(size_t size = kDefaultSize);
+	~GLUploadRing();
+
+	GLUploadRing(const GLUploadRing&) = delete;
+	GLUploadRing& operator=(const GLUploadRing&) = delete;
+
+	GLuint getHandle() const { return handle_; }
+
+	/// Thread-safe, returns nullptr if there is no free space now; 'offset' is the offset of the range in the buffer
+	uint8_t* allocate(size_t size, uint64_t* offset);
+
+	/// Render thread: the copies from the range allocated at 'offset' have been issued
+	void release(uint64_t offset);
+
+	/// Render thread: fence the ranges released since the previous call and recycle the ones the GPU is done with
+	void endFrame();
+
+private:
+	struct Range
+	{
+		// positions are monotonically increasing, the offset in the buffer is 'position % size_'
+		uint64_t begin_;
+		uint64_t end_;
+		bool isReleased_;
+	};
+
+	struct Fence
+	{
+		GLsync sync_;
+		uint64_t end_;
+	};
+
+	GLuint handle_ = 0;
+	uint8_t* data_ = nullptr;
+	size_t size_ = 0;
+
+	std::mutex mutex_;
+	// allocated ranges which are not fenced yet, in the order of allocations
+	std::deque<Range> ranges_;
+	uint64_t head_ = 0;
+	// everything before the tail is free
+	uint64_t tail_ = 0;
+
+	// render thread only
+	std::deque<Fence> fences_;
+	uint64_t fencedEnd_ = 0;
+};
@@ -3,6 +3,7 @@
 #include <array>
 
 #include "shared/glFramework/GLShader.h"
+#include "shared/glFramework/GLStreamingBuffer.h"
 #include "shared/glFramework/GLTexture.h"
 #include "shared/scene/VtxData.h"
 
@@ -96,6 +97,14 @@ public:
 class CanvasGL
 {
 public:
+	CanvasGL()
+	{
+		glCreateVertexArrays(1, &vao_);
+	}
+	~CanvasGL()
+	{
+		glDeleteVertexArrays(1, &vao_);
+	}
 	void line(const vec3& p1, const vec3& p2, const vec4& c)
 	{
 		lines_.push_back({ .position = p1, .color = c });
@@ -106,17 +115,21 @@ public:
 		if (lines_.empty())
 			return;
 
-		assert(lines_.size() < kMaxLines);
-
-		glNamedBufferSubData(mesh_.bufferVertices_->getHandle(), 0, uint32_t(lines_.size() * sizeof(VertexData)), lines_.data());
+		// the lines of the previous frames can still be read by the GPU, they are written into a new range every time
+		streaming_.bindRange(GL_SHADER_STORAGE_BUFFER, 1, streaming_.upload(lines_.data(), GLsizeiptr(lines_.size() * sizeof(VertexData))));
 		progLines_.useProgram();
-		mesh_.drawArrays(GL_LINES, 0, (GLint)lines_.size());
+		glBindVertexArray(vao_);
+		glDrawArrays(GL_LINES, 0, (GLint)lines_.size());
+		streaming_.endFrame();
 
 		lines_.clear();
 	}
 
+	uint32_t getNumStalls() const { return streaming_.getNumStalls(); }
+
 private:
-	static constexpr uint32_t kMaxLines = 1024*1024;
+	// the streaming buffer starts with this many line vertices per frame and grows if more lines are drawn
+	static constexpr uint32_t kInitialVertices = 16*1024;
 	struct VertexData {
 		vec3 position;
 		vec4 color;
@@ -125,7 +138,8 @@ private:
 	GLShader shdLinesVertex_ = GLShader("data/shaders/chapter08/GL01_lines.vert");
 	GLShader shdLinesFragment_ = GLShader("data/shaders/chapter08/GL01_lines.frag");
 	GLProgram progLines_ = GLProgram(shdLinesVertex_, shdLinesFragment_);
-	GLMeshPVP mesh_ = GLMeshPVP({}, nullptr, sizeof(VertexData) * kMaxLines);
+	GLuint vao_ = 0;
+	GLStreamingBuffer streaming_ = GLStreamingBuffer(sizeof(VertexData) * kInitialVertices);
 };
 
 inline void renderCameraFrustumGL(CanvasGL& canvas, const mat4& camView, const mat4& camProj, const vec4& color, int numSegments = 1)
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "shared/glFramework/GLShader.h"
+#include "shared/glFramework/GLStreamingBuffer.h"
 
 #include <imgui/imgui.h>
 #include <imgui/imgui_internal.h>
@@ -45,9 +46,8 @@ public:
 	{
 		glCreateVertexArrays(1, &vao_);
 
-		glVertexArrayElementBuffer(vao_, elements_.getHandle());
-		glVertexArrayVertexBuffer(vao_, 0, vertices_.getHandle(), 0, sizeof(ImDrawVert));
-
+		// vertices, indices and the projection matrix are written into the current frame's range of the streaming buffer,
+		// the vertex and element buffers are bound for every draw list (the streaming buffer is replaced when it grows)
 		glEnableVertexArrayAttrib(vao_, 0);
 		glEnableVertexArrayAttrib(vao_, 1);
 		glEnableVertexArrayAttrib(vao_, 2);
@@ -60,8 +60,6 @@ public:
 		glVertexArrayAttribBinding(vao_, 1, 0);
 		glVertexArrayAttribBinding(vao_, 2, 0);
 
-		glBindBufferBase(GL_UNIFORM_BUFFER, 7, perFrameDataBuffer_.getHandle());
-
 		defaultInitImGui();
 	}
 	~ImGuiGLRenderer()
@@ -69,6 +67,7 @@ public:
 		glDeleteVertexArrays(1, &vao_);
 		glDeleteTextures(1, &texture_);
 	}
+	uint32_t getNumStalls() const { return streaming_.getNumStalls(); }
 	void render(int width, int height, const ImDrawData* draw_data)
 	{
 		if (!draw_data)
@@ -91,13 +90,15 @@ public:
 		const float B = draw_data->DisplayPos.y + draw_data->DisplaySize.y;
 		const glm::mat4 orthoProjection = glm::ortho(L, R, B, T);
 
-		glNamedBufferSubData(perFrameDataBuffer_.getHandle(), 0, sizeof(glm::mat4), glm::value_ptr(orthoProjection));
+		streaming_.bindRange(GL_UNIFORM_BUFFER, 7, streaming_.upload(glm::value_ptr(orthoProjection), sizeof(glm::mat4)));
 
 		for (int n = 0; n < draw_data->CmdListsCount; n++)
 		{
 			const ImDrawList* cmd_list = draw_data->CmdLists[n];
-			glNamedBufferSubData(vertices_.getHandle(), 0, (GLsizeiptr)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert), cmd_list->VtxBuffer.Data);
-			glNamedBufferSubData(elements_.getHandle(), 0, (GLsizeiptr)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx), cmd_list->IdxBuffer.Data);
+			const GLStreamingBuffer::Range vertices = streaming_.upload(cmd_list->VtxBuffer.Data, (GLsizeiptr)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+			const GLStreamingBuffer::Range elements = streaming_.upload(cmd_list->IdxBuffer.Data, (GLsizeiptr)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+			glVertexArrayVertexBuffer(vao_, 0, vertices.buffer_, vertices.offset_, sizeof(ImDrawVert));
+			glVertexArrayElementBuffer(vao_, elements.buffer_);
 
 			for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++)
 			{
@@ -106,12 +107,14 @@ public:
 				glScissor((int)cr.x, (int)(height - cr.w), (int)(cr.z - cr.x), (int)(cr.w - cr.y));
 				glBindTextureUnit(0, (GLuint)(intptr_t)pcmd->TextureId);
 				glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, GL_UNSIGNED_SHORT,
-					(void*)(intptr_t)(pcmd->IdxOffset * sizeof(ImDrawIdx)), (GLint)pcmd->VtxOffset);
+					(void*)(intptr_t)(elements.offset_ + pcmd->IdxOffset * sizeof(ImDrawIdx)), (GLint)pcmd->VtxOffset);
 			}
 		}
 
 		glScissor(0, 0, width, height);
 		glDisable(GL_SCISSOR_TEST);
+
+		streaming_.endFrame();
 	}
 
 private:
@@ -152,12 +155,10 @@ private:
 private:
 	GLuint texture_ = 0;
 	GLuint vao_ = 0;
-	GLBuffer vertices_ = GLBuffer(128 * 1024, nullptr, GL_DYNAMIC_STORAGE_BIT);
-	GLBuffer elements_ = GLBuffer(256 * 1024, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	GLStreamingBuffer streaming_ = GLStreamingBuffer(256 * 1024);
 	GLShader vertex_ = GLShader(GL_VERTEX_SHADER, shaderCodeImGuiVertex);
 	GLShader fragment_ = GLShader(GL_FRAGMENT_SHADER, shaderCodeImGuiFragment);
 	GLProgram program_ = GLProgram(vertex_, fragment_);
-	GLBuffer perFrameDataBuffer_ = GLBuffer(sizeof(glm::mat4), nullptr, GL_DYNAMIC_STORAGE_BIT);
 };
 
 void imguiTextureWindowGL(const char* title, uint32_t texId)
@@ -62,6 +62,18 @@ void loadMaterials(const char* fileName, std::vector<MaterialDescription>& mater
 	fclose(f);
 }
 
+std::vector<bool> getSRGBTextures(const std::vector<MaterialDescription>& materials, size_t numTextures)
+{
+	std::vector<bool> isSRGB(numTextures, true);
+
+	for (const auto& m: materials)
+		for (const uint64_t map: { m.ambientOcclusionMap_, m.metallicRoughnessMap_, m.normalMap_, m.opacityMap_ })
+			if (map < numTextures)
+				isSRGB[map] = false;
+
+	return isSRGB;
+}
+
 void mergeMaterialLists(
 	const std::vector< std::vector<MaterialDescription>* >& oldMaterials,
 	const std::vector< std::vector<std::string>* >& oldTextures,
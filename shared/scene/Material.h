@@ -40,6 +40,9 @@ static_assert(sizeof(MaterialDescription) % 16 == 0, "MaterialDescription should
 void saveMaterials(const char* fileName, const std::vector<MaterialDescription>& materials, const std::vector<std::string>& files);
 void loadMaterials(const char* fileName, std::vector<MaterialDescription>& materials, std::vector<std::string>& files);
 
+// Which textures hold sRGB-encoded colors: all of them except the ones used as normal, metallic-roughness, occlusion or opacity maps
+std::vector<bool> getSRGBTextures(const std::vector<MaterialDescription>& materials, size_t numTextures);
+
 // Merge material lists from multiple scenes (follows the logic of merging in mergeScenes)
 void mergeMaterialLists(
 	// Input:
@@ -0,0 +1,398 @@
+#include "shared/scene/OcclusionCulling.h"
+
+#include <algorithm>
+#include <float.h>
+#include <numeric>
+#include <stdio.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#	define OCCLUSION_USE_SSE 1
+#	include <emmintrin.h>
+#endif
+
+using glm::vec3;
+using glm::vec4;
+
+// Vertices closer than this (in clip space W) are treated as behind the eye
+static constexpr float kMinW = 1e-4f;
+
+// The vertex is between the eye and the near plane (or behind the eye): the renderer clips it away, its depth would be negative here
+static inline bool isBeforeNearPlane(const vec4& p)
+{
+	return p.w < kMinW || p.z < -p.w;
+}
+
+// Vertices close to the near plane project far outside of the screen: the coordinates are clamped before the conversion (NaN goes to 'minV')
+static inline int toPixel(float v, int minV, int maxV)
+{
+	if (!(v > float(minV)))
+		return minV;
+	if (v >= float(maxV))
+		return maxV;
+	return int(v);
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height)
+: w_((width + kTileWidth - 1) / kTileWidth * kTileWidth)
+, h_((height + kTileHeight - 1) / kTileHeight * kTileHeight)
+, tilesX_(w_ / kTileWidth)
+, tilesY_(h_ / kTileHeight)
+, depth_(w_ * h_, 1.0f)
+, tileMaxDepth_(tilesX_ * tilesY_, 1.0f)
+, tileBins_(tilesX_ * tilesY_)
+{
+}
+
+void OcclusionBuffer::clear(const glm::mat4& viewProj)
+{
+	viewProj_ = viewProj;
+	triangles_.clear();
+	std::fill(depth_.begin(), depth_.end(), 1.0f);
+	std::fill(tileMaxDepth_.begin(), tileMaxDepth_.end(), 1.0f);
+}
+
+void OcclusionBuffer::addOccluder(const float* vertices, uint32_t vertexStride, const uint32_t* indices, uint32_t indexCount, uint32_t baseVertex, const glm::mat4& model)
+{
+	const glm::mat4 mvp = viewProj_ * model;
+
+	const float w = float(w_);
+	const float h = float(h_);
+
+	for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		Triangle tri;
+		bool clipped = false;
+
+		for (int k = 0; k != 3; k++)
+		{
+			const float* v = vertices + (size_t)(indices[i + k] + baseVertex) * vertexStride;
+			const vec4 p = mvp * vec4(v[0], v[1], v[2], 1.0f);
+
+			// Occluder triangles crossing the near plane are skipped: dropping an occluder is always conservative
+			if (isBeforeNearPlane(p))
+			{
+				clipped = true;
+				break;
+			}
+
+			const vec3 ndc = vec3(p) / p.w;
+			tri.v[k] = vec3((ndc.x * 0.5f + 0.5f) * w, (0.5f - ndc.y * 0.5f) * h, ndc.z * 0.5f + 0.5f);
+		}
+
+		if (clipped)
+			continue;
+
+		// bring the triangle to one winding, so both front and back faces occlude
+		const vec3 e1 = tri.v[1] - tri.v[0];
+		const vec3 e2 = tri.v[2] - tri.v[0];
+		const float area = e1.x * e2.y - e1.y * e2.x;
+
+		if (fabsf(area) < 1e-6f)
+			continue;
+
+		if (area < 0.0f)
+			std::swap(tri.v[1], tri.v[2]);
+
+		const float minX = std::min({ tri.v[0].x, tri.v[1].x, tri.v[2].x });
+		const float maxX = std::max({ tri.v[0].x, tri.v[1].x, tri.v[2].x });
+		const float minY = std::min({ tri.v[0].y, tri.v[1].y, tri.v[2].y });
+		const float maxY = std::max({ tri.v[0].y, tri.v[1].y, tri.v[2].y });
+		const float minZ = std::min({ tri.v[0].z, tri.v[1].z, tri.v[2].z });
+
+		if (maxX < 0.0f || maxY < 0.0f || minX > w || minY > h || minZ > 1.0f)
+			continue;
+
+		triangles_.push_back(tri);
+	}
+}
+
+void OcclusionBuffer::rasterize(tf::Executor* executor)
+{
+	// 1. Bin all the triangles into screen tiles
+	for (auto& b: tileBins_)
+		b.clear();
+
+	for (uint32_t t = 0; t != (uint32_t)triangles_.size(); t++)
+	{
+		const Triangle& tri = triangles_[t];
+
+		const float minX = std::min({ tri.v[0].x, tri.v[1].x, tri.v[2].x });
+		const float maxX = std::max({ tri.v[0].x, tri.v[1].x, tri.v[2].x });
+		const float minY = std::min({ tri.v[0].y, tri.v[1].y, tri.v[2].y });
+		const float maxY = std::max({ tri.v[0].y, tri.v[1].y, tri.v[2].y });
+
+		const int tx0 = toPixel(minX, 0, w_ - 1) / kTileWidth;
+		const int tx1 = toPixel(maxX, 0, w_ - 1) / kTileWidth;
+		const int ty0 = toPixel(minY, 0, h_ - 1) / kTileHeight;
+		const int ty1 = toPixel(maxY, 0, h_ - 1) / kTileHeight;
+
+		for (int ty = ty0; ty <= ty1; ty++)
+			for (int tx = tx0; tx <= tx1; tx++)
+				tileBins_[ty * tilesX_ + tx].push_back(t);
+	}
+
+	// 2. Rasterize the tiles independently
+	const int numTiles = tilesX_ * tilesY_;
+
+	if (executor)
+	{
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, numTiles, 1, [this](int tile) { rasterizeTile(tile); });
+		executor->run(taskflow).wait();
+	}
+	else
+	{
+		for (int tile = 0; tile != numTiles; tile++)
+			rasterizeTile(tile);
+	}
+}
+
+void OcclusionBuffer::rasterizeTile(int tile)
+{
+	const int x0 = (tile % tilesX_) * kTileWidth;
+	const int y0 = (tile / tilesX_) * kTileHeight;
+	const int x1 = x0 + kTileWidth - 1;
+	const int y1 = y0 + kTileHeight - 1;
+
+	for (uint32_t t: tileBins_[tile])
+	{
+		const vec3& a = triangles_[t].v[0];
+		const vec3& b = triangles_[t].v[1];
+		const vec3& c = triangles_[t].v[2];
+
+		// edge functions E(x, y) = A * x + B * y + C, positive inside the triangle
+		const float A0 = a.y - b.y, B0 = b.x - a.x, C0 = -(A0 * a.x + B0 * a.y);
+		const float A1 = b.y - c.y, B1 = c.x - b.x, C1 = -(A1 * b.x + B1 * b.y);
+		const float A2 = c.y - a.y, B2 = a.x - c.x, C2 = -(A2 * c.x + B2 * c.y);
+
+		const float area = A0 * c.x + B0 * c.y + C0;
+
+		// depth plane Z(x, y) = ZA * x + ZB * y + ZC (barycentric weight of 'b' is E2/area and of 'c' is E0/area)
+		const float dzb = (b.z - a.z) / area;
+		const float dzc = (c.z - a.z) / area;
+		const float ZA = A2 * dzb + A0 * dzc;
+		const float ZB = B2 * dzb + B0 * dzc;
+		const float ZC = a.z + C2 * dzb + C0 * dzc;
+
+		const int minX = toPixel(std::min({ a.x, b.x, c.x }), x0, x1) & ~3;
+		const int maxX = toPixel(std::max({ a.x, b.x, c.x }), x0, x1);
+		const int minY = toPixel(std::min({ a.y, b.y, c.y }), y0, y1);
+		const int maxY = toPixel(std::max({ a.y, b.y, c.y }), y0, y1);
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			const float py = float(y) + 0.5f;
+			float* row = depth_.data() + y * w_;
+
+#if OCCLUSION_USE_SSE
+			const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			const __m128 zero = _mm_setzero_ps();
+
+			for (int x = minX; x <= maxX; x += 4)
+			{
+				const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), laneOffsets);
+
+				const __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A0), px), _mm_set1_ps(B0 * py + C0));
+				const __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A1), px), _mm_set1_ps(B1 * py + C1));
+				const __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A2), px), _mm_set1_ps(B2 * py + C2));
+
+				const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+
+				if (!_mm_movemask_ps(inside))
+					continue;
+
+				const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ZA), px), _mm_set1_ps(ZB * py + ZC));
+				const __m128 oldZ = _mm_loadu_ps(row + x);
+				const __m128 newZ = _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(oldZ, z)), _mm_andnot_ps(inside, oldZ));
+
+				_mm_storeu_ps(row + x, newZ);
+			}
+#else
+			for (int x = minX; x <= maxX; x += 4)
+			{
+				for (int lane = 0; lane != 4; lane++)
+				{
+					const float px = float(x + lane) + 0.5f;
+
+					if ((A0 * px + B0 * py + C0 < 0.0f) || (A1 * px + B1 * py + C1 < 0.0f) || (A2 * px + B2 * py + C2 < 0.0f))
+						continue;
+
+					row[x + lane] = std::min(row[x + lane], ZA * px + ZB * py + ZC);
+				}
+			}
+#endif
+		}
+	}
+
+	// update the coarse level
+	float maxDepth = 0.0f;
+
+	for (int y = y0; y <= y1; y++)
+	{
+		const float* row = depth_.data() + y * w_;
+		for (int x = x0; x <= x1; x++)
+			maxDepth = std::max(maxDepth, row[x]);
+	}
+
+	tileMaxDepth_[tile] = maxDepth;
+}
+
+bool OcclusionBuffer::isBoxVisible(const BoundingBox& box) const
+{
+	const vec3 corners[] = {
+		vec3(box.min_.x, box.min_.y, box.min_.z),
+		vec3(box.min_.x, box.max_.y, box.min_.z),
+		vec3(box.min_.x, box.min_.y, box.max_.z),
+		vec3(box.min_.x, box.max_.y, box.max_.z),
+		vec3(box.max_.x, box.min_.y, box.min_.z),
+		vec3(box.max_.x, box.max_.y, box.min_.z),
+		vec3(box.max_.x, box.min_.y, box.max_.z),
+		vec3(box.max_.x, box.max_.y, box.max_.z),
+	};
+
+	float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+	for (const auto& c: corners)
+	{
+		const vec4 p = viewProj_ * vec4(c, 1.0f);
+
+		if (isBeforeNearPlane(p))
+			return true;
+
+		const vec3 ndc = vec3(p) / p.w;
+		const float sx = (ndc.x * 0.5f + 0.5f) * float(w_);
+		const float sy = (0.5f - ndc.y * 0.5f) * float(h_);
+
+		minX = std::min(minX, sx);
+		maxX = std::max(maxX, sx);
+		minY = std::min(minY, sy);
+		maxY = std::max(maxY, sy);
+		minZ = std::min(minZ, ndc.z * 0.5f + 0.5f);
+	}
+
+	// completely outside of the screen or beyond the far plane
+	if (maxX < 0.0f || maxY < 0.0f || minX >= float(w_) || minY >= float(h_) || minZ > 1.0f)
+		return false;
+
+	const int x0 = toPixel(floorf(minX), 0, w_ - 1);
+	const int x1 = toPixel(ceilf(maxX),  0, w_ - 1);
+	const int y0 = toPixel(floorf(minY), 0, h_ - 1);
+	const int y1 = toPixel(ceilf(maxY),  0, h_ - 1);
+
+	for (int ty = y0 / kTileHeight; ty <= y1 / kTileHeight; ty++)
+	{
+		for (int tx = x0 / kTileWidth; tx <= x1 / kTileWidth; tx++)
+		{
+			// every pixel in this tile is closer than the box
+			if (minZ > tileMaxDepth_[ty * tilesX_ + tx])
+				continue;
+
+			const int px0 = std::max(x0, tx * kTileWidth);
+			const int px1 = std::min(x1, tx * kTileWidth + kTileWidth - 1);
+			const int py0 = std::max(y0, ty * kTileHeight);
+			const int py1 = std::min(y1, ty * kTileHeight + kTileHeight - 1);
+
+			for (int y = py0; y <= py1; y++)
+			{
+				const float* row = depth_.data() + y * w_;
+				for (int x = px0; x <= px1; x++)
+					if (minZ <= row[x])
+						return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+Bitmap OcclusionBuffer::getDepthBitmap() const
+{
+	Bitmap bmp(w_, h_, 1, eBitmapFormat_UnsignedByte);
+
+	for (size_t i = 0; i != depth_.size(); i++)
+		bmp.data_[i] = uint8_t(clamp(depth_[i], 0.0f, 1.0f) * 255.0f);
+
+	return bmp;
+}
+
+bool OcclusionBuffer::saveDepthBuffer(const char* fileName) const
+{
+	FILE* f = fopen(fileName, "wb");
+
+	if (!f)
+	{
+		printf("Cannot open %s for writing\n", fileName);
+		return false;
+	}
+
+	const Bitmap bmp = getDepthBitmap();
+
+	fprintf(f, "P5\n%d %d\n255\n", bmp.w_, bmp.h_);
+	fwrite(bmp.data_.data(), 1, bmp.data_.size(), f);
+	fclose(f);
+
+	return true;
+}
+
+std::vector<uint32_t> selectOccluders(const MeshData& meshData, const std::vector<DrawData>& shapes, const std::vector<glm::mat4>& globalTransforms, const OcclusionCullingParams& params)
+{
+	std::vector<float> areas(shapes.size());
+
+	for (size_t i = 0; i != shapes.size(); i++)
+	{
+		const vec3 s = meshData.boxes_[shapes[i].meshIndex].getTransformed(globalTransforms[shapes[i].transformIndex]).getSize();
+		areas[i] = s.x * s.y + s.y * s.z + s.z * s.x;
+	}
+
+	std::vector<uint32_t> occluders(shapes.size());
+	std::iota(occluders.begin(), occluders.end(), 0);
+
+	const size_t count = std::min((size_t)params.maxOccluders, shapes.size());
+
+	std::partial_sort(occluders.begin(), occluders.begin() + count, occluders.end(),
+		[&areas](uint32_t a, uint32_t b) { return areas[a] > areas[b]; });
+
+	occluders.resize(count);
+
+	return occluders;
+}
+
+void cullShapes(OcclusionBuffer& buffer, const glm::mat4& viewProj,
+	const MeshData& meshData, const std::vector<DrawData>& shapes, const std::vector<glm::mat4>& globalTransforms,
+	const std::vector<uint32_t>& occluders, bool* visibility,
+	tf::Executor* executor, const OcclusionCullingParams& params)
+{
+	buffer.clear(viewProj);
+
+	for (uint32_t i: occluders)
+	{
+		const DrawData& dd = shapes[i];
+		const Mesh& mesh = meshData.meshes_[dd.meshIndex];
+		const uint32_t lod = std::min(params.occluderLOD, mesh.lodCount - 1);
+
+		buffer.addOccluder(meshData.vertexData_.data(), 8, /* position, UV + normal */
+			meshData.indexData_.data() + mesh.indexOffset + mesh.lodOffset[lod], mesh.getLODIndicesCount(lod),
+			mesh.vertexOffset, globalTransforms[dd.transformIndex]);
+	}
+
+	buffer.rasterize(executor);
+
+	auto testShape = [&](int i)
+	{
+		const DrawData& dd = shapes[i];
+		visibility[i] = buffer.isBoxVisible(meshData.boxes_[dd.meshIndex].getTransformed(globalTransforms[dd.transformIndex]));
+	};
+
+	if (executor)
+	{
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, (int)shapes.size(), 1, testShape);
+		executor->run(taskflow).wait();
+	}
+	else
+	{
+		for (int i = 0; i != (int)shapes.size(); i++)
+			testShape(i);
+	}
+}
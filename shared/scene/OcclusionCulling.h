@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "shared/Bitmap.h"
+#include "shared/UtilsMath.h"
+#include "shared/scene/VtxData.h"
+
+#include <taskflow/taskflow.hpp>
+
+/**
+	CPU software occlusion culling.
+
+	A small set of occluders is rasterized into a low-resolution depth buffer split into screen tiles.
+	Each tile is rasterized independently (4 pixels at a time) and keeps a conservative "farthest depth" value,
+	which is the coarse level of a two-level hierarchical depth buffer.
+	Occludees (world-space bounding boxes) are tested against the coarse level first and against the individual pixels only when needed.
+
+	No GPU is involved, so this runs headless. Depth values are in [0..1], 0 is the near plane (OpenGL-style clip space is assumed).
+*/
+struct OcclusionBuffer
+{
+	static constexpr int kTileWidth  = 32;
+	static constexpr int kTileHeight = 8;
+
+	explicit OcclusionBuffer(int width = 256, int height = 128);
+
+	/* Start a new frame: drop all queued occluders and reset the depth to the far plane */
+	void clear(const glm::mat4& viewProj);
+
+	/* Queue indexed triangles (vertexStride is in floats, position is the first 3 floats of each vertex) */
+	void addOccluder(const float* vertices, uint32_t vertexStride, const uint32_t* indices, uint32_t indexCount, uint32_t baseVertex, const glm::mat4& model);
+
+	/* Rasterize all the queued occluders (tiles are processed in parallel if the executor is provided) */
+	void rasterize(tf::Executor* executor = nullptr);
+
+	/* Test a world-space bounding box. Boxes crossing the near plane are always visible */
+	bool isBoxVisible(const BoundingBox& box) const;
+
+	/* Debug output: 8-bit grayscale depth image (white = far) and a binary PGM dump of it */
+	Bitmap getDepthBitmap() const;
+	bool saveDepthBuffer(const char* fileName) const;
+
+	inline int getWidth() const { return w_; }
+	inline int getHeight() const { return h_; }
+	inline const std::vector<float>& getDepth() const { return depth_; }
+
+private:
+	struct Triangle
+	{
+		// screen-space X, Y and depth for each vertex
+		glm::vec3 v[3];
+	};
+
+	int w_;
+	int h_;
+	int tilesX_;
+	int tilesY_;
+
+	glm::mat4 viewProj_ = glm::mat4(1.0f);
+
+	std::vector<float> depth_;
+	// coarse level: the farthest depth value in each tile
+	std::vector<float> tileMaxDepth_;
+
+	std::vector<Triangle> triangles_;
+	std::vector<std::vector<uint32_t>> tileBins_;
+
+	void rasterizeTile(int tile);
+};
+
+struct OcclusionCullingParams
+{
+	/* How many draw items are rasterized as occluders */
+	uint32_t maxOccluders = 64;
+	/* Mesh LOD used for occluder rasterization (clamped to the available LODs) */
+	uint32_t occluderLOD = 0;
+};
+
+/* Pick the draw items with the largest world-space bounding boxes. Returns indices into 'shapes' */
+std::vector<uint32_t> selectOccluders(const MeshData& meshData, const std::vector<DrawData>& shapes, const std::vector<glm::mat4>& globalTransforms, const OcclusionCullingParams& params = OcclusionCullingParams());
+
+/* Rasterize the occluders and fill visibility[i] for each item in shapes (the array is suitable for MultiRenderer::updateIndirectBuffers()) */
+void cullShapes(OcclusionBuffer& buffer, const glm::mat4& viewProj,
+	const MeshData& meshData, const std::vector<DrawData>& shapes, const std::vector<glm::mat4>& globalTransforms,
+	const std::vector<uint32_t>& occluders, bool* visibility,
+	tf::Executor* executor = nullptr, const OcclusionCullingParams& params = OcclusionCullingParams());
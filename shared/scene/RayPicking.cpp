@@ -0,0 +1,640 @@
+#include "shared/scene/RayPicking.h"
+
+#include <algorithm>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#	define RAYPICKING_USE_SSE 1
+#	include <emmintrin.h>
+#endif
+
+using glm::vec3;
+using glm::vec4;
+
+/* 8 is the number of per-vertex attributes: position, normal + UV */
+static constexpr uint32_t kNumVertexComponents = 8;
+
+static constexpr uint32_t kNumBins = 16;
+
+/* Beyond this depth the builder switches to median splits, which bounds the total depth by kMaxBVHDepth */
+static constexpr uint32_t kMaxSAHDepth = 32;
+static constexpr uint32_t kMaxBVHDepth = 64;
+
+/* Lanes with |det| below this value are treated as parallel to the ray (the padding lanes have det == 0) */
+static constexpr float kDetEpsilon = 1e-20f;
+
+static inline float surfaceArea(const BoundingBox& b)
+{
+	const vec3 d = b.max_ - b.min_;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static inline BoundingBox emptyBox()
+{
+	BoundingBox b;
+	b.min_ = vec3(FLT_MAX);
+	b.max_ = vec3(-FLT_MAX);
+	return b;
+}
+
+static inline void growBox(BoundingBox& b, const BoundingBox& other)
+{
+	b.min_ = glm::min(b.min_, other.min_);
+	b.max_ = glm::max(b.max_, other.max_);
+}
+
+void buildBVH(const std::vector<BoundingBox>& boxes, uint32_t maxLeafSize, std::vector<BVHNode>& outNodes, std::vector<uint32_t>& outOrder)
+{
+	const uint32_t numPrims = (uint32_t)boxes.size();
+
+	outNodes.clear();
+	outOrder.resize(numPrims);
+	std::iota(outOrder.begin(), outOrder.end(), 0);
+
+	if (!numPrims)
+		return;
+
+	std::vector<vec3> centroids(numPrims);
+	for (uint32_t i = 0; i != numPrims; i++)
+		centroids[i] = boxes[i].getCenter();
+
+	outNodes.reserve(2 * numPrims);
+	outNodes.push_back(BVHNode { .first_ = 0, .count_ = numPrims });
+
+	struct StackItem
+	{
+		uint32_t node;
+		uint32_t depth;
+	};
+
+	std::vector<StackItem> stack = { { 0, 0 } };
+
+	while (!stack.empty())
+	{
+		const StackItem item = stack.back();
+		stack.pop_back();
+
+		const uint32_t first = outNodes[item.node].first_;
+		const uint32_t count = outNodes[item.node].count_;
+
+		BoundingBox bounds = emptyBox();
+		BoundingBox centroidBounds = emptyBox();
+
+		for (uint32_t i = first; i != first + count; i++)
+		{
+			growBox(bounds, boxes[outOrder[i]]);
+			centroidBounds.combinePoint(centroids[outOrder[i]]);
+		}
+
+		outNodes[item.node].min_ = bounds.min_;
+		outNodes[item.node].max_ = bounds.max_;
+
+		if (count <= maxLeafSize)
+			continue;
+
+		const vec3 extent = centroidBounds.max_ - centroidBounds.min_;
+
+		int bestAxis = -1;
+		uint32_t bestSplit = 0;
+
+		if (item.depth < kMaxSAHDepth)
+		{
+			float bestCost = FLT_MAX;
+
+			for (int axis = 0; axis != 3; axis++)
+			{
+				if (extent[axis] <= 0.0f)
+					continue;
+
+				BoundingBox binBounds[kNumBins];
+				uint32_t binCount[kNumBins] = { 0 };
+				for (auto& b: binBounds)
+					b = emptyBox();
+
+				const float scale = float(kNumBins) / extent[axis];
+
+				for (uint32_t i = first; i != first + count; i++)
+				{
+					const uint32_t p = outOrder[i];
+					const uint32_t bin = std::min(uint32_t((centroids[p][axis] - centroidBounds.min_[axis]) * scale), kNumBins - 1);
+					binCount[bin]++;
+					growBox(binBounds[bin], boxes[p]);
+				}
+
+				// sweep from the right to accumulate the right-side costs, then from the left
+				float rightArea[kNumBins];
+				uint32_t rightCount[kNumBins];
+				BoundingBox acc = emptyBox();
+				uint32_t accCount = 0;
+
+				for (uint32_t b = kNumBins - 1; b > 0; b--)
+				{
+					if (binCount[b])
+						growBox(acc, binBounds[b]);
+					accCount += binCount[b];
+					rightArea[b] = accCount ? surfaceArea(acc) : 0.0f;
+					rightCount[b] = accCount;
+				}
+
+				acc = emptyBox();
+				accCount = 0;
+
+				for (uint32_t b = 0; b != kNumBins - 1; b++)
+				{
+					if (binCount[b])
+						growBox(acc, binBounds[b]);
+					accCount += binCount[b];
+
+					if (!accCount || !rightCount[b + 1])
+						continue;
+
+					const float cost = surfaceArea(acc) * accCount + rightArea[b + 1] * rightCount[b + 1];
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = b + 1;
+					}
+				}
+			}
+		}
+
+		uint32_t mid = first + count / 2;
+
+		if (bestAxis >= 0)
+		{
+			const float scale = float(kNumBins) / extent[bestAxis];
+			const float minC = centroidBounds.min_[bestAxis];
+
+			auto it = std::partition(outOrder.begin() + first, outOrder.begin() + first + count, [&](uint32_t p) {
+				return std::min(uint32_t((centroids[p][bestAxis] - minC) * scale), kNumBins - 1) < bestSplit;
+			});
+
+			mid = (uint32_t)(it - outOrder.begin());
+		}
+		else
+		{
+			// median split along the largest centroid extent (also handles coincident centroids)
+			const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : ((extent.y >= extent.z) ? 1 : 2);
+
+			std::nth_element(outOrder.begin() + first, outOrder.begin() + mid, outOrder.begin() + first + count, [&](uint32_t a, uint32_t b) {
+				return centroids[a][axis] < centroids[b][axis];
+			});
+		}
+
+		const uint32_t left = (uint32_t)outNodes.size();
+
+		outNodes.push_back(BVHNode { .first_ = first, .count_ = mid - first });
+		outNodes.push_back(BVHNode { .first_ = mid,   .count_ = first + count - mid });
+
+		outNodes[item.node].first_ = left;
+		outNodes[item.node].count_ = 0;
+
+		stack.push_back({ left + 1, item.depth + 1 });
+		stack.push_back({ left,     item.depth + 1 });
+	}
+}
+
+static inline bool intersectNode(const BVHNode& node, const vec3& origin, const vec3& invDir, float tMax, float& tNear)
+{
+	const vec3 t0 = (node.min_ - origin) * invDir;
+	const vec3 t1 = (node.max_ - origin) * invDir;
+
+	const vec3 tMin = glm::min(t0, t1);
+	const vec3 tFar = glm::max(t0, t1);
+
+	tNear = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+	const float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+
+	return tNear <= tExit;
+}
+
+/* Front-to-back traversal. visitLeaf(node, tBest) may shrink tBest and returns true to terminate the traversal (any-hit queries) */
+template <typename LeafFunc>
+static void traverseBVH(const std::vector<BVHNode>& nodes, const Ray& ray, float& tBest, LeafFunc visitLeaf)
+{
+	if (nodes.empty())
+		return;
+
+	const vec3 invDir = 1.0f / ray.dir_;
+
+	struct StackItem
+	{
+		uint32_t node;
+		float tNear;
+	};
+
+	StackItem stack[kMaxBVHDepth + 1];
+	uint32_t sp = 0;
+
+	float tRoot;
+	if (!intersectNode(nodes[0], ray.origin_, invDir, tBest, tRoot))
+		return;
+
+	stack[sp++] = { 0, tRoot };
+
+	while (sp)
+	{
+		const StackItem item = stack[--sp];
+
+		if (item.tNear > tBest)
+			continue;
+
+		const BVHNode& node = nodes[item.node];
+
+		if (node.count_)
+		{
+			if (visitLeaf(node, tBest))
+				return;
+			continue;
+		}
+
+		float tLeft, tRight;
+		const bool hitLeft = intersectNode(nodes[node.first_], ray.origin_, invDir, tBest, tLeft);
+		const bool hitRight = intersectNode(nodes[node.first_ + 1], ray.origin_, invDir, tBest, tRight);
+
+		// push the far child first, so the near one is processed next
+		if (hitLeft && hitRight)
+		{
+			if (tLeft <= tRight)
+			{
+				stack[sp++] = { node.first_ + 1, tRight };
+				stack[sp++] = { node.first_, tLeft };
+			}
+			else
+			{
+				stack[sp++] = { node.first_, tLeft };
+				stack[sp++] = { node.first_ + 1, tRight };
+			}
+		}
+		else if (hitLeft)
+			stack[sp++] = { node.first_, tLeft };
+		else if (hitRight)
+			stack[sp++] = { node.first_ + 1, tRight };
+	}
+}
+
+/* Double-sided Moeller-Trumbore test for 4 triangles. Returns the lane of the nearest hit closer than tBest or -1 */
+template <bool anyHit, typename Packet>
+static int intersectPacket(const Packet& p, const Ray& ray, float tBest, float& outT, float& outU, float& outV)
+{
+#if defined(RAYPICKING_USE_SSE)
+	const __m128 dx = _mm_set1_ps(ray.dir_.x);
+	const __m128 dy = _mm_set1_ps(ray.dir_.y);
+	const __m128 dz = _mm_set1_ps(ray.dir_.z);
+
+	const __m128 e1x = _mm_loadu_ps(p.e1_[0]);
+	const __m128 e1y = _mm_loadu_ps(p.e1_[1]);
+	const __m128 e1z = _mm_loadu_ps(p.e1_[2]);
+	const __m128 e2x = _mm_loadu_ps(p.e2_[0]);
+	const __m128 e2y = _mm_loadu_ps(p.e2_[1]);
+	const __m128 e2z = _mm_loadu_ps(p.e2_[2]);
+
+	// pvec = cross(dir, e2)
+	const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+	const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+
+	// tvec = origin - v0
+	const __m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin_.x), _mm_loadu_ps(p.v0_[0]));
+	const __m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin_.y), _mm_loadu_ps(p.v0_[1]));
+	const __m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin_.z), _mm_loadu_ps(p.v0_[2]));
+
+	// qvec = cross(tvec, e1)
+	const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+	const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+	const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+	const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+
+	__m128 mask = _mm_cmpgt_ps(absDet, _mm_set1_ps(kDetEpsilon));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+	mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(tBest)));
+
+	const int bits = _mm_movemask_ps(mask);
+	if (!bits)
+		return -1;
+
+	alignas(16) float tt[4], uu[4], vv[4];
+	_mm_store_ps(tt, t);
+	_mm_store_ps(uu, u);
+	_mm_store_ps(vv, v);
+
+	int lane = -1;
+	for (int i = 0; i != 4; i++)
+	{
+		if (!(bits & (1 << i)) || tt[i] >= tBest)
+			continue;
+		lane = i;
+		tBest = tt[i];
+		if (anyHit)
+			break;
+	}
+
+	outT = tt[lane];
+	outU = uu[lane];
+	outV = vv[lane];
+
+	return lane;
+#else
+	int lane = -1;
+
+	for (int i = 0; i != 4; i++)
+	{
+		const vec3 e1(p.e1_[0][i], p.e1_[1][i], p.e1_[2][i]);
+		const vec3 e2(p.e2_[0][i], p.e2_[1][i], p.e2_[2][i]);
+		const vec3 pvec = glm::cross(ray.dir_, e2);
+		const float det = glm::dot(e1, pvec);
+
+		if (fabsf(det) <= kDetEpsilon)
+			continue;
+
+		const float invDet = 1.0f / det;
+		const vec3 tvec = ray.origin_ - vec3(p.v0_[0][i], p.v0_[1][i], p.v0_[2][i]);
+		const float u = glm::dot(tvec, pvec) * invDet;
+		if (u < 0.0f || u > 1.0f)
+			continue;
+
+		const vec3 qvec = glm::cross(tvec, e1);
+		const float v = glm::dot(ray.dir_, qvec) * invDet;
+		if (v < 0.0f || u + v > 1.0f)
+			continue;
+
+		const float t = glm::dot(e2, qvec) * invDet;
+		if (t <= 0.0f || t >= tBest)
+			continue;
+
+		lane = i;
+		tBest = outT = t;
+		outU = u;
+		outV = v;
+
+		if (anyHit)
+			break;
+	}
+
+	return lane;
+#endif // RAYPICKING_USE_SSE
+}
+
+void MeshBVH::build(const MeshData& meshData, uint32_t meshIndex, uint32_t lod)
+{
+	const Mesh& mesh = meshData.meshes_[meshIndex];
+
+	lod = std::min(lod, mesh.lodCount - 1);
+
+	meshIndex_ = meshIndex;
+	numTriangles_ = mesh.getLODIndicesCount(lod) / 3;
+
+	const uint32_t* indices = meshData.indexData_.data() + mesh.indexOffset + mesh.lodOffset[lod];
+
+	auto getPosition = [&](uint32_t i) {
+		const float* v = meshData.vertexData_.data() + (size_t)(indices[i] + mesh.vertexOffset) * kNumVertexComponents;
+		return vec3(v[0], v[1], v[2]);
+	};
+
+	std::vector<BoundingBox> boxes(numTriangles_);
+	for (size_t i = 0; i != numTriangles_; i++)
+	{
+		const vec3 pts[3] = { getPosition(3 * (uint32_t)i + 0), getPosition(3 * (uint32_t)i + 1), getPosition(3 * (uint32_t)i + 2) };
+		boxes[i] = BoundingBox(pts, 3);
+	}
+
+	std::vector<uint32_t> order;
+	buildBVH(boxes, kLeafSize, nodes_, order);
+
+	packets_.clear();
+
+	for (auto& node: nodes_)
+	{
+		if (!node.count_)
+			continue;
+
+		TrianglePacket p = {};
+
+		for (uint32_t lane = 0; lane != kLeafSize; lane++)
+		{
+			p.triangle_[lane] = ~0u;
+
+			if (lane >= node.count_)
+				continue;
+
+			const uint32_t tri = order[node.first_ + lane];
+			const vec3 v0 = getPosition(3 * tri + 0);
+			const vec3 e1 = getPosition(3 * tri + 1) - v0;
+			const vec3 e2 = getPosition(3 * tri + 2) - v0;
+
+			for (int c = 0; c != 3; c++)
+			{
+				p.v0_[c][lane] = v0[c];
+				p.e1_[c][lane] = e1[c];
+				p.e2_[c][lane] = e2[c];
+			}
+
+			p.triangle_[lane] = tri;
+		}
+
+		node.first_ = (uint32_t)packets_.size();
+		packets_.push_back(p);
+	}
+
+	bounds_ = nodes_.empty() ? BoundingBox(vec3(0.0f), vec3(0.0f)) : BoundingBox(nodes_[0].min_, nodes_[0].max_);
+}
+
+template <bool anyHit>
+bool MeshBVH::traverse(const Ray& ray, RayHit& hit) const
+{
+	float tBest = std::min(ray.tMax_, hit.t_);
+	bool found = false;
+
+	traverseBVH(nodes_, ray, tBest, [&](const BVHNode& node, float& tMax) {
+		const TrianglePacket& p = packets_[node.first_];
+
+		float t, u, v;
+		const int lane = intersectPacket<anyHit>(p, ray, tMax, t, u, v);
+
+		if (lane < 0)
+			return false;
+
+		found = true;
+		tMax = t;
+
+		hit.t_ = t;
+		hit.u_ = u;
+		hit.v_ = v;
+		hit.triangle_ = p.triangle_[lane];
+		hit.mesh_ = meshIndex_;
+		hit.node_ = -1;
+
+		return anyHit;
+	});
+
+	return found;
+}
+
+bool MeshBVH::intersect(const Ray& ray, RayHit& hit) const
+{
+	return traverse<false>(ray, hit);
+}
+
+bool MeshBVH::intersectAny(const Ray& ray) const
+{
+	RayHit hit;
+	return traverse<true>(ray, hit);
+}
+
+void SceneBVH::build(const MeshData& meshData, const Scene& scene, uint32_t lod, tf::Executor* executor)
+{
+	meshes_.resize(meshData.meshes_.size());
+
+	auto buildMesh = [&](int i) { meshes_[i].build(meshData, (uint32_t)i, lod); };
+
+	if (executor)
+	{
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, (int)meshes_.size(), 1, buildMesh);
+		executor->run(taskflow).wait();
+	}
+	else
+	{
+		for (int i = 0; i != (int)meshes_.size(); i++)
+			buildMesh(i);
+	}
+
+	updateTransforms(scene);
+}
+
+void SceneBVH::updateTransforms(const Scene& scene)
+{
+	instances_.clear();
+
+	std::vector<std::pair<Instance, BoundingBox>> items;
+
+	// prefab instances are expanded: all their meshes report the instance node
+	forEachMeshNode(scene, [&](uint32_t node, uint32_t mesh, uint32_t, const glm::mat4& instanceTransform)
+	{
+		if (mesh >= meshes_.size() || !meshes_[mesh].getTriangleCount())
+			return;
+
+		const glm::mat4 transform = scene.globalTransform_[node] * instanceTransform;
+
+		items.push_back({ Instance { .node_ = node, .mesh_ = mesh, .invTransform_ = glm::inverse(transform) }, meshes_[mesh].getBounds().getTransformed(transform) });
+	});
+
+	// unordered_map iteration order is unspecified: keep the results reproducible
+	std::stable_sort(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first.node_ < b.first.node_; });
+
+	std::vector<BoundingBox> boxes(items.size());
+	instances_.reserve(items.size());
+	for (size_t i = 0; i != items.size(); i++)
+	{
+		instances_.push_back(items[i].first);
+		boxes[i] = items[i].second;
+	}
+
+	buildBVH(boxes, 2, nodes_, order_);
+}
+
+template <bool anyHit>
+bool SceneBVH::traverse(const Ray& ray, RayHit& hit) const
+{
+	float tBest = std::min(ray.tMax_, hit.t_);
+	bool found = false;
+
+	traverseBVH(nodes_, ray, tBest, [&](const BVHNode& node, float& tMax) {
+		for (uint32_t i = node.first_; i != node.first_ + node.count_; i++)
+		{
+			const Instance& inst = instances_[order_[i]];
+
+			// the direction is not normalized, so 't' stays the same in mesh space
+			const Ray localRay = {
+				.origin_ = vec3(inst.invTransform_ * vec4(ray.origin_, 1.0f)),
+				.dir_ = glm::mat3(inst.invTransform_) * ray.dir_,
+				.tMax_ = tMax
+			};
+
+			if (anyHit)
+			{
+				if (meshes_[inst.mesh_].intersectAny(localRay))
+				{
+					found = true;
+					return true;
+				}
+			}
+			else if (meshes_[inst.mesh_].intersect(localRay, hit))
+			{
+				found = true;
+				tMax = hit.t_;
+				hit.node_ = (int)inst.node_;
+			}
+		}
+		return false;
+	});
+
+	return found;
+}
+
+bool SceneBVH::intersect(const Ray& ray, RayHit& hit) const
+{
+	return traverse<false>(ray, hit);
+}
+
+bool SceneBVH::intersectAny(const Ray& ray) const
+{
+	RayHit hit;
+	return traverse<true>(ray, hit);
+}
+
+template <typename Func>
+void SceneBVH::forEachRay(size_t count, tf::Executor* executor, Func func) const
+{
+	// small batches keep the per-task overhead low and balance the load between threads
+	constexpr size_t kBatchSize = 256;
+
+	const int numBatches = (int)((count + kBatchSize - 1) / kBatchSize);
+
+	auto processBatch = [&](int batch) {
+		const size_t end = std::min(count, (batch + 1) * kBatchSize);
+		for (size_t i = batch * kBatchSize; i < end; i++)
+			func(i);
+	};
+
+	if (executor)
+	{
+		tf::Taskflow taskflow;
+		taskflow.for_each_index(0, numBatches, 1, processBatch);
+		executor->run(taskflow).wait();
+	}
+	else
+	{
+		for (int b = 0; b != numBatches; b++)
+			processBatch(b);
+	}
+}
+
+void SceneBVH::intersectRays(const Ray* rays, RayHit* hits, size_t count, tf::Executor* executor) const
+{
+	forEachRay(count, executor, [&](size_t i) {
+		hits[i] = RayHit();
+		intersect(rays[i], hits[i]);
+	});
+}
+
+void SceneBVH::intersectAnyRays(const Ray* rays, bool* occluded, size_t count, tf::Executor* executor) const
+{
+	forEachRay(count, executor, [&](size_t i) {
+		occluded[i] = intersectAny(rays[i]);
+	});
+}
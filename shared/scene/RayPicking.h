@@ -0,0 +1,148 @@
+#pragma once
+
+#include <float.h>
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "shared/UtilsMath.h"
+#include "shared/scene/Scene.h"
+#include "shared/scene/VtxData.h"
+
+#include <taskflow/taskflow.hpp>
+
+/**
+	Ray-vs-scene queries for editor picking.
+
+	Every mesh gets a triangle BVH (binned SAH build). Leaves hold up to 4 triangles stored as one SoA packet,
+	so a leaf is intersected with a single 4-wide triangle test.
+	Scene instances (nodes with meshes) are organized in a top-level BVH over their world-space bounding boxes,
+	rays are brought into mesh space with the inverse global transform of an instance.
+
+	Triangles are double-sided. Ray directions do not have to be normalized, 't' is measured in the units of the ray direction.
+*/
+
+struct Ray
+{
+	glm::vec3 origin_;
+	glm::vec3 dir_;
+	float tMax_ = FLT_MAX;
+};
+
+struct RayHit
+{
+	float t_ = FLT_MAX;
+	// barycentric coordinates of the hit point (relative to the 2nd and 3rd vertices)
+	float u_ = 0.0f;
+	float v_ = 0.0f;
+	// triangle index inside the selected LOD of the mesh (the first index is at lodOffset[lod] + 3 * triangle_)
+	uint32_t triangle_ = ~0u;
+	uint32_t mesh_ = ~0u;
+	// scene node (-1 for MeshBVH queries)
+	int node_ = -1;
+
+	inline bool hasHit() const { return triangle_ != ~0u; }
+};
+
+/* Build a picking ray from normalized device coordinates [-1..1] */
+inline Ray makePickingRay(const glm::mat4& proj, const glm::mat4& view, const glm::vec2& ndc)
+{
+	const glm::mat4 invViewProj = glm::inverse(proj * view);
+	const glm::vec4 p0 = invViewProj * glm::vec4(ndc, -1.0f, 1.0f);
+	const glm::vec4 p1 = invViewProj * glm::vec4(ndc, +1.0f, 1.0f);
+	const glm::vec3 origin = glm::vec3(p0) / p0.w;
+	return Ray { .origin_ = origin, .dir_ = glm::vec3(p1) / p1.w - origin, .tMax_ = 1.0f };
+}
+
+struct BVHNode
+{
+	glm::vec3 min_;
+	// inner nodes: index of the left child (the right child is next to it); leaves: first primitive
+	uint32_t first_;
+	glm::vec3 max_;
+	// number of primitives in a leaf, 0 for inner nodes
+	uint32_t count_;
+};
+
+static_assert(sizeof(BVHNode) == 32);
+
+/* Binned SAH builder. Returns the nodes, leaves reference the ranges in 'outOrder' (a permutation of 'boxes' indices) */
+void buildBVH(const std::vector<BoundingBox>& boxes, uint32_t maxLeafSize, std::vector<BVHNode>& outNodes, std::vector<uint32_t>& outOrder);
+
+struct MeshBVH
+{
+	static constexpr uint32_t kLeafSize = 4;
+
+	void build(const MeshData& meshData, uint32_t meshIndex, uint32_t lod = 0);
+
+	/* Nearest hit closer than min(ray.tMax_, hit.t_). Returns true and updates 'hit' if such a hit exists */
+	bool intersect(const Ray& ray, RayHit& hit) const;
+
+	/* Any hit closer than ray.tMax_ */
+	bool intersectAny(const Ray& ray) const;
+
+	inline const BoundingBox& getBounds() const { return bounds_; }
+	inline size_t getTriangleCount() const { return numTriangles_; }
+	inline size_t getNodeCount() const { return nodes_.size(); }
+
+private:
+	/* 4 triangles in SoA layout: the first vertex and two edges. Unused lanes are degenerate and never hit */
+	struct TrianglePacket
+	{
+		float v0_[3][4];
+		float e1_[3][4];
+		float e2_[3][4];
+		uint32_t triangle_[4];
+	};
+
+	uint32_t meshIndex_ = 0;
+	size_t numTriangles_ = 0;
+	BoundingBox bounds_;
+
+	std::vector<BVHNode> nodes_;
+	// one packet per leaf
+	std::vector<TrianglePacket> packets_;
+
+	template <bool anyHit>
+	bool traverse(const Ray& ray, RayHit& hit) const;
+};
+
+struct SceneBVH
+{
+	/* Build BVHs for all meshes (in parallel if the executor is provided) and the top-level BVH over the scene nodes with meshes */
+	void build(const MeshData& meshData, const Scene& scene, uint32_t lod = 0, tf::Executor* executor = nullptr);
+
+	/* Rebuild only the top-level BVH, e.g. after recalculateGlobalTransforms() */
+	void updateTransforms(const Scene& scene);
+
+	bool intersect(const Ray& ray, RayHit& hit) const;
+	bool intersectAny(const Ray& ray) const;
+
+	/* Batched queries, rays are split between the executor threads */
+	void intersectRays(const Ray* rays, RayHit* hits, size_t count, tf::Executor* executor = nullptr) const;
+	void intersectAnyRays(const Ray* rays, bool* occluded, size_t count, tf::Executor* executor = nullptr) const;
+
+	inline size_t getInstanceCount() const { return instances_.size(); }
+	inline const std::vector<MeshBVH>& getMeshBVHs() const { return meshes_; }
+
+private:
+	struct Instance
+	{
+		uint32_t node_;
+		uint32_t mesh_;
+		glm::mat4 invTransform_;
+	};
+
+	std::vector<MeshBVH> meshes_;
+	std::vector<Instance> instances_;
+
+	std::vector<BVHNode> nodes_;
+	std::vector<uint32_t> order_;
+
+	template <bool anyHit>
+	bool traverse(const Ray& ray, RayHit& hit) const;
+
+	template <typename Func>
+	void forEachRay(size_t count, tf::Executor* executor, Func func) const;
+};
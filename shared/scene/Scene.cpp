@@ -113,16 +113,9 @@ void loadMap(FILE* f, std::unordered_map<uint32_t, uint32_t>& map)
 		map[ms[i * 2 + 0]] = ms[i * 2 + 1];
 }
 
-void loadScene(const char* fileName, Scene& scene)
+/* The prefab scenes are stored right after the instancing scene, always with all the optional sections */
+static void loadSceneData(FILE* f, Scene& scene, bool isPrefab)
 {
-	FILE* f = fopen(fileName, "rb");
-
-	if (!f)
-	{
-		printf("Cannot open scene file '%s'. Please run SceneConverter from Chapter7 and/or MergeMeshes from Chapter 9", fileName);
-		return;
-	}
-
 	uint32_t sz = 0;
 	fread(&sz, sizeof(sz), 1, f);
 
@@ -139,7 +132,7 @@ void loadScene(const char* fileName, Scene& scene)
 	loadMap(f, scene.materialForNode_);
 	loadMap(f, scene.meshes_);
 
-	if (!feof(f))
+	if (isPrefab || !feof(f))
 	{
 		loadMap(f, scene.nameForNode_);
 		loadStringList(f, scene.names_);
@@ -147,6 +140,37 @@ void loadScene(const char* fileName, Scene& scene)
 		loadStringList(f, scene.materialNames_);
 	}
 
+	// Prefab component (absent in the files without prefabs: the counters stay zero at the end of the file)
+	loadMap(f, scene.prefabForNode_);
+
+	uint32_t numPrefabs = 0;
+	fread(&numPrefabs, sizeof(numPrefabs), 1, f);
+
+	scene.prefabs_.resize(numPrefabs);
+
+	for (auto& p: scene.prefabs_)
+	{
+		fread(&p.meshOffset_, sizeof(p.meshOffset_), 1, f);
+		fread(&p.materialOffset_, sizeof(p.materialOffset_), 1, f);
+
+		auto prefab = std::make_shared<Scene>();
+		loadSceneData(f, *prefab, true);
+		p.scene_ = prefab;
+	}
+}
+
+void loadScene(const char* fileName, Scene& scene)
+{
+	FILE* f = fopen(fileName, "rb");
+
+	if (!f)
+	{
+		printf("Cannot open scene file '%s'. Please run SceneConverter from Chapter7 and/or MergeMeshes from Chapter 9", fileName);
+		return;
+	}
+
+	loadSceneData(f, scene, false);
+
 	fclose(f);
 }
 
@@ -164,10 +188,8 @@ void saveMap(FILE* f, const std::unordered_map<uint32_t, uint32_t>& map)
 	fwrite(ms.data(), sizeof(int), ms.size(), f);
 }
 
-void saveScene(const char* fileName, const Scene& scene)
+static void saveSceneData(FILE* f, const Scene& scene, bool isPrefab)
 {
-	FILE* f = fopen(fileName, "wb");
-
 	const uint32_t sz = (uint32_t)scene.hierarchy_.size();
 	fwrite(&sz, sizeof(sz), 1, f);
 
@@ -179,13 +201,39 @@ void saveScene(const char* fileName, const Scene& scene)
 	saveMap(f, scene.materialForNode_);
 	saveMap(f, scene.meshes_);
 
-	if (!scene.names_.empty() && !scene.nameForNode_.empty())
+	const bool hasPrefabs = isPrefab || !scene.prefabs_.empty();
+
+	if (hasPrefabs || (!scene.names_.empty() && !scene.nameForNode_.empty()))
 	{
 		saveMap(f, scene.nameForNode_);
 		saveStringList(f, scene.names_);
 
 		saveStringList(f, scene.materialNames_);
 	}
+
+	if (!hasPrefabs)
+		return;
+
+	// Shared prefabs are stored once per entry of prefabs_ (mergeScenes() may add several entries for one scene)
+	saveMap(f, scene.prefabForNode_);
+
+	const uint32_t numPrefabs = (uint32_t)scene.prefabs_.size();
+	fwrite(&numPrefabs, sizeof(numPrefabs), 1, f);
+
+	for (const auto& p: scene.prefabs_)
+	{
+		fwrite(&p.meshOffset_, sizeof(p.meshOffset_), 1, f);
+		fwrite(&p.materialOffset_, sizeof(p.materialOffset_), 1, f);
+		saveSceneData(f, *p.scene_, true);
+	}
+}
+
+void saveScene(const char* fileName, const Scene& scene)
+{
+	FILE* f = fopen(fileName, "wb");
+
+	saveSceneData(f, scene, false);
+
 	fclose(f);
 }
 
@@ -341,6 +389,15 @@ void mergeScenes(Scene& scene, const std::vector<Scene*>& scenes, const std::vec
 		mergeMaps(scene.meshes_,          s->meshes_,          offs, mergeMeshes ? meshOffs : 0);
 		mergeMaps(scene.materialForNode_, s->materialForNode_, offs, mergeMaterials ? materialOfs : 0);
 		mergeMaps(scene.nameForNode_,     s->nameForNode_,     offs, nameOffs);
+		mergeMaps(scene.prefabForNode_,   s->prefabForNode_,   offs, (int)scene.prefabs_.size());
+
+		// prefabs are shared, only their mesh/material offsets are adjusted
+		for (const ScenePrefab& p: s->prefabs_)
+			scene.prefabs_.push_back(ScenePrefab {
+				.scene_ = p.scene_,
+				.meshOffset_ = p.meshOffset_ + (mergeMeshes ? meshOffs : 0),
+				.materialOffset_ = p.materialOffset_ + (mergeMaterials ? materialOfs : 0)
+			});
 
 		offs += nodeCount;
 
@@ -380,6 +437,124 @@ void mergeScenes(Scene& scene, const std::vector<Scene*>& scenes, const std::vec
 		i->level_++;
 }
 
+uint32_t addPrefab(Scene& scene, const std::shared_ptr<const Scene>& prefab, uint32_t meshOffset, uint32_t materialOffset)
+{
+	scene.prefabs_.push_back(ScenePrefab { .scene_ = prefab, .meshOffset_ = meshOffset, .materialOffset_ = materialOffset });
+	return (uint32_t)scene.prefabs_.size() - 1;
+}
+
+int addPrefabInstance(Scene& scene, int parent, uint32_t prefabIndex, const glm::mat4& transform)
+{
+	const int level = (parent > -1) ? scene.hierarchy_[parent].level_ + 1 : 0;
+	const int node = addNode(scene, parent, level);
+	scene.localTransform_[node] = transform;
+	scene.prefabForNode_[node] = prefabIndex;
+	return node;
+}
+
+/**
+	Unlike mergeScenes() the hierarchies are not copied: memory is proportional to the number of unique scenes plus one node per instance.
+	Global transforms of the prefab content are not stored, forEachMeshNode() reports them relative to the instance nodes
+*/
+void mergeScenesInstanced(Scene& scene, const std::vector<Scene*>& scenes, const std::vector<glm::mat4>& rootTransforms, const std::vector<uint32_t>& meshCounts,
+	bool mergeMeshes, bool mergeMaterials)
+{
+	const int root = addNode(scene, -1, 0);
+	setNodeName(scene, root, "NewRoot");
+
+	if (scenes.empty())
+		return;
+
+	uint32_t meshOffs = 0;
+	uint32_t materialOfs = 0;
+	auto meshCount = meshCounts.begin();
+
+	if (!mergeMaterials)
+		scene.materialNames_ = scenes[0]->materialNames_;
+
+	std::unordered_map<const Scene*, uint32_t> prefabForScene;
+
+	for (size_t i = 0; i != scenes.size(); i++)
+	{
+		const Scene* s = scenes[i];
+
+		auto p = prefabForScene.find(s);
+		if (p == prefabForScene.end())
+		{
+			// the only copy of this scene; the prefab root transform is applied by the instance nodes
+			auto prefab = std::make_shared<Scene>(*s);
+			markAsChanged(*prefab, 0);
+			recalculateGlobalTransforms(*prefab);
+
+			p = prefabForScene.emplace(s, addPrefab(scene, prefab, mergeMeshes ? meshOffs : 0, mergeMaterials ? materialOfs : 0)).first;
+
+			if (mergeMaterials)
+				mergeVectors(scene.materialNames_, s->materialNames_);
+
+			materialOfs += (uint32_t)s->materialNames_.size();
+			if (mergeMeshes)
+				meshOffs += *meshCount;
+		}
+
+		if (mergeMeshes)
+			meshCount++;
+
+		addPrefabInstance(scene, root, p->second, rootTransforms.empty() ? glm::mat4(1.0f) : rootTransforms[i]);
+	}
+}
+
+// Copy the prefab node 'src' and its subtree below 'parent', nested prefab instances are copied too
+static void copyPrefabNode(Scene& scene, int parent, const Scene& prefab, int src, uint32_t meshOffset, uint32_t materialOffset)
+{
+	const int node = addNode(scene, parent, scene.hierarchy_[parent].level_ + 1);
+	scene.localTransform_[node] = prefab.localTransform_[src];
+
+	if (auto m = prefab.meshes_.find(src); m != prefab.meshes_.end())
+		scene.meshes_[node] = m->second + meshOffset;
+	if (auto m = prefab.materialForNode_.find(src); m != prefab.materialForNode_.end())
+		scene.materialForNode_[node] = m->second + materialOffset;
+	if (auto n = prefab.nameForNode_.find(src); n != prefab.nameForNode_.end())
+	{
+		scene.nameForNode_[node] = (uint32_t)scene.names_.size();
+		scene.names_.push_back(prefab.names_[n->second]);
+	}
+
+	if (auto p = prefab.prefabForNode_.find(src); p != prefab.prefabForNode_.end())
+	{
+		const ScenePrefab& nested = prefab.prefabs_[p->second];
+		for (int i = 0; i != (int)nested.scene_->hierarchy_.size(); i++)
+			if (nested.scene_->hierarchy_[i].parent_ == -1)
+				copyPrefabNode(scene, node, *nested.scene_, i, meshOffset + nested.meshOffset_, materialOffset + nested.materialOffset_);
+	}
+
+	for (int s = prefab.hierarchy_[src].firstChild_; s != -1; s = prefab.hierarchy_[s].nextSibling_)
+		copyPrefabNode(scene, node, prefab, s, meshOffset, materialOffset);
+}
+
+void expandPrefabInstances(Scene& scene)
+{
+	if (scene.prefabForNode_.empty())
+		return;
+
+	// the new nodes are appended: take the instances in a stable order before adding them
+	std::vector<std::pair<uint32_t, uint32_t>> instances(scene.prefabForNode_.begin(), scene.prefabForNode_.end());
+	std::sort(instances.begin(), instances.end());
+
+	for (const auto& i: instances)
+	{
+		const ScenePrefab& prefab = scene.prefabs_[i.second];
+		for (int n = 0; n != (int)prefab.scene_->hierarchy_.size(); n++)
+			if (prefab.scene_->hierarchy_[n].parent_ == -1)
+				copyPrefabNode(scene, (int)i.first, *prefab.scene_, n, prefab.meshOffset_, prefab.materialOffset_);
+	}
+
+	scene.prefabForNode_.clear();
+	scene.prefabs_.clear();
+
+	markAsChanged(scene, 0);
+	recalculateGlobalTransforms(scene);
+}
+
 void dumpSceneToDot(const char* fileName, const Scene& scene, int* visited)
 {
 	FILE* f = fopen(fileName, "w");
@@ -410,95 +585,162 @@ void dumpSceneToDot(const char* fileName, const Scene& scene, int* visited)
 	fclose(f);
 }
 
-/** A rather long algorithm (and the auxiliary routines) to delete a number of scene nodes from the hierarchy */
-/* */
+/** Deletion of a number of scene nodes (with all their subtrees) from the hierarchy */
 
-// Add an index to a sorted index array
-static void addUniqueIdx(std::vector<uint32_t>& v, uint32_t index)
+// Mark the nodes and all their descendants. Every node is visited once, an explicit stack is used instead of recursion
+static std::vector<uint8_t> markNodesToDelete(const Scene& scene, const std::vector<uint32_t>& nodesToDelete)
 {
-	if (!std::binary_search(v.begin(), v.end(), index))
-		v.push_back(index);
+	std::vector<uint8_t> deleted(scene.hierarchy_.size(), 0);
+	std::vector<int> stack;
+
+	for (uint32_t root: nodesToDelete)
+	{
+		if (deleted[root])
+			continue;
+
+		deleted[root] = 1;
+		stack.push_back(root);
+
+		while (!stack.empty())
+		{
+			const int node = stack.back();
+			stack.pop_back();
+
+			for (int n = scene.hierarchy_[node].firstChild_; n != -1; n = scene.hierarchy_[n].nextSibling_)
+				if (!deleted[n])
+				{
+					deleted[n] = 1;
+					stack.push_back(n);
+				}
+		}
+	}
+
+	return deleted;
 }
 
-// Recurse down from a node and collect all nodes which are already marked for deletion
-static void collectNodesToDelete(const Scene& scene, int node, std::vector<uint32_t>& nodes)
+// Relink a sibling list skipping the deleted nodes. Hierarchy fields of the kept nodes receive new indices. Returns the first kept node (or -1)
+static int relinkSiblings(std::vector<Hierarchy>& hierarchy, const std::vector<int>& newIndices, int first)
 {
-	for (int n = scene.hierarchy_[node].firstChild_; n != - 1 ; n = scene.hierarchy_[n].nextSibling_) {
-		addUniqueIdx(nodes, n);
-		collectNodesToDelete(scene, n, nodes);
+	int firstKept = -1;
+	int prevKept = -1;
+
+	for (int n = first; n != -1; n = hierarchy[n].nextSibling_)
+	{
+		if (newIndices[n] == -1)
+			continue;
+
+		if (prevKept == -1)
+			firstKept = n;
+		else
+			hierarchy[prevKept].nextSibling_ = newIndices[n];
+
+		prevKept = n;
 	}
+
+	if (prevKept != -1)
+		hierarchy[prevKept].nextSibling_ = -1;
+
+	// as in addNode(), only the first sibling caches the last one
+	if (firstKept != -1)
+		hierarchy[firstKept].lastSibling_ = newIndices[prevKept];
+
+	return firstKept;
 }
 
-int findLastNonDeletedItem(const Scene& scene, const std::vector<int>& newIndices, int node)
+// Move the kept items to their new positions. newIndices[i] <= i, so this can be done in place
+template <typename T>
+static void compactArray(std::vector<T>& v, const std::vector<int>& newIndices, size_t newSize)
 {
-	// we have to be more subtle:
-	//   if the (newIndices[firstChild_] == -1), we should follow the link and extract the last non-removed item
-	//   ..
-	if (node == -1)
-		return -1;
-
-	return (newIndices[node] == -1) ?
-		findLastNonDeletedItem(scene, newIndices, scene.hierarchy_[node].nextSibling_) :
-		newIndices[node];
+	for (size_t i = 0; i != v.size(); i++)
+		if (newIndices[i] != -1 && newIndices[i] != (int)i)
+			v[newIndices[i]] = std::move(v[i]);
+
+	v.resize(newSize);
 }
 
 void shiftMapIndices(std::unordered_map<uint32_t, uint32_t>& items, const std::vector<int>& newIndices)
 {
 	std::unordered_map<uint32_t, uint32_t> newItems;
+	newItems.reserve(items.size());
 	for (const auto& m: items) {
 		int newIndex = newIndices[m.first];
 		if (newIndex != -1)
 			newItems[newIndex] = m.second;
 	}
-	items = newItems;
+	items = std::move(newItems);
 }
 
-// Approximately an O ( N * Log(N) * Log(M)) algorithm (N = scene.size, M = nodesToDelete.size) to delete a collection of nodes from scene graph
+// An O(N + M) algorithm (N = scene.size, M = nodesToDelete.size) to delete a collection of nodes from scene graph:
+// a mark bitmap, a single compaction pass over the hierarchy and transforms and remapping of all the components
 void deleteSceneNodes(Scene& scene, const std::vector<uint32_t>& nodesToDelete)
 {
-	// 0) Add all the nodes down below in the hierarchy
-	auto indicesToDelete = nodesToDelete;
-	for (auto i: indicesToDelete)
-		collectNodesToDelete(scene, i, indicesToDelete);
-
-	// aux array with node indices to keep track of the moved ones [moved = [](node) { return (node != nodes[node]); ]
-	std::vector<int> nodes(scene.hierarchy_.size());
-	std::iota(nodes.begin(), nodes.end(), 0);
+	const size_t oldSize = scene.hierarchy_.size();
 
-	// 1.a) Move all the indicesToDelete to the end of 'nodes' array (and cut them off, a variation of swap'n'pop for multiple elements)
-	auto oldSize = nodes.size();
-	eraseSelected(nodes, indicesToDelete);
+	// 0) Mark all the nodes down below in the hierarchy
+	const std::vector<uint8_t> deleted = markNodesToDelete(scene, nodesToDelete);
 
-	// 1.b) Make a newIndices[oldIndex] mapping table
+	// 1) Make a newIndices[oldIndex] mapping table (-1 for deleted nodes)
 	std::vector<int> newIndices(oldSize, -1);
-	for(int i = 0 ; i < nodes.size() ; i++)
-		newIndices[nodes[i]] = i;
-
-	// 2) Replace all non-null parent/firstChild/nextSibling pointers in all the nodes by new positions
-	auto nodeMover = [&scene, &newIndices](Hierarchy& h) {
-		return Hierarchy {
-			.parent_ = (h.parent_ != -1) ? newIndices[h.parent_] : -1,
-			.firstChild_ = findLastNonDeletedItem(scene, newIndices, h.firstChild_),
-			.nextSibling_ = findLastNonDeletedItem(scene, newIndices, h.nextSibling_),
-			.lastSibling_ = findLastNonDeletedItem(scene, newIndices, h.lastSibling_)
-		};
-	};
-	std::transform(scene.hierarchy_.begin(), scene.hierarchy_.end(), scene.hierarchy_.begin(), nodeMover);
+	int newSize = 0;
+	for (size_t i = 0; i != oldSize; i++)
+		if (!deleted[i])
+			newIndices[i] = newSize++;
+
+	// 2) Relink all the sibling lists. Each list is walked once: starting from the first child of a kept parent or from the first root
+	std::vector<Hierarchy>& h = scene.hierarchy_;
+	std::vector<uint8_t> hasPrevRoot(oldSize, 0);
+	for (size_t i = 0; i != oldSize; i++)
+		if (h[i].parent_ == -1 && h[i].nextSibling_ != -1)
+			hasPrevRoot[h[i].nextSibling_] = 1;
+
+	for (size_t i = 0; i != oldSize; i++)
+	{
+		if (deleted[i])
+			continue;
+
+		// a kept node has a kept parent, so parent_ can be remapped directly
+		if (h[i].parent_ != -1)
+			h[i].parent_ = newIndices[h[i].parent_];
+
+		h[i].lastSibling_ = -1;
+	}
+
+	for (size_t i = 0; i != oldSize; i++)
+		if (h[i].parent_ == -1 && !hasPrevRoot[i])
+			relinkSiblings(h, newIndices, (int)i);
+
+	for (size_t i = 0; i != oldSize; i++)
+	{
+		if (deleted[i])
+			continue;
 
-	// 3) Finally throw away the hierarchy items
-	eraseSelected(scene.hierarchy_, indicesToDelete);
+		const int firstKept = relinkSiblings(h, newIndices, h[i].firstChild_);
+		h[i].firstChild_ = (firstKept != -1) ? newIndices[firstKept] : -1;
+	}
 
-	// 4) As in mergeScenes() routine we also have to adjust all the "components" (i.e., meshes, materials, names and transformations)
+	// 3) Throw away the hierarchy items and (as in mergeScenes() routine) adjust all the "components"
 
-	// 4a) Transformations are stored in arrays, so we just erase the items as we did with the scene.hierarchy_
-	eraseSelected(scene.localTransform_, indicesToDelete);
-	eraseSelected(scene.globalTransform_, indicesToDelete);
+	// 3a) Hierarchy and transformations are stored in arrays, so we move the kept items in a single pass
+	compactArray(scene.hierarchy_, newIndices, newSize);
+	compactArray(scene.localTransform_, newIndices, newSize);
+	compactArray(scene.globalTransform_, newIndices, newSize);
 
-	// 4b) All the maps should change the key values with the newIndices[] array
+	// 3b) All the maps should change the key values with the newIndices[] array
 	shiftMapIndices(scene.meshes_, newIndices);
 	shiftMapIndices(scene.materialForNode_, newIndices);
 	shiftMapIndices(scene.nameForNode_, newIndices);
+	shiftMapIndices(scene.prefabForNode_, newIndices);
+
+	// 3c) Pending transform updates refer to the old indices
+	for (auto& changed: scene.changedAtThisFrame_)
+	{
+		size_t dst = 0;
+		for (int node: changed)
+			if (newIndices[node] != -1)
+				changed[dst++] = newIndices[node];
+		changed.resize(dst);
+	}
 
-	// 5) scene node names list is not modified, but in principle it can be (remove all non-used items and adjust the nameForNode_ map)
-	// 6) Material names list is not modified also, but if some materials fell out of use
+	// 4) scene node names list is not modified, but in principle it can be (remove all non-used items and adjust the nameForNode_ map)
+	// 5) Material names list is not modified also, but if some materials fell out of use
 }
@@ -1,5 +1,6 @@
 ﻿#pragma once
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -27,6 +28,17 @@ struct Hierarchy
 	int level_;
 };
 
+struct Scene;
+
+/* Shared subtree referenced by the instance nodes (see prefabForNode_).
+   Mesh and material indices of the prefab nodes are shifted by meshOffset_/materialOffset_ when the instances are expanded */
+struct ScenePrefab
+{
+	std::shared_ptr<const Scene> scene_;
+	uint32_t meshOffset_ = 0;
+	uint32_t materialOffset_ = 0;
+};
+
 /* This scene is converted into a descriptorSet(s) in MultiRenderer class 
    This structure is also used as a storage type in SceneExporter tool
  */
@@ -57,6 +69,12 @@ struct Scene
 
 	// Debug list of material names
 	std::vector<std::string> materialNames_;
+
+	// Prefab component: Which prefab is instantiated at the node. The instance node transform is the root transform of the prefab content
+	std::unordered_map<uint32_t, uint32_t> prefabForNode_;
+
+	// List of prefabs (saved by saveScene() after the scene itself, see expandPrefabInstances() for the loaders indexing node transforms)
+	std::vector<ScenePrefab> prefabs_;
 };
 
 int addNode(Scene& scene, int parent, int level);
@@ -93,5 +111,50 @@ void dumpSceneToDot(const char* fileName, const Scene& scene, int* visited = nul
 void mergeScenes(Scene& scene, const std::vector<Scene*>& scenes, const std::vector<glm::mat4>& rootTransforms, const std::vector<uint32_t>& meshCounts,
 		bool mergeMeshes = true, bool mergeMaterials = true);
 
+/* Add a prefab to the scene. The global transforms of the prefab scene must be up to date (they are used as prefab-local transforms) */
+uint32_t addPrefab(Scene& scene, const std::shared_ptr<const Scene>& prefab, uint32_t meshOffset = 0, uint32_t materialOffset = 0);
+
+/* Add a node instantiating the prefab 'prefabIndex' with the given local transform */
+int addPrefabInstance(Scene& scene, int parent, uint32_t prefabIndex, const glm::mat4& transform);
+
+/* The "grid of objects" use case of mergeScenes() without copying the hierarchies:
+   every unique scene in 'scenes' becomes a prefab (stored once) and every item of 'scenes' is an instance node below the new root.
+   Mesh and material offsets are accumulated only for the first occurrence of each scene */
+void mergeScenesInstanced(Scene& scene, const std::vector<Scene*>& scenes, const std::vector<glm::mat4>& rootTransforms, const std::vector<uint32_t>& meshCounts,
+		bool mergeMeshes = true, bool mergeMaterials = true);
+
+/* Visit all the mesh nodes of the scene, expanding prefab instances: func(node, meshIndex, materialIndex, instanceTransform).
+   For the prefab content 'node' is the (top-level) instance node and 'instanceTransform' is the immutable prefab-local transform of the mesh,
+   the global transform is scene.globalTransform_[node] * instanceTransform (the identity for the regular nodes).
+   materialIndex is ~0u for the nodes without a material. The order of visits is stable as long as the scene components are not modified */
+template <typename Func>
+void forEachMeshNode(const Scene& scene, Func&& func, const glm::mat4& instanceTransform = glm::mat4(1.0f), uint32_t meshOffset = 0, uint32_t materialOffset = 0, int instanceNode = -1)
+{
+	const bool isPrefab = instanceNode > -1;
+
+	for (const auto& c: scene.meshes_)
+	{
+		auto material = scene.materialForNode_.find(c.first);
+		func(
+			isPrefab ? (uint32_t)instanceNode : c.first,
+			c.second + meshOffset,
+			(material != scene.materialForNode_.end()) ? material->second + materialOffset : ~0u,
+			isPrefab ? instanceTransform * scene.globalTransform_[c.first] : glm::mat4(1.0f));
+	}
+
+	for (const auto& p: scene.prefabForNode_)
+	{
+		const ScenePrefab& prefab = scene.prefabs_[p.second];
+		forEachMeshNode(*prefab.scene_, func,
+			isPrefab ? instanceTransform * scene.globalTransform_[p.first] : glm::mat4(1.0f),
+			meshOffset + prefab.meshOffset_,
+			materialOffset + prefab.materialOffset_,
+			isPrefab ? instanceNode : (int)p.first);
+	}
+}
+
+/* Replace the prefab instances with copies of the prefab nodes (for the renderers indexing the node transforms directly) */
+void expandPrefabInstances(Scene& scene);
+
 // Delete a collection of nodes from a scenegraph
 void deleteSceneNodes(Scene& scene, const std::vector<uint32_t>& nodesToDelete);
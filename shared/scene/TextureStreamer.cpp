@@ -0,0 +1,356 @@
+#include "shared/scene/TextureStreamer.h"
+#include "shared/Utils.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+
+static size_t getLevelsSize(int w, int h, uint32_t firstLevel, uint32_t numLevels)
+{
+	size_t size = 0;
+	for (uint32_t i = firstLevel; i < numLevels; i++)
+		size += size_t(std::max(1, w >> i)) * std::max(1, h >> i) * 4;
+	return size;
+}
+
+TextureStreamer::TextureStreamer(const std::vector<std::string>& files, const std::vector<bool>& isSRGB, const TextureStreamerParams& params)
+: params_(params)
+, files_(files)
+, isSRGB_(isSRGB.empty() ? std::vector<bool>(files.size(), true) : isSRGB)
+, textures_(files.size())
+{
+	// only the metadata is needed before the first frame: the cache entries are mapped, no texels are read here
+	jobs_.reserve(files.size());
+	for (uint32_t i = 0; i != (uint32_t)files.size(); i++)
+	{
+		textures_[i].isStreamed_ = !endsWith(files[i].c_str(), ".ktx");
+		if (textures_[i].isStreamed_)
+			jobs_.push_back(StreamJob { .texture_ = i, .level_ = kNotResident, .group_ = eStreamJobGroup_Appear });
+	}
+
+	// with no requests yet the textures are decoded in the order of the files
+	std::reverse(jobs_.begin(), jobs_.end());
+
+	std::lock_guard lock(mutex_);
+	startWorkers();
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	{
+		std::lock_guard lock(mutex_);
+		jobs_.clear();
+	}
+
+	executor_.wait_for_all();
+}
+
+uint32_t TextureStreamer::getNumPendingLoads() const
+{
+	std::lock_guard lock(mutex_);
+
+	return numPendingLoads_;
+}
+
+void TextureStreamer::resetRequests()
+{
+	std::lock_guard lock(mutex_);
+
+	for (auto& t: textures_)
+	{
+		t.requestedSize_ = 0.0f;
+		t.priority_ = 0.0f;
+	}
+}
+
+void TextureStreamer::requestScreenSize(uint32_t texture, float screenSize, bool isVisible)
+{
+	std::lock_guard lock(mutex_);
+
+	StreamedTexture& t = textures_[texture];
+	t.requestedSize_ = std::max(t.requestedSize_, screenSize);
+	t.priority_ = std::max(t.priority_, isVisible ? screenSize : screenSize * params_.outOfFrustumPriority_);
+}
+
+void TextureStreamer::startWorkers()
+{
+	while (numRunningWorkers_ < params_.numWorkers_ && numRunningWorkers_ < jobs_.size())
+	{
+		numRunningWorkers_++;
+		executor_.async([this]() { runWorker(); });
+	}
+}
+
+bool TextureStreamer::takeJob(StreamJob& job)
+{
+	std::lock_guard lock(mutex_);
+
+	for (size_t i = jobs_.size(); i-- > 0; )
+	{
+		const bool isLoad = jobs_[i].level_ != kNotResident;
+
+		// decoding does not add to the memory in flight and is never held back
+		if (isLoad && numPendingLoads_ >= params_.maxPendingLoads_)
+			continue;
+
+		job = jobs_[i];
+		jobs_.erase(jobs_.begin() + i);
+
+		textures_[job.texture_].isBusy_ = true;
+		if (isLoad)
+			numPendingLoads_++;
+
+		return true;
+	}
+
+	// restarted by the next update()
+	numRunningWorkers_--;
+
+	return false;
+}
+
+void TextureStreamer::runWorker()
+{
+	StreamJob job;
+
+	while (takeJob(job))
+	{
+		if (job.level_ == kNotResident)
+			decodeTexture(job.texture_);
+		else
+			loadLevels(job.texture_, job.level_);
+	}
+}
+
+void TextureStreamer::decodeTexture(uint32_t texture)
+{
+	// on a cache miss the texture becomes visible with its tail levels while the full chain is being generated
+	auto publishTail = [this, texture](const CachedTexture& tail, uint32_t firstLevel)
+	{
+		StreamedTextureUpdate u;
+		u.texture_ = texture;
+		u.w_ = tail.w_;
+		u.h_ = tail.h_;
+		u.firstLevel_ = firstLevel;
+		u.numLevels_ = tail.numLevels_;
+
+		{
+			std::lock_guard lock(mutex_);
+			textures_[texture].hasPendingTail_ = true;
+			numPendingLoads_++;
+		}
+
+		pushLevels(u, tail.getMips(), getLevelsSize(tail.w_, tail.h_, 0, tail.numLevels_));
+	};
+
+	CachedTexture source;
+	const bool isLoaded = loadCachedTexture(files_[texture].c_str(), source, 0, MipChainParams { .sRGB_ = isSRGB_[texture] }, params_.tailSize_, publishTail);
+
+	if (!isLoaded)
+		printf("TextureStreamer: cannot load [%s]\n", files_[texture].c_str());
+
+	uint32_t tailLevel = 0;
+	while (tailLevel + 1 < source.numLevels_ && std::max(source.w_ >> tailLevel, source.h_ >> tailLevel) > (int)params_.tailSize_)
+		tailLevel++;
+
+	std::lock_guard lock(mutex_);
+	StreamedTexture& t = textures_[texture];
+	t.source_ = std::move(source);
+	t.tailLevel_ = tailLevel;
+	t.isLoaded_ = isLoaded;
+	t.isFailed_ = !isLoaded;
+	// released by popUpdate() if the tail has not been taken yet
+	t.isBusy_ = t.hasPendingTail_;
+}
+
+void TextureStreamer::loadLevels(uint32_t texture, uint32_t firstLevel)
+{
+	// 'source_' does not change once the texture is loaded
+	const CachedTexture& source = textures_[texture].source_;
+
+	StreamedTextureUpdate u;
+	u.texture_ = texture;
+	u.w_ = std::max(1, source.w_ >> firstLevel);
+	u.h_ = std::max(1, source.h_ >> firstLevel);
+	u.firstLevel_ = firstLevel;
+	u.numLevels_ = source.numLevels_ - firstLevel;
+
+	// the pages of the mapped cache entry are read here, not on the render thread
+	const size_t offset = getLevelsSize(source.w_, source.h_, 0, firstLevel);
+	const size_t size = getLevelsSize(source.w_, source.h_, firstLevel, source.numLevels_);
+
+	pushLevels(u, source.getMips() + offset, size);
+}
+
+void TextureStreamer::pushLevels(StreamedTextureUpdate& u, const uint8_t* levels, size_t size)
+{
+	uint8_t* dst = params_.allocateStaging_ ? params_.allocateStaging_(size, &u.stagingOffset_) : nullptr;
+	u.isStaged_ = dst != nullptr;
+
+	if (!dst)
+	{
+		u.mips_.resize(size);
+		dst = u.mips_.data();
+	}
+
+	memcpy(dst, levels, size);
+
+	ready_.push(std::move(u));
+}
+
+void TextureStreamer::update()
+{
+	std::lock_guard lock(mutex_);
+
+	const uint32_t numTextures = (uint32_t)textures_.size();
+
+	// 1. Levels matching the requested screen sizes
+	std::vector<uint32_t> targets(numTextures, kNotResident);
+
+	for (uint32_t i = 0; i != numTextures; i++)
+	{
+		const StreamedTexture& t = textures_[i];
+		if (!t.isLoaded_)
+			continue;
+
+		const float texSize = (float)std::max(t.source_.w_, t.source_.h_);
+		const uint32_t level = (t.requestedSize_ > 0.0f) ? (uint32_t)std::max(0.0f, floorf(log2f(texSize / t.requestedSize_))) : t.tailLevel_;
+		targets[i] = std::min(level, t.tailLevel_);
+	}
+
+	// 2. Evict the largest top levels until everything fits into the budget (the tails are always resident)
+	size_t total = 0;
+	for (uint32_t i = 0; i != numTextures; i++)
+		if (targets[i] != kNotResident)
+			total += getLevelsSize(textures_[i].source_.w_, textures_[i].source_.h_, targets[i], textures_[i].source_.numLevels_);
+
+	const bool isOverBudget = total > params_.memoryBudget_;
+
+	if (isOverBudget)
+	{
+		auto getTopLevelSize = [this, &targets](uint32_t i) { return getLevelsSize(textures_[i].source_.w_, textures_[i].source_.h_, targets[i], targets[i] + 1); };
+
+		std::priority_queue<std::pair<size_t, uint32_t>> topLevels;
+		for (uint32_t i = 0; i != numTextures; i++)
+			if (targets[i] != kNotResident && targets[i] < textures_[i].tailLevel_)
+				topLevels.push({ getTopLevelSize(i), i });
+
+		while (total > params_.memoryBudget_ && !topLevels.empty())
+		{
+			const uint32_t i = topLevels.top().second;
+			total -= topLevels.top().first;
+			topLevels.pop();
+
+			if (++targets[i] < textures_[i].tailLevel_)
+				topLevels.push({ getTopLevelSize(i), i });
+		}
+	}
+
+	// 3. Rebuild the jobs: the ones not taken by the workers since the previous update are stale and replaced
+	jobs_.clear();
+
+	for (uint32_t i = 0; i != numTextures; i++)
+	{
+		const StreamedTexture& t = textures_[i];
+		if (t.isBusy_ || t.isFailed_ || !t.isStreamed_)
+			continue;
+
+		StreamJob job { .texture_ = i, .level_ = targets[i], .priority_ = t.priority_ };
+
+		if (!t.isLoaded_ || t.residentLevel_ == kNotResident)
+		{
+			// not visible at all: decode it or load its tail first
+			job.level_ = t.isLoaded_ ? t.tailLevel_ : kNotResident;
+			job.group_ = eStreamJobGroup_Appear;
+		}
+		else
+		{
+			// a texture is not shrunk by a single level unless the budget needs it, the camera moving back and forth does not reload it every frame
+			const bool isUpgrade = targets[i] < t.residentLevel_;
+			const bool isEviction = targets[i] > t.residentLevel_ + 1 || (targets[i] > t.residentLevel_ && isOverBudget);
+
+			if (!isUpgrade && !isEviction)
+				continue;
+
+			job.group_ = (isEviction && isOverBudget) ? eStreamJobGroup_Evict : eStreamJobGroup_Refine;
+		}
+
+		jobs_.push_back(job);
+	}
+
+	// the ties go in the order of the textures
+	std::sort(jobs_.begin(), jobs_.end(), [](const StreamJob& a, const StreamJob& b)
+	{
+		if (a.group_ != b.group_)
+			return a.group_ < b.group_;
+		if (a.priority_ != b.priority_)
+			return a.priority_ < b.priority_;
+		return a.texture_ > b.texture_;
+	});
+
+	startWorkers();
+}
+
+bool TextureStreamer::popUpdate(StreamedTextureUpdate& u)
+{
+	if (!ready_.pop(u))
+		return false;
+
+	// 'source_' is not read here: the tail levels can come while the decoding job is still running
+	StreamedTexture& t = textures_[u.texture_];
+
+	residentBytes_ -= t.residentSize_;
+	t.residentSize_ = getLevelsSize(u.w_, u.h_, 0, u.numLevels_);
+	residentBytes_ += t.residentSize_;
+
+	t.residentLevel_ = u.firstLevel_;
+
+	std::lock_guard lock(mutex_);
+	if (t.hasPendingTail_)
+	{
+		// the texture stays busy until its decoding job is done
+		t.hasPendingTail_ = false;
+		t.isBusy_ = !t.isLoaded_ && !t.isFailed_;
+	}
+	else
+	{
+		t.isBusy_ = false;
+	}
+	numPendingLoads_--;
+
+	return true;
+}
+
+void requestShapeTextures(TextureStreamer& streamer, const MeshData& meshData, const std::vector<DrawData>& shapes, const std::vector<glm::mat4>& globalTransforms,
+	const std::vector<MaterialDescription>& materials, const glm::mat4& view, const glm::mat4& proj, float viewportHeight)
+{
+	const glm::vec3 eye = glm::vec3(glm::inverse(view)[3]);
+
+	glm::vec4 frustumPlanes[6];
+	glm::vec4 frustumCorners[8];
+	getFrustumPlanes(proj * view, frustumPlanes);
+	getFrustumCorners(proj * view, frustumCorners);
+
+	// pixels covered by a unit-size object at a unit distance
+	const float pixelsPerUnit = 0.5f * proj[1][1] * viewportHeight;
+
+	streamer.resetRequests();
+
+	for (const auto& s: shapes)
+	{
+		const BoundingBox box = meshData.boxes_[s.meshIndex].getTransformed(globalTransforms[s.transformIndex]);
+
+		// the whole texture is assumed to be mapped once across the box
+		const float dist = glm::length(eye - glm::clamp(eye, box.min_, box.max_));
+		const float screenSize = glm::length(box.getSize()) * pixelsPerUnit / std::max(dist, 1e-3f);
+
+		const bool isVisible = isBoxInFrustum(frustumPlanes, frustumCorners, box);
+
+		const MaterialDescription& m = materials[s.materialIndex];
+
+		for (const uint64_t map: { m.ambientOcclusionMap_, m.emissiveMap_, m.albedoMap_, m.metallicRoughnessMap_, m.normalMap_, m.opacityMap_ })
+			if (map != INVALID_TEXTURE)
+				streamer.requestScreenSize((uint32_t)map, screenSize, isVisible);
+	}
+}
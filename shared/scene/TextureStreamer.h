@@ -0,0 +1,167 @@
+#pragma once
+
+#include <float.h>
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "shared/MPSCQueue.h"
+#include "shared/TextureCache.h"
+#include "shared/scene/Material.h"
+#include "shared/scene/VtxData.h"
+
+#include <taskflow/taskflow.hpp>
+
+/**
+	Progressive MIP streaming of material textures.
+
+	Textures come from the persistent texture cache (see loadCachedTexture()): the entries are memory-mapped and store the levels
+	one after another, so any range of levels is read without decoding. KTX files are not streamed: they keep their compressed levels
+	and the renderer loads them whole (GLTexture, VulkanResources::loadKTX()). On a cache miss the tail levels are published right after
+	the image is decoded, before the full chain is generated and cached. A texture becomes resident with its small tail levels first
+	and is upgraded as higher resolutions are requested. When the requested levels do not fit into the memory budget,
+	the largest top levels of all the textures are evicted first.
+
+	Decoding and file I/O are done by the streamer's worker tasks. Jobs are rebuilt on every update() and taken by the workers in the order of
+	their priorities, computed from the requests of the current frame: textures which are not visible at all yet go first, then evictions needed
+	by the memory budget, then the upgrades and evictions of the textures covering the most pixels. Jobs which are not needed anymore
+	are dropped before they start. The loaded levels are handed over to the render thread through a lock-free queue.
+	update() is called by the render thread once per frame, then popUpdate() returns the textures to be recreated from a range of levels
+	one by one: the renderer replaces its texture objects and updates the descriptors or bindless handles as long as its frame time budget allows.
+*/
+
+struct TextureStreamerParams
+{
+	/// all the resident levels of all the textures, in bytes
+	size_t memoryBudget_ = size_t(512) << 20;
+	/// levels of this size and smaller are loaded first and never evicted
+	uint32_t tailSize_ = 64;
+	/// loaded textures not taken by popUpdate() yet, limits the memory in flight
+	uint32_t maxPendingLoads_ = 16;
+	/// worker tasks decoding and loading textures at the same time
+	uint32_t numWorkers_ = 4;
+	/// priority scale of the textures requested by the shapes outside of the view frustum
+	float outOfFrustumPriority_ = 0.01f;
+	/// staging memory the workers write the loaded levels into (e.g. a persistently mapped pixel buffer), called from the worker threads;
+	/// returns nullptr if there is no space and the levels go to StreamedTextureUpdate::mips_
+	std::function<uint8_t*(size_t size, uint64_t* offset)> allocateStaging_;
+};
+
+struct StreamedTextureUpdate
+{
+	uint32_t texture_ = 0;
+	/// size of the first level in 'mips_'
+	int w_ = 0;
+	int h_ = 0;
+	/// index of the first level in 'mips_' within the full MIP chain of the texture
+	uint32_t firstLevel_ = 0;
+	uint32_t numLevels_ = 0;
+	/// RGBA8 levels one after another (see generateMipChain())
+	std::vector<uint8_t> mips_;
+	/// the levels are in the staging memory at 'stagingOffset_' instead of 'mips_' (see TextureStreamerParams::allocateStaging_)
+	bool isStaged_ = false;
+	uint64_t stagingOffset_ = 0;
+};
+
+class TextureStreamer
+{
+public:
+	/// 'isSRGB' tells how the MIP levels of each file are filtered (see getSRGBTextures()), empty if all the textures hold sRGB colors
+	explicit TextureStreamer(const std::vector<std::string>& files, const std::vector<bool>& isSRGB = {}, const TextureStreamerParams& params = TextureStreamerParams());
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	/// Forget the requests of the previous frame, textures with no requests shrink to their tail levels.
+	/// Until the first call all the textures are requested at full resolution
+	void resetRequests();
+
+	/// A texture is drawn 'screenSize' pixels across this frame (the largest of all the requests is kept).
+	/// The projected size is also the priority of the texture jobs, lowered for invisible shapes
+	void requestScreenSize(uint32_t texture, float screenSize = FLT_MAX, bool isVisible = true);
+
+	/// Reschedule decoding, loads and evictions within the memory budget by the priorities of the current requests
+	void update();
+
+	/// Take the next texture ready to be recreated, returns false if there is none (render thread only)
+	bool popUpdate(StreamedTextureUpdate& u);
+
+	inline size_t getResidentBytes() const { return residentBytes_; }
+	uint32_t getNumPendingLoads() const;
+
+private:
+	static constexpr uint32_t kNotResident = ~0u;
+
+	enum eStreamJobGroup
+	{
+		eStreamJobGroup_Refine = 0,
+		eStreamJobGroup_Evict = 1,
+		eStreamJobGroup_Appear = 2,
+	};
+
+	struct StreamJob
+	{
+		uint32_t texture_ = 0;
+		/// first level to load, kNotResident to decode the texture
+		uint32_t level_ = kNotResident;
+		eStreamJobGroup group_ = eStreamJobGroup_Refine;
+		float priority_ = 0.0f;
+	};
+
+	struct StreamedTexture
+	{
+		// written once by the decoding job, read-only afterwards
+		CachedTexture source_;
+		bool isLoaded_ = false;
+		bool isFailed_ = false;
+		// KTX files are loaded by the renderer
+		bool isStreamed_ = true;
+		uint32_t tailLevel_ = 0;
+
+		float requestedSize_ = FLT_MAX;
+		float priority_ = 0.0f;
+		// a job of this texture has been taken by a worker and has not been completed
+		bool isBusy_ = false;
+		// the tail levels published by the decoding job have not been taken by popUpdate() yet
+		bool hasPendingTail_ = false;
+		// only touched by the render thread
+		uint32_t residentLevel_ = kNotResident;
+		size_t residentSize_ = 0;
+	};
+
+	TextureStreamerParams params_;
+
+	std::vector<std::string> files_;
+	std::vector<bool> isSRGB_;
+	std::vector<StreamedTexture> textures_;
+
+	// sorted by priority, the last job goes first
+	std::vector<StreamJob> jobs_;
+	uint32_t numRunningWorkers_ = 0;
+	uint32_t numPendingLoads_ = 0;
+
+	// textures, requests and jobs, the loaded levels do not go through it
+	mutable std::mutex mutex_;
+
+	MPSCQueue<StreamedTextureUpdate> ready_;
+
+	size_t residentBytes_ = 0;
+
+	tf::Executor executor_;
+
+	void startWorkers();
+	bool takeJob(StreamJob& job);
+	void runWorker();
+	void decodeTexture(uint32_t texture);
+	void loadLevels(uint32_t texture, uint32_t firstLevel);
+	void pushLevels(StreamedTextureUpdate& u, const uint8_t* levels, size_t size);
+};
+
+/// Request the textures of all the shapes with the projected size of their world-space bounding boxes, shapes outside of the view frustum get lower priorities
+void requestShapeTextures(TextureStreamer& streamer, const MeshData& meshData, const std::vector<DrawData>& shapes, const std::vector<glm::mat4>& globalTransforms,
+	const std::vector<MaterialDescription>& materials, const glm::mat4& view, const glm::mat4& proj, float viewportHeight);
@@ -20,7 +20,25 @@ struct CompositeRenderer: public Renderer
 			if (r.renderer_.framebuffer_ != VK_NULL_HANDLE)
 				fb = r.renderer_.framebuffer_;
 
-			r.renderer_.fillCommandBuffer(cmdBuffer, currentImage, fb, rp);
+			ctx_.fillCommandBuffer(r.renderer_, cmdBuffer, currentImage, fb, rp);
+		}
+	}
+
+	// Each of the internal renderers is recorded separately, in the same order
+	void collectRenderJobs(std::vector<RenderJob>& jobs, VkFramebuffer fb1, VkRenderPass rp1) override
+	{
+		for (auto& r: renderers_)
+		if (r.enabled_)
+		{
+			VkRenderPass rp = rp1;
+			VkFramebuffer fb = fb1;
+
+			if (r.renderer_.renderPass_.handle != VK_NULL_HANDLE)
+				rp = r.renderer_.renderPass_.handle;
+			if (r.renderer_.framebuffer_ != VK_NULL_HANDLE)
+				fb = r.renderer_.framebuffer_;
+
+			r.renderer_.collectRenderJobs(jobs, fb, rp);
 		}
 	}
 
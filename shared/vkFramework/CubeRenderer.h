@@ -10,6 +10,7 @@ struct CubemapRenderer: public Renderer
 		RenderPass screenRenderPass = RenderPass());
 
 	void fillCommandBuffer(VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) override;
+	const char* getProfilerName() const override { return "Cubemap"; }
 
 	void updateBuffers(size_t currentImage) override;
 
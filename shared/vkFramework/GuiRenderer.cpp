@@ -162,6 +162,33 @@ void imguiTextureWindow(const char* Title, uint32_t texId)
 	ImGui::End();
 }
 
+void imguiGPUProfilerWindow(const char* title, const VulkanGPUProfiler& profiler)
+{
+	ImGui::Begin(title, nullptr);
+
+	if (!profiler.isSupported())
+		ImGui::Text("Timestamps are not supported");
+	else if (ImGui::BeginTable("GPUScopes", 2, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+	{
+		ImGui::TableSetupColumn("Renderer");
+		ImGui::TableSetupColumn("GPU, ms");
+		ImGui::TableHeadersRow();
+
+		for (const auto& s: profiler.getScopes())
+		{
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(s.name_);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", (double)(s.endNs_ - s.beginNs_) * 1e-6);
+		}
+
+		ImGui::EndTable();
+	}
+
+	ImGui::End();
+}
+
 int renderSceneTree(const Scene& scene, int node)
 {
 	int selected = -1;
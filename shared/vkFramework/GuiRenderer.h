@@ -10,6 +10,7 @@ struct GuiRenderer: public Renderer
 	virtual ~GuiRenderer();
 
 	void fillCommandBuffer(VkCommandBuffer commandBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) override;
+	const char* getProfilerName() const override { return "ImGui"; }
 	void updateBuffers(size_t currentImage) override;
 
 private:
@@ -20,4 +21,7 @@ private:
 };
 
 void imguiTextureWindow(const char* Title, uint32_t texId);
+
+/// GPU time of the renderers in the latest frame measured by VulkanRenderContext::gpuProfiler_
+void imguiGPUProfilerWindow(const char* title, const VulkanGPUProfiler& profiler);
 int renderSceneTree(const Scene& scene, int node);
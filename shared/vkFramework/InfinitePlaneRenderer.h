@@ -10,6 +10,7 @@ struct InfinitePlaneRenderer: public Renderer
 		RenderPass screenRenderPass = RenderPass());
 
 	void fillCommandBuffer(VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) override;
+	const char* getProfilerName() const override { return "InfinitePlane"; }
 	void updateBuffers(size_t currentImage) override;
 
 	inline void setMatrices(const glm::mat4& proj, const glm::mat4& view, const glm::mat4& model) { proj_ = proj; view_ = view; model_ = model; }
@@ -18,6 +18,7 @@ struct LineCanvas: public Renderer
 	{}
 
 	void fillCommandBuffer(VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) override;
+	const char* getProfilerName() const override { return "LineCanvas"; }
 	void updateBuffers(size_t currentImage) override;
 
 	void clear() { lines_.clear(); }
@@ -1,8 +1,7 @@
 #include "shared/vkFramework/MultiRenderer.h"
+#include "shared/Utils.h"
 
-#include <stb/stb_image.h>
-
-uint8_t* genDefaultCheckerboardImage(int* width, int* height);
+#include <chrono>
 
 VKSceneData::VKSceneData(VulkanRenderContext& ctx,
 	const char* meshFile,
@@ -19,9 +18,28 @@ VKSceneData::VKSceneData(VulkanRenderContext& ctx,
 
 	loadMaterials(materialFile, materials_, textureFiles_);
 
+	const std::vector<bool> isSRGB = getSRGBTextures(materials_, textureFiles_.size());
+
 	std::vector<VulkanTexture> textures;
-	for (const auto& f: textureFiles_) {
-		auto t = asyncLoad ? ctx.resources.addSolidRGBATexture() : ctx.resources.loadTexture2D(f.c_str());
+	for (size_t i = 0; i != textureFiles_.size(); i++) {
+		std::string& f = textureFiles_[i];
+		// KTX files are uploaded with their stored levels, decoded textures come from the persistent cache, loadTexture2D() reports unreadable files
+		VulkanTexture ktx;
+		if (endsWith(f.c_str(), ".ktx"))
+		{
+			if (ctx.resources.tryLoadKTX(f.c_str(), ktx))
+			{
+				textures.push_back(ktx);
+				continue;
+			}
+			// the device cannot sample ETC2: use the image Tool01_TextureCompressor has encoded ("<original file name>.ktx") instead
+			f.resize(f.size() - strlen(".ktx"));
+			printf("VKSceneData: the device does not support the format of %s.ktx, using %s\n", f.c_str(), f.c_str());
+		}
+		CachedTexture cached;
+		auto t = asyncLoad ? ctx.resources.addSolidRGBATexture() :
+			loadCachedTexture(f.c_str(), cached, 0, MipChainParams { .sRGB_ = isSRGB[i] }) ? ctx.resources.addRGBAMIPTexture(cached.w_, cached.h_, cached.numLevels_, cached.getMips()) :
+			ctx.resources.loadTexture2D(f.c_str());
 		textures.push_back(t);
 #if 0
 		if (t.image.image != nullptr)
@@ -29,29 +47,23 @@ VKSceneData::VKSceneData(VulkanRenderContext& ctx,
 #endif
 	}
 
+	// the small tail levels come first, the rest is streamed in as requested (the loaded KTX files are not streamed)
 	if (asyncLoad)
-	{
-		loadedFiles_.reserve(textureFiles_.size());
+		streamer_ = std::make_unique<TextureStreamer>(textureFiles_, isSRGB);
 
-		taskflow_.for_each_index(0u, (uint32_t)textureFiles_.size(), 1u, [this](int idx)
-			{
-				int w, h;
-				const uint8_t* img = stbi_load(this->textureFiles_[idx].c_str(), &w, &h, nullptr, STBI_rgb_alpha);
-				if (!img)
-					img = genDefaultCheckerboardImage(&w, &h);
-				std::lock_guard lock(loadedFilesMutex_);
-				loadedFiles_.emplace_back(LoadedImageData { idx, w, h, img });
-			}
-		);
+	for (const auto& t: textures)
+		textureSlots_.push_back(ctx.resources.addBindlessTexture(t));
 
-		executor_.run(taskflow_);
-	}
+	allMaterialTextures = std::move(textures);
 
-	allMaterialTextures = fsTextureArrayAttachment(textures);
+	std::vector<MaterialDescription> gpuMaterials;
+	gpuMaterials.reserve(materials_.size());
+	for (const auto& m: materials_)
+		gpuMaterials.push_back(getGPUMaterial(m));
 
 	const uint32_t materialsSize = static_cast<uint32_t>(sizeof(MaterialDescription) * materials_.size());
 	material_ = ctx.resources.addStorageBuffer(materialsSize);
-	uploadBufferData(ctx.vkDev, material_.memory, 0, materials_.data(), materialsSize);
+	uploadBufferData(ctx.vkDev, material_.memory, 0, gpuMaterials.data(), materialsSize);
 
 	loadMeshes(meshFile);
 	loadScene(sceneFile);
@@ -77,6 +89,14 @@ void VKSceneData::loadMeshes(const char* meshFile)
 	uploadBufferData(ctx.vkDev, storage.memory, 0, meshData_.vertexData_.data(), vertexBufferSize);
 	uploadBufferData(ctx.vkDev, storage.memory, vertexBufferSize, meshData_.indexData_.data(), indexBufferSize);
 
+	const uint32_t meshesSize = (uint32_t)(meshData_.meshes_.size() * sizeof(Mesh));
+	meshes_ = ctx.resources.addStorageBuffer(meshesSize);
+	uploadBufferData(ctx.vkDev, meshes_.memory, 0, meshData_.meshes_.data(), meshesSize);
+
+	const uint32_t boxesSize = (uint32_t)(meshData_.boxes_.size() * sizeof(BoundingBox));
+	boxes_ = ctx.resources.addStorageBuffer(boxesSize);
+	uploadBufferData(ctx.vkDev, boxes_.memory, 0, meshData_.boxes_.data(), boxesSize);
+
 	vertexBuffer_ = BufferAttachment { .dInfo = { .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .shaderStageFlags = VK_SHADER_STAGE_VERTEX_BIT }, .buffer = storage, .offset = 0, .size = vertexBufferSize };
 	indexBuffer_  = BufferAttachment { .dInfo = { .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .shaderStageFlags = VK_SHADER_STAGE_VERTEX_BIT }, .buffer = storage, .offset = vertexBufferSize, .size = indexBufferSize };
 }
@@ -85,23 +105,25 @@ void VKSceneData::loadScene(const char* sceneFile)
 {
 	::loadScene(sceneFile, scene_);
 
-	// prepare draw data buffer
-	for (const auto& c : scene_.meshes_)
+	// prepare draw data buffer (every mesh of a prefab instance is a separate shape with its own transform)
+	forEachMeshNode(scene_, [this](uint32_t node, uint32_t mesh, uint32_t material, const glm::mat4& instanceTransform)
 	{
-		auto material = scene_.materialForNode_.find(c.first);
-		if (material == scene_.materialForNode_.end())
-			continue;
+		if (material == ~0u)
+			return;
 
 		shapes_.push_back(
 			DrawData{
-				.meshIndex = c.second,
-				.materialIndex = material->second,
+				.meshIndex = mesh,
+				.materialIndex = material,
 				.LOD = 0,
-				.indexOffset = meshData_.meshes_[c.second].indexOffset,
-				.vertexOffset = meshData_.meshes_[c.second].vertexOffset,
-				.transformIndex = c.first
+				.indexOffset = meshData_.meshes_[mesh].indexOffset,
+				.vertexOffset = meshData_.meshes_[mesh].vertexOffset,
+				.transformIndex = (uint32_t)shapes_.size()
 			});
-	}
+
+		shapeNodes_.push_back(node);
+		shapeInstanceTransforms_.push_back(instanceTransform);
+	});
 
 	shapeTransforms_.resize(shapes_.size());
 	transforms_ = ctx.resources.addStorageBuffer(shapes_.size() * sizeof(glm::mat4));
@@ -112,15 +134,35 @@ void VKSceneData::loadScene(const char* sceneFile)
 
 void VKSceneData::updateMaterial(int matIdx)
 {
-	uploadBufferData(ctx.vkDev, material_.memory, matIdx * sizeof(MaterialDescription), materials_.data() + matIdx, sizeof(MaterialDescription));
+	const MaterialDescription m = getGPUMaterial(materials_[matIdx]);
+	uploadBufferData(ctx.vkDev, material_.memory, matIdx * sizeof(MaterialDescription), &m, sizeof(MaterialDescription));
+}
+
+MaterialDescription VKSceneData::getGPUMaterial(const MaterialDescription& m) const
+{
+	auto getSlot = [this](uint64_t idx) { return (idx == INVALID_TEXTURE) ? INVALID_TEXTURE : (uint64_t)textureSlots_[idx]; };
+
+	MaterialDescription out = m;
+	out.ambientOcclusionMap_ = getSlot(m.ambientOcclusionMap_);
+	out.emissiveMap_ = getSlot(m.emissiveMap_);
+	out.albedoMap_ = getSlot(m.albedoMap_);
+	out.metallicRoughnessMap_ = getSlot(m.metallicRoughnessMap_);
+	out.normalMap_ = getSlot(m.normalMap_);
+	out.opacityMap_ = getSlot(m.opacityMap_);
+	return out;
+}
+
+void VKSceneData::requestTextures(const glm::mat4& view, const glm::mat4& proj)
+{
+	if (streamer_)
+		requestShapeTextures(*streamer_, meshData_, shapes_, shapeTransforms_, materials_, view, proj, (float)ctx.vkDev.framebufferHeight);
 }
 
 void VKSceneData::convertGlobalToShapeTransforms()
 {
-	// fill the shapeTransforms_ array from globalTransforms_
-	size_t i = 0;
-	for (const auto& c : shapes_)
-		shapeTransforms_[i++] = scene_.globalTransform_[c.transformIndex];
+	// fill the shapeTransforms_ array from globalTransforms_ (the prefab-local transforms are prepared once in loadScene())
+	for (size_t i = 0; i != shapes_.size(); i++)
+		shapeTransforms_[i] = scene_.globalTransform_[shapeNodes_[i]] * shapeInstanceTransforms_[i];
 }
 
 void VKSceneData::recalculateAllTransforms()
@@ -182,8 +224,8 @@ MultiRenderer::MultiRenderer(
 			storageBufferAttachment(sceneData_.material_,    0, (uint32_t)sceneData_.material_.size, VK_SHADER_STAGE_FRAGMENT_BIT),
 			storageBufferAttachment(sceneData_.transforms_,  0, (uint32_t)sceneData_.transforms_.size, VK_SHADER_STAGE_VERTEX_BIT),
 		},
-		.textures = textureAttachments,
-		.textureArrays = { sceneData_.allMaterialTextures }
+		// the material textures are in the bindless table (set 1)
+		.textures = textureAttachments
 	};
 
 	for (const auto& b: auxBuffers)
@@ -195,7 +237,8 @@ MultiRenderer::MultiRenderer(
 	for (size_t i = 0; i != imgCount; i++)
 	{
 		uniforms_[i] = ctx.resources.addUniformBuffer(uniformBufferSize);
-		indirect_[i] = ctx.resources.addIndirectBuffer(indirectDataSize);
+		// also used as a storage buffer by the GPU culling pass
+		indirect_[i] = ctx.resources.addComputedIndirectBuffer(indirectDataSize);
 		updateIndirectBuffers(i);
 
 		shape_[i] = ctx.resources.addStorageBuffer(shapesSize);
@@ -208,17 +251,27 @@ MultiRenderer::MultiRenderer(
 		ctx.resources.updateDescriptorSet(descriptorSets_[i], dsInfo);
 	}
 
-	initPipeline({ vertShaderFile, fragShaderFile }, pInfo);
+	pipelineLayout_ = ctx.resources.addPipelineLayout({ descriptorSetLayout_, ctx.resources.getBindlessTextureSetLayout() });
+	graphicsPipeline_ = ctx.resources.addPipeline(renderPass_.handle, pipelineLayout_, { vertShaderFile, fragShaderFile }, pInfo);
 }
 
 void MultiRenderer::fillCommandBuffer(VkCommandBuffer commandBuffer, size_t currentImage, VkFramebuffer fb, VkRenderPass rp)
 {
+	/* Dispatches are not allowed inside a render pass, so the culling pass goes first */
+	if (useGPUCulling_)
+		fillCullingCommands(commandBuffer, currentImage);
+
 	beginRenderPass((rp != VK_NULL_HANDLE) ? rp : renderPass_.handle, (fb != VK_NULL_HANDLE) ? fb : framebuffer_, commandBuffer, currentImage);
 
-	/* For CountKHR (Vulkan 1.1) we may use indirect rendering with GPU-based object counter */
-	/// vkCmdDrawIndirectCountKHR(commandBuffer, indirectBuffers_[currentImage], 0, countBuffers_[currentImage], 0, shapes.size(), sizeof(VkDrawIndirectCommand));
+	const VkDescriptorSet bindlessSet = ctx_.resources.getBindlessTextureSet();
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout_, 1, 1, &bindlessSet, 0, nullptr);
+
+	/* For CountKHR (Vulkan 1.1) we use indirect rendering with GPU-based object counter */
+	if (useGPUCulling_)
+		vkCmdDrawIndirectCountKHR(commandBuffer, indirect_[currentImage].buffer, 0, count_[currentImage].buffer, 0, (uint32_t)sceneData_.shapes_.size(), sizeof(VkDrawIndirectCommand));
 	/* For Vulkan 1.0 vkCmdDrawIndirect is enough */
-	vkCmdDrawIndirect(commandBuffer, indirect_[currentImage].buffer, 0, (uint32_t)sceneData_.shapes_.size(), sizeof(VkDrawIndirectCommand));
+	else
+		vkCmdDrawIndirect(commandBuffer, indirect_[currentImage].buffer, 0, (uint32_t)sceneData_.shapes_.size(), sizeof(VkDrawIndirectCommand));
 
 	vkCmdEndRenderPass(commandBuffer);
 }
@@ -226,15 +279,115 @@ void MultiRenderer::fillCommandBuffer(VkCommandBuffer commandBuffer, size_t curr
 void MultiRenderer::updateBuffers(size_t imageIndex)
 {
 	updateUniformBuffer((uint32_t)imageIndex, 0, sizeof(ubo_), &ubo_);
+
+	if (useGPUCulling_)
+	{
+		const mat4 viewProj = ubo_.proj_ * ubo_.view_;
+		getFrustumPlanes(viewProj, cullingData_.frustumPlanes_);
+		getFrustumCorners(viewProj, cullingData_.frustumCorners_);
+		cullingData_.cameraPos_ = ubo_.cameraPos_;
+		cullingData_.numShapes_ = (uint32_t)sceneData_.shapes_.size();
+
+		uploadBufferData(ctx_.vkDev, cullingUniforms_[imageIndex].memory, 0, &cullingData_, sizeof(cullingData_));
+	}
 }
 
-void MultiRenderer::updateIndirectBuffers(size_t currentImage, bool* visibility)
+void MultiRenderer::enableGPUCulling(const char* compShaderFile)
 {
-	VkDrawIndirectCommand* data = nullptr;
-	vkMapMemory(ctx_.vkDev.device, indirect_[currentImage].memory, 0, sizeof(VkDrawIndirectCommand), 0, (void**)&data);
+	const size_t imgCount = ctx_.vkDev.swapchainImages.size();
+
+	const uint32_t numShapes = (uint32_t)sceneData_.shapes_.size();
+	const uint32_t shapesSize = numShapes * sizeof(DrawData);
+	const uint32_t indirectDataSize = numShapes * sizeof(VkDrawIndirectCommand);
+
+	count_.resize(imgCount);
+	cullingUniforms_.resize(imgCount);
+	cullingDescriptorSets_.resize(imgCount);
+
+	// bindings must match data/shaders/chapter07/VK01_Culling.comp
+	DescriptorSetInfo dsInfo = {
+		.buffers = {
+			uniformBufferAttachment(VulkanBuffer {},          0, sizeof(CullingData), VK_SHADER_STAGE_COMPUTE_BIT),
+			storageBufferAttachment(VulkanBuffer {},          0, shapesSize, VK_SHADER_STAGE_COMPUTE_BIT),
+			storageBufferAttachment(sceneData_.transforms_,   0, (uint32_t)sceneData_.transforms_.size, VK_SHADER_STAGE_COMPUTE_BIT),
+			storageBufferAttachment(sceneData_.boxes_,        0, (uint32_t)sceneData_.boxes_.size, VK_SHADER_STAGE_COMPUTE_BIT),
+			storageBufferAttachment(sceneData_.meshes_,       0, (uint32_t)sceneData_.meshes_.size, VK_SHADER_STAGE_COMPUTE_BIT),
+			storageBufferAttachment(VulkanBuffer {},          0, indirectDataSize, VK_SHADER_STAGE_COMPUTE_BIT),
+			storageBufferAttachment(VulkanBuffer {},          0, sizeof(uint32_t), VK_SHADER_STAGE_COMPUTE_BIT),
+		}
+	};
+
+	cullingDescriptorSetLayout_ = ctx_.resources.addDescriptorSetLayout(dsInfo);
+	cullingDescriptorPool_ = ctx_.resources.addDescriptorPool(dsInfo, (uint32_t)imgCount);
+
+	for (size_t i = 0; i != imgCount; i++)
+	{
+		cullingUniforms_[i] = ctx_.resources.addUniformBuffer(sizeof(CullingData));
+		/* the counter is reset with vkCmdFillBuffer() every frame */
+		count_[i] = ctx_.resources.addBuffer(sizeof(uint32_t),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT); /* for debugging we make it host-visible */
+
+		dsInfo.buffers[0].buffer = cullingUniforms_[i];
+		dsInfo.buffers[1].buffer = shape_[i];
+		dsInfo.buffers[5].buffer = indirect_[i];
+		dsInfo.buffers[6].buffer = count_[i];
+
+		cullingDescriptorSets_[i] = ctx_.resources.addDescriptorSet(cullingDescriptorPool_, cullingDescriptorSetLayout_);
+		ctx_.resources.updateDescriptorSet(cullingDescriptorSets_[i], dsInfo);
+	}
+
+	cullingPipelineLayout_ = ctx_.resources.addPipelineLayout(cullingDescriptorSetLayout_);
+	cullingPipeline_ = ctx_.resources.addComputePipeline(compShaderFile, cullingPipelineLayout_);
+
+	useGPUCulling_ = true;
+}
+
+void MultiRenderer::fillCullingCommands(VkCommandBuffer commandBuffer, size_t currentImage)
+{
+	vkCmdFillBuffer(commandBuffer, count_[currentImage].buffer, 0, sizeof(uint32_t), 0);
+
+	// the counter reset must be visible to the compute shader and the previous indirect draw from these buffers must be finished
+	const VkMemoryBarrier resetBarrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	};
 
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &resetBarrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingPipeline_);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingPipelineLayout_, 0, 1, &cullingDescriptorSets_[currentImage], 0, nullptr);
+
+	// local_size_x = 64 in VK01_Culling.comp
+	const uint32_t numShapes = (uint32_t)sceneData_.shapes_.size();
+	vkCmdDispatch(commandBuffer, (numShapes + 63) / 64, 1, 1);
+
+	// make sure the compute shader finishes before the indirect commands and the draw count are consumed
+	const VkMemoryBarrier indirectBarrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+	};
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		0, 1, &indirectBarrier, 0, nullptr, 0, nullptr);
+}
+
+void MultiRenderer::updateIndirectBuffers(size_t currentImage, bool* visibility)
+{
 	const uint32_t size = (uint32_t)sceneData_.shapes_.size();
 
+	VkDrawIndirectCommand* data = nullptr;
+	vkMapMemory(ctx_.vkDev.device, indirect_[currentImage].memory, 0, size * sizeof(VkDrawIndirectCommand), 0, (void**)&data);
+
 	for (uint32_t i = 0; i != size; i++)
 	{
 		const uint32_t j = sceneData_.shapes_[i].meshIndex;
@@ -250,24 +403,42 @@ void MultiRenderer::updateIndirectBuffers(size_t currentImage, bool* visibility)
 	vkUnmapMemory(ctx_.vkDev.device, indirect_[currentImage].memory);
 }
 
-bool MultiRenderer::checkLoadedTextures()
+bool MultiRenderer::checkLoadedTextures(double timeBudgetMs)
 {
-	VKSceneData::LoadedImageData data;
+	if (!sceneData_.streamer_)
+		return false;
+
+	frameIndex_++;
 
+	const size_t numFramesInFlight = ctx_.vkDev.swapchainImages.size();
+
+	while (!releasedTextures_.empty() && releasedTextures_.front().second + numFramesInFlight < frameIndex_)
 	{
-		std::lock_guard lock(sceneData_.loadedFilesMutex_);
+		ctx_.resources.destroyTexture(releasedTextures_.front().first);
+		releasedTextures_.pop_front();
+	}
 
-		if (sceneData_.loadedFiles_.empty())
-			return false;
+	sceneData_.streamer_->update();
 
-		data = sceneData_.loadedFiles_.back();
+	const auto start = std::chrono::steady_clock::now();
 
-		sceneData_.loadedFiles_.pop_back();
-	}
+	bool hasUploads = false;
+	StreamedTextureUpdate u;
 
-	this->updateTexture(data.index_, ctx_.resources.addRGBATexture(data.w_, data.h_, const_cast<uint8_t*>(data.img_)));
+	while (sceneData_.streamer_->popUpdate(u))
+	{
+		hasUploads = true;
 
-	stbi_image_free((void*)data.img_);
+		VulkanTexture& texture = sceneData_.allMaterialTextures[u.texture_];
+		releasedTextures_.push_back({ texture, frameIndex_ });
+
+		texture = ctx_.resources.addRGBAMIPTexture(u.w_, u.h_, u.numLevels_, u.mips_.data());
+		// a single descriptor is written, the descriptor sets and the recorded command buffers are not touched
+		ctx_.resources.updateBindlessTexture(sceneData_.textureSlots_[u.texture_], texture);
+
+		if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() > timeBudgetMs)
+			break;
+	}
 
-	return true;
+	return hasUploads;
 }
@@ -4,6 +4,11 @@
 #include "shared/scene/Scene.h"
 #include "shared/scene/Material.h"
 #include "shared/scene/VtxData.h"
+#include "shared/TextureCache.h"
+#include "shared/scene/TextureStreamer.h"
+
+#include <deque>
+#include <memory>
 
 #include <taskflow/taskflow.hpp>
 
@@ -25,9 +30,15 @@ struct VKSceneData
 	VulkanBuffer material_;
 	VulkanBuffer transforms_;
 
+	/* Mesh descriptors and mesh-space bounding boxes for GPU culling */
+	VulkanBuffer meshes_;
+	VulkanBuffer boxes_;
+
 	VulkanRenderContext& ctx;
 
-	TextureArrayAttachment allMaterialTextures;
+	/* Material textures and their slots in the bindless texture table of ctx.resources */
+	std::vector<VulkanTexture> allMaterialTextures;
+	std::vector<uint32_t> textureSlots_;
 
 	BufferAttachment indexBuffer_;
 	BufferAttachment vertexBuffer_;
@@ -39,8 +50,13 @@ struct VKSceneData
 
 	std::vector<glm::mat4> shapeTransforms_;
 
+	/* shapes_[i].transformIndex is 'i': the global transforms of the shapes are in shapeTransforms_ (use them with cullShapes() and requestShapeTextures()) */
 	std::vector<DrawData> shapes_;
 
+	/* The node of each shape (the instance node for the prefab content) and the transform relative to it, see forEachMeshNode() */
+	std::vector<uint32_t> shapeNodes_;
+	std::vector<glm::mat4> shapeInstanceTransforms_;
+
 	void loadScene(const char* sceneFile);
 	void loadMeshes(const char* meshFile);
 
@@ -50,26 +66,20 @@ struct VKSceneData
 
 	void updateMaterial(int matIdx);
 
-	/* Chapter 9, async loading */
-	struct LoadedImageData
-	{
-		int index_ = 0;
-		int w_ = 0;
-		int h_ = 0;
-		const uint8_t* img_ = nullptr;
-	};
+	/* The material with the texture indices replaced by the bindless slots */
+	MaterialDescription getGPUMaterial(const MaterialDescription& m) const;
 
+	/* Chapter 9, async loading: progressive MIP streaming of the material textures, applied by MultiRenderer::checkLoadedTextures() */
 	std::vector<std::string> textureFiles_;
-	std::vector<LoadedImageData> loadedFiles_;
-	std::mutex loadedFilesMutex_;
+	std::unique_ptr<TextureStreamer> streamer_;
 
-private:
-	tf::Taskflow taskflow_;
-	tf::Executor executor_;
+	/* Textures of all the shapes are streamed at their on-screen resolution, call once per frame */
+	void requestTextures(const glm::mat4& view, const glm::mat4& proj);
 };
 
 constexpr const char* DefaultMeshVertexShader = "data/shaders/chapter07/VK01.vert";
 constexpr const char* DefaultMeshFragmentShader = "data/shaders/chapter07/VK01.frag";
+constexpr const char* DefaultMeshCullingShader = "data/shaders/chapter07/VK01_Culling.comp";
 
 struct MultiRenderer: public Renderer
 {
@@ -84,10 +94,24 @@ struct MultiRenderer: public Renderer
 		const std::vector<TextureAttachment>& auxTextures = std::vector<TextureAttachment> {});
 
 	void fillCommandBuffer(VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) override;
+	const char* getProfilerName() const override { return "MultiRenderer"; }
 	void updateBuffers(size_t currentImage) override;
 
+	/* visibility[] can be filled by frustum culling or by cullShapes() from shared/scene/OcclusionCulling.h */
 	void updateIndirectBuffers(size_t currentImage, bool* visibility = nullptr);
 
+	/*
+		GPU-driven rendering: a compute pass performs frustum culling and LOD selection for all shapes,
+		writes compacted indirect commands and the draw count, and the scene is drawn with vkCmdDrawIndirectCountKHR().
+		The CPU cost of issuing draws no longer depends on the number of shapes and updateIndirectBuffers() is not needed.
+	*/
+	void enableGPUCulling(const char* compShaderFile = DefaultMeshCullingShader);
+
+	/* Distance (in bounding sphere radii) at which LOD 1 is selected by the GPU culling pass. Zero disables distance-based LOD selection */
+	inline void setLODDistanceScale(float scale) {
+		cullingData_.lodDistanceScale_ = scale;
+	}
+
 	inline void setMatrices(const glm::mat4& proj, const glm::mat4& view) {
 		const glm::mat4 m1 = glm::scale(glm::mat4(1.f), glm::vec3(1.f, -1.f, 1.f));
 		ubo_.proj_ = proj;
@@ -100,12 +124,17 @@ struct MultiRenderer: public Renderer
 
 	inline const VKSceneData& getSceneData() const { return sceneData_; }
 
-	// Async loading in Chapter9
-	bool checkLoadedTextures();
+	// Async loading in Chapter9: replaces the textures which have new MIP levels streamed in or out until the time budget runs out (at least one texture per call).
+	// Materials reference the textures by their indices and do not change
+	bool checkLoadedTextures(double timeBudgetMs = 2.0);
 
 private:
 	VKSceneData& sceneData_;
 
+	// replaced textures and the frame they were replaced at, destroyed when no frame in flight can use them
+	std::deque<std::pair<VulkanTexture, size_t>> releasedTextures_;
+	size_t frameIndex_ = 0;
+
 	std::vector<VulkanBuffer> indirect_;
 	std::vector<VulkanBuffer> shape_;
 
@@ -114,4 +143,27 @@ private:
 		mat4 view_;
 		vec4 cameraPos_;
 	} ubo_;
+
+	/* GPU culling pass */
+	bool useGPUCulling_ = false;
+
+	std::vector<VulkanBuffer> count_;
+	std::vector<VulkanBuffer> cullingUniforms_;
+	std::vector<VkDescriptorSet> cullingDescriptorSets_;
+
+	VkDescriptorSetLayout cullingDescriptorSetLayout_ = nullptr;
+	VkDescriptorPool cullingDescriptorPool_ = nullptr;
+	VkPipelineLayout cullingPipelineLayout_ = nullptr;
+	VkPipeline cullingPipeline_ = nullptr;
+
+	struct CullingData {
+		vec4 frustumPlanes_[6];
+		vec4 frustumCorners_[8];
+		vec4 cameraPos_;
+		float lodDistanceScale_ = 0.0f;
+		uint32_t numShapes_ = 0;
+		uint32_t padding_[2] = { 0, 0 };
+	} cullingData_;
+
+	void fillCullingCommands(VkCommandBuffer commandBuffer, size_t currentImage);
 };
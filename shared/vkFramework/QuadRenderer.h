@@ -10,6 +10,7 @@ struct QuadRenderer: public Renderer
 		RenderPass screenRenderPass = RenderPass());
 
 	void fillCommandBuffer(VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) override;
+	const char* getProfilerName() const override { return "Quads"; }
 	void updateBuffers(size_t currentImage) override;
 
 	void quad(float x1, float y1, float x2, float y2, int texIdx);
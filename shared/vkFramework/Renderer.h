@@ -13,6 +13,14 @@ struct Renderer
 	virtual void fillCommandBuffer(VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) = 0;
 	virtual void updateBuffers(size_t currentImage) {}
 
+	// Parallel recording (see VulkanRenderContext::enableParallelRecording()): the renderers recording their own command buffers in place of this one
+	virtual void collectRenderJobs(std::vector<RenderJob>& jobs, VkFramebuffer fb, VkRenderPass rp) {
+		jobs.push_back(RenderJob { .renderer_ = *this, .fb_ = fb, .rp_ = rp });
+	}
+
+	// GPU profiling (see VulkanRenderContext::enableGPUProfiler()): the name of the timestamp scope around fillCommandBuffer(), the renderers without a name are not measured
+	virtual const char* getProfilerName() const { return nullptr; }
+
 	inline void updateUniformBuffer(uint32_t currentImage, const uint32_t offset, const uint32_t size, const void* data) {
 		uploadBufferData(ctx_.vkDev, uniforms_[currentImage].memory, offset, data, size);
 	}
@@ -78,7 +86,7 @@ struct Renderer
 	uint32_t processingWidth;
 	uint32_t processingHeight;
 
-	// Updating individual textures (9 is the binding in our Chapter7-Chapter9 IBL scene shaders)
+	// Updating individual textures of a texture array attachment (the scene shaders of MultiRenderer use the bindless texture table of VulkanResources instead)
 	void updateTexture(uint32_t textureIndex, VulkanTexture newTexture, uint32_t bindingIndex = 9)
 	{
 		for (auto ds: descriptorSets_)
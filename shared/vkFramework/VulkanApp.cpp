@@ -1,6 +1,10 @@
 #include "VulkanApp.h"
 
 #include "shared/vkFramework/Renderer.h"
+#include "shared/VulkanUploadBatcher.h"
+
+#include <algorithm>
+#include <taskflow/taskflow.hpp>
 
 Resolution detectResolution(int width, int height)
 {
@@ -53,7 +57,8 @@ GLFWwindow* initVulkanApp(int width, int height, Resolution* resolution)
 	return result;
 }
 
-bool drawFrame(VulkanRenderDevice& vkDev, const std::function<void(uint32_t)>& updateBuffersFunc, const std::function<void(VkCommandBuffer, uint32_t)>& composeFrameFunc)
+bool drawFrame(VulkanRenderDevice& vkDev, const std::function<void(uint32_t)>& updateBuffersFunc, const std::function<void(VkCommandBuffer, uint32_t)>& composeFrameFunc,
+	const std::vector<VkCommandBuffer>* extraCommandBuffers)
 {
 	uint32_t imageIndex = 0;
 	VkResult result = vkAcquireNextImageKHR(vkDev.device, vkDev.swapchain, 0, vkDev.semaphore, VK_NULL_HANDLE, &imageIndex);
@@ -75,21 +80,45 @@ bool drawFrame(VulkanRenderDevice& vkDev, const std::function<void(uint32_t)>& u
 
 	VK_CHECK(vkBeginCommandBuffer(commandBuffer, &bi));
 
+	// textures uploaded since the previous frame: the frame waits for the transfer queue only if it acquires some of them
+	uint64_t uploadWaitValue = vkDev.uploadBatcher ? vkDev.uploadBatcher->flushToCommandBuffer(commandBuffer) : 0;
+
 	composeFrameFunc(commandBuffer, imageIndex);
 
 	VK_CHECK(vkEndCommandBuffer(commandBuffer));
 
-	const VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT }; // or even VERTEX_SHADER_STAGE
+	// anything uploaded while composing the frame: its acquire barriers are submitted before the frame, which waits for the same copies
+	if (vkDev.uploadBatcher)
+		uploadWaitValue = std::max(uploadWaitValue, vkDev.uploadBatcher->flush());
+
+	std::vector<VkCommandBuffer> commandBuffers = { commandBuffer };
+	if (extraCommandBuffers)
+		commandBuffers.insert(commandBuffers.end(), extraCommandBuffers->begin(), extraCommandBuffers->end());
+
+	const VkSemaphore waitSemaphores[] = { vkDev.semaphore, uploadWaitValue ? vkDev.uploadBatcher->getTimelineSemaphore() : VK_NULL_HANDLE };
+	const VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT }; // or even VERTEX_SHADER_STAGE
+	// the value of the binary semaphore is ignored
+	const uint64_t waitValues[] = { 0, uploadWaitValue };
+
+	const VkTimelineSemaphoreSubmitInfoKHR tsi =
+	{
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.pNext = nullptr,
+		.waitSemaphoreValueCount = 2,
+		.pWaitSemaphoreValues = waitValues,
+		.signalSemaphoreValueCount = 0,
+		.pSignalSemaphoreValues = nullptr
+	};
 
 	const VkSubmitInfo si =
 	{
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.pNext = nullptr,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = &vkDev.semaphore,
+		.pNext = uploadWaitValue ? &tsi : nullptr,
+		.waitSemaphoreCount = uploadWaitValue ? 2u : 1u,
+		.pWaitSemaphores = waitSemaphores,
 		.pWaitDstStageMask = waitStages,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &vkDev.commandBuffers[imageIndex],
+		.commandBufferCount = (uint32_t)commandBuffers.size(),
+		.pCommandBuffers = commandBuffers.data(),
 		.signalSemaphoreCount = 1,
 		.pSignalSemaphores = &vkDev.renderSemaphore
 	};
@@ -133,9 +162,16 @@ void VulkanRenderContext::composeFrame(VkCommandBuffer commandBuffer, uint32_t i
 		VkClearValue { .depthStencil = { 1.0f, 0 } }
 	};
 
+	if (gpuProfiler_)
+		gpuProfiler_->beginFrame(commandBuffer, imageIndex);
+
 	beginRenderPass(commandBuffer, clearRenderPass.handle, imageIndex, defaultScreenRect, VK_NULL_HANDLE, 2u, defaultClearValues);
 	vkCmdEndRenderPass( commandBuffer );
 
+	parallelCommandBuffers_.clear();
+
+	std::vector<RenderJob> jobs;
+
 	for (auto& r : onScreenRenderers_)
 		if (r.enabled_)
 		{
@@ -147,13 +183,126 @@ void VulkanRenderContext::composeFrame(VkCommandBuffer commandBuffer, uint32_t i
 			if (r.renderer_.framebuffer_ != VK_NULL_HANDLE)
 				fb = r.renderer_.framebuffer_;
 
-			r.renderer_.fillCommandBuffer(commandBuffer, imageIndex, fb, rp.handle);
+			if (recordingExecutor_)
+				r.renderer_.collectRenderJobs(jobs, fb, rp.handle);
+			else
+				fillCommandBuffer(r.renderer_, commandBuffer, imageIndex, fb, rp.handle);
 		}
 
+	if (recordingExecutor_)
+	{
+		recordInParallel(jobs, imageIndex, defaultScreenRect);
+		return;
+	}
+
 	beginRenderPass(commandBuffer, finalRenderPass.handle, imageIndex, defaultScreenRect);
 	vkCmdEndRenderPass( commandBuffer );
 }
 
+void VulkanRenderContext::fillCommandBuffer(Renderer& r, VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb, VkRenderPass rp)
+{
+	const char* name = gpuProfiler_ ? r.getProfilerName() : nullptr;
+
+	if (!name)
+	{
+		r.fillCommandBuffer(cmdBuffer, currentImage, fb, rp);
+		return;
+	}
+
+	const uint32_t scope = gpuProfiler_->beginScope(cmdBuffer, name);
+	r.fillCommandBuffer(cmdBuffer, currentImage, fb, rp);
+	gpuProfiler_->endScope(cmdBuffer, scope);
+}
+
+VulkanRenderContext::~VulkanRenderContext()
+{
+	for (auto& f: parallelFrames_)
+		for (auto pool: f.pools_)
+			vkDestroyCommandPool(vkDev.device, pool, nullptr);
+}
+
+void VulkanRenderContext::enableParallelRecording(tf::Executor* executor)
+{
+	recordingExecutor_ = executor ? executor : &getImageProcessingExecutor();
+	parallelFrames_.resize(vkDev.swapchainImages.size());
+}
+
+void VulkanRenderContext::enableGPUProfiler()
+{
+	gpuProfiler_ = std::make_unique<VulkanGPUProfiler>(vkDev);
+}
+
+void VulkanRenderContext::recordInParallel(const std::vector<RenderJob>& jobs, uint32_t imageIndex, const VkRect2D& screenRect)
+{
+	ParallelFrame& frame = parallelFrames_[imageIndex];
+
+	// one more buffer for the final pass
+	const size_t numBuffers = jobs.size() + 1;
+
+	while (frame.pools_.size() < numBuffers)
+	{
+		const VkCommandPoolCreateInfo cpi =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+			.pNext = nullptr,
+			.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+			.queueFamilyIndex = vkDev.graphicsFamily
+		};
+
+		VkCommandPool pool;
+		VK_CHECK(vkCreateCommandPool(vkDev.device, &cpi, nullptr, &pool));
+
+		const VkCommandBufferAllocateInfo ai =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.pNext = nullptr,
+			.commandPool = pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1
+		};
+
+		VkCommandBuffer buffer;
+		VK_CHECK(vkAllocateCommandBuffers(vkDev.device, &ai, &buffer));
+
+		frame.pools_.push_back(pool);
+		frame.buffers_.push_back(buffer);
+	}
+
+	const VkCommandBufferBeginInfo bi =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = nullptr
+	};
+
+	// the previous frame using these pools has completed (drawFrame() waits for the device to be idle)
+	auto recordJob = [this, &frame, &jobs, &bi, imageIndex](int i)
+	{
+		VK_CHECK(vkResetCommandPool(vkDev.device, frame.pools_[i], 0));
+		VK_CHECK(vkBeginCommandBuffer(frame.buffers_[i], &bi));
+
+		const RenderJob& job = jobs[i];
+		fillCommandBuffer(job.renderer_, frame.buffers_[i], imageIndex, job.fb_, job.rp_);
+
+		VK_CHECK(vkEndCommandBuffer(frame.buffers_[i]));
+	};
+
+	tf::Taskflow taskflow;
+	taskflow.for_each_index(0, (int)jobs.size(), 1, recordJob);
+	recordingExecutor_->run(taskflow).wait();
+
+	const size_t last = jobs.size();
+
+	VK_CHECK(vkResetCommandPool(vkDev.device, frame.pools_[last], 0));
+	VK_CHECK(vkBeginCommandBuffer(frame.buffers_[last], &bi));
+	beginRenderPass(frame.buffers_[last], finalRenderPass.handle, imageIndex, screenRect);
+	vkCmdEndRenderPass(frame.buffers_[last]);
+	VK_CHECK(vkEndCommandBuffer(frame.buffers_[last]));
+
+	parallelCommandBuffers_.assign(frame.buffers_.begin(), frame.buffers_.begin() + numBuffers);
+}
+
 void VulkanApp::assignCallbacks()
 {
 	glfwSetCursorPosCallback(
@@ -230,7 +379,8 @@ void VulkanApp::mainLoop()
 
 		bool frameRendered = drawFrame(ctx_.vkDev,
 			[this](uint32_t img) { this->updateBuffers(img); },
-			[this](auto cmd, auto img) { ctx_.composeFrame(cmd, img); }
+			[this](auto cmd, auto img) { ctx_.composeFrame(cmd, img); },
+			&ctx_.parallelCommandBuffers_
 		);
 
 		fpsCounter_.tick(deltaSeconds, frameRendered);
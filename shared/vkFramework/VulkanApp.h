@@ -21,6 +21,7 @@
 #include "shared/UtilsFPS.h"
 
 #include "shared/vkFramework/VulkanResources.h"
+#include "shared/vkFramework/VulkanGPUProfiler.h"
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -37,7 +38,9 @@ struct Resolution
 
 GLFWwindow* initVulkanApp(int width, int height, Resolution* resolution = nullptr);
 
-bool drawFrame(VulkanRenderDevice& vkDev, const std::function<void(uint32_t)>& updateBuffersFunc, const std::function<void(VkCommandBuffer, uint32_t)>& composeFrameFunc);
+/* 'extraCommandBuffers' (filled by composeFrameFunc) are submitted in order after the main command buffer in the same batch */
+bool drawFrame(VulkanRenderDevice& vkDev, const std::function<void(uint32_t)>& updateBuffersFunc, const std::function<void(VkCommandBuffer, uint32_t)>& composeFrameFunc,
+	const std::vector<VkCommandBuffer>* extraCommandBuffers = nullptr);
 
 struct Renderer;
 
@@ -51,6 +54,13 @@ struct RenderItem {
 	{}
 };
 
+/* A renderer with the framebuffer and the render pass it records into (see Renderer::collectRenderJobs()) */
+struct RenderJob {
+	Renderer& renderer_;
+	VkFramebuffer fb_;
+	VkRenderPass rp_;
+};
+
 struct VulkanRenderContext
 {
 	VulkanInstance vk;
@@ -75,9 +85,32 @@ struct VulkanRenderContext
 	{
 	}
 
+	~VulkanRenderContext();
+
 	void updateBuffers(uint32_t imageIndex);
 	void composeFrame(VkCommandBuffer commandBuffer, uint32_t imageIndex);
 
+	/*
+		Parallel recording: the render jobs of the enabled renderers are recorded on 'executor' (getImageProcessingExecutor() if nullptr)
+		into their own command buffers, allocated from a command pool per job and per swapchain image.
+		composeFrame() puts the buffers into parallelCommandBuffers_ which drawFrame() submits in order after the main one.
+		The fillCommandBuffer() methods are called concurrently and must only record commands.
+	*/
+	void enableParallelRecording(tf::Executor* executor = nullptr);
+
+	std::vector<VkCommandBuffer> parallelCommandBuffers_;
+
+	/*
+		GPU profiling: composeFrame() writes timestamps around every renderer with a name (see Renderer::getProfilerName()),
+		including the internal renderers of CompositeRenderer. The results of the previous frames are in gpuProfiler_->getScopes().
+	*/
+	void enableGPUProfiler();
+
+	std::unique_ptr<VulkanGPUProfiler> gpuProfiler_;
+
+	/* Renderer::fillCommandBuffer() in a GPU profiler scope */
+	void fillCommandBuffer(Renderer& r, VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb, VkRenderPass rp);
+
 	// For Chapter 8 & 9
 	inline PipelineInfo pipelineParametersForOutputs(const std::vector<VulkanTexture>& outputs) const {
 		return PipelineInfo {
@@ -116,6 +149,20 @@ struct VulkanRenderContext
 
 		vkCmdBeginRenderPass( cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE );
 	}
+
+private:
+	tf::Executor* recordingExecutor_ = nullptr;
+
+	// command pools of the render jobs (and the final pass as the last one) for a swapchain image
+	struct ParallelFrame
+	{
+		std::vector<VkCommandPool> pools_;
+		std::vector<VkCommandBuffer> buffers_;
+	};
+
+	std::vector<ParallelFrame> parallelFrames_;
+
+	void recordInParallel(const std::vector<RenderJob>& jobs, uint32_t imageIndex, const VkRect2D& screenRect);
 };
 
 struct VulkanApp
@@ -0,0 +1,250 @@
+#include "shared/vkFramework/VulkanGPUProfiler.h"
+#include "shared/EasyProfilerWrapper.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(_WIN32)
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <windows.h>
+#else
+#	include <time.h>
+#endif // _WIN32
+
+// the host clock vkGetCalibratedTimestampsEXT() samples together with the device one
+#if defined(_WIN32)
+static constexpr VkTimeDomainEXT kHostTimeDomain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+static constexpr VkTimeDomainEXT kHostTimeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif // _WIN32
+
+static uint64_t getSteadyClockNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// A timestamp of kHostTimeDomain in nanoseconds
+static uint64_t hostTimestampToNs(uint64_t timestamp)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	const uint64_t f = (uint64_t)frequency.QuadPart;
+	return (timestamp / f) * 1000000000ull + (timestamp % f) * 1000000000ull / f;
+#else
+	return timestamp;
+#endif // _WIN32
+}
+
+/// The current time of kHostTimeDomain in nanoseconds
+static uint64_t getHostClockNs()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return hostTimestampToNs((uint64_t)counter.QuadPart);
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif // _WIN32
+}
+
+static bool isTimeDomainSupported(VkPhysicalDevice physicalDevice, VkTimeDomainEXT domain)
+{
+	uint32_t numDomains = 0;
+	if (vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(physicalDevice, &numDomains, nullptr) != VK_SUCCESS)
+		return false;
+
+	std::vector<VkTimeDomainEXT> domains(numDomains);
+	if (vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(physicalDevice, &numDomains, domains.data()) != VK_SUCCESS)
+		return false;
+
+	return std::find(domains.begin(), domains.end(), domain) != domains.end();
+}
+
+VulkanGPUProfiler::VulkanGPUProfiler(VulkanRenderDevice& vkDev)
+: vkDev_(vkDev)
+, frames_(vkDev.swapchainImages.size())
+{
+	uint32_t numFamilies = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(vkDev.physicalDevice, &numFamilies, nullptr);
+
+	std::vector<VkQueueFamilyProperties> families(numFamilies);
+	vkGetPhysicalDeviceQueueFamilyProperties(vkDev.physicalDevice, &numFamilies, families.data());
+
+	const uint32_t validBits = families[vkDev.graphicsFamily].timestampValidBits;
+
+	if (!validBits)
+	{
+		printf("VulkanGPUProfiler: the graphics queue does not support timestamps\n");
+		return;
+	}
+
+	timestampMask_ = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(vkDev.physicalDevice, &props);
+	timestampPeriod_ = props.limits.timestampPeriod;
+
+	for (auto& f: frames_)
+		f.names_.resize(kMaxScopes);
+
+	// two queries per scope for every frame and one more for the calibration
+	const VkQueryPoolCreateInfo ci =
+	{
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = (uint32_t)frames_.size() * kMaxScopes * 2 + 1,
+		.pipelineStatistics = 0
+	};
+
+	VK_CHECK(vkCreateQueryPool(vkDev.device, &ci, nullptr, &queryPool_));
+
+	useCalibratedTimestamps_ = vkDev.useCalibratedTimestamps &&
+		isTimeDomainSupported(vkDev.physicalDevice, VK_TIME_DOMAIN_DEVICE_EXT) &&
+		isTimeDomainSupported(vkDev.physicalDevice, kHostTimeDomain);
+
+	calibrate();
+}
+
+VulkanGPUProfiler::~VulkanGPUProfiler()
+{
+	if (queryPool_ != VK_NULL_HANDLE)
+		vkDestroyQueryPool(vkDev_.device, queryPool_, nullptr);
+}
+
+void VulkanGPUProfiler::calibrate()
+{
+	if (useCalibratedTimestamps_)
+	{
+		// the device and the host clocks are sampled at the same moment by the driver
+		const VkCalibratedTimestampInfoEXT infos[2] =
+		{
+			{ .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .pNext = nullptr, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT },
+			{ .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .pNext = nullptr, .timeDomain = kHostTimeDomain },
+		};
+
+		uint64_t timestamps[2] = {};
+		uint64_t maxDeviation = 0;
+
+		if (vkGetCalibratedTimestampsEXT(vkDev_.device, 2, infos, timestamps, &maxDeviation) == VK_SUCCESS)
+		{
+			// the host clock may have another epoch than the steady clock: both are read now to get the offset
+			const uint64_t hostNowNs = getHostClockNs();
+			const uint64_t steadyNowNs = getSteadyClockNs();
+
+			gpuBase_ = timestamps[0];
+			cpuBaseNs_ = steadyNowNs - (hostNowNs - hostTimestampToNs(timestamps[1]));
+			return;
+		}
+
+		// do not fall back to the stalling calibration below every frame
+		printf("VulkanGPUProfiler: vkGetCalibratedTimestampsEXT() failed, the clocks are calibrated once\n");
+		useCalibratedTimestamps_ = false;
+	}
+
+	// a timestamp written by a single-time submit: it is earlier than the moment the submit has completed by the submit latency
+	const uint32_t query = (uint32_t)frames_.size() * kMaxScopes * 2;
+
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(vkDev_);
+	vkCmdResetQueryPool(commandBuffer, queryPool_, query, 1);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool_, query);
+	endSingleTimeCommands(vkDev_, commandBuffer);
+
+	cpuBaseNs_ = getSteadyClockNs();
+
+	VK_CHECK(vkGetQueryPoolResults(vkDev_.device, queryPool_, query, 1, sizeof(gpuBase_), &gpuBase_, sizeof(gpuBase_), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+}
+
+uint64_t VulkanGPUProfiler::toNanoseconds(uint64_t timestamp) const
+{
+	int64_t ticks = (int64_t)((timestamp - gpuBase_) & timestampMask_);
+
+	// the timestamps earlier than the calibration wrap around the valid bits
+	if (timestampMask_ != ~0ull && ticks > (int64_t)(timestampMask_ >> 1))
+		ticks -= (int64_t)timestampMask_ + 1;
+
+	return (uint64_t)((int64_t)cpuBaseNs_ + (int64_t)((double)ticks * timestampPeriod_));
+}
+
+void VulkanGPUProfiler::readResults(uint32_t frame)
+{
+	const uint32_t numScopes = frames_[frame].numScopes_;
+
+	if (!numScopes)
+		return;
+
+	// (value, availability) pairs
+	std::vector<uint64_t> results(numScopes * 2 * 2);
+
+	const VkResult result = vkGetQueryPoolResults(vkDev_.device, queryPool_, frame * kMaxScopes * 2, numScopes * 2,
+		results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	if (result != VK_SUCCESS && result != VK_NOT_READY)
+		return;
+
+	for (uint32_t i = 0; i != numScopes * 2; i++)
+		if (!results[i * 2 + 1])
+			return;
+
+	if (useCalibratedTimestamps_)
+		calibrate();
+
+	scopes_.resize(numScopes);
+
+	for (uint32_t i = 0; i != numScopes; i++)
+	{
+		Scope& s = scopes_[i];
+		s.name_ = frames_[frame].names_[i];
+		s.beginNs_ = toNanoseconds(results[i * 4 + 0]);
+		s.endNs_ = toNanoseconds(results[i * 4 + 2]);
+
+		PROFILER_GPU_BLOCK(s.name_, s.beginNs_, s.endNs_);
+	}
+}
+
+void VulkanGPUProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	if (!isSupported())
+		return;
+
+	// the scopes of the frame recorded before
+	frames_[currentFrame_].numScopes_ = std::min(numScopes_.load(), kMaxScopes);
+
+	readResults(imageIndex);
+
+	vkCmdResetQueryPool(commandBuffer, queryPool_, imageIndex * kMaxScopes * 2, kMaxScopes * 2);
+
+	currentFrame_ = imageIndex;
+	frames_[imageIndex].numScopes_ = 0;
+	numScopes_ = 0;
+}
+
+uint32_t VulkanGPUProfiler::beginScope(VkCommandBuffer commandBuffer, const char* name)
+{
+	if (!isSupported())
+		return ~0u;
+
+	const uint32_t scope = numScopes_++;
+
+	if (scope >= kMaxScopes)
+		return ~0u;
+
+	frames_[currentFrame_].names_[scope] = name;
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool_, (currentFrame_ * kMaxScopes + scope) * 2);
+
+	return scope;
+}
+
+void VulkanGPUProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+	if (scope == ~0u)
+		return;
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool_, (currentFrame_ * kMaxScopes + scope) * 2 + 1);
+}
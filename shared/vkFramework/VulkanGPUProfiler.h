@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "shared/UtilsVulkan.h"
+
+/**
+	GPU timestamps of the scopes recorded into the frames (see VulkanRenderContext::enableGPUProfiler()).
+
+	Every swapchain image has its own range of queries: the results of a frame are read when the same image is recorded again,
+	the frames in flight are never waited for (a frame whose queries are not available yet is skipped).
+	The GPU ticks are converted to std::chrono::steady_clock: with VK_EXT_calibrated_timestamps supporting the device and the host
+	(CLOCK_MONOTONIC or QueryPerformanceCounter) time domains the clocks are calibrated every frame without a stall, otherwise once
+	with a single-time submit. The results are emitted with PROFILER_GPU_BLOCK() as well.
+
+	beginScope() and endScope() can be called from several threads recording different command buffers of the same frame.
+*/
+class VulkanGPUProfiler final
+{
+public:
+	static constexpr uint32_t kMaxScopes = 256;
+
+	struct Scope
+	{
+		const char* name_;
+		// std::chrono::steady_clock nanoseconds
+		uint64_t beginNs_;
+		uint64_t endNs_;
+	};
+
+	explicit VulkanGPUProfiler(VulkanRenderDevice& vkDev);
+	~VulkanGPUProfiler();
+
+	VulkanGPUProfiler(const VulkanGPUProfiler&) = delete;
+	VulkanGPUProfiler& operator=(const VulkanGPUProfiler&) = delete;
+
+	/// false if the graphics queue does not support timestamps (the scopes are not recorded then)
+	inline bool isSupported() const { return queryPool_ != VK_NULL_HANDLE; }
+
+	/// Read the results of the previous frame recorded for 'imageIndex' and reset its queries, called before any scope of the frame
+	void beginFrame(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+
+	/// Returns the index passed to endScope(), ~0u if the frame has no free queries left. 'name' should outlive the profiler
+	uint32_t beginScope(VkCommandBuffer commandBuffer, const char* name);
+	void endScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+	/// The scopes of the latest frame with the results available, in the order they have been started
+	inline const std::vector<Scope>& getScopes() const { return scopes_; }
+
+private:
+	VulkanRenderDevice& vkDev_;
+
+	VkQueryPool queryPool_ = VK_NULL_HANDLE;
+
+	// nanoseconds per tick and the mask of the valid bits
+	double timestampPeriod_ = 1.0;
+	uint64_t timestampMask_ = ~0ull;
+
+	// vkGetCalibratedTimestampsEXT() samples both time domains, cleared if it fails
+	bool useCalibratedTimestamps_ = false;
+
+	// a GPU timestamp and the steady clock at the same moment
+	uint64_t gpuBase_ = 0;
+	uint64_t cpuBaseNs_ = 0;
+
+	struct Frame
+	{
+		std::vector<const char*> names_;
+		uint32_t numScopes_ = 0;
+	};
+
+	std::vector<Frame> frames_;
+	uint32_t currentFrame_ = 0;
+	std::atomic<uint32_t> numScopes_ = 0;
+
+	std::vector<Scope> scopes_;
+
+	void calibrate();
+	uint64_t toNanoseconds(uint64_t timestamp) const;
+	void readResults(uint32_t frame);
+};
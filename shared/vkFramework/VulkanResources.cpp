@@ -1,4 +1,5 @@
 #include "shared/vkFramework/VulkanResources.h"
+#include "shared/VulkanUploadBatcher.h"
 
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
@@ -17,6 +18,10 @@ glslang_stage_t glslangShaderStageFromFileName(const char* fileName);
 
 VulkanResources::~VulkanResources()
 {
+	// nothing should refer to the destroyed images
+	if (vkDev.uploadBatcher)
+		vkDev.uploadBatcher->wait();
+
 	for (auto& t: allTextures)
 	{
 		destroyVulkanImage(vkDev.device, t.image);
@@ -64,11 +69,11 @@ VulkanTexture VulkanResources::loadCubeMap(const char* fileName, uint32_t mipLev
 	else
 		createCubeTextureImage(vkDev, fileName, cubemap.image.image, cubemap.image.imageMemory, &w, &h);
 
-	createImageView(vkDev.device, cubemap.image.image, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, &cubemap.image.imageView, VK_IMAGE_VIEW_TYPE_CUBE, 6, mipLevels);
+	createImageView(vkDev.device, cubemap.image.image, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, &cubemap.image.imageView, VK_IMAGE_VIEW_TYPE_CUBE, 6, mipLevels);
 
 	createTextureSampler(vkDev.device, &cubemap.sampler);
 
-	cubemap.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	cubemap.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 
 	cubemap.width = w;
 	cubemap.height = h;
@@ -79,29 +84,59 @@ VulkanTexture VulkanResources::loadCubeMap(const char* fileName, uint32_t mipLev
 }
 
 VulkanTexture VulkanResources::loadKTX(const char* fileName)
+{
+	VulkanTexture ktx;
+
+	if (!tryLoadKTX(fileName, ktx))
+	{
+		printf("VulkanResources: the format of KTX texture %s is not supported by the device\n", fileName);
+		exit(EXIT_FAILURE);
+	}
+
+	return ktx;
+}
+
+bool VulkanResources::tryLoadKTX(const char* fileName, VulkanTexture& texture)
 {
 	gli::texture gliTex = gli::load_ktx(fileName);
 	glm::tvec3<uint32_t> extent(gliTex.extent(0));
 
+	// gli formats are enumerated in the same order as VkFormat values
+	static_assert((int)gli::FORMAT_RG16_SFLOAT_PACK16 == (int)VK_FORMAT_R16G16_SFLOAT);
+	static_assert((int)gli::FORMAT_RGBA_ETC2_UNORM_BLOCK16 == (int)VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK);
+	const VkFormat format = (VkFormat)gliTex.format();
+	const uint32_t mipLevels = (uint32_t)gliTex.levels();
+
+	if (!isTextureFormatSupported(vkDev, format))
+		return false;
+
 	VulkanTexture ktx = {
 		.width = extent.x,
 		.height = extent.y,
-		.depth = 4
+		.depth = 4,
+		.format = format
 	};
 
-	if (!createTextureImageFromData(vkDev, ktx.image.image, ktx.image.imageMemory,
-		(uint8_t*)gliTex.data(0, 0, 0), ktx.width, ktx.height, VK_FORMAT_R16G16_SFLOAT))
+	// all the stored levels (e.g. ETC2 files from Tool01_TextureCompressor) are uploaded as they are
+	std::vector<size_t> levelOffsets(mipLevels);
+	for (uint32_t i = 0; i != mipLevels; i++)
+		levelOffsets[i] = (const uint8_t*)gliTex.data(0, 0, i) - (const uint8_t*)gliTex.data(0, 0, 0);
+
+	if (!createMIPTextureImageFromLevels(vkDev, ktx.image.image, ktx.image.imageMemory,
+		gliTex.data(0, 0, 0), gliTex.size(), levelOffsets, ktx.width, ktx.height, format))
 	{
-		printf("ModelRenderer: failed to load BRDF LUT texture \n");
+		printf("VulkanResources: failed to load KTX texture %s\n", fileName);
 		exit(EXIT_FAILURE);
 	}
 
-	createImageView(vkDev.device, ktx.image.image, VK_FORMAT_R16G16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, &ktx.image.imageView);
-	createTextureSampler(vkDev.device, &ktx.sampler, VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	createImageView(vkDev.device, ktx.image.image, format, VK_IMAGE_ASPECT_COLOR_BIT, &ktx.image.imageView, VK_IMAGE_VIEW_TYPE_2D, 1, mipLevels);
+	createTextureSampler(vkDev.device, &ktx.sampler, VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, (float)(mipLevels - 1));
 
 	allTextures.push_back(ktx);
 
-	return ktx;
+	texture = ktx;
+
+	return true;
 }
 
 VulkanTexture VulkanResources::loadTexture2D(const char* filename)
@@ -154,6 +189,46 @@ VulkanTexture VulkanResources::addRGBATexture(int texWidth, int texHeight, void*
 	return tex;
 }
 
+VulkanTexture VulkanResources::addRGBAMIPTexture(int texWidth, int texHeight, uint32_t mipLevels, const void* mips)
+{
+	VulkanTexture tex;
+	tex.width  = texWidth;
+	tex.height = texHeight;
+	tex.depth  = 1;
+	tex.format = VK_FORMAT_R8G8B8A8_UNORM;
+
+	// the image is left in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	if (!createMIPTextureImageFromData(vkDev, tex.image.image, tex.image.imageMemory,
+		const_cast<void*>(mips), mipLevels, texWidth, texHeight, tex.format))
+	{
+		printf("Cannot create MIP texture\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!createImageView(vkDev.device, tex.image.image, tex.format, VK_IMAGE_ASPECT_COLOR_BIT, &tex.image.imageView, VK_IMAGE_VIEW_TYPE_2D, 1, mipLevels))
+	{
+		printf("Cannot create image view for MIP texture\n");
+		exit(EXIT_FAILURE);
+	}
+
+	createTextureSampler(vkDev.device, &tex.sampler, VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, (float)(mipLevels - 1));
+	allTextures.push_back(tex);
+	return tex;
+}
+
+void VulkanResources::destroyTexture(const VulkanTexture& texture)
+{
+	auto i = std::find_if(allTextures.begin(), allTextures.end(), [&texture](const VulkanTexture& t) { return t.image.image == texture.image.image; });
+
+	if (i == allTextures.end())
+		return;
+
+	destroyVulkanImage(vkDev.device, i->image);
+	vkDestroySampler(vkDev.device, i->sampler, nullptr);
+
+	allTextures.erase(i);
+}
+
 VulkanTexture VulkanResources::addSolidRGBATexture(uint32_t color)
 {
 	VulkanTexture tex;
@@ -512,6 +587,13 @@ VkPipeline VulkanResources::addPipeline(VkRenderPass renderPass, VkPipelineLayou
 	const std::vector<const char*>& shaderFiles,
 	const PipelineInfo& ppInfo)
 {
+	const PipelineKey key(renderPass, pipelineLayout, std::vector<std::string>(shaderFiles.begin(), shaderFiles.end()),
+		ppInfo.width, ppInfo.height, ppInfo.topology, ppInfo.useDepth, ppInfo.useBlending, ppInfo.dynamicScissorState, ppInfo.patchControlPoints);
+
+	auto it = pipelineMap.find(key);
+	if (it != pipelineMap.end())
+		return it->second;
+
 	VkPipeline pipeline;
 
 	if (!this->createGraphicsPipeline(vkDev, renderPass, pipelineLayout, shaderFiles,
@@ -522,6 +604,7 @@ VkPipeline VulkanResources::addPipeline(VkRenderPass renderPass, VkPipelineLayou
 	}
 
 	allPipelines.push_back(pipeline);
+	pipelineMap[key] = pipeline;
 	return pipeline;
 }
 
@@ -545,6 +628,16 @@ VkDescriptorSetLayout VulkanResources::addDescriptorSetLayout(const DescriptorSe
 		bindings.push_back(descriptorSetLayoutBinding(bindingIdx++, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, t.dInfo.shaderStageFlags, static_cast<uint32_t>(t.textures.size())));
 	}
 
+	/* the renderers with the same bindings (e.g., all the QuadProcessors) share one layout */
+	DSLayoutKey key;
+	key.reserve(bindings.size());
+	for (const auto& b: bindings)
+		key.emplace_back(b.descriptorType, b.stageFlags, b.descriptorCount);
+
+	auto it = dsLayoutMap.find(key);
+	if (it != dsLayoutMap.end())
+		return it->second;
+
 	const VkDescriptorSetLayoutCreateInfo layoutInfo = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
 		.pNext = nullptr,
@@ -560,6 +653,7 @@ VkDescriptorSetLayout VulkanResources::addDescriptorSetLayout(const DescriptorSe
 	}
 
 	allDSLayouts.push_back(descriptorSetLayout);
+	dsLayoutMap[key] = descriptorSetLayout;
 	return descriptorSetLayout;
 }
 
@@ -584,6 +678,168 @@ VkDescriptorSet VulkanResources::addDescriptorSet(VkDescriptorPool descriptorPoo
 	return descriptorSet;
 }
 
+void VulkanResources::initBindlessTextures()
+{
+	if (bindless.set != VK_NULL_HANDLE)
+		return;
+
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProps = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT,
+		.pNext = nullptr
+	};
+
+	VkPhysicalDeviceProperties2 props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &indexingProps
+	};
+
+	vkGetPhysicalDeviceProperties2(vkDev.physicalDevice, &props);
+
+	// the per-stage limits count the descriptors of all the sets of a pipeline layout: leave room for the other sets' descriptors;
+	// 64-bit math, the limits can be close to UINT32_MAX or below the reserve
+	auto getAvailable = [](uint32_t limit, uint32_t reserved) -> uint64_t
+	{
+		return (uint64_t(limit) > reserved) ? uint64_t(limit) - reserved : 0;
+	};
+
+	// a combined image sampler counts both as a sampler and as a sampled image
+	const uint64_t maxTextures = std::min({
+		getAvailable(indexingProps.maxPerStageUpdateAfterBindResources, kBindlessReservedResources),
+		getAvailable(indexingProps.maxPerStageDescriptorUpdateAfterBindSamplers, kBindlessReservedSamplers),
+		getAvailable(indexingProps.maxPerStageDescriptorUpdateAfterBindSampledImages, kBindlessReservedSamplers),
+		getAvailable(indexingProps.maxDescriptorSetUpdateAfterBindSamplers, kBindlessReservedSamplers),
+		getAvailable(indexingProps.maxDescriptorSetUpdateAfterBindSampledImages, kBindlessReservedSamplers) });
+
+	bindless.capacity = (uint32_t)std::min<uint64_t>(kMaxBindlessTextures, maxTextures);
+
+	if (!bindless.capacity)
+	{
+		printf("The device does not support enough update-after-bind samplers for bindless textures\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// the variable-count binding declares the upper bound of the allocated count
+	const VkDescriptorSetLayoutBinding binding = descriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, bindless.capacity);
+
+	const VkDescriptorBindingFlagsEXT bindingFlags =
+		VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+		VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+		VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT;
+
+	const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+		.pNext = nullptr,
+		.bindingCount = 1,
+		.pBindingFlags = &bindingFlags
+	};
+
+	const VkDescriptorSetLayoutCreateInfo layoutInfo = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = &flagsInfo,
+		.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+		.bindingCount = 1,
+		.pBindings = &binding
+	};
+
+	if (vkCreateDescriptorSetLayout(vkDev.device, &layoutInfo, nullptr, &bindless.layout) != VK_SUCCESS)
+	{
+		printf("Failed to create bindless descriptor set layout\n");
+		exit(EXIT_FAILURE);
+	}
+
+	allDSLayouts.push_back(bindless.layout);
+
+	const VkDescriptorPoolSize poolSize = { .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = bindless.capacity };
+
+	const VkDescriptorPoolCreateInfo poolInfo = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT,
+		.maxSets = 1,
+		.poolSizeCount = 1,
+		.pPoolSizes = &poolSize
+	};
+
+	if (vkCreateDescriptorPool(vkDev.device, &poolInfo, nullptr, &bindless.pool) != VK_SUCCESS)
+	{
+		printf("Cannot allocate bindless descriptor pool\n");
+		exit(EXIT_FAILURE);
+	}
+
+	allDPools.push_back(bindless.pool);
+
+	const VkDescriptorSetVariableDescriptorCountAllocateInfoEXT countInfo = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT,
+		.pNext = nullptr,
+		.descriptorSetCount = 1,
+		.pDescriptorCounts = &bindless.capacity
+	};
+
+	const VkDescriptorSetAllocateInfo allocInfo = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = &countInfo,
+		.descriptorPool = bindless.pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &bindless.layout
+	};
+
+	if (vkAllocateDescriptorSets(vkDev.device, &allocInfo, &bindless.set) != VK_SUCCESS)
+	{
+		printf("Cannot allocate bindless descriptor set\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+uint32_t VulkanResources::addBindlessTexture(const VulkanTexture& texture)
+{
+	initBindlessTextures();
+
+	uint32_t slot;
+
+	if (!bindless.freeSlots.empty())
+	{
+		slot = bindless.freeSlots.back();
+		bindless.freeSlots.pop_back();
+	}
+	else
+	{
+		if (bindless.numSlots == bindless.capacity)
+		{
+			printf("Bindless texture table is full (%u textures)\n", bindless.capacity);
+			exit(EXIT_FAILURE);
+		}
+		slot = bindless.numSlots++;
+	}
+
+	updateTextureInDescriptorSetArray(vkDev, bindless.set, texture, slot, 0);
+
+	return slot;
+}
+
+void VulkanResources::updateBindlessTexture(uint32_t slot, const VulkanTexture& texture)
+{
+	updateTextureInDescriptorSetArray(vkDev, bindless.set, texture, slot, 0);
+}
+
+void VulkanResources::removeBindlessTexture(uint32_t slot)
+{
+	// partially bound: the stale descriptor is fine as long as it is not sampled
+	bindless.freeSlots.push_back(slot);
+}
+
+VkDescriptorSetLayout VulkanResources::getBindlessTextureSetLayout()
+{
+	initBindlessTextures();
+	return bindless.layout;
+}
+
+VkDescriptorSet VulkanResources::getBindlessTextureSet()
+{
+	initBindlessTextures();
+	return bindless.set;
+}
+
 /*
 	This routine counts all textures in all texture arrays (if any of them are present),
 	creates a list of DescriptorWrite operations with required buffer/image info structures
@@ -766,14 +1022,26 @@ RenderPass VulkanResources::addDepthRenderPass(const std::vector<VulkanTexture>&
 
 VkPipelineLayout VulkanResources::addPipelineLayout(VkDescriptorSetLayout dsLayout, uint32_t vtxConstSize, uint32_t fragConstSize)
 {
+	return addPipelineLayout(std::vector<VkDescriptorSetLayout> { dsLayout }, vtxConstSize, fragConstSize);
+}
+
+VkPipelineLayout VulkanResources::addPipelineLayout(const std::vector<VkDescriptorSetLayout>& dsLayouts, uint32_t vtxConstSize, uint32_t fragConstSize)
+{
+	const PipelineLayoutKey key(dsLayouts, vtxConstSize, fragConstSize);
+
+	auto it = pipelineLayoutMap.find(key);
+	if (it != pipelineLayoutMap.end())
+		return it->second;
+
 	VkPipelineLayout pipelineLayout;
-	if (!createPipelineLayoutWithConstants(vkDev.device, dsLayout, &pipelineLayout, vtxConstSize, fragConstSize))
+	if (!createPipelineLayoutWithConstants(vkDev.device, (uint32_t)dsLayouts.size(), dsLayouts.data(), &pipelineLayout, vtxConstSize, fragConstSize))
 	{
 		printf("Cannot create pipeline layout\n");
 		exit(EXIT_FAILURE);
 	}
 
 	allPipelineLayouts.push_back(pipelineLayout);
+	pipelineLayoutMap[key] = pipelineLayout;
 	return pipelineLayout;
 }
 
@@ -5,6 +5,8 @@
 #include <cstring>
 #include <memory>
 #include <map>
+#include <string>
+#include <tuple>
 #include <utility>
 
 /**
@@ -154,6 +156,9 @@ struct VulkanResources
 
 	VulkanTexture loadKTX(const char* fileName);
 
+	/// Like loadKTX(), returns false without creating anything if the device cannot sample the format of the file (ETC2 on most desktop GPUs)
+	bool tryLoadKTX(const char* fileName, VulkanTexture& texture);
+
 	VulkanTexture createFontTexture(const char* fontFile);
 
 	VulkanTexture addColorTexture(int texWidth = 0, int texHeight = 0, VkFormat colorFormat = VK_FORMAT_B8G8R8A8_UNORM, VkFilter minFilter = VK_FILTER_LINEAR, VkFilter maxFilter = VK_FILTER_LINEAR, VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT);
@@ -164,6 +169,12 @@ struct VulkanResources
 
 	VulkanTexture addRGBATexture(int texWidth, int texHeight, void* data);
 
+	/// RGBA8 MIP chain with the levels stored one after another (see generateMipChain() and loadCachedTexture())
+	VulkanTexture addRGBAMIPTexture(int texWidth, int texHeight, uint32_t mipLevels, const void* mips);
+
+	/// Destroy a texture created by this object before the end of its lifetime (it should not be used by any frame in flight)
+	void destroyTexture(const VulkanTexture& texture);
+
 	VulkanBuffer addBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, bool createMapping = false);
 
 	inline VulkanBuffer addUniformBuffer(VkDeviceSize bufferSize, bool createMapping = false) {
@@ -201,8 +212,12 @@ struct VulkanResources
 		.clearColor_ = false, .clearDepth_ = true,
 		.flags_ = eRenderPassBit_Offscreen | eRenderPassBit_First });
 
+	/* The layouts and the pipelines are shared: the same arguments return the same object (destroyed once in the end) */
 	VkPipelineLayout addPipelineLayout(VkDescriptorSetLayout dsLayout, uint32_t vtxConstSize = 0, uint32_t fragConstSize = 0);
 
+	/* The layout of the descriptor sets 0..dsLayouts.size()-1 */
+	VkPipelineLayout addPipelineLayout(const std::vector<VkDescriptorSetLayout>& dsLayouts, uint32_t vtxConstSize = 0, uint32_t fragConstSize = 0);
+
 	VkPipeline addPipeline(VkRenderPass renderPass, VkPipelineLayout pipelineLayout,
 		const std::vector<const char*>& shaderFiles,
 		const PipelineInfo& pipelineParams = PipelineInfo { .width = 0, .height = 0, .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, .useDepth = true, .useBlending = false, .dynamicScissorState = false });
@@ -220,6 +235,31 @@ struct VulkanResources
 
 	const std::vector<VulkanTexture>& getTextures() const { return allTextures; } 
 
+	/**
+		Bindless textures: a single descriptor set with an update-after-bind, partially bound, variable-count array of combined image samplers
+		(descriptor indexing), declared in the shaders as 'layout(set = 1, binding = 0) uniform sampler2D textures[]'.
+		The slots are allocated from a free list: adding, replacing or removing a texture writes one descriptor,
+		the descriptor sets of the renderers are never rebuilt and the recorded command buffers stay valid.
+		The table is created on the first use with up to kMaxBindlessTextures slots (less if the device limits are lower).
+		The device limits are shared with the other sets of the pipeline layouts: the table leaves kBindlessReservedSamplers samplers
+		and kBindlessReservedResources resources of the fragment stage to them.
+	*/
+	static constexpr uint32_t kMaxBindlessTextures = 65536;
+	static constexpr uint32_t kBindlessReservedSamplers = 16;
+	static constexpr uint32_t kBindlessReservedResources = 64;
+
+	/// Returns the slot of 'texture' in the table
+	uint32_t addBindlessTexture(const VulkanTexture& texture);
+
+	/// Point the slot to another texture, no frame sampling the slot may be in flight (drawFrame() waits for the device to be idle)
+	void updateBindlessTexture(uint32_t slot, const VulkanTexture& texture);
+
+	/// Return the slot to the free list, the shaders should not sample it anymore (the texture is not destroyed)
+	void removeBindlessTexture(uint32_t slot);
+
+	VkDescriptorSetLayout getBindlessTextureSetLayout();
+	VkDescriptorSet getBindlessTextureSet();
+
 	std::vector<VkFramebuffer> addFramebuffers(VkRenderPass renderPass, VkImageView depthView = VK_NULL_HANDLE);
 
 	/**  Helper functions for small Chapter 8/9 demos */
@@ -250,6 +290,30 @@ private:
 	std::vector<ShaderModule> shaderModules;
 	std::map<std::string, int> shaderMap;
 
+	/* (type, stage flags, descriptor count) of each binding */
+	using DSLayoutKey = std::vector<std::tuple<VkDescriptorType, VkShaderStageFlags, uint32_t>>;
+	using PipelineLayoutKey = std::tuple<std::vector<VkDescriptorSetLayout>, uint32_t, uint32_t>;
+	/* render pass, layout, shader files and the fields of PipelineInfo */
+	using PipelineKey = std::tuple<VkRenderPass, VkPipelineLayout, std::vector<std::string>,
+		uint32_t, uint32_t, VkPrimitiveTopology, bool, bool, bool, uint32_t>;
+
+	std::map<DSLayoutKey, VkDescriptorSetLayout> dsLayoutMap;
+	std::map<PipelineLayoutKey, VkPipelineLayout> pipelineLayoutMap;
+	std::map<PipelineKey, VkPipeline> pipelineMap;
+
+	struct BindlessTextures
+	{
+		VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+		VkDescriptorPool pool = VK_NULL_HANDLE;
+		VkDescriptorSet set = VK_NULL_HANDLE;
+		uint32_t capacity = 0;
+		// slots allocated so far, the released ones are reused first
+		uint32_t numSlots = 0;
+		std::vector<uint32_t> freeSlots;
+	} bindless;
+
+	void initBindlessTextures();
+
 	bool createGraphicsPipeline(
 		VulkanRenderDevice& vkDev,
 		VkRenderPass renderPass, VkPipelineLayout pipelineLayout,
@@ -10,6 +10,7 @@ VulkanShaderProcessor::VulkanShaderProcessor(VulkanRenderContext& ctx,
 	RenderPass screenRenderPass)
 	: Renderer(ctx)
 	, indexBufferSize(indexBufferSize)
+	, profilerName_(shaders.back())
 {
 	descriptorSetLayout_ = ctx.resources.addDescriptorSetLayout(dsInfo);
 
@@ -19,8 +19,12 @@ struct VulkanShaderProcessor: public Renderer
 
 	void fillCommandBuffer(VkCommandBuffer cmdBuffer, size_t currentImage, VkFramebuffer fb = VK_NULL_HANDLE, VkRenderPass rp = VK_NULL_HANDLE) override;
 
+	// the fragment shader file
+	const char* getProfilerName() const override { return profilerName_.c_str(); }
+
 private:
 	uint32_t indexBufferSize;
+	std::string profilerName_;
 };
 
 struct QuadProcessor: public VulkanShaderProcessor
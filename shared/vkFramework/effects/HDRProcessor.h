@@ -139,12 +139,17 @@ struct HDRProcessor: public CompositeRenderer
 	{
 		// Call base method
 		CompositeRenderer::fillCommandBuffer(cmdBuffer, currentImage, fb1, rp1);
-		// Swap avgLuminance inputs for adaptation and composer
-		static const std::vector<int> switchIndices { 21, 22, 23, 24, 25, 26, 28, 29 };
-		for (auto i: switchIndices)
-			renderers_[i].enabled_ = !renderers_[i].enabled_;
+		swapLuminanceInputs();
 	}
 
+	void collectRenderJobs(std::vector<RenderJob>& jobs, VkFramebuffer fb1, VkRenderPass rp1) override
+	{
+		CompositeRenderer::collectRenderJobs(jobs, fb1, rp1);
+		swapLuminanceInputs();
+	}
+
+	const char* getProfilerName() const override { return "HDR"; }
+
 	inline VulkanTexture getBloom1() const { return bloomY1Tex; }
 	inline VulkanTexture getBloom2() const { return bloomY2Tex; }
 
@@ -159,6 +164,14 @@ struct HDRProcessor: public CompositeRenderer
 	inline VulkanTexture getResult() const { return resultTex; }
 
 private:
+	// Swap avgLuminance inputs for adaptation and composer
+	void swapLuminanceInputs()
+	{
+		static const std::vector<int> switchIndices { 21, 22, 23, 24, 25, 26, 28, 29 };
+		for (auto i: switchIndices)
+			renderers_[i].enabled_ = !renderers_[i].enabled_;
+	}
+
 	// Static texture with rotation pattern
 	VulkanTexture streaksPatternTex;
 
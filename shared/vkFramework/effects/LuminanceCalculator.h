@@ -87,6 +87,8 @@ struct LuminanceCalculator: public CompositeRenderer
 		renderers_.emplace_back(lum01ToShader, false);
 	}
 
+	const char* getProfilerName() const override { return "Luminance"; }
+
 	inline VulkanTexture getResult64() const { return lumTex64; }
 	inline VulkanTexture getResult32() const { return lumTex32; }
 	inline VulkanTexture getResult16() const { return lumTex16; }
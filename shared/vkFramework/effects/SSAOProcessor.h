@@ -63,6 +63,8 @@ struct SSAOProcessor: public CompositeRenderer
 		renderers_.emplace_back(finalColorToShader, false);
 	}
 
+	const char* getProfilerName() const override { return "SSAO"; }
+
 	inline VulkanTexture getSSAO()   const { return SSAOTex; }
 	inline VulkanTexture getBlurX()  const { return SSAOBlurXTex; }
 	inline VulkanTexture getBlurY()  const { return SSAOBlurYTex; }
@@ -1,4 +1,5 @@
 #include "shared/vkRenderers/VulkanComputedItem.h"
+#include "shared/VulkanUploadBatcher.h"
 
 ComputedItem::ComputedItem(VulkanRenderDevice& vkDev, uint32_t uniformBufferSize)
 	: vkDev(vkDev)
@@ -61,6 +62,10 @@ bool ComputedItem::submit()
 	// Use a fence to ensure that compute command buffer has finished executing before using it again
 	waitFence();
 
+	// the compute queue is not ordered with the graphics queue executing the batched uploads
+	if (vkDev.uploadBatcher)
+		vkDev.uploadBatcher->wait();
+
 	const VkSubmitInfo submitInfo = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
 		.pNext = nullptr,
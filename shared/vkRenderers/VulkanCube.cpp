@@ -75,7 +75,7 @@ CubeRenderer::CubeRenderer(VulkanRenderDevice& vkDev, VulkanImage inDepthTexture
 	// Resource loading
 	createCubeTextureImage(vkDev, textureFile, texture.image, texture.imageMemory);
 
-	createImageView(vkDev.device, texture.image, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, &texture.imageView, VK_IMAGE_VIEW_TYPE_CUBE, 6);
+	createImageView(vkDev.device, texture.image, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, &texture.imageView, VK_IMAGE_VIEW_TYPE_CUBE, 6);
 	createTextureSampler(vkDev.device, &textureSampler);
 
 	// Pipeline initialization
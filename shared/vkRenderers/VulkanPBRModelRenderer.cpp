@@ -119,7 +119,7 @@ static void loadCubeMap(VulkanRenderDevice& vkDev, const char* fileName, VulkanT
 	else
 		createCubeTextureImage(vkDev, fileName, cubemap.image.image, cubemap.image.imageMemory);
 
-	createImageView(vkDev.device, cubemap.image.image, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, &cubemap.image.imageView, VK_IMAGE_VIEW_TYPE_CUBE, 6, mipLevels);
+	createImageView(vkDev.device, cubemap.image.image, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, &cubemap.image.imageView, VK_IMAGE_VIEW_TYPE_CUBE, 6, mipLevels);
 	createTextureSampler(vkDev.device, &cubemap.sampler);
 }
 